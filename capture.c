@@ -0,0 +1,207 @@
+// Capture files; the format is described in capture.h.
+
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------------
+// Writing
+// ---------------------------------------------------------------------------
+
+bool capture_create(struct capture_writer *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+
+    // O_EXCL: a capture is never written over. Replacing one is a delete and
+    // a fresh recording, not something a typo in a name should do on its own.
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int saved = errno;  // the caller tells EEXIST from the rest
+        fprintf(stderr, "Error: cannot create capture %s: %s\n", path, strerror(errno));
+        errno = saved;
+        return false;
+    }
+    w->file = fdopen(fd, "wb");
+    if (!w->file) {
+        close(fd);
+        return false;
+    }
+    // Written from the reader threads, one record per event: a large stdio
+    // buffer turns that into one write every few thousand events.
+    setvbuf(w->file, NULL, _IOFBF, 1 << 16);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    w->started = (long long)now.tv_sec * 1000000LL + now.tv_usec;
+
+    struct capture_header header = {
+        .version = CAPTURE_VERSION,
+        .record_size = sizeof(struct capture_record),
+        .started = (__u64)w->started,
+    };
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, w->file) != 1) {
+        fclose(w->file);
+        w->file = NULL;
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+void capture_write(struct capture_writer *w, const struct input_event *ev) {
+    if (!w->file) {
+        return;
+    }
+    long long t = (long long)ev->time.tv_sec * 1000000LL + ev->time.tv_usec - w->started;
+    struct capture_record record = {
+        // An event stamped a moment before the file was opened — it was
+        // already queued — plays at the start rather than wrapping round.
+        .t = (__u64)(t > 0 ? t : 0),
+        .value = ev->value,
+        .type = ev->type,
+        .code = ev->code,
+    };
+    fwrite(&record, sizeof(record), 1, w->file);
+    w->count++;
+}
+
+void capture_finish(struct capture_writer *w) {
+    if (w->file) {
+        fclose(w->file);
+        w->file = NULL;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+
+bool capture_map(struct capture_reader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive; the descriptor is not needed for it.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    // Read front to back exactly once, so the kernel may read ahead; the
+    // pages already played are dropped in capture_next.
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    r->data = data;
+    r->size = (size_t)st.st_size;
+
+    const struct capture_header *header = data;
+    if (r->size >= sizeof(*header) && memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) == 0) {
+        if (header->version != CAPTURE_VERSION || header->record_size != sizeof(struct capture_record)) {
+            fprintf(stderr, "Error: %s is capture version %u, this daemon reads %d\n",
+                    path, header->version, CAPTURE_VERSION);
+            capture_unmap(r);
+            errno = EINVAL;
+            return false;
+        }
+        r->pos = sizeof(*header);
+        r->text = false;
+    } else {
+        r->pos = 0;
+        r->text = true;
+    }
+    return true;
+}
+
+/**
+ * One "E: <sec>.<usec> <type> <code> <value>" line of evemu-record output,
+ * type and code in hex. Every other line — the device description at the top,
+ * comments, blank lines — is skipped.
+ */
+static bool next_evemu(struct capture_reader *r, struct capture_event *out) {
+    while (r->pos < r->size) {
+        const char *line = r->data + r->pos;
+        const char *end = memchr(line, '\n', r->size - r->pos);
+        size_t length = end ? (size_t)(end - line) : r->size - r->pos;
+        r->pos += length + (end ? 1 : 0);
+
+        if (length < 3 || line[0] != 'E' || line[1] != ':') {
+            continue;
+        }
+        // The mapping is not NUL-terminated, so the line is parsed from a copy.
+        char copy[128];
+        size_t n = length < sizeof(copy) - 1 ? length : sizeof(copy) - 1;
+        memcpy(copy, line, n);
+        copy[n] = '\0';
+
+        long long sec, usec;
+        unsigned int type, code;
+        int value;
+        if (sscanf(copy, "E: %lld.%lld %x %x %d", &sec, &usec, &type, &code, &value) != 5) {
+            continue;
+        }
+        long long t = sec * 1000000LL + usec;
+        if (!r->have_origin) {
+            r->origin = t;
+            r->have_origin = true;
+        }
+        out->t = t - r->origin;
+        out->type = (__u16)type;
+        out->code = (__u16)code;
+        out->value = value;
+        return true;
+    }
+    return false;
+}
+
+// How far the read position gets ahead of the last drop before the pages
+// behind it are given back. What keeps an hour of replay at constant memory:
+// otherwise every page read stays mapped, and counted, until the very end.
+#define CAPTURE_DROP_BYTES (1 << 20)
+
+/** The next event, or false at the end of the file. */
+bool capture_next(struct capture_reader *r, struct capture_event *out) {
+    if (r->pos - r->dropped >= 2 * CAPTURE_DROP_BYTES) {
+        size_t upto = (r->pos - CAPTURE_DROP_BYTES) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+        madvise((void *)(r->data + r->dropped), upto - r->dropped, MADV_DONTNEED);
+        r->dropped = upto;
+    }
+    if (r->text) {
+        return next_evemu(r, out);
+    }
+    if (r->size - r->pos < sizeof(struct capture_record)) {
+        return false;   // the end, or a record cut off by a crash mid-write
+    }
+    struct capture_record record;
+    memcpy(&record, r->data + r->pos, sizeof(record));
+    r->pos += sizeof(record);
+
+    out->t = (long long)record.t;
+    out->type = record.type;
+    out->code = record.code;
+    out->value = record.value;
+    return true;
+}
+
+void capture_unmap(struct capture_reader *r) {
+    if (r->data) {
+        munmap((void *)r->data, r->size);
+        r->data = NULL;
+    }
+    r->size = 0;
+    r->pos = 0;
+}
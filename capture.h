@@ -0,0 +1,71 @@
+// Capture files: raw input as it arrived, on disk, for replaying sessions of
+// any length. A train sent to /play is capped at MAX_PLAY_EVENTS and lives in
+// memory while it plays; a capture is mapped and read one record at a time, so
+// an hour of input costs no more memory than a click.
+//
+// The format is a fixed header and then packed records, nothing else:
+//
+//   header  "MCWCAP1\n", u32 version, u32 record size, u64 wall-clock start (µs)
+//   record  u64 µs since the start, s32 value, u16 type, u16 code
+//
+// Little-endian, as written by the machine that recorded it. evemu-record's
+// text output is read as well, so anything evemu has captured replays too.
+
+#ifndef MACROCLICKWERK_CAPTURE_H
+#define MACROCLICKWERK_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/input.h>
+
+#define CAPTURE_MAGIC   "MCWCAP1\n"
+#define CAPTURE_VERSION 1
+
+struct capture_header {
+    char magic[8];
+    __u32 version;
+    __u32 record_size;
+    __u64 started;
+} __attribute__((packed));
+
+struct capture_record {
+    __u64 t;
+    __s32 value;
+    __u16 type;
+    __u16 code;
+} __attribute__((packed));
+
+/** One event read back, whichever format it came from. */
+struct capture_event {
+    long long t;    // µs since the start of the capture
+    __u16 type;
+    __u16 code;
+    __s32 value;
+};
+
+struct capture_writer {
+    FILE *file;
+    long long started;      // wall-clock µs, the clock evdev stamps events with
+    unsigned long long count;
+};
+
+struct capture_reader {
+    const char *data;
+    size_t size;
+    size_t pos;
+    size_t dropped;         // pages before this offset are already unmapped
+    bool text;              // evemu rather than our own records
+    bool have_origin;
+    long long origin;       // first evemu timestamp, which becomes t = 0
+};
+
+bool capture_create(struct capture_writer *w, const char *path);
+void capture_write(struct capture_writer *w, const struct input_event *ev);
+void capture_finish(struct capture_writer *w);
+
+bool capture_map(struct capture_reader *r, const char *path);
+bool capture_next(struct capture_reader *r, struct capture_event *out);
+void capture_unmap(struct capture_reader *r);
+
+#endif
@@ -0,0 +1,173 @@
+// gamepad-bench - what gamepad translation costs per event.
+//
+// Replays a capture file — one of the daemon's, or evemu-record output —
+// through the mapping as fast as it will go, with no devices involved: frames
+// are written to /dev/null and the stick engine is ticked on the capture's own
+// clock, as the timer would have. Reports the translation alone and the whole
+// path, flushes and ticks included, in nanoseconds per event.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "capture.h"
+#include "gamepad.h"
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-m MAPPING] [-p PROFILE] [-n EVENTS] <capture>\n", name);
+    fprintf(stderr, "  -m MAPPING\tTranslate through this mapping file instead of the built-in one.\n");
+    fprintf(stderr, "  -p PROFILE\tThe profile to use (the first).\n");
+    fprintf(stderr, "  -n EVENTS\tReplay the capture until this many events went through (1000000).\n");
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    const char *mapping = NULL;
+    const char *profile_name = NULL;
+    long long target = 1000000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:p:n:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                mapping = optarg;
+                break;
+            case 'p':
+                profile_name = optarg;
+                break;
+            case 'n':
+                target = atoll(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1 || target < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct stick_config stick;
+    stick_defaults(&stick);
+    static struct gamepad_map map;
+    if (mapping) {
+        if (!gamepad_map_load(&map, mapping, &stick)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        gamepad_map_builtin(&map, &stick);
+    }
+    int profile = profile_name ? gamepad_map_find(&map, profile_name) : 0;
+    if (profile < 0) {
+        fprintf(stderr, "Error: no profile %s in %s\n", profile_name, mapping ? mapping : "the built-in mapping");
+        return EXIT_FAILURE;
+    }
+
+    // Read into memory first, so the file is not what gets measured.
+    struct capture_reader reader;
+    if (!capture_map(&reader, argv[optind])) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    size_t count = 0, capacity = 4096;
+    struct capture_event *events = malloc(capacity * sizeof(*events));
+    struct capture_event ev;
+    while (events && capture_next(&reader, &ev)) {
+        if (count == capacity) {
+            capacity *= 2;
+            struct capture_event *grown = realloc(events, capacity * sizeof(*events));
+            if (!grown) {
+                free(events);
+                events = NULL;
+                break;
+            }
+            events = grown;
+        }
+        events[count++] = ev;
+    }
+    capture_unmap(&reader);
+    if (!events || count == 0) {
+        fprintf(stderr, "Error: no events in %s\n", argv[optind]);
+        free(events);
+        return EXIT_FAILURE;
+    }
+
+    // A pad without a device: what gamepad_create() sets up, minus uinput and
+    // the timer.
+    struct gamepad pad;
+    memset(&pad, 0, sizeof(pad));
+    pad.fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    pad.timer_fd = -1;
+    if (pad.fd < 0) {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+    gamepad_use_profile(&pad, &map.profiles[profile]);
+
+    long long rounds = (target + (long long)count - 1) / (long long)count;
+    long long taken = 0, frames = 0, ticks = 0;
+    long long translate_ns = 0, full_ns = 0;
+
+    for (long long round = 0; round < rounds; round++) {
+        // The mapping alone: one table lookup per event, no output.
+        long long start = now_ns();
+        for (size_t i = 0; i < count; i++) {
+            struct input_event ie = { .type = events[i].type, .code = events[i].code, .value = events[i].value };
+            taken += gamepad_translate(&pad, &ie);
+        }
+        translate_ns += now_ns() - start;
+        gamepad_use_profile(&pad, &map.profiles[profile]);
+
+        // Everything: frames flushed where the source frame ends, and the
+        // stick ticked at its rate as the capture's time goes by.
+        long long tick_us = 1000000LL / pad.stick.rate_hz;
+        long long next_tick = events[0].t + tick_us;
+        start = now_ns();
+        for (size_t i = 0; i < count; i++) {
+            struct input_event ie = { .type = events[i].type, .code = events[i].code, .value = events[i].value };
+            for (; next_tick <= events[i].t; next_tick += tick_us) {
+                if (!gamepad_stick_busy(&pad)) {
+                    // The timer is off while the stick rests.
+                    next_tick += (events[i].t - next_tick) / tick_us * tick_us;
+                    continue;
+                }
+                gamepad_tick(&pad);
+                ticks++;
+                frames += pad.dirty_buttons || pad.dirty_axes;
+                gamepad_flush(&pad);
+            }
+            if (ie.type == EV_SYN && ie.code == SYN_REPORT) {
+                frames += pad.dirty_buttons || pad.dirty_axes;
+                gamepad_flush(&pad);
+            } else {
+                gamepad_translate(&pad, &ie);
+            }
+        }
+        full_ns += now_ns() - start;
+        gamepad_use_profile(&pad, &map.profiles[profile]);
+    }
+
+    long long total = rounds * (long long)count;
+    printf("%zu events, replayed %lld times, %s profile %s\n",
+           count, rounds, mapping ? mapping : "built-in", map.profiles[profile].name);
+    printf("  taken by the mapping  %.1f%%\n", 100.0 * (double)taken / (double)total);
+    printf("  translate only        %.1f ns/event\n", (double)translate_ns / (double)total);
+    printf("  with flush and ticks  %.1f ns/event  (%lld frames, %lld ticks)\n",
+           (double)full_ns / (double)total, frames, ticks);
+
+    close(pad.fd);
+    free(events);
+    return EXIT_SUCCESS;
+}
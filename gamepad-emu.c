@@ -1,268 +1,328 @@
+// gamepad-emu - keyboard and mouse as a virtual gamepad, on its own.
+//
+// The same translation the daemon's gamepad mode uses (gamepad.c), for when
+// macroclickwerk is not running: it grabs the two devices itself, so the two
+// cannot run side by side. With the daemon up, use its -g or POST /gamepad
+// instead.
+//
+// One epoll loop over both devices, the stick clock and a watch on /dev/input.
+// Events are read in batches, and the pad's frame is written where the
+// source's frame ends — at its SYN_REPORT — and only when something on the pad
+// changed, so a key the mapping does not have, or a SYN on its own, writes
+// nothing. A device that goes away is waited for and grabbed again when it
+// comes back.
+
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <linux/input.h>
-#include <linux/uinput.h>
 #include <stdlib.h>
-#include <math.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 
-#define MAX_MOUSE_HISTORY 2
-#define MOUSE_MULTIPLIER 2.0
+#include "gamepad.h"
 
-struct mouse_movement {
-    float x;
-    float y;
-};
+// Events taken from a device per read(): a full mouse frame and then some.
+#define READ_BATCH 64
 
-struct gamepad_state {
-    struct input_event axes[4];  // Left stick X/Y (0,1), Right stick X/Y (2,3)
-    struct input_event buttons[17];  // Matches the JS mapping
-    int button_states[17];  // Track button press states
+struct source {
+    const char *path;
+    const char *what;
+    int fd;                 // -1 while the device is gone
+    bool dropped;           // the kernel dropped events; resync at the next SYN_REPORT
 };
 
-static struct mouse_movement mouse_history[MAX_MOUSE_HISTORY];
-static int mouse_history_count = 0;
+static volatile sig_atomic_t keep_running = 1;
 
-float normalize_movement(int movement) {
-    if (movement == 0) return 0;
+// SIGUSR2 steps to the next profile of the mapping. The handler only counts;
+// the loop, woken by the interrupted epoll_wait(), does the switching.
+static volatile sig_atomic_t profile_steps = 0;
 
-    float result = log2f(abs(movement)) / 6.8f + 0.1f;
-    return movement < 0 ? -result : result;
+static void stop_handler(int sig) {
+    (void)sig;
+    keep_running = 0;
 }
 
-void update_mouse_history(int movement_x, int movement_y) {
-    // Shift history
-    for (int i = MAX_MOUSE_HISTORY - 1; i > 0; i--) {
-        mouse_history[i] = mouse_history[i-1];
-    }
+static void next_profile_handler(int sig) {
+    (void)sig;
+    profile_steps++;
+}
 
-    // Add new movement
-    if (movement_x == 0 && movement_y == 0) {
-        mouse_history_count = 0;
-    } else {
-        mouse_history[0].x = normalize_movement(movement_x);
-        mouse_history[0].y = normalize_movement(movement_y);
-        mouse_history_count = mouse_history_count < MAX_MOUSE_HISTORY ?
-                              mouse_history_count + 1 : MAX_MOUSE_HISTORY;
-    }
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
-void get_smooth_movement(float *x, float *y) {
-    if (mouse_history_count == 0) {
-        *x = 0;
-        *y = 0;
-        return;
+static bool attach(int epoll_fd, struct source *s) {
+    int fd = open(s->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
     }
-
-    float acc_x = 0, acc_y = 0;
-    for (int i = 0; i < mouse_history_count; i++) {
-        acc_x += mouse_history[i].x;
-        acc_y += mouse_history[i].y;
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        fprintf(stderr, "gamepad-emu: cannot grab %s (%s): %s\n", s->what, s->path, strerror(errno));
+        close(fd);
+        return false;
     }
-
-    *x = (acc_x / mouse_history_count) * MOUSE_MULTIPLIER;
-    *y = (acc_y / mouse_history_count) * MOUSE_MULTIPLIER;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(fd);
+        return false;
+    }
+    s->fd = fd;
+    s->dropped = false;
+    fprintf(stderr, "gamepad-emu: %s attached (%s)\n", s->what, s->path);
+    return true;
 }
 
-static int emit(int fd, struct input_event *ev) {
-    return write(fd, ev, sizeof(struct input_event));
+static void detach(int epoll_fd, struct source *s, struct gamepad *pad) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->fd = -1;
+    // Its keys will never send their release: nothing may stay pressed.
+    gamepad_reset(pad);
+    fprintf(stderr, "gamepad-emu: %s gone, waiting for it to come back\n", s->what);
 }
 
-void setup_gamepad(int fd) {
-    struct uinput_setup usetup;
-    memset(&usetup, 0, sizeof(usetup));
-    strncpy(usetup.name, "Keyboard/Mouse Gamepad", UINPUT_MAX_NAME_SIZE);
-    usetup.id.bustype = BUS_USB;
-    usetup.id.vendor = 0x1234;
-    usetup.id.product = 0x5678;
-    usetup.id.version = 1;
-
-    // Enable gamepad events
-    ioctl(fd, UI_SET_EVBIT, EV_KEY);
-    ioctl(fd, UI_SET_EVBIT, EV_ABS);
-    ioctl(fd, UI_SET_EVBIT, EV_SYN);
-
-    // Setup buttons (BTN_GAMEPAD to BTN_THUMBR)
-    for (int i = BTN_GAMEPAD; i <= BTN_THUMBR; i++) {
-        ioctl(fd, UI_SET_KEYBIT, i);
+/**
+ * After a SYN_DROPPED the key events in between are lost, so the pad is told
+ * the device's real key state instead, for the keys that device has. Keys that
+ * already agree change nothing.
+ */
+static void resync(struct source *s, struct gamepad *pad) {
+    unsigned char has[KEY_MAX / 8 + 1] = {0};
+    unsigned char down[KEY_MAX / 8 + 1] = {0};
+    if (ioctl(s->fd, EVIOCGBIT(EV_KEY, sizeof(has)), has) < 0 ||
+        ioctl(s->fd, EVIOCGKEY(sizeof(down)), down) < 0) {
+        return;
     }
-
-    // Setup axes
-    struct uinput_abs_setup abs_setup;
-    memset(&abs_setup, 0, sizeof(abs_setup));
-
-    // Left/Right stick X/Y
-    for (int i = ABS_X; i <= ABS_RY; i++) {
-        ioctl(fd, UI_SET_ABSBIT, i);
-        abs_setup.code = i;
-        abs_setup.absinfo.minimum = -32768;
-        abs_setup.absinfo.maximum = 32767;
-        abs_setup.absinfo.fuzz = 16;
-        abs_setup.absinfo.flat = 128;
-        ioctl(fd, UI_ABS_SETUP, &abs_setup);
+    for (int code = 0; code <= KEY_MAX; code++) {
+        if (has[code / 8] & (1u << (code % 8))) {
+            struct input_event ev = {
+                .type = EV_KEY,
+                .code = (__u16)code,
+                .value = (down[code / 8] & (1u << (code % 8))) != 0,
+            };
+            gamepad_translate(pad, &ev);
+        }
     }
-
-    ioctl(fd, UI_DEV_SETUP, &usetup);
-    ioctl(fd, UI_DEV_CREATE);
 }
 
-void handle_keyboard_event(struct input_event *ev, struct gamepad_state *state, int fd) {
-    // Map keyboard keys to gamepad buttons
-    switch (ev->code) {
-        case KEY_E:  // A button
-            state->button_states[0] = ev->value;
-            state->buttons[0].value = ev->value;
-            emit(fd, &state->buttons[0]);
-            break;
-        case KEY_C:  // B button
-        case KEY_ESC:
-            state->button_states[1] = ev->value;
-            state->buttons[1].value = ev->value;
-            emit(fd, &state->buttons[1]);
-            break;
-            // Add more key mappings following your JS configuration
-        case KEY_W:  // Left stick up
-            state->axes[1].value = ev->value ? -32767 : 0;
-            emit(fd, &state->axes[1]);
-            break;
-        case KEY_S:  // Left stick down
-            state->axes[1].value = ev->value ? 32767 : 0;
-            emit(fd, &state->axes[1]);
-            break;
-        case KEY_A:  // Left stick left
-            state->axes[0].value = ev->value ? -32767 : 0;
-            emit(fd, &state->axes[0]);
-            break;
-        case KEY_D:  // Left stick right
-            state->axes[0].value = ev->value ? 32767 : 0;
-            emit(fd, &state->axes[0]);
-            break;
+/** Everything the device has queued, a batch at a time. False once it is gone. */
+static bool drain(struct source *s, struct gamepad *pad) {
+    struct input_event batch[READ_BATCH];
+    while (1) {
+        ssize_t n = read(s->fd, batch, sizeof(batch));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return true;
+            }
+            return false;   // ENODEV: unplugged
+        }
+        if (n == 0) {
+            return false;
+        }
+
+        for (size_t i = 0; i < (size_t)n / sizeof(batch[0]); i++) {
+            const struct input_event *ev = &batch[i];
+            if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+                s->dropped = true;
+            } else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+                if (s->dropped) {
+                    s->dropped = false;
+                    resync(s, pad);
+                }
+                // Mouse motion waits for the stick clock; buttons go out now.
+                gamepad_wake(pad);
+                gamepad_flush(pad);
+            } else if (!s->dropped) {
+                gamepad_translate(pad, ev);
+            }
+        }
+        if ((size_t)n < sizeof(batch)) {
+            return true;    // a short read: the queue is empty
+        }
     }
 }
 
-void handle_mouse_event(struct input_event *ev, struct gamepad_state *state, int fd) {
-    static int mouse_x = 0, mouse_y = 0;
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-m MAPPING] [-s STICK] <keyboard device> <mouse device>\n", name);
+    fprintf(stderr, "  -m MAPPING\tKeys, buttons and profiles from a mapping file (see gamepad.map);\n");
+    fprintf(stderr, "          \tSIGUSR2 steps to the next profile.\n");
+    fprintf(stderr, "  -s STICK\tHow mouse motion moves the right stick, as key=value,…:\n");
+    fprintf(stderr, "          \trate (Hz, 1000), decay (ms back to centre, 60), filter (ticks\n");
+    fprintf(stderr, "          \taveraged, 4), scale (counts for full tilt, 400), inner (0.1),\n");
+    fprintf(stderr, "          \tcurve=linear | exp:EXPONENT (exp:0.5) | lut:P0/P1/…\n");
+    fprintf(stderr, "Devices that are missing or unplugged are waited for.\n");
+}
 
-    if (ev->type == EV_REL) {
-        switch (ev->code) {
-            case REL_X:
-                mouse_x = ev->value;
+int main(int argc, char *argv[]) {
+    struct stick_config stick;
+    stick_defaults(&stick);
+    const char *mapping = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:s:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                mapping = optarg;
                 break;
-            case REL_Y:
-                mouse_y = ev->value;
+            case 's':
+                if (!stick_parse(&stick, optarg)) {
+                    return EXIT_FAILURE;
+                }
                 break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
         }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
-        update_mouse_history(mouse_x, mouse_y);
-        float smooth_x, smooth_y;
-        get_smooth_movement(&smooth_x, &smooth_y);
-
-        // Update right stick axes
-        state->axes[2].value = (int)(smooth_x * 32767);
-        state->axes[3].value = (int)(smooth_y * 32767);
-
-        emit(fd, &state->axes[2]);
-        emit(fd, &state->axes[3]);
-    } else if (ev->type == EV_KEY) {
-        switch (ev->code) {
-            case BTN_LEFT:  // R2
-                state->button_states[7] = ev->value;
-                state->buttons[7].value = ev->value;
-                emit(fd, &state->buttons[7]);
-                break;
-            case BTN_RIGHT:  // L2
-                state->button_states[6] = ev->value;
-                state->buttons[6].value = ev->value;
-                emit(fd, &state->buttons[6]);
-                break;
-            case BTN_MIDDLE:  // R3
-                state->button_states[11] = ev->value;
-                state->buttons[11].value = ev->value;
-                emit(fd, &state->buttons[11]);
-                break;
+    // Loaded after the options, so -s is there for every profile to start from.
+    static struct gamepad_map map;
+    if (mapping) {
+        if (!gamepad_map_load(&map, mapping, &stick)) {
+            return EXIT_FAILURE;
         }
+    } else {
+        gamepad_map_builtin(&map, &stick);
     }
-}
-
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <keyboard device> <mouse device>\n", argv[0]);
+    int profile = 0;
+
+    // No SA_RESTART: the signals have to get epoll_wait() to return.
+    struct sigaction action = { .sa_handler = next_profile_handler };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, NULL);
+    action.sa_handler = stop_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    struct gamepad pad;
+    if (!gamepad_create(&pad, "Keyboard/Mouse Gamepad")) {
         return EXIT_FAILURE;
     }
+    gamepad_use_profile(&pad, &map.profiles[profile]);
 
-    int keyboard_fd = open(argv[1], O_RDONLY);
-    int mouse_fd = open(argv[2], O_RDONLY);
-    int gamepad_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-
-    if (keyboard_fd < 0 || mouse_fd < 0 || gamepad_fd < 0) {
-        perror("Failed to open input devices");
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        gamepad_destroy(&pad);
         return EXIT_FAILURE;
     }
-
-    // Grab input devices
-    ioctl(keyboard_fd, EVIOCGRAB, 1);
-    ioctl(mouse_fd, EVIOCGRAB, 1);
-
-    // Setup virtual gamepad
-    setup_gamepad(gamepad_fd);
-
-    // Initialize gamepad state
-    struct gamepad_state state;
-    memset(&state, 0, sizeof(state));
-
-    // Set up event types
-    for (int i = 0; i < 4; i++) {
-        state.axes[i].type = EV_ABS;
-        state.axes[i].code = ABS_X + i;
+    struct epoll_event timer_ev = { .events = EPOLLIN, .data.ptr = &pad };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pad.timer_fd, &timer_ev);
+
+    // IN_ATTRIB as well as IN_CREATE: udev sets permissions after the node
+    // appears, so an open can lose that race and the chmod is the second chance.
+    int watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd >= 0 && inotify_add_watch(watch_fd, "/dev/input", IN_CREATE | IN_ATTRIB) >= 0) {
+        struct epoll_event watch_ev = { .events = EPOLLIN, .data.ptr = NULL };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watch_fd, &watch_ev);
+    } else {
+        fprintf(stderr, "gamepad-emu: cannot watch /dev/input; a missing device is retried every second\n");
     }
-    for (int i = 0; i < 17; i++) {
-        state.buttons[i].type = EV_KEY;
-        state.buttons[i].code = BTN_GAMEPAD + i;
+
+    struct source sources[2] = {
+        { .path = argv[optind], .what = "keyboard", .fd = -1 },
+        { .path = argv[optind + 1], .what = "mouse", .fd = -1 },
+    };
+    for (int i = 0; i < 2; i++) {
+        if (!attach(epoll_fd, &sources[i])) {
+            fprintf(stderr, "gamepad-emu: %s (%s) not there yet: %s\n",
+                    sources[i].what, sources[i].path, strerror(errno));
+        }
     }
 
-    // Main event loop
-    struct input_event ev;
-    fd_set fds;
-    int max_fd = (keyboard_fd > mouse_fd ? keyboard_fd : mouse_fd) + 1;
+    long long retry_at = now_ms() + 1000;
+    while (keep_running) {
+        bool missing = sources[0].fd < 0 || sources[1].fd < 0;
+        int timeout = -1;
+        if (missing) {
+            long long wait = retry_at - now_ms();
+            timeout = wait > 0 ? (int)wait : 0;
+        }
 
-    while (1) {
-        FD_ZERO(&fds);
-        FD_SET(keyboard_fd, &fds);
-        FD_SET(mouse_fd, &fds);
+        struct epoll_event ready[8];
+        int n = epoll_wait(epoll_fd, ready, 8, timeout);
 
-        if (select(max_fd, &fds, NULL, NULL, NULL) < 0) {
-            perror("select");
+        if (profile_steps) {
+            profile = (profile + profile_steps) % map.count;
+            profile_steps = 0;
+            gamepad_use_profile(&pad, &map.profiles[profile]);
+            fprintf(stderr, "gamepad-emu: profile %s\n", map.profiles[profile].name);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
             break;
         }
 
-        if (FD_ISSET(keyboard_fd, &fds)) {
-            if (read(keyboard_fd, &ev, sizeof(ev)) == sizeof(ev)) {
-                handle_keyboard_event(&ev, &state, gamepad_fd);
+        for (int i = 0; i < n; i++) {
+            void *what = ready[i].data.ptr;
+            if (what == &pad) {
+                unsigned long long expirations;
+                if (read(pad.timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    gamepad_on_timer(&pad, expirations);
+                }
+            } else if (what == NULL) {
+                // What changed does not matter, only that something did. The
+                // node exists before udev has finished with it, so the retry
+                // comes a moment later.
+                char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                while (read(watch_fd, buf, sizeof(buf)) > 0) {
+                }
+                if (retry_at > now_ms() + 150) {
+                    retry_at = now_ms() + 150;
+                }
+            } else {
+                struct source *s = what;
+                if ((ready[i].events & (EPOLLERR | EPOLLHUP)) || !drain(s, &pad)) {
+                    detach(epoll_fd, s, &pad);
+                    retry_at = now_ms() + 150;
+                }
             }
         }
 
-        if (FD_ISSET(mouse_fd, &fds)) {
-            if (read(mouse_fd, &ev, sizeof(ev)) == sizeof(ev)) {
-                handle_mouse_event(&ev, &state, gamepad_fd);
+        if (sources[0].fd < 0 || sources[1].fd < 0) {
+            if (now_ms() >= retry_at) {
+                for (int i = 0; i < 2; i++) {
+                    if (sources[i].fd < 0) {
+                        attach(epoll_fd, &sources[i]);
+                    }
+                }
+                retry_at = now_ms() + 1000;
             }
         }
-
-        // Sync events
-        struct input_event sync_ev;
-        memset(&sync_ev, 0, sizeof(sync_ev));
-        sync_ev.type = EV_SYN;
-        sync_ev.code = SYN_REPORT;
-        emit(gamepad_fd, &sync_ev);
     }
 
     // Cleanup
-    ioctl(keyboard_fd, EVIOCGRAB, 0);
-    ioctl(mouse_fd, EVIOCGRAB, 0);
-    close(keyboard_fd);
-    close(mouse_fd);
-    ioctl(gamepad_fd, UI_DEV_DESTROY);
-    close(gamepad_fd);
+    for (int i = 0; i < 2; i++) {
+        if (sources[i].fd >= 0) {
+            ioctl(sources[i].fd, EVIOCGRAB, 0);
+            close(sources[i].fd);
+        }
+    }
+    if (watch_fd >= 0) {
+        close(watch_fd);
+    }
+    close(epoll_fd);
+    gamepad_reset(&pad);
+    gamepad_destroy(&pad);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
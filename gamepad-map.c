@@ -0,0 +1,269 @@
+// Mapping files, compiled into per-profile lookup tables; see gamepad.h, and
+// gamepad.map for the format.
+
+#include "gamepad.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct code_name {
+    const char *name;
+    __u16 code;
+};
+
+#define NAME(code) { #code, code }
+
+// The names a mapping file is likely to want. Anything else is written as its
+// number from linux/input-event-codes.h.
+static const struct code_name key_names[] = {
+    NAME(KEY_ESC), NAME(KEY_1), NAME(KEY_2), NAME(KEY_3), NAME(KEY_4), NAME(KEY_5),
+    NAME(KEY_6), NAME(KEY_7), NAME(KEY_8), NAME(KEY_9), NAME(KEY_0), NAME(KEY_MINUS),
+    NAME(KEY_EQUAL), NAME(KEY_BACKSPACE), NAME(KEY_TAB), NAME(KEY_ENTER), NAME(KEY_SPACE),
+    NAME(KEY_A), NAME(KEY_B), NAME(KEY_C), NAME(KEY_D), NAME(KEY_E), NAME(KEY_F),
+    NAME(KEY_G), NAME(KEY_H), NAME(KEY_I), NAME(KEY_J), NAME(KEY_K), NAME(KEY_L),
+    NAME(KEY_M), NAME(KEY_N), NAME(KEY_O), NAME(KEY_P), NAME(KEY_Q), NAME(KEY_R),
+    NAME(KEY_S), NAME(KEY_T), NAME(KEY_U), NAME(KEY_V), NAME(KEY_W), NAME(KEY_X),
+    NAME(KEY_Y), NAME(KEY_Z), NAME(KEY_LEFTBRACE), NAME(KEY_RIGHTBRACE),
+    NAME(KEY_SEMICOLON), NAME(KEY_APOSTROPHE), NAME(KEY_GRAVE), NAME(KEY_BACKSLASH),
+    NAME(KEY_COMMA), NAME(KEY_DOT), NAME(KEY_SLASH), NAME(KEY_CAPSLOCK),
+    NAME(KEY_LEFTCTRL), NAME(KEY_RIGHTCTRL), NAME(KEY_LEFTSHIFT), NAME(KEY_RIGHTSHIFT),
+    NAME(KEY_LEFTALT), NAME(KEY_RIGHTALT), NAME(KEY_LEFTMETA), NAME(KEY_RIGHTMETA),
+    NAME(KEY_F1), NAME(KEY_F2), NAME(KEY_F3), NAME(KEY_F4), NAME(KEY_F5), NAME(KEY_F6),
+    NAME(KEY_F7), NAME(KEY_F8), NAME(KEY_F9), NAME(KEY_F10), NAME(KEY_F11), NAME(KEY_F12),
+    NAME(KEY_UP), NAME(KEY_DOWN), NAME(KEY_LEFT), NAME(KEY_RIGHT), NAME(KEY_HOME),
+    NAME(KEY_END), NAME(KEY_PAGEUP), NAME(KEY_PAGEDOWN), NAME(KEY_INSERT), NAME(KEY_DELETE),
+    NAME(BTN_LEFT), NAME(BTN_RIGHT), NAME(BTN_MIDDLE), NAME(BTN_SIDE), NAME(BTN_EXTRA),
+    NAME(BTN_FORWARD), NAME(BTN_BACK),
+};
+
+// What a key can be bound to: the pad's buttons, under their kernel names...
+static const struct code_name button_names[] = {
+    NAME(BTN_SOUTH), NAME(BTN_EAST), NAME(BTN_C), NAME(BTN_NORTH), NAME(BTN_WEST),
+    NAME(BTN_Z), NAME(BTN_TL), NAME(BTN_TR), NAME(BTN_TL2), NAME(BTN_TR2),
+    NAME(BTN_SELECT), NAME(BTN_START), NAME(BTN_MODE), NAME(BTN_THUMBL), NAME(BTN_THUMBR),
+    NAME(BTN_A), NAME(BTN_B), NAME(BTN_X), NAME(BTN_Y),
+};
+
+// ...and its axes, in the pad's order.
+static const struct code_name axis_names[GAMEPAD_AXES] = {
+    NAME(ABS_X), NAME(ABS_Y), NAME(ABS_RX), NAME(ABS_RY),
+};
+
+#undef NAME
+
+/** A name from `names`, or a number; -1 for neither. */
+static int lookup(const struct code_name *names, size_t count, const char *word) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(names[i].name, word) == 0) {
+            return names[i].code;
+        }
+    }
+    char *end;
+    long code = strtol(word, &end, 0);
+    return end != word && *end == '\0' && code >= 0 ? (int)code : -1;
+}
+
+#define LOOKUP(names, word) lookup(names, sizeof(names) / sizeof(names[0]), word)
+
+static void profile_init(struct gamepad_profile *p, const char *name, const struct stick_config *stick) {
+    memset(p, 0, sizeof(*p));
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->mouse_axis = 2;      // the right stick
+    p->stick = *stick;
+}
+
+static void bind_button(struct gamepad_profile *p, __u16 key, __u16 button) {
+    p->keys[key] = (struct gamepad_binding){ .kind = BIND_BUTTON, .index = (unsigned char)(button - BTN_GAMEPAD) };
+}
+
+static void bind_axis(struct gamepad_profile *p, __u16 key, int axis, int amount) {
+    p->keys[key] = (struct gamepad_binding){ .kind = BIND_AXIS, .index = (unsigned char)axis, .amount = (__s16)amount };
+}
+
+void gamepad_map_builtin(struct gamepad_map *m, const struct stick_config *stick) {
+    memset(m, 0, sizeof(*m));
+    struct gamepad_profile *p = &m->profiles[0];
+    profile_init(p, "default", stick);
+    m->count = 1;
+
+    // Buttons are BTN_GAMEPAD plus their index in the browser's standard
+    // gamepad mapping, which is what this mapping was first written against.
+    bind_button(p, KEY_E, BTN_GAMEPAD + 0);         // A
+    bind_button(p, KEY_C, BTN_GAMEPAD + 1);         // B
+    bind_button(p, KEY_ESC, BTN_GAMEPAD + 1);
+    bind_button(p, BTN_RIGHT, BTN_GAMEPAD + 6);     // L2
+    bind_button(p, BTN_LEFT, BTN_GAMEPAD + 7);      // R2
+    bind_button(p, BTN_MIDDLE, BTN_GAMEPAD + 11);   // R3
+    bind_axis(p, KEY_W, 1, -GAMEPAD_AXIS_MAX);      // left stick
+    bind_axis(p, KEY_S, 1, GAMEPAD_AXIS_MAX);
+    bind_axis(p, KEY_A, 0, -GAMEPAD_AXIS_MAX);
+    bind_axis(p, KEY_D, 0, GAMEPAD_AXIS_MAX);
+}
+
+int gamepad_map_find(const struct gamepad_map *m, const char *name) {
+    for (int i = 0; i < m->count; i++) {
+        if (strcmp(m->profiles[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Profile names go into the daemon's JSON as they are, so they are kept to
+// characters that need no escaping there.
+static bool valid_profile_name(const char *name) {
+    size_t length = strlen(name);
+    if (length == 0 || length >= GAMEPAD_PROFILE_NAME) {
+        return false;
+    }
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_' && *c != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** One line of a profile, already split into words. Returns an error, or NULL. */
+static const char *parse_line(struct gamepad_profile *p, char **word, int words) {
+    if (strcmp(word[0], "stick") == 0) {
+        if (words != 2) {
+            return "stick takes one key=value,… argument";
+        }
+        return stick_parse(&p->stick, word[1]) ? NULL : "bad stick settings";
+    }
+    if (strcmp(word[0], "mouse") == 0) {
+        if (words != 2) {
+            return "mouse takes left, right or off";
+        }
+        if (strcmp(word[1], "left") == 0) {
+            p->mouse_axis = 0;
+        } else if (strcmp(word[1], "right") == 0) {
+            p->mouse_axis = 2;
+        } else if (strcmp(word[1], "off") == 0) {
+            p->mouse_axis = -1;
+        } else {
+            return "mouse takes left, right or off";
+        }
+        return NULL;
+    }
+
+    int key = LOOKUP(key_names, word[0]);
+    if (key < 0 || key > KEY_MAX) {
+        return "unknown key";
+    }
+    if (words == 3 && strcmp(word[1], "button") == 0) {
+        int button = LOOKUP(button_names, word[2]);
+        if (button < BTN_GAMEPAD || button > BTN_THUMBR) {
+            return "unknown gamepad button";
+        }
+        bind_button(p, (__u16)key, (__u16)button);
+        return NULL;
+    }
+    if (words == 4 && strcmp(word[1], "axis") == 0) {
+        int code = LOOKUP(axis_names, word[2]);
+        int axis = -1;
+        for (int i = 0; i < GAMEPAD_AXES; i++) {
+            if (axis_names[i].code == code) {
+                axis = i;
+            }
+        }
+        if (axis < 0) {
+            return "unknown gamepad axis";
+        }
+        char *end;
+        float deflection = strtof(word[3], &end);
+        if (*end != '\0' || deflection < -1 || deflection > 1) {
+            return "deflection must be between -1 and 1";
+        }
+        bind_axis(p, (__u16)key, axis, (int)lroundf(deflection * GAMEPAD_AXIS_MAX));
+        return NULL;
+    }
+    if (words == 2 && strcmp(word[1], "none") == 0) {
+        p->keys[key].kind = BIND_NONE;
+        return NULL;
+    }
+    return "expected KEY button BUTTON, KEY axis AXIS DEFLECTION or KEY none";
+}
+
+bool gamepad_map_load(struct gamepad_map *m, const char *path, const struct stick_config *stick) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open mapping %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // Built on the heap and copied over at the end: a file with an error in
+    // its last line must not leave half a mapping behind.
+    struct gamepad_map *next = calloc(1, sizeof(*next));
+    if (!next) {
+        fclose(f);
+        return false;
+    }
+    struct gamepad_profile *p = NULL;
+    const char *error = NULL;
+    char line[512];
+    int number = 0;
+
+    while (!error && fgets(line, sizeof(line), f)) {
+        number++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *word[5];
+        int words = 0;
+        char *saveptr = NULL;
+        for (char *w = strtok_r(line, " \t\r\n", &saveptr); w && words < 5; w = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            word[words++] = w;
+        }
+        if (words == 0) {
+            continue;
+        }
+
+        size_t length = strlen(word[0]);
+        if (word[0][0] == '[' && word[0][length - 1] == ']') {
+            word[0][length - 1] = '\0';
+            const char *name = word[0] + 1;
+            if (words != 1 || !valid_profile_name(name)) {
+                error = "profile names are [A-Za-z0-9._-], at most 31 characters";
+            } else if (gamepad_map_find(next, name) >= 0) {
+                error = "profile defined twice";
+            } else if (next->count == GAMEPAD_PROFILES_MAX) {
+                error = "too many profiles";
+            } else {
+                p = &next->profiles[next->count++];
+                profile_init(p, name, stick);
+            }
+            continue;
+        }
+        if (words == 5) {
+            error = "too many words";
+            continue;
+        }
+        // Bindings ahead of the first [section] make up a profile of their own.
+        if (!p) {
+            p = &next->profiles[next->count++];
+            profile_init(p, "default", stick);
+        }
+        error = parse_line(p, word, words);
+    }
+    fclose(f);
+
+    if (!error && next->count == 0) {
+        error = "no profiles";
+        number = 0;
+    }
+    if (error) {
+        fprintf(stderr, "Error: %s:%d: %s\n", path, number, error);
+        free(next);
+        return false;
+    }
+    *m = *next;
+    free(next);
+    return true;
+}
@@ -0,0 +1,437 @@
+// Keyboard and mouse to gamepad translation; see gamepad.h.
+
+#include "gamepad.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <linux/uinput.h>
+
+static const __u16 axis_codes[GAMEPAD_AXES] = { ABS_X, ABS_Y, ABS_RX, ABS_RY };
+
+bool gamepad_create(struct gamepad *g, const char *name) {
+    memset(g, 0, sizeof(*g));
+    g->mouse_axis = -1;
+    g->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (g->timer_fd < 0) {
+        fprintf(stderr, "Error: Failed to create the stick timer: %s.\n", strerror(errno));
+        g->fd = -1;
+        return false;
+    }
+    g->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (g->fd < 0) {
+        fprintf(stderr, "Error: Failed to open /dev/uinput: %s.\n", strerror(errno));
+        close(g->timer_fd);
+        g->timer_fd = -1;
+        return false;
+    }
+
+    struct uinput_setup usetup = {
+        .id = { .bustype = BUS_USB, .vendor = 0x1234, .product = 0x5678, .version = 1 },
+    };
+    snprintf(usetup.name, sizeof(usetup.name), "%s", name);
+
+    struct stick_config defaults;
+    stick_defaults(&defaults);
+    gamepad_configure(g, &defaults);
+
+    bool ok = ioctl(g->fd, UI_SET_EVBIT, EV_KEY) >= 0 &&
+              ioctl(g->fd, UI_SET_EVBIT, EV_ABS) >= 0 &&
+              ioctl(g->fd, UI_SET_EVBIT, EV_SYN) >= 0;
+    for (int code = BTN_GAMEPAD; ok && code <= BTN_THUMBR; code++) {
+        ok = ioctl(g->fd, UI_SET_KEYBIT, code) >= 0;
+    }
+    for (int i = 0; ok && i < GAMEPAD_AXES; i++) {
+        struct uinput_abs_setup abs_setup = {
+            .code = axis_codes[i],
+            .absinfo = { .minimum = -GAMEPAD_AXIS_MAX - 1, .maximum = GAMEPAD_AXIS_MAX, .fuzz = 16, .flat = 128 },
+        };
+        ok = ioctl(g->fd, UI_SET_ABSBIT, axis_codes[i]) >= 0 &&
+             ioctl(g->fd, UI_ABS_SETUP, &abs_setup) >= 0;
+    }
+    ok = ok && ioctl(g->fd, UI_DEV_SETUP, &usetup) >= 0 && ioctl(g->fd, UI_DEV_CREATE) >= 0;
+
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot create virtual gamepad [%s]: %s.\n", name, strerror(errno));
+        close(g->fd);
+        close(g->timer_fd);
+        g->fd = g->timer_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void gamepad_destroy(struct gamepad *g) {
+    if (g->fd >= 0) {
+        ioctl(g->fd, UI_DEV_DESTROY);
+        close(g->fd);
+        close(g->timer_fd);
+        g->fd = g->timer_fd = -1;
+    }
+}
+
+static void set_button(struct gamepad *g, int index, __s32 value) {
+    unsigned char down = value != 0;    // autorepeat (2) is still just down
+    if (g->button[index] != down) {
+        // A press and release inside one frame would cancel out and the tap
+        // would never be seen: the press gets a frame of its own first.
+        if (g->dirty_buttons & (1u << index)) {
+            gamepad_flush(g);
+        }
+        g->button[index] = down;
+        g->dirty_buttons |= 1u << index;
+    }
+}
+
+static void set_axis(struct gamepad *g, int index, __s32 value) {
+    if (value > GAMEPAD_AXIS_MAX) {
+        value = GAMEPAD_AXIS_MAX;
+    } else if (value < -GAMEPAD_AXIS_MAX) {
+        value = -GAMEPAD_AXIS_MAX;
+    }
+    if (g->axis[index] != value) {
+        g->axis[index] = value;
+        g->dirty_axes |= 1u << index;
+    }
+}
+
+bool gamepad_set(struct gamepad *g, __u16 type, __u16 code, __s32 value) {
+    if (type == EV_KEY && code >= BTN_GAMEPAD && code <= BTN_THUMBR) {
+        set_button(g, code - BTN_GAMEPAD, value);
+        return true;
+    }
+    if (type == EV_ABS) {
+        for (int i = 0; i < GAMEPAD_AXES; i++) {
+            if (axis_codes[i] == code) {
+                set_axis(g, i, value);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// --- the stick engine ----------------------------------------------------------
+
+void stick_defaults(struct stick_config *c) {
+    memset(c, 0, sizeof(*c));
+    c->rate_hz = 1000;
+    c->decay_ms = 60;
+    c->filter = 4;
+    c->scale = 400;
+    c->inner = 0.1f;
+    c->curve = STICK_EXPONENTIAL;
+    c->exponent = 0.5f;
+}
+
+static bool parse_curve(struct stick_config *c, const char *value) {
+    if (strcmp(value, "linear") == 0) {
+        c->curve = STICK_LINEAR;
+        return true;
+    }
+    if (strncmp(value, "exp:", 4) == 0) {
+        char *end;
+        float exponent = strtof(value + 4, &end);
+        if (*end != '\0' || exponent <= 0) {
+            return false;
+        }
+        c->curve = STICK_EXPONENTIAL;
+        c->exponent = exponent;
+        return true;
+    }
+    if (strncmp(value, "lut:", 4) == 0) {
+        float lut[STICK_LUT_MAX];
+        int n = 0;
+        const char *p = value + 4;
+        while (*p) {
+            char *end;
+            if (n == STICK_LUT_MAX) {
+                return false;
+            }
+            lut[n++] = strtof(p, &end);
+            if (end == p || (*end != '/' && *end != '\0')) {
+                return false;
+            }
+            p = *end ? end + 1 : end;
+        }
+        if (n < 2) {
+            return false;
+        }
+        c->curve = STICK_LUT;
+        memcpy(c->lut, lut, sizeof(float) * (size_t)n);
+        c->lut_len = n;
+        return true;
+    }
+    return false;
+}
+
+bool stick_parse(struct stick_config *c, const char *spec) {
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", spec);
+
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(item, '=');
+        if (!value) {
+            fprintf(stderr, "Error: stick setting \"%s\" has no value.\n", item);
+            return false;
+        }
+        *value++ = '\0';
+        char *end;
+        bool ok;
+        if (strcmp(item, "curve") == 0) {
+            ok = parse_curve(c, value);
+        } else if (strcmp(item, "rate") == 0) {
+            c->rate_hz = (int)strtol(value, &end, 10);
+            ok = *end == '\0' && c->rate_hz >= 1 && c->rate_hz <= 8000;
+        } else if (strcmp(item, "filter") == 0) {
+            c->filter = (int)strtol(value, &end, 10);
+            ok = *end == '\0' && c->filter >= 1 && c->filter <= STICK_FILTER_MAX;
+        } else if (strcmp(item, "decay") == 0) {
+            c->decay_ms = strtof(value, &end);
+            ok = *end == '\0' && c->decay_ms >= 0;
+        } else if (strcmp(item, "scale") == 0) {
+            c->scale = strtof(value, &end);
+            ok = *end == '\0' && c->scale > 0;
+        } else if (strcmp(item, "inner") == 0) {
+            c->inner = strtof(value, &end);
+            ok = *end == '\0' && c->inner >= 0 && c->inner < 1;
+        } else {
+            fprintf(stderr, "Error: unknown stick setting \"%s\".\n", item);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: bad value for stick setting %s: \"%s\".\n", item, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void set_timer(struct gamepad *g, bool on) {
+    long long period_ns = on ? 1000000000LL / g->stick.rate_hz : 0;
+    struct timespec period = { .tv_sec = period_ns / 1000000000LL, .tv_nsec = period_ns % 1000000000LL };
+    struct itimerspec spec = { .it_interval = period, .it_value = period };
+    if (g->timer_fd >= 0 && timerfd_settime(g->timer_fd, 0, &spec, NULL) == 0) {
+        g->timer_armed = on;
+    }
+}
+
+void gamepad_configure(struct gamepad *g, const struct stick_config *c) {
+    g->stick = *c;
+    if (g->timer_armed) {
+        set_timer(g, true);     // at the new rate
+    }
+    // Per tick, so a faster clock falls back no faster in real time.
+    g->decay = c->decay_ms > 0 ? expf(-1000.0f / ((float)c->rate_hz * c->decay_ms)) : 0;
+    // A shorter filter must not keep counting what fell out of it.
+    memset(g->ring_x, 0, sizeof(g->ring_x));
+    memset(g->ring_y, 0, sizeof(g->ring_y));
+    g->ring_pos = 0;
+    g->ring_sum_x = g->ring_sum_y = 0;
+}
+
+/** Deflection, 0..1 in, 0..1 out, through the configured curve. */
+static float shape(const struct stick_config *c, float x) {
+    if (x >= 1) {
+        return 1;
+    }
+    switch (c->curve) {
+        case STICK_EXPONENTIAL:
+            return powf(x, c->exponent);
+        case STICK_LUT: {
+            float at = x * (float)(c->lut_len - 1);
+            int i = (int)at;
+            return c->lut[i] + (c->lut[i + 1] - c->lut[i]) * (at - (float)i);
+        }
+        case STICK_LINEAR:
+        default:
+            return x;
+    }
+}
+
+static __s32 stick_output(const struct stick_config *c, float level) {
+    float magnitude = fabsf(level) / c->scale;
+    if (magnitude == 0) {
+        return 0;
+    }
+    float out = c->inner + (1 - c->inner) * shape(c, magnitude);
+    if (out > 1) {
+        out = 1;
+    }
+    return (__s32)(copysignf(out, level) * GAMEPAD_AXIS_MAX);
+}
+
+bool gamepad_stick_busy(const struct gamepad *g) {
+    return g->mouse_dx || g->mouse_dy || g->ring_sum_x || g->ring_sum_y ||
+           g->level_x != 0 || g->level_y != 0;
+}
+
+bool gamepad_tick(struct gamepad *g) {
+    const struct stick_config *c = &g->stick;
+
+    // Box filter over the last `filter` ticks of motion: a mouse reporting at
+    // 125 Hz into a 1 kHz clock is one tick of motion and seven of none, and
+    // unfiltered the stick would twitch to that beat.
+    int slot = g->ring_pos;
+    g->ring_sum_x += g->mouse_dx - g->ring_x[slot];
+    g->ring_sum_y += g->mouse_dy - g->ring_y[slot];
+    g->ring_x[slot] = g->mouse_dx;
+    g->ring_y[slot] = g->mouse_dy;
+    g->ring_pos = (slot + 1) % c->filter;
+    g->mouse_dx = g->mouse_dy = 0;
+
+    g->level_x = g->level_x * g->decay + (float)g->ring_sum_x / (float)c->filter;
+    g->level_y = g->level_y * g->decay + (float)g->ring_sum_y / (float)c->filter;
+    // Under 1% of full scale the stick is home. The decay alone would only
+    // creep toward zero, held at `inner` all the while — a slow drift after
+    // the mouse has stopped — and keep the clock running forever.
+    float rest = c->scale / 100;
+    if (fabsf(g->level_x) < rest && g->ring_sum_x == 0) {
+        g->level_x = 0;
+    }
+    if (fabsf(g->level_y) < rest && g->ring_sum_y == 0) {
+        g->level_y = 0;
+    }
+
+    if (g->mouse_axis >= 0) {
+        set_axis(g, g->mouse_axis, stick_output(c, g->level_x));
+        set_axis(g, g->mouse_axis + 1, stick_output(c, g->level_y));
+    }
+    return gamepad_stick_busy(g);
+}
+
+void gamepad_wake(struct gamepad *g) {
+    if (!g->timer_armed && gamepad_stick_busy(g)) {
+        set_timer(g, true);
+    }
+}
+
+void gamepad_interrupt(struct gamepad *g) {
+    struct itimerspec spec = { .it_value = { .tv_nsec = 1 } };
+    if (g->timer_fd >= 0 && timerfd_settime(g->timer_fd, 0, &spec, NULL) == 0) {
+        g->timer_armed = false;     // one shot: nothing repeats after it
+    }
+}
+
+void gamepad_on_timer(struct gamepad *g, unsigned long long expirations) {
+    // A stall of seconds is not worth seconds of ticks: a tenth of one is
+    // plenty for the decay to have finished.
+    unsigned long long cap = (unsigned long long)g->stick.rate_hz / 10 + 1;
+    bool busy = true;
+    for (unsigned long long i = 0; i < expirations && i < cap && busy; i++) {
+        busy = gamepad_tick(g);
+    }
+    if (!busy) {
+        set_timer(g, false);
+    }
+    gamepad_flush(g);
+}
+
+// --- the mapping -------------------------------------------------------------
+
+void gamepad_use_profile(struct gamepad *g, const struct gamepad_profile *p) {
+    g->profile = p;
+    g->mouse_axis = p->mouse_axis;
+    g->stick = p->stick;
+    gamepad_reset(g);
+}
+
+bool gamepad_translate(struct gamepad *g, const struct input_event *ev) {
+    if (!g->profile) {
+        return false;
+    }
+    if (ev->type == EV_REL) {
+        if (g->mouse_axis < 0) {
+            return false;
+        }
+        // Only collected here: the stick moves on the next tick.
+        if (ev->code == REL_X) {
+            g->mouse_dx += ev->value;
+        } else if (ev->code == REL_Y) {
+            g->mouse_dy += ev->value;
+        } else {
+            return false;   // wheels stay wheels
+        }
+        return true;
+    }
+    if (ev->type != EV_KEY || ev->code > KEY_MAX) {
+        return false;
+    }
+
+    const struct gamepad_binding *b = &g->profile->keys[ev->code];
+    if (b->kind == BIND_NONE) {
+        return false;
+    }
+    unsigned char bit = (unsigned char)(1u << (ev->code & 7));
+    unsigned char *slot = &g->key_down[ev->code >> 3];
+    bool down = ev->value != 0;
+    if (down == ((*slot & bit) != 0)) {
+        return true;    // autorepeat, or a key that was down before a profile switch
+    }
+    *slot ^= bit;
+
+    if (b->kind == BIND_BUTTON) {
+        g->button_keys[b->index] += down ? 1 : -1;
+        set_button(g, b->index, g->button_keys[b->index] != 0);
+    } else {
+        g->axis_keys[b->index] += down ? b->amount : -b->amount;
+        set_axis(g, b->index, g->axis_keys[b->index]);
+    }
+    return true;
+}
+
+bool gamepad_flush(struct gamepad *g) {
+    if (g->fd < 0 || (g->dirty_buttons == 0 && g->dirty_axes == 0)) {
+        return true;
+    }
+
+    struct input_event frame[GAMEPAD_BUTTONS + GAMEPAD_AXES + 1];
+    int n = 0;
+    memset(frame, 0, sizeof(frame));
+    for (int i = 0; i < GAMEPAD_BUTTONS; i++) {
+        if (g->dirty_buttons & (1u << i)) {
+            frame[n].type = EV_KEY;
+            frame[n].code = BTN_GAMEPAD + i;
+            frame[n].value = g->button[i];
+            n++;
+        }
+    }
+    for (int i = 0; i < GAMEPAD_AXES; i++) {
+        if (g->dirty_axes & (1u << i)) {
+            frame[n].type = EV_ABS;
+            frame[n].code = axis_codes[i];
+            frame[n].value = g->axis[i];
+            n++;
+        }
+    }
+    frame[n].type = EV_SYN;
+    frame[n].code = SYN_REPORT;
+    n++;
+
+    g->dirty_buttons = 0;
+    g->dirty_axes = 0;
+    ssize_t written = write(g->fd, frame, sizeof(frame[0]) * (size_t)n);
+    return written == (ssize_t)(sizeof(frame[0]) * (size_t)n);
+}
+
+void gamepad_reset(struct gamepad *g) {
+    for (int i = 0; i < GAMEPAD_BUTTONS; i++) {
+        set_button(g, i, 0);
+    }
+    for (int i = 0; i < GAMEPAD_AXES; i++) {
+        set_axis(g, i, 0);
+    }
+    memset(g->key_down, 0, sizeof(g->key_down));
+    memset(g->button_keys, 0, sizeof(g->button_keys));
+    memset(g->axis_keys, 0, sizeof(g->axis_keys));
+    g->mouse_dx = g->mouse_dy = 0;
+    g->level_x = g->level_y = 0;
+    gamepad_configure(g, &g->stick);
+    gamepad_flush(g);
+}
@@ -0,0 +1,202 @@
+// Keyboard and mouse to gamepad translation, shared by the daemon's gamepad
+// mode and the standalone gamepad-emu.
+//
+// Translation only fills in a frame: what changed since the last flush, one
+// slot per button and axis, so an axis that moves twice within one source
+// frame is written once, at its last value. gamepad_flush() writes the frame
+// to the virtual pad in a single write(), ending in one SYN_REPORT, and writes
+// nothing at all when nothing changed. Callers flush when their source frame
+// ends.
+//
+// What goes where is data, not code: a gamepad_map, compiled from a mapping
+// file (gamepad-map.c) into one table per profile, indexed by key code, so
+// translating a key is a single lookup. A pad uses one profile at a time and
+// can be moved to another while running.
+//
+// Mouse motion is the exception. It feeds the stick engine, which runs on a
+// clock of its own rather than on input: gamepad_tick(), at stick.rate_hz,
+// integrates the motion since the last tick, lets the stick fall back toward
+// centre, and shapes the result through a response curve. A mouse that stops
+// therefore brings the stick home on its own, and the stick moves at a fixed
+// rate however irregular the mouse reports are.
+//
+// Not thread-safe: the daemon serialises access with a mutex of its own.
+
+#ifndef MACROCLICKWERK_GAMEPAD_H
+#define MACROCLICKWERK_GAMEPAD_H
+
+#include <stdbool.h>
+#include <linux/input.h>
+
+#define GAMEPAD_BUTTONS (BTN_THUMBR - BTN_GAMEPAD + 1)
+#define GAMEPAD_AXES    4       // left stick X/Y, right stick X/Y
+
+#define GAMEPAD_AXIS_MAX 32767
+
+#define STICK_LUT_MAX    32
+#define STICK_FILTER_MAX 32
+
+enum stick_curve {
+    STICK_LINEAR,
+    STICK_EXPONENTIAL,      // |x|^exponent: below 1, small motion counts for more
+    STICK_LUT,              // piecewise linear through evenly spaced points on 0..1
+};
+
+struct stick_config {
+    int rate_hz;            // ticks per second
+    float decay_ms;         // time constant of the fall back to centre
+    int filter;             // ticks of motion averaged before integrating, 1 for none
+    float scale;            // integrated counts that mean full deflection
+    float inner;            // smallest deflection a moving mouse gives, past a game's dead zone
+    enum stick_curve curve;
+    float exponent;
+    float lut[STICK_LUT_MAX];
+    int lut_len;
+};
+
+#define GAMEPAD_PROFILES_MAX 8
+#define GAMEPAD_PROFILE_NAME 32
+
+enum gamepad_binding_kind {
+    BIND_NONE,              // not the pad's: the event goes on where it was going
+    BIND_BUTTON,
+    BIND_AXIS,
+};
+
+struct gamepad_binding {
+    unsigned char kind;     // enum gamepad_binding_kind
+    unsigned char index;    // button (from BTN_GAMEPAD) or axis
+    __s16 amount;           // axis deflection while the key is down
+};
+
+struct gamepad_profile {
+    char name[GAMEPAD_PROFILE_NAME];
+    struct gamepad_binding keys[KEY_MAX + 1];
+    int mouse_axis;         // X axis of the stick mouse motion drives, its Y follows; -1 for none
+    struct stick_config stick;
+};
+
+struct gamepad_map {
+    struct gamepad_profile profiles[GAMEPAD_PROFILES_MAX];
+    int count;
+};
+
+struct gamepad {
+    int fd;                             // the virtual pad, -1 until created
+    int timer_fd;                       // the stick engine's clock, a timerfd
+    bool timer_armed;                   // disarmed whenever the stick is at rest
+    unsigned char button[GAMEPAD_BUTTONS];
+    __s32 axis[GAMEPAD_AXES];
+    unsigned int dirty_buttons;         // bit per button changed since the last flush
+    unsigned int dirty_axes;
+
+    // The profile in use, and what its keys are doing: which are down, how
+    // many of those hold each button, and what they add up to on each axis —
+    // so W and S together cancel, and letting go of one leaves the other.
+    const struct gamepad_profile *profile;
+    int mouse_axis;
+    unsigned char key_down[KEY_MAX / 8 + 1];
+    unsigned char button_keys[GAMEPAD_BUTTONS];
+    __s32 axis_keys[GAMEPAD_AXES];
+
+    // The stick engine: motion since the last tick, the last `filter` ticks
+    // of it, and the integrated, decaying level the deflection comes from.
+    struct stick_config stick;
+    float decay;                        // per-tick factor, from decay_ms and rate_hz
+    int mouse_dx, mouse_dy;
+    int ring_x[STICK_FILTER_MAX], ring_y[STICK_FILTER_MAX];
+    int ring_pos;
+    int ring_sum_x, ring_sum_y;
+    float level_x, level_y;
+};
+
+/** 1 kHz, a 60 ms decay, a short filter and a square-root curve. */
+void stick_defaults(struct stick_config *c);
+
+/**
+ * Apply "key=value,…" on top of `c`: rate, decay, filter, scale, inner, and
+ * curve=linear, curve=exp:EXPONENT or curve=lut:P0/P1/…. Returns false, naming
+ * the problem on stderr, for anything it does not understand.
+ */
+bool stick_parse(struct stick_config *c, const char *spec);
+
+/**
+ * The mapping the pad had before mapping files: WASD on the left stick, E and
+ * C/Esc for A and B, the mouse buttons on L2/R2/R3 and motion on the right
+ * stick — one profile, "default", with `stick` for its stick settings.
+ */
+void gamepad_map_builtin(struct gamepad_map *m, const struct stick_config *stick);
+
+/**
+ * Load a mapping file; the format is described in gamepad.map. Every profile
+ * starts from `stick`. Returns false, naming file and line on stderr, for
+ * anything it does not understand, and leaves `m` as it was.
+ */
+bool gamepad_map_load(struct gamepad_map *m, const char *path, const struct stick_config *stick);
+
+/** The index of the profile called `name`, or -1. */
+int gamepad_map_find(const struct gamepad_map *m, const char *name);
+
+/**
+ * Translate through `p` from now on, with its stick settings. Everything the
+ * old profile held is let go first, flushed at once: keys still down when the
+ * switch happened are ignored until they come up.
+ */
+void gamepad_use_profile(struct gamepad *g, const struct gamepad_profile *p);
+
+/** Use `c` from the next tick on. */
+void gamepad_configure(struct gamepad *g, const struct stick_config *c);
+
+/**
+ * The pad starts with stick_defaults() and no profile, so it translates
+ * nothing until it gets one from gamepad_use_profile().
+ */
+bool gamepad_create(struct gamepad *g, const char *name);
+void gamepad_destroy(struct gamepad *g);
+
+/**
+ * Put a native gamepad event — a BTN_GAMEPAD button or one of the stick axes —
+ * into the frame. False for anything the pad does not have.
+ */
+bool gamepad_set(struct gamepad *g, __u16 type, __u16 code, __s32 value);
+
+/**
+ * Translate one keyboard or mouse event through the profile. True when the
+ * profile took it, in which case it should not also go wherever it was going.
+ * A key the profile maps is taken on autorepeat too, and changes nothing.
+ */
+bool gamepad_translate(struct gamepad *g, const struct input_event *ev);
+
+/**
+ * Advance the stick engine by one tick. Returns whether the stick still has
+ * anywhere to go: false once it is centred with no motion waiting.
+ */
+bool gamepad_tick(struct gamepad *g);
+
+/** Whether there is motion or deflection for gamepad_tick() to work on. */
+bool gamepad_stick_busy(const struct gamepad *g);
+
+/**
+ * The clock. Callers wait for timer_fd to be readable, read the expiration
+ * count from it, and hand that to gamepad_on_timer(), which runs that many
+ * ticks — a late wakeup still decays by the time that passed — and writes the
+ * result as one frame. The timer stops once the stick is at rest;
+ * gamepad_wake() starts it again, and belongs after every translated event.
+ */
+void gamepad_on_timer(struct gamepad *g, unsigned long long expirations);
+void gamepad_wake(struct gamepad *g);
+
+/**
+ * Make timer_fd readable now, whatever the stick is doing, so a thread
+ * waiting on the clock wakes up and can see it is time to stop. Before
+ * gamepad_destroy(), which closes the fd under it otherwise.
+ */
+void gamepad_interrupt(struct gamepad *g);
+
+/** Write what changed as one frame. Returns false if the write failed. */
+bool gamepad_flush(struct gamepad *g);
+
+/** Every button up and both sticks centred, flushed at once. */
+void gamepad_reset(struct gamepad *g);
+
+#endif
@@ -20,10 +20,11 @@ import { Recorder, acceleratorToEvdevCodes } from './src/recorder.js';
 import { MacroStore, type Config } from './src/store.js';
 import { starterMacro } from './src/starter.js';
 import {
-    childLists, describeStep, findStep, lastPointerEndpoint, reachesEnd,
+    asksModel, childLists, describeStep, findStep, lastPointerEndpoint, reachesEnd,
     resolveRecordTarget, resolveRunStart, type Macro, type RecordTarget, type Step,
 } from './src/model.js';
 import { clearProblems, onProblemsChanged, problemCount, reportProblem } from './src/problems.js';
+import { base64Png, captureRegion } from './src/screenshot.js';
 import { MacroPopup } from './ui/popup.js';
 import { clearMarker, flashRegion, pickRegion, showMarker } from './ui/overlay.js';
 
@@ -38,6 +39,9 @@ const KEYBINDINGS = [
  */
 const RUNNING_PUBLISH_MS = 100;
 
+/** Smaller than this, a picked picture matches half the screen. */
+const MIN_PATCH_SIDE = 8;
+
 /** Where preferences wants a captured step to land. */
 interface CaptureTarget {
     serial: number;
@@ -90,7 +94,8 @@ export default class MacroclickwerkExtension extends Extension {
 
         const config = this._store.config;
         this._daemon = new DaemonClient(config.controlSocket, config.eventSocket);
-        this._evaluator = new ConditionEvaluator(config, trace => this._onTrace(trace), flashRegion);
+        this._evaluator = new ConditionEvaluator(
+            config, trace => this._onTrace(trace), flashRegion, () => this._popup?.refresh());
         this._recorder = new Recorder(this._daemon, config, {
             onStatus: text => this._onStatus(text),
             onError: error => {
@@ -206,6 +211,7 @@ export default class MacroclickwerkExtension extends Extension {
             runningMacroIds: () => this._runningMacros().map(([id]) => id),
             isPaused: () => this._runningMacros().some(([, runner]) => runner.paused),
             isRecording: () => this._recorder?.recording ?? false,
+            modelState: () => this._evaluator?.modelState ?? '',
             resumeStep: () => this._settings?.get_string('record-into') ?? '',
             onEnabledChanged: enabled => {
                 if (enabled) {
@@ -304,6 +310,8 @@ export default class MacroclickwerkExtension extends Extension {
     }
 
     private _onRunningChanged(): void {
+        this._evaluator?.setModelInUse(this._runningMacros()
+            .some(([id]) => asksModel(this._store?.getMacro(id)?.body ?? [])));
         this._updateIcon();
         this._popup?.refresh();
     }
@@ -648,6 +656,24 @@ export default class MacroclickwerkExtension extends Extension {
      * go and point at than to read off the screen and type in, and this is how
      * an existing one is corrected without recording the step again.
      */
+    /**
+     * Drag over something on the screen and hand back that part of it, as an
+     * image check's picture. Taken after the picker is gone, at the screen's
+     * own pixels — the same the check's captures will have.
+     */
+    private async _pickPatch(): Promise<object> {
+        this._indicator?.menu.close(true);
+        const region = await pickRegion('Drag over what to look for — Escape to cancel');
+        if (!region) {
+            return { ok: false, message: 'cancelled' };
+        }
+        if (region.w < MIN_PATCH_SIDE || region.h < MIN_PATCH_SIDE) {
+            return { ok: false, message: `a picture needs to be at least ${MIN_PATCH_SIDE}×${MIN_PATCH_SIDE} to be found again` };
+        }
+        const pixbuf = await captureRegion(region.x, region.y, region.w, region.h);
+        return { ok: true, png: base64Png(pixbuf), w: pixbuf.get_width(), h: pixbuf.get_height() };
+    }
+
     private async _pickPoint(): Promise<object> {
         const fail = (message: string, hint?: string) => {
             reportProblem('Recording', `could not pick a position: ${message}`, { hint });
@@ -941,6 +967,10 @@ export default class MacroclickwerkExtension extends Extension {
             void this._answerRequest('pick-region', async () => ({ region: await pickRegion() }));
             return;
         }
+        if (key === 'pick-patch-request') {
+            void this._answerRequest('pick-patch', () => this._pickPatch());
+            return;
+        }
         if (key === 'pick-point-request') {
             void this._answerRequest('pick-point', () => this._pickPoint());
             return;
@@ -1013,8 +1043,8 @@ export default class MacroclickwerkExtension extends Extension {
         }
         try {
             const status = await this._daemon.status();
-            if (status.version < 2) {
-                reportProblem('Daemon', `it speaks protocol v${status.version}, this extension needs v2`, {
+            if (status.version < 4) {
+                reportProblem('Daemon', `it speaks protocol v${status.version}, this extension needs v4`, {
                     hint: 'Rebuild and reinstall it: cd macroclickwerk && ./deploy.sh',
                 });
             } else if (status.devices.length === 0) {
@@ -17,7 +17,7 @@ import {
     type ClickStep,
     type Condition,
     type ConditionType,
-    type LlmCondition,
+    type ImageCondition,
     type Macro,
     type MouseButton,
     type MoveStep,
@@ -43,7 +43,7 @@ import {
 import { MacroStore } from './src/store.js';
 import { buildInstruction, testConnection } from './src/llm.js';
 
-const CONDITION_TYPES: ConditionType[] = ['always', 'llm', 'color', 'and', 'or', 'not'];
+const CONDITION_TYPES: ConditionType[] = ['always', 'llm', 'color', 'image', 'and', 'or', 'not'];
 
 const MACROS_FILE = 'macroclickwerk-macros.json';
 const SETTINGS_FILE = 'macroclickwerk-settings.json';
@@ -96,7 +96,7 @@ function scaleWidthFor(width: number): typeof SCALE_WIDTHS[number] {
 }
 
 /** The nested step lists a container step owns, as the editor draws them. */
-type BranchKind = 'body' | 'then' | 'else';
+type BranchKind = 'body' | 'then' | 'else' | 'timeout';
 
 /**
  * A step reads as a line of a program, so it gets the same icon everywhere and
@@ -109,8 +109,10 @@ const STEP_ICONS: Record<StepKind, string> = {
     key: 'input-keyboard-symbolic',
     text: 'insert-text-symbolic',
     wait: 'alarm-symbolic',
+    replay: 'document-open-recent-symbolic',
     loop: 'media-playlist-repeat-symbolic',
     if: 'media-playlist-shuffle-symbolic',
+    until: 'view-reveal-symbolic',        // watching the screen
     break: 'application-exit-symbolic',   // an arrow leaving: out of the loop, not the macro
     continue: 'media-skip-forward-symbolic',
     start: 'view-refresh-symbolic',       // start, and start again: the same request
@@ -177,6 +179,11 @@ const BRANCH_STYLE: Record<BranchKind, { icon: string; title: string; hint: stri
         title: 'No',
         hint: 'runs when it does not',
     },
+    timeout: {
+        icon: 'alarm-symbolic',
+        title: 'Timed out',
+        hint: 'runs when the wait gave up',
+    },
 };
 
 /**
@@ -207,6 +214,10 @@ const EDITOR_CSS = `
     box-shadow: inset 4px 0 0 alpha(@warning_color, 0.9);
     background-color: alpha(@warning_color, 0.06);
 }
+.macroclickwerk-branch-timeout {
+    box-shadow: inset 4px 0 0 alpha(@error_color, 0.9);
+    background-color: alpha(@error_color, 0.06);
+}
 
 .macroclickwerk-running {
     background-color: alpha(@accent_bg_color, 0.28);
@@ -674,6 +685,8 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
      * everything about it lives here rather than with the callers. A move can
      * additionally offer 'store' via `store` — remember the spot rather than
      * go anywhere — which is the other half of 'prev': one marks, one returns.
+     * 'found', where the last image check found its picture, is the same on
+     * both too.
      */
     private _positionRow(opts: {
         step: ClickStep | MoveStep;
@@ -690,14 +703,20 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
             title: _('Position'),
             subtitle: _('Where the pointer was before the last positioned step'),
         };
+        const foundState: RowState = {
+            title: _('Position'),
+            subtitle: _('Where the last image check that matched found its picture'),
+        };
         const storeState: RowState | null = opts.store ?? null;
         const row = new Adw.ActionRow();
-        let mode: 'off' | 'on' | 'prev' | 'store' =
+        let mode: 'off' | 'on' | 'prev' | 'store' | 'found' =
             opts.step.mode === 'prev' ? 'prev'
+            : opts.step.mode === 'found' ? 'found'
             : storeState && opts.step.mode === 'store' ? 'store'
             : opts.step.mode === opts.onModeName ? 'on' : 'off';
         const state = (): RowState =>
             mode === 'prev' ? prevState
+            : mode === 'found' ? foundState
             : mode === 'store' && storeState ? storeState
             : mode === 'on' ? opts.on : opts.off;
 
@@ -723,6 +742,8 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
             mode === 'store') : null;
         const history = toggleButton('document-open-recent-symbolic',
             _('Go back to where the pointer was before the last positioned step'), mode === 'prev');
+        const found = toggleButton('edit-find-symbolic',
+            _('Go to the middle of what the last image check found'), mode === 'found');
 
         const sync = () => {
             const now = state();
@@ -744,18 +765,20 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         // in place rather than rebuilt: a rebuild would take the button you
         // just pressed down with it.
         let settling = false;
-        const setMode = (next: 'off' | 'on' | 'prev' | 'store') => {
+        const setMode = (next: 'off' | 'on' | 'prev' | 'store' | 'found') => {
             mode = next;
             settling = true;
             toggle.set_active(mode === 'on');
             storeBtn?.set_active(mode === 'store');
             history.set_active(mode === 'prev');
+            found.set_active(mode === 'found');
             settling = false;
             // The one place the row's vocabulary meets the step's. Cast because
             // a union field only accepts writes both members allow.
             (opts.step as { mode: string }).mode =
                 mode === 'on' ? opts.onModeName
                 : mode === 'prev' ? 'prev'
+                : mode === 'found' ? 'found'
                 : mode === 'store' ? 'store' : 'abs';
             sync();
             this._refreshStepTitle(opts.step);
@@ -776,6 +799,11 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
                 setMode(history.get_active() ? 'prev' : 'off');
             }
         });
+        found.connect('toggled', () => {
+            if (!settling) {
+                setMode(found.get_active() ? 'found' : 'off');
+            }
+        });
         sync();
 
         row.add_suffix(entry);
@@ -786,6 +814,7 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
             row.add_suffix(storeBtn);
         }
         row.add_suffix(history);
+        row.add_suffix(found);
         return row;
     }
 
@@ -1447,6 +1476,8 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
             // No first, in the order the two blocks are drawn below it.
             parts.push(`${this._countLabel((step.else ?? []).length)} ${_('else')}, ` +
                 `${this._countLabel(step.then.length)} ${_('then')}`);
+        } else if (step.kind === 'until') {
+            parts.push(`${this._countLabel(step.timeout.length)} ${_('if it times out')}`);
         }
         return parts.join(' — ');
     }
@@ -1581,11 +1612,16 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
                     retitle();
                     this._save();
                 }));
-            suffixes.append(spinSuffix(step.holdMs ?? 20, 0, 10000, 5,
+            suffixes.append(spinSuffix(step.holdMs ?? 20, 0, 600000, 5,
                 _('How long the key stays down, in milliseconds'), value => {
                     step.holdMs = value;
                     this._save();
                 }));
+            suffixes.append(spinSuffix(step.repeatMs ?? 0, 0, 1000, 5,
+                _('Repeat the key this often while it is down, in milliseconds; 0 for no repeat'), value => {
+                    step.repeatMs = value || undefined;
+                    this._save();
+                }));
             break;
 
         case 'text':
@@ -1596,6 +1632,22 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
                 }));
             break;
 
+        // The same two numbers a wait has, give or take: how long at most,
+        // and how often at most. The condition is what the card opens onto.
+        case 'until':
+            suffixes.append(spinSuffix(step.timeoutMs, 0, 86400000, 1000,
+                _('Give up after this long, in milliseconds; 0 waits for as long as it takes'), value => {
+                    step.timeoutMs = value;
+                    retitle();
+                    this._save();
+                }));
+            suffixes.append(spinSuffix(step.minIntervalMs, 0, 600000, 50,
+                _('Check at most this often while the screen keeps changing, in milliseconds'), value => {
+                    step.minIntervalMs = value;
+                    this._save();
+                }));
+            break;
+
         // Both numbers, and the line already reads "Wait 1s ±200ms", so the
         // card had nothing left to open onto.
         case 'wait':
@@ -1680,7 +1732,7 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         // against whichever row is holding the steps.
         for (const list of children) {
             const kind: BranchKind =
-                list.key === 'then' || list.key === 'else' ? list.key : 'body';
+                list.key === 'then' || list.key === 'else' || list.key === 'timeout' ? list.key : 'body';
             const style = BRANCH_STYLE[kind];
             let nested: Adw.ExpanderRow;
             if (inline) {
@@ -1829,12 +1881,20 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
             case 'wait':
                 break;
 
+            case 'replay':
+                rows.push(entryRow(_('Capture (recorded with tools/watch-events --capture)'), step.capture, text => {
+                    step.capture = text.trim();
+                    save();
+                }));
+                break;
+
             // No rows: a repeat's count sits on the row itself, which is what
             // keeps the card from opening onto a single setting.
             case 'loop':
                 break;
 
             case 'if':
+            case 'until':
                 rows.push(...this._buildConditionSection(_('Condition'), step.cond, next => {
                     step.cond = next;
                     this._saveAndRebuild();
@@ -1980,35 +2040,7 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
                     _('How to word this, and what is actually sent'), promptHelp(), 64));
                 rows.push(promptRow);
 
-                const areaRow = new Adw.ActionRow({
-                    title: _('Screen area'),
-                    subtitle: condition.region
-                        ? `${condition.region.w}×${condition.region.h} at ${condition.region.x},${condition.region.y}`
-                        : _('The whole screen'),
-                });
-                const pick = new Gtk.Button({
-                    label: _('Pick'),
-                    tooltip_text: _('Drag a rectangle over the screen to select the area'),
-                    valign: Gtk.Align.CENTER,
-                });
-                pick.connect('clicked', () => this._pickRegionFor(condition));
-                areaRow.add_suffix(pick);
-                if (condition.region) {
-                    const region = condition.region;
-                    const show = new Gtk.Button({ label: _('Show'), valign: Gtk.Align.CENTER });
-                    show.connect('clicked', () => this._showMarker(region.x, region.y, region.w, region.h));
-                    areaRow.add_suffix(show);
-                    const clear = new Gtk.Button({
-                        label: _('Screen'),
-                        tooltip_text: _('Check the whole screen instead'),
-                        valign: Gtk.Align.CENTER,
-                    });
-                    clear.connect('clicked', () => {
-                        condition.region = null;
-                        rebuild();
-                    });
-                    areaRow.add_suffix(clear);
-                }
+                const areaRow = this._areaRow(condition, _('Screen area'));
                 const flash = new Gtk.ToggleButton({
                     label: _('Flash'),
                     active: condition.flash === true,
@@ -2022,6 +2054,53 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
                 areaRow.add_suffix(flash);
                 rows.push(areaRow);
 
+                rows.push(spinRow(
+                    _('Ask again once this much of the area changed (%, 0 = every time)'),
+                    Math.round((condition.minChange ?? 0) * 100), 0, 100, 1,
+                    value => {
+                        // 0 is the default, and the default is not written down.
+                        if (value > 0) {
+                            condition.minChange = value / 100;
+                        } else {
+                            delete condition.minChange;
+                        }
+                        save();
+                    }));
+
+                break;
+            }
+
+            case 'image': {
+                const pictureRow = new Adw.ActionRow({
+                    title: _('Picture'),
+                    subtitle: condition.png
+                        ? `${condition.w}×${condition.h}`
+                        : _('None yet: pick what to look for'),
+                });
+                if (condition.png) {
+                    const texture = Gdk.Texture.new_from_bytes(new GLib.Bytes(GLib.base64_decode(condition.png)));
+                    pictureRow.add_prefix(new Gtk.Picture({
+                        paintable: texture,
+                        can_shrink: true,
+                        height_request: 32,
+                        valign: Gtk.Align.CENTER,
+                    }));
+                }
+                const pick = new Gtk.Button({
+                    label: _('Pick'),
+                    tooltip_text: _('Drag a rectangle over what to look for: that part of the screen is the picture'),
+                    valign: Gtk.Align.CENTER,
+                });
+                pick.connect('clicked', () => this._pickPatchFor(condition));
+                pictureRow.add_suffix(pick);
+                rows.push(pictureRow);
+
+                rows.push(this._areaRow(condition, _('Look in')));
+                rows.push(spinRow(_('Required similarity (%)'), Math.round(condition.threshold * 100), 50, 100, 1,
+                    value => {
+                        condition.threshold = value / 100;
+                        save();
+                    }));
                 break;
             }
 
@@ -2500,7 +2579,44 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         });
     }
 
-    private _pickRegionFor(condition: LlmCondition): void {
+    /**
+     * The part of the screen a check looks at, with Pick and Show for it, and
+     * a way back to the whole screen. Shared by the checks that have one.
+     */
+    private _areaRow(condition: { region?: Region | null }, title: string): Adw.ActionRow {
+        const areaRow = new Adw.ActionRow({
+            title,
+            subtitle: condition.region
+                ? `${condition.region.w}×${condition.region.h} at ${condition.region.x},${condition.region.y}`
+                : _('The whole screen'),
+        });
+        const pick = new Gtk.Button({
+            label: _('Pick'),
+            tooltip_text: _('Drag a rectangle over the screen to select the area'),
+            valign: Gtk.Align.CENTER,
+        });
+        pick.connect('clicked', () => this._pickRegionFor(condition));
+        areaRow.add_suffix(pick);
+        if (condition.region) {
+            const region = condition.region;
+            const show = new Gtk.Button({ label: _('Show'), valign: Gtk.Align.CENTER });
+            show.connect('clicked', () => this._showMarker(region.x, region.y, region.w, region.h));
+            areaRow.add_suffix(show);
+            const clear = new Gtk.Button({
+                label: _('Screen'),
+                tooltip_text: _('Check the whole screen instead'),
+                valign: Gtk.Align.CENTER,
+            });
+            clear.connect('clicked', () => {
+                condition.region = null;
+                this._saveAndRebuild();
+            });
+            areaRow.add_suffix(clear);
+        }
+        return areaRow;
+    }
+
+    private _pickRegionFor(condition: { region?: Region | null }): void {
         this._askShell('pick-region', {}, {
             minimize: true,
             onResult: answer => {
@@ -2512,6 +2628,27 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         });
     }
 
+    /**
+     * Drag a rectangle over what an image check should look for; the shell
+     * captures it and hands back the picture. The area it looks in is left
+     * alone — a picture that is no longer inside it says so when it runs.
+     */
+    private _pickPatchFor(condition: ImageCondition): void {
+        this._askShell('pick-patch', {}, {
+            minimize: true,
+            onResult: answer => {
+                if (answer.ok && typeof answer.png === 'string') {
+                    condition.png = answer.png;
+                    condition.w = answer.w;
+                    condition.h = answer.h;
+                    this._saveAndRebuild();
+                } else {
+                    this._toast(`${_('nothing was picked')}: ${answer.message ?? _('it timed out')}`);
+                }
+            },
+        });
+    }
+
     /** Flash an X, or a rectangle, at these coordinates. */
     private _showMarker(x: number, y: number, w?: number, h?: number): void {
         this._askShell('show-marker', { x, y, w, h });
@@ -2549,6 +2686,18 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         group.add(spinRow(_('Timeout (ms)'), this._settings.get_int('llm-timeout-ms'), 1000, 300000, 1000, value => {
             this._settings.set_int('llm-timeout-ms', Math.round(value));
         }));
+        group.add(spinRow(_('Requests at once (more only for a server with parallel slots)'),
+            this._settings.get_int('llm-max-requests'), 1, 16, 1, value => {
+                this._settings.set_int('llm-max-requests', Math.round(value));
+            }));
+        group.add(spinRow(_('Model checks of one and/or at once (1 = in order)'),
+            this._settings.get_int('condition-parallelism'), 1, 16, 1, value => {
+                this._settings.set_int('condition-parallelism', Math.round(value));
+            }));
+        group.add(spinRow(_('Keep the model loaded: ping after idle (ms, 0 = never)'),
+            this._settings.get_int('llm-keep-alive-ms'), 0, 3600000, 10000, value => {
+                this._settings.set_int('llm-keep-alive-ms', Math.round(value));
+            }));
 
         const testRow = new Adw.ActionRow({
             title: _('Test the connection'),
@@ -2590,6 +2739,24 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         group.add(testRow);
         page.add(group);
 
+        const reuseGroup = new Adw.PreferencesGroup({
+            title: _('Reusing answers'),
+            description: _('The same question about the same picture gets the last answer, without asking the model again. ' +
+                'Letting the picture differ also skips the encode, but it is compared as a tiny thumbnail: ' +
+                'a box ticked or a toast in a large area can go unnoticed, and the old answer is given.'),
+        });
+        reuseGroup.add(spinRow(
+            _('Reuse an answer for (ms, 0 = always ask)'),
+            this._settings.get_int('llm-cache-ttl-ms'), 0, 86400000, 1000,
+            value => this._settings.set_int('llm-cache-ttl-ms', Math.round(value)),
+        ));
+        reuseGroup.add(spinRow(
+            _('Picture may differ by (bits of 160, 0 = exactly the same)'),
+            this._settings.get_int('llm-cache-distance'), 0, 64, 1,
+            value => this._settings.set_int('llm-cache-distance', Math.round(value)),
+        ));
+        page.add(reuseGroup);
+
         const imageGroup = new Adw.PreferencesGroup({
             title: _('Screenshots'),
             description: _('Sent as PNG, so text stays sharp. A tight screen area helps more than scaling.'),
@@ -2601,6 +2768,11 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         imageGroup.add(comboRow(_('Scale down to'), SCALE_WIDTHS, scaleLabels(), scale, value => {
             this._settings.set_int('llm-max-width', Number(value));
         }));
+        imageGroup.add(spinRow(
+            _('Share a capture between checks this close (ms, 0 = never)'),
+            this._settings.get_int('frame-fresh-ms'), 0, 2000, 10,
+            value => this._settings.set_int('frame-fresh-ms', Math.round(value)),
+        ));
         page.add(imageGroup);
 
         return page;
@@ -2632,6 +2804,18 @@ export default class MacroclickwerkPreferences extends ExtensionPreferences {
         ));
         page.add(recording);
 
+        const tracing = new Adw.PreferencesGroup({
+            title: _('Tracing'),
+            description: _('Where a run’s time goes: open the files in ui.perfetto.dev'),
+        });
+        const traceRow = new Adw.SwitchRow({
+            title: _('Trace runs'),
+            subtitle: _('Each run’s steps, daemon requests, captures and model calls, written to ~/.cache/macroclickwerk/traces'),
+        });
+        this._settings.bind('trace-runs', traceRow, 'active', Gio.SettingsBindFlags.DEFAULT);
+        tracing.add(traceRow);
+        page.add(tracing);
+
         return page;
     }
 
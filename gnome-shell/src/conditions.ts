@@ -1,22 +1,40 @@
-// Condition evaluation. Cheap checks (pixel colour) never touch the network;
-// only the `llm` type sends a screenshot to the configured endpoint.
+// Condition evaluation. Cheap checks (pixel colour, a picture searched for by
+// the native helper) never touch the network; only the `llm` type sends a
+// screenshot to the configured endpoint.
 
+import Gio from 'gi://Gio';
 import GLib from 'gi://GLib';
 
-import type { ColorCondition, Condition, LlmCondition, Region } from './model.js';
-import { describeCondition } from './model.js';
-import { LlmClient, LlmError, type LlmSettings } from './llm.js';
+import type { ColorCondition, Condition, ImageCondition, LlmCondition, Region } from './model.js';
+import { conditionAsksModel, describeCondition } from './model.js';
+import { type EncodedImage, EncodeWorker } from './encoder.js';
+import {
+    Cancelled, LlmClient, LlmError, type LlmSettings, onCancelled, type Verdict, VerdictCache,
+} from './llm.js';
+import { ImageMatcher, MatcherError } from './matcher.js';
 import { reportProblem } from './problems.js';
 import type { Config } from './store.js';
 import {
+    capturePixel,
     captureRegion,
     captureScreen,
-    colorCoverage,
+    clampToStage,
     colorDistance,
-    encodeForLlm,
+    coverageAtLeast,
     formatColor,
+    frameCache,
+    type FrameStats,
+    groupRegions,
+    luminanceSignature,
     parseColor,
+    perceptualHash,
+    type Pixels,
+    pixelsOf,
     readPixel,
+    type Rect,
+    signatureChange,
+    stageRect,
+    viewOf,
 } from './screenshot.js';
 
 export interface EvaluationTrace {
@@ -24,45 +42,201 @@ export interface EvaluationTrace {
     result: boolean;
     detail: string;
     latencyMs: number;
+    /** A model check in it was answered from an earlier answer, not asked. */
+    cached: boolean;
+}
+
+/** How a tree is checked: the defaults are the extension's; test/bench-conditions.mjs compares. */
+export interface EvaluatorOptions {
+    /** Capture a condition's colour leaves together (on); off, each captures on its own. */
+    batchColours?: boolean;
+    /** Ask a tree's model leaves about one area in one request (on); off, each sends its own picture. */
+    askTogether?: boolean;
+}
+
+/** What one evaluation of a tree carries down to its leaves. */
+interface Pass {
+    frames?: FrameStats;
+    /** The pixels of each planned colour leaf, captured on first use; see `_plan`. */
+    plan?: Map<ColorCondition, () => Promise<Pixels>>;
+    /** Model leaves asked together with others about the same area; see `_group`. */
+    questions?: Map<LlmCondition, Questions>;
+    /** Set by a model check that was answered from `_verdicts`. */
+    cached?: boolean;
+    /** Told where an image check found its picture, in stage coordinates. */
+    onFound?: (point: { x: number; y: number }) => void;
+}
+
+/** The questions of one tree about one area, for one request. */
+interface Questions {
+    prompts: string[];
+    /** The picture the first of them to get that far took; all are asked about it. */
+    image?: Promise<EncodedImage>;
+    /** Once answered, for the leaves reached after. */
+    answers?: Verdict[];
 }
 
 export class ConditionEvaluator {
-    private _llm = new LlmClient();
+    private _llm: LlmClient;
+    private _encoder = new EncodeWorker();
+    private _matcher = new ImageMatcher();
+    private _verdicts = new VerdictCache();
+    /**
+     * Per model check with a `minChange`, the picture its last answer was
+     * about and that answer. Weak, because the document being edited in
+     * preferences replaces its condition objects wholesale.
+     */
+    private _lastAsked = new WeakMap<LlmCondition, { signature: Uint8Array; verdict: Verdict }>();
     private _config: Config;
     private _onTrace?: (trace: EvaluationTrace) => void;
     private _onFlash?: (region?: Region | null) => void;
+    /** See `EvaluatorOptions`. */
+    private readonly _batch: boolean;
+    /** See `EvaluatorOptions`. */
+    private readonly _askTogether: boolean;
+    /** A running macro has a model check in it; see `setModelInUse`. */
+    private _modelInUse = false;
+    private _keepAliveId = 0;
 
     /**
      * `onFlash` shows a check's area on screen, for the conditions that asked
      * for that; null is the whole screen. A callback because drawing belongs
      * to the shell UI, and this file also runs under plain gjs in the tests.
+     * `onModelChanged` fires when `modelState` has something new to say.
      */
     constructor(
         config: Config,
         onTrace?: (trace: EvaluationTrace) => void,
         onFlash?: (region?: Region | null) => void,
+        onModelChanged?: () => void,
+        options: EvaluatorOptions = {},
     ) {
+        this._llm = new LlmClient(onModelChanged);
         this._config = config;
         this._onTrace = onTrace;
         this._onFlash = onFlash;
+        this._batch = options.batchColours ?? true;
+        this._askTogether = options.askTogether ?? true;
+        frameCache.freshMs = config.frameFreshMs;
     }
 
     setConfig(config: Config): void {
+        // Answers from another model, or another endpoint's, are no answers.
+        const otherModel = config.llmModel !== this._config.llmModel || config.llmEndpoint !== this._config.llmEndpoint;
+        if (otherModel) {
+            this._verdicts.clear();
+            this._lastAsked = new WeakMap();
+        }
+        const keepAliveChanged = config.llmKeepAliveMs !== this._config.llmKeepAliveMs;
         this._config = config;
+        frameCache.freshMs = config.frameFreshMs;
+        if (this._modelInUse && otherModel) {
+            this._llm.warm(this._llmSettings());
+        }
+        if (keepAliveChanged) {
+            this._scheduleKeepAlive();
+        }
+    }
+
+    /**
+     * Whether a running macro may ask the model. The first time it does, the
+     * model is warmed up there and then — a server that unloaded it takes tens
+     * of seconds to load it again, and that belongs before the first check,
+     * not inside its timeout. While it stays true, the model is pinged whenever
+     * it has been idle for the keep-alive interval, so it is never unloaded
+     * between checks that are minutes apart.
+     */
+    setModelInUse(inUse: boolean): void {
+        if (inUse === this._modelInUse) {
+            return;
+        }
+        this._modelInUse = inUse;
+        if (inUse) {
+            this._llm.warm(this._llmSettings());
+        }
+        this._scheduleKeepAlive();
+    }
+
+    /**
+     * For the popup: how ready the model is, while a macro may ask it, and
+     * once checks have had to queue for it, how many are and the most that were.
+     */
+    get modelState(): string {
+        if (!this._modelInUse || !this._config.llmEndpoint) {
+            return '';
+        }
+        const peak = this._llm.peakQueueDepth;
+        const queue = peak > 0 ? `; ${this._llm.queueDepth} queued, ${peak} at most` : '';
+        switch (this._llm.warmth) {
+            case 'warming':
+                return `model warming up${queue}`;
+            case 'cold':
+                return `model cold${queue}`;
+            case 'warm': {
+                const first = this._llm.firstTokenMs;
+                return (first === null ? 'model warm' : `model warm, first token in ${first}ms`) + queue;
+            }
+        }
+    }
+
+    private _scheduleKeepAlive(): void {
+        if (this._keepAliveId) {
+            GLib.source_remove(this._keepAliveId);
+            this._keepAliveId = 0;
+        }
+        const every = this._config.llmKeepAliveMs;
+        if (!this._modelInUse || every <= 0) {
+            return;
+        }
+        this._keepAliveId = GLib.timeout_add(GLib.PRIORITY_LOW, every, () => {
+            // A check answered in the meantime kept it loaded already.
+            if (this._llm.idleMs >= every) {
+                this._llm.warm(this._llmSettings());
+            }
+            return GLib.SOURCE_CONTINUE;
+        });
+    }
+
+    /** What every model request goes out with, checks and warm-ups alike. */
+    private _llmSettings(): LlmSettings {
+        return {
+            endpoint: this._config.llmEndpoint,
+            model: this._config.llmModel,
+            apiKey: this._config.llmApiKey,
+            timeoutMs: this._config.llmTimeoutMs,
+            maxRequests: this._config.llmMaxRequests,
+        };
     }
 
     destroy(): void {
+        this._modelInUse = false;
+        this._scheduleKeepAlive();
         this._llm.destroy();
+        this._encoder.destroy();
+        this._matcher.destroy();
+        frameCache.clear();
     }
 
-    /** Evaluate a condition tree. Throws when a check cannot be answered. */
-    async evaluate(condition: Condition | null | undefined): Promise<boolean> {
+    /**
+     * Evaluate a condition tree. Throws when a check cannot be answered.
+     * `frames` counts the captures the checks took and were spared, for
+     * whichever run asked. `onFound` hears where each image check that
+     * matched found its picture — the middle of it, on the stage.
+     */
+    async evaluate(
+        condition: Condition | null | undefined,
+        frames?: FrameStats,
+        onFound?: (point: { x: number; y: number }) => void,
+    ): Promise<boolean> {
         if (!condition) {
             return true;
         }
 
         const started = GLib.get_monotonic_time();
-        const { result, detail } = await this._evaluateInner(condition);
+        const pass: Pass = {
+            frames, plan: this._plan(condition, frames), questions: this._group(condition), onFound,
+        };
+        const { result, detail } = await this._evaluateInner(condition, pass);
         const latencyMs = Math.round((GLib.get_monotonic_time() - started) / 1000);
 
         this._onTrace?.({
@@ -70,69 +244,276 @@ export class ConditionEvaluator {
             result,
             detail,
             latencyMs,
+            cached: pass.cached ?? false,
         });
         return result;
     }
 
-    private async _evaluateInner(condition: Condition): Promise<{ result: boolean; detail: string }> {
+    /**
+     * The parts of the stage a condition tree looks at, so whoever is waiting
+     * on it knows which redraws could change its answer. None for a tree that
+     * looks at nothing: no redraw can change `always`.
+     */
+    regionsOf(condition: Condition | null | undefined): Rect[] {
+        if (!condition) {
+            return [];
+        }
+        const area = (region?: Region | null): Rect =>
+            region ? clampToStage(region.x, region.y, region.w, region.h) : stageRect();
+        switch (condition.type) {
+            case 'always':
+                return [];
+            case 'color':
+                return [clampToStage(condition.x, condition.y, Math.max(1, condition.w), Math.max(1, condition.h))];
+            case 'image':
+            case 'llm':
+                return [area(condition.region)];
+            case 'and':
+            case 'or':
+                return condition.of.flatMap(child => this.regionsOf(child));
+            case 'not':
+                return this.regionsOf(condition.of);
+        }
+    }
+
+    private async _evaluateInner(
+        condition: Condition, pass: Pass, cancellable: Gio.Cancellable | null = null,
+    ): Promise<{ result: boolean; detail: string }> {
         switch (condition.type) {
             case 'always':
                 return { result: true, detail: '' };
 
             case 'not': {
-                const inner = await this._evaluateInner(condition.of);
+                const inner = await this._evaluateInner(condition.of, pass, cancellable);
                 return { result: !inner.result, detail: inner.detail };
             }
 
-            case 'and': {
+            case 'and':
                 if (condition.of.length === 0) {
                     return { result: true, detail: 'no sub-conditions' };
                 }
-                for (const child of condition.of) {
-                    const inner = await this._evaluateInner(child);
-                    if (!inner.result) {
-                        return { result: false, detail: inner.detail };
-                    }
-                }
-                return { result: true, detail: '' };
-            }
+                return this._evaluateChildren(condition.of, false, pass, cancellable);
 
-            case 'or': {
+            case 'or':
                 if (condition.of.length === 0) {
                     return { result: false, detail: 'no sub-conditions' };
                 }
-                let lastDetail = '';
-                for (const child of condition.of) {
-                    const inner = await this._evaluateInner(child);
-                    if (inner.result) {
-                        return { result: true, detail: inner.detail };
-                    }
-                    lastDetail = inner.detail;
-                }
-                return { result: false, detail: lastDetail };
-            }
+                return this._evaluateChildren(condition.of, true, pass, cancellable);
 
             case 'color':
-                return this._evaluateColor(condition);
+                return this._evaluateColor(condition, pass);
+
+            case 'image':
+                return this._evaluateImage(condition, pass);
 
             case 'llm':
-                return this._evaluateLlm(condition);
+                return this._evaluateLlm(condition, pass, cancellable);
         }
     }
 
     /**
-     * One capture covers both cases: a 1×1 area is the single-pixel check, and
-     * reporting the colour actually found is far more useful there than a
-     * coverage percentage.
+     * The children of an `and` (`decider` false) or an `or` (true), settled by
+     * the first to come back with the decider. Children without a model check
+     * go first, one after another: they cost a capture at most, and one that
+     * settles it spares asking the model at all. The model checks then run up
+     * to `conditionParallelism` at once, so an `or` of three costs the
+     * quickest yes rather than all three answers; once one settles it, the
+     * rest are cancelled and their requests dropped. The detail lists which
+     * children ran and which did not.
+     *
+     * A child that fails does not fail the lot while another can still
+     * settle it; only once none has does the first failure, in order, stand.
      */
-    private async _evaluateColor(condition: ColorCondition): Promise<{ result: boolean; detail: string }> {
+    private async _evaluateChildren(
+        children: Condition[], decider: boolean, pass: Pass, cancellable: Gio.Cancellable | null,
+    ): Promise<{ result: boolean; detail: string }> {
+        const limit = Math.max(1, this._config.conditionParallelism);
+        const slow = children.map(conditionAsksModel);
+        if (limit === 1 || !slow.some(Boolean)) {
+            return this._evaluateInOrder(children, decider, pass, cancellable);
+        }
+
+        const scope = new Gio.Cancellable();
+        const unlink = onCancelled(cancellable, () => scope.cancel());
+        const states: string[] = children.map(() => 'not started');
+        const outcomes: ({ result: boolean; detail: string } | Error | undefined)[] = [];
+        const run = async (index: number) => {
+            states[index] = 'running';
+            try {
+                const inner = await this._evaluateInner(children[index], pass, scope);
+                outcomes[index] = inner;
+                states[index] = inner.result ? 'yes' : 'no';
+            } catch (error) {
+                outcomes[index] = error as Error;
+                states[index] = error instanceof Cancelled ? 'cancelled' : 'failed';
+            }
+            return index;
+        };
+        const decided = (index: number) => {
+            const outcome = outcomes[index];
+            return outcome && !(outcome instanceof Error) && outcome.result === decider ? outcome : null;
+        };
+
+        let settledBy: { result: boolean; detail: string } | null = null;
+        try {
+            for (let i = 0; i < children.length && !settledBy; i++) {
+                if (!slow[i]) {
+                    settledBy = decided(await run(i));
+                }
+            }
+
+            const waiting = children.map((_, i) => i).filter(i => slow[i]);
+            const running = new Map<number, Promise<number>>();
+            while (!settledBy && (waiting.length > 0 || running.size > 0)) {
+                while (running.size < limit && waiting.length > 0) {
+                    const index = waiting.shift()!;
+                    running.set(index, run(index));
+                }
+                const index = await Promise.race(running.values());
+                running.delete(index);
+                settledBy = decided(index);
+            }
+        } finally {
+            unlink();
+            scope.cancel();
+        }
+
+        const summary = states
+            .map((state, i) => `#${i + 1} ${state === 'running' ? 'cancelled' : state}`)
+            .join(', ');
+        if (!settledBy) {
+            // Nobody settled it: the first failure stands, or else the answer
+            // is the other way, with the detail it would have had in order.
+            const failed = outcomes.find(outcome => outcome instanceof Error);
+            if (failed) {
+                throw failed;
+            }
+            const last = outcomes[children.length - 1] as { detail: string };
+            settledBy = { result: !decider, detail: decider ? last.detail : '' };
+        }
+        return { result: settledBy.result, detail: settledBy.detail ? `${settledBy.detail}; ${summary}` : summary };
+    }
+
+    /** One child after another, as `conditionParallelism` 1 asks for. */
+    private async _evaluateInOrder(
+        children: Condition[], decider: boolean, pass: Pass, cancellable: Gio.Cancellable | null,
+    ): Promise<{ result: boolean; detail: string }> {
+        let lastDetail = '';
+        for (const child of children) {
+            const inner = await this._evaluateInner(child, pass, cancellable);
+            if (inner.result === decider) {
+                return inner;
+            }
+            lastDetail = inner.detail;
+        }
+        return { result: !decider, detail: decider ? lastDetail : '' };
+    }
+
+    /**
+     * The colour leaves of a tree, planned together: their areas are grouped
+     * into as few captures as make sense, each taken once, the first time a
+     * leaf in it is reached, and every leaf reads its own part of that. An
+     * and/or that is decided early still skips the captures only the leaves
+     * after it needed. A tree with one colour leaf has nothing to share.
+     */
+    private _plan(condition: Condition, frames?: FrameStats): Pass['plan'] {
+        const leaves: ColorCondition[] = [];
+        const collect = (node: Condition): void => {
+            if (node.type === 'color') {
+                leaves.push(node);
+            } else if (node.type === 'not') {
+                collect(node.of);
+            } else if (node.type === 'and' || node.type === 'or') {
+                node.of.forEach(collect);
+            }
+        };
+        collect(condition);
+        if (!this._batch || leaves.length < 2) {
+            return undefined;
+        }
+
+        const rects = leaves.map(leaf => clampToStage(leaf.x, leaf.y, Math.max(1, leaf.w), Math.max(1, leaf.h)));
+        const plan = new Map<ColorCondition, () => Promise<Pixels>>();
+        for (const group of groupRegions(rects)) {
+            let captured: Promise<Pixels> | undefined;
+            for (const member of group.members) {
+                plan.set(leaves[member], () => {
+                    if (captured && frames) {
+                        frames.reused++;
+                    }
+                    captured ??= captureRegion(group.rect.x, group.rect.y, group.rect.w, group.rect.h, frames)
+                        .then(pixelsOf);
+                    return captured.then(pixels => viewOf(pixels, group.rect, rects[member]));
+                });
+            }
+        }
+        return plan;
+    }
+
+    /**
+     * The model leaves of a tree, by the area they look at: "is the button
+     * green", "is the dialog open" and "is the timer at zero" about one window
+     * go to the model as one picture and three questions, not three pictures.
+     * Nothing is asked until a leaf is reached, and then everything the tree
+     * asks about its area, so an and/or decided early may have asked a
+     * question it turned out not to need — cheap next to a second picture.
+     */
+    private _group(condition: Condition): Pass['questions'] {
+        if (!this._askTogether || !this._llm.asksTogether) {
+            return undefined;
+        }
+        const byArea = new Map<string, LlmCondition[]>();
+        const collect = (node: Condition): void => {
+            if (node.type === 'llm') {
+                const area = JSON.stringify(node.region ?? null);
+                byArea.set(area, [...byArea.get(area) ?? [], node]);
+            } else if (node.type === 'not') {
+                collect(node.of);
+            } else if (node.type === 'and' || node.type === 'or') {
+                node.of.forEach(collect);
+            }
+        };
+        collect(condition);
+
+        const questions = new Map<LlmCondition, Questions>();
+        for (const leaves of byArea.values()) {
+            const prompts = [...new Set(leaves.map(leaf => leaf.prompt))];
+            if (prompts.length < 2) {
+                continue;
+            }
+            const shared: Questions = { prompts };
+            leaves.forEach(leaf => questions.set(leaf, shared));
+        }
+        return questions.size > 0 ? questions : undefined;
+    }
+
+    /** This leaf's answer out of the request that asks all of `questions`. */
+    private async _answerOf(
+        questions: Questions, prompt: string, image: EncodedImage, settings: LlmSettings,
+        cancellable: Gio.Cancellable | null,
+    ): Promise<Verdict> {
+        // Leaves that get here together share one request through the client;
+        // one that gets here after it has been answered does not send another.
+        const answers = questions.answers ?? await this._llm.askMany(questions.prompts, image, settings, cancellable);
+        questions.answers = answers;
+        return answers[questions.prompts.indexOf(prompt)];
+    }
+
+    /**
+     * A 1×1 area is the single-pixel check, read off the stage without a
+     * capture unless the tree planned one, and reporting the colour actually
+     * found is far more useful there than a coverage percentage.
+     */
+    private async _evaluateColor(condition: ColorCondition, pass: Pass): Promise<{ result: boolean; detail: string }> {
         const w = Math.max(1, condition.w);
         const h = Math.max(1, condition.h);
-        const pixbuf = await captureRegion(condition.x, condition.y, w, h);
         const target = parseColor(condition.color);
+        const planned = pass.plan?.get(condition);
 
         if (w * h === 1) {
-            const actual = readPixel(pixbuf, 0, 0);
+            const actual = planned
+                ? readPixel(await planned())
+                : await capturePixel(condition.x, condition.y, pass.frames);
             const distance = colorDistance(actual, target);
             return {
                 result: distance <= condition.tolerance,
@@ -140,39 +521,179 @@ export class ConditionEvaluator {
             };
         }
 
-        const coverage = colorCoverage(pixbuf, target, condition.tolerance);
+        const pixels = planned
+            ? await planned()
+            : pixelsOf(await captureRegion(condition.x, condition.y, w, h, pass.frames));
+        const { result, matched, seen, total } = coverageAtLeast(pixels, target, condition.tolerance, condition.coverage);
+        // Counting stops once the answer is certain, so short of the whole
+        // area the share found is only a bound — the one that decided it.
+        const share = result || seen === total ? matched : matched + total - seen;
+        const bound = seen === total ? '' : result ? 'at least ' : 'at most ';
         return {
-            result: coverage >= condition.coverage,
-            detail: `${(coverage * 100).toFixed(1)}% matched, need ${(condition.coverage * 100).toFixed(0)}%`,
+            result,
+            detail: `${bound}${(share / total * 100).toFixed(1)}% matched, need ${(condition.coverage * 100).toFixed(0)}%`,
         };
     }
 
-    private async _evaluateLlm(condition: LlmCondition): Promise<{ result: boolean; detail: string }> {
+    /**
+     * The search itself is the helper's; see matcher.ts. A check without a
+     * picture yet has nothing to look for and fails like one that cannot run,
+     * rather than answering either way.
+     */
+    private async _evaluateImage(condition: ImageCondition, pass: Pass): Promise<{ result: boolean; detail: string }> {
+        try {
+            if (!condition.png) {
+                throw new MatcherError('there is no picture to look for',
+                    'Pick one in the check: Pick, then drag over it on the screen.');
+            }
+            const area = condition.region
+                ? clampToStage(condition.region.x, condition.region.y, condition.region.w, condition.region.h)
+                : stageRect();
+            const frame = pixelsOf(await captureRegion(area.x, area.y, area.w, area.h, pass.frames));
+            const found = await this._matcher.find(frame, condition.png);
+
+            const result = found.score >= condition.threshold;
+            // Found in the capture's pixels; a HiDPI stage has more of those
+            // than logical ones, and the picture was picked at the same scale.
+            const scale = frame.width / area.w;
+            const x = Math.round(area.x + (found.x + condition.w / 2) / scale);
+            const y = Math.round(area.y + (found.y + condition.h / 2) / scale);
+            if (result) {
+                pass.onFound?.({ x, y });
+            }
+            return {
+                result,
+                detail: `best match ${(found.score * 100).toFixed(1)}% at ${x},${y}, ` +
+                    `need ${(condition.threshold * 100).toFixed(0)}% (${(found.micros / 1000).toFixed(1)}ms)`,
+            };
+        } catch (error) {
+            const message = (error as Error).message;
+            reportProblem('Screen', message, {
+                where: describeCondition(condition),
+                hint: error instanceof MatcherError && error.hint
+                    ? error.hint
+                    : 'The helper is started again on the next check; run from a terminal, it says what went wrong.',
+            });
+            throw new Error(`the picture could not be looked for: ${message}`);
+        }
+    }
+
+    private async _evaluateLlm(
+        condition: LlmCondition, pass: Pass, cancellable: Gio.Cancellable | null,
+    ): Promise<{ result: boolean; detail: string }> {
         // Endpoint, model and timeout are global settings: a per-condition copy
         // of each was more knobs than anyone wants on every prompt.
-        const settings: LlmSettings = {
-            endpoint: this._config.llmEndpoint,
-            model: this._config.llmModel,
-            apiKey: this._config.llmApiKey,
-            timeoutMs: this._config.llmTimeoutMs,
-        };
+        const settings = this._llmSettings();
 
         try {
             const pixbuf = condition.region
-                ? await captureRegion(condition.region.x, condition.region.y, condition.region.w, condition.region.h)
-                : await captureScreen();
-            const image = encodeForLlm(pixbuf, this._config.llmMaxWidth);
-            // After the capture — the flash must not be in the picture the
-            // model is asked about — and after the encode, which blocks the
-            // main loop and would sit between the flash and its first paint.
+                ? await captureRegion(condition.region.x, condition.region.y, condition.region.w, condition.region.h, pass.frames)
+                : await captureScreen(pass.frames);
+            // A capture cannot be called off once asked for, and may be
+            // shared with other checks anyway; what follows it can.
+            if (cancellable?.is_cancelled()) {
+                throw new Cancelled();
+            }
+
+            const said = (verdict: Verdict) =>
+                `model said ${verdict.match ? 'yes' : 'no'}${verdict.reason ? ` — ${verdict.reason}` : ''}`;
+            const answered = (verdict: Verdict, how: string) => {
+                pass.cached = true;
+                if (condition.flash) {
+                    this._onFlash?.(condition.region);
+                }
+                return { result: verdict.match, detail: `${said(verdict)} (${how})` };
+            };
+
+            // Nothing much has happened in the area since the last answer: that
+            // answer stands. Held against the picture that answer was about,
+            // not the last one looked at, so a slow drift still adds up to a
+            // change in the end.
+            const minChange = condition.minChange ?? 0;
+            const signature = minChange > 0 ? luminanceSignature(pixbuf) : null;
+            const last = this._lastAsked.get(condition);
+            if (signature && last) {
+                const changed = signatureChange(last.signature, signature);
+                if (changed < minChange) {
+                    return answered(last.verdict,
+                        `unchanged: ${(changed * 100).toFixed(1)}% of the area moved, ` +
+                        `asks again at ${(minChange * 100).toFixed(0)}%`);
+                }
+            }
+
+            // Asked before, of a picture that has not changed since: the same
+            // answer, without the seconds of inference. By default only the
+            // very same picture counts, known by its checksum once encoded. A
+            // tolerance compares thumbnails instead and saves the encode too,
+            // but a box ticking in a large area does not show in a thumbnail,
+            // so it is opt in.
+            const ttlMs = this._config.llmCacheTtlMs;
+            const tolerance = this._config.llmCacheDistance;
+            const hash = ttlMs > 0 && tolerance > 0 ? perceptualHash(pixbuf) : null;
+            const key = JSON.stringify([condition.prompt, settings.model, condition.region ?? null]);
+            const remembered = hash
+                ? this._verdicts.lookup(key, hash, tolerance, ttlMs)
+                : null;
+            if (remembered) {
+                if (signature) {
+                    this._lastAsked.set(condition, { signature, verdict: remembered.verdict });
+                }
+                return answered(remembered.verdict,
+                    `cached from ${Math.round(remembered.ageMs / 1000)}s ago, ${remembered.distance} bits off`);
+            }
+
+            // The encode happens in the helper; the flash goes up while it
+            // does. After the capture, though: the flash must not be in the
+            // picture the model is asked about.
+            // Asked together with others, the picture is whichever of theirs
+            // was taken first, and encoded once.
+            const together = pass.questions?.get(condition);
+            const encoding = together
+                ? together.image ??= this._encoder.encode(pixbuf, this._config.llmMaxWidth)
+                : this._encoder.encode(pixbuf, this._config.llmMaxWidth);
             if (condition.flash) {
                 this._onFlash?.(condition.region);
             }
-            const verdict = await this._llm.ask(condition.prompt, image, settings);
+            const image = await encoding;
+            if (cancellable?.is_cancelled()) {
+                throw new Cancelled();
+            }
+            const same = ttlMs > 0 && !hash ? this._verdicts.recall(key, image.checksum, ttlMs) : null;
+            if (same) {
+                if (signature) {
+                    this._lastAsked.set(condition, { signature, verdict: same.verdict });
+                }
+                return answered(same.verdict, `cached from ${Math.round(same.ageMs / 1000)}s ago, the same picture`);
+            }
+            const verdict = together
+                ? await this._answerOf(together, condition.prompt, image, settings, cancellable)
+                : await this._llm.ask(condition.prompt, image, settings, cancellable);
+            if (ttlMs > 0) {
+                this._verdicts.store(key, hash, verdict, image.checksum);
+            }
+            if (signature) {
+                this._lastAsked.set(condition, { signature, verdict });
+            }
 
-            const detail = `model said ${verdict.match ? 'yes' : 'no'}${verdict.reason ? ` — ${verdict.reason}` : ''} (${verdict.latencyMs}ms)`;
-            return { result: verdict.match, detail };
+            const waited = verdict.queuedMs
+                ? `, after ${verdict.queuedMs}ms queued behind ${verdict.queuedBehind ?? 0}`
+                : '';
+            const shared = verdict.shared ? ', shared with another check asking the same' : '';
+            const cold = verdict.cold ? ', the model was cold' : '';
+            const askedWith = (verdict.askedWith ?? 1) > 1
+                ? `, one of ${verdict.askedWith} questions in the request`
+                : '';
+            const took = verdict.verdictMs !== undefined
+                ? `verdict in ${verdict.verdictMs}ms, ${verdict.latencyMs}ms total`
+                : `${verdict.latencyMs}ms`;
+            return {
+                result: verdict.match,
+                detail: `${said(verdict)} (${took}${waited}${shared}${cold}${askedWith})`,
+            };
         } catch (error) {
+            if (error instanceof Cancelled) {
+                throw error;
+            }
             const message = error instanceof LlmError ? error.message : (error as Error).message;
             // A failed check has no answer, and guessing one either way sends the
             // macro down a branch on no evidence. Say so and stop.
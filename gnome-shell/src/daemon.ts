@@ -5,12 +5,18 @@
 import Gio from 'gi://Gio';
 import GLib from 'gi://GLib';
 
-import type { RawEvent } from './model.js';
+import { BTN_MISC, EV_KEY, EV_SYN, KEY_OK } from './keymap.js';
+import type { InputResource, RawEvent } from './model.js';
+import { ALL_INPUT } from './model.js';
 import { reportProblem } from './problems.js';
+import { DAEMON_PID, tracer } from './tracer.js';
 
 export const DEFAULT_CONTROL_SOCKET = '/var/run/macroclickwerk-socket';
 export const DEFAULT_EVENT_SOCKET = '/var/run/macroclickwerk-events';
 
+// How long to wait before asking again when the daemon says a clone is busy.
+const BUSY_RETRY_MS = 2;
+
 let promisified = false;
 
 function ensurePromisified(): void {
@@ -49,6 +55,12 @@ export interface DaemonStatus {
     version: number;
     recording: boolean;
     playing: boolean;
+    /** Keys the daemon is holding down on its own; see `hold`. */
+    holds: number;
+    /** The capture file being recorded into, if any; see `setRecording`. */
+    capture: string | null;
+    /** Whether mapped keys and motion are going to the virtual gamepad. */
+    gamepad: boolean;
     devices: DaemonDevice[];
 }
 
@@ -60,10 +72,50 @@ export class DaemonError extends Error {}
 
 /**
  * The right to play, for as long as one macro holds it. `DaemonClient` is one
- * of these — the plain queue — and `exclusive` hands out a private one.
+ * of these — the plain queues — and `exclusive` hands out a private one.
+ * `uses` is the input the events go through; see `eventResources`.
  */
 export interface Playback {
-    play(events: RawEvent[]): Promise<PlayResult>;
+    play(events: RawEvent[], uses?: InputResource[]): Promise<PlayResult>;
+}
+
+/**
+ * The clones a train lands on, routed the way the daemon routes it: keys to
+ * the keyboard's, buttons and motion to the pointer's.
+ */
+export function eventResources(events: RawEvent[]): InputResource[] {
+    let pointer = false;
+    let keyboard = false;
+    for (const event of events) {
+        if (event.type === EV_KEY && (event.code < BTN_MISC || event.code >= KEY_OK)) {
+            keyboard = true;
+        } else if (event.type !== EV_SYN) {
+            pointer = true;
+        }
+    }
+    return ALL_INPUT.filter(use => use === 'pointer' ? pointer : keyboard);
+}
+
+/**
+ * The daemon's side of a /play, into the trace: it stamps each stage on the
+ * same clock as ours. An older daemon sends no timing, and then there is only
+ * our side.
+ */
+export function traceTiming(json: any, what: string): void {
+    const timing = json?.timing;
+    if (!tracer.active || !timing || typeof timing.arrived !== 'number') {
+        return;
+    }
+    tracer.add(DAEMON_PID, 'playback', [
+        { name: 'read request', start: timing.arrived, end: timing.received },
+        { name: 'parse', start: timing.received, end: timing.started },
+        {
+            name: what,
+            start: timing.started,
+            end: timing.ended,
+            args: { played: json.played, aborted: !!json.aborted, 'latest event late (µs)': timing.late },
+        },
+    ]);
 }
 
 interface AsyncSocketClient {
@@ -84,16 +136,28 @@ interface AsyncDataInputStream {
     read_line_async(priority: number, cancellable: Gio.Cancellable | null): Promise<[Uint8Array | null, number]>;
 }
 
+/** How the client queues playback: the defaults are the extension's; the benchmarks compare. */
+export interface DaemonOptions {
+    /**
+     * One queue for all input, the way playback worked before each input had
+     * its own. Off; on is for test/bench-leases.mjs to measure against.
+     */
+    sharedQueue?: boolean;
+}
+
 export class DaemonClient {
     private _controlPath: string;
     private _eventPath: string;
-    /** Tail of the queue of playbacks; see `play`. */
-    private _turn: Promise<void> = Promise.resolve();
+    /** Tail of each input's queue of playbacks; see `play`. */
+    private _turns = new Map<InputResource, Promise<void>>();
+    /** See `DaemonOptions`. */
+    private readonly _shared: boolean;
 
-    constructor(controlPath = DEFAULT_CONTROL_SOCKET, eventPath = DEFAULT_EVENT_SOCKET) {
+    constructor(controlPath = DEFAULT_CONTROL_SOCKET, eventPath = DEFAULT_EVENT_SOCKET, options: DaemonOptions = {}) {
         ensurePromisified();
         this._controlPath = controlPath;
         this._eventPath = eventPath;
+        this._shared = options.sharedQueue ?? false;
     }
 
     get controlPath(): string {
@@ -110,6 +174,7 @@ export class DaemonClient {
     }
 
     private async _request(method: string, path: string, body: object | null, timeoutMs: number): Promise<any> {
+        const started = tracer.start();
         const cancellable = new Gio.Cancellable();
         let timeoutId = 0;
         if (timeoutMs > 0) {
@@ -185,6 +250,7 @@ export class DaemonClient {
             if (timeoutId) {
                 GLib.source_remove(timeoutId);
             }
+            tracer.end(started, `${method} ${path}`, 'daemon requests');
         }
     }
 
@@ -194,6 +260,9 @@ export class DaemonClient {
             version: json.version ?? 0,
             recording: !!json.recording,
             playing: !!json.playing,
+            holds: json.holds ?? 0,
+            capture: json.capture ?? null,
+            gamepad: !!json.gamepad,
             devices: Array.isArray(json.devices) ? json.devices : [],
         };
     }
@@ -202,13 +271,16 @@ export class DaemonClient {
      * Play an event train. The daemon answers only once the train has finished,
      * so the returned promise resolves when the input has actually been sent.
      *
-     * It plays one train at a time and answers "busy" to anything that arrives
-     * during one. Several macros running at once would hit that constantly, and
-     * a busy answer is a failed step rather than a short wait — so they queue up
-     * here instead, one step each, in the order they asked.
+     * It plays one train per clone at a time and answers "busy" to another
+     * train for a clone that is in use. Several macros running at once would
+     * hit that constantly — so they queue up here instead, one step each, in
+     * the order they asked. There is a queue per input: a train waits only
+     * for the trains ahead of it that use the same clone, so keys typed by one
+     * macro do not wait behind another's clicks. `uses` is worked out from the
+     * events when not given.
      */
-    async play(events: RawEvent[]): Promise<PlayResult> {
-        return this._queue(() => this._play(events));
+    async play(events: RawEvent[], uses = eventResources(events)): Promise<PlayResult> {
+        return this._queue(uses, () => this._play(events));
     }
 
     /**
@@ -221,22 +293,37 @@ export class DaemonClient {
      * from another macro landing in the middle of it moves the very pointer
      * being measured, so both macros end up chasing each other's corrections.
      *
-     * Held for as long as `work` runs, so `work` must be something that ends:
-     * a bounded walk and the click at the end of it, not a whole macro.
+     * Only the queues of `uses` are held: a walk holds the pointer, and a
+     * macro that only types goes on typing while it lasts. Held for as long
+     * as `work` runs, so `work` must be something that ends: a bounded walk
+     * and the click at the end of it, not a whole macro.
      */
-    async exclusive<T>(work: (lease: Playback) => Promise<T>): Promise<T> {
+    async exclusive<T>(uses: InputResource[], work: (lease: Playback) => Promise<T>): Promise<T> {
         // Straight to _play: this is already the queue's turn, and going through
         // play() again would put the work behind a turn that is waiting for it.
         const lease: Playback = { play: events => this._play(events) };
-        return this._queue(() => work(lease));
+        return this._queue(uses, () => work(lease));
     }
 
-    /** Run `job` once everything asked for before it has finished. */
-    private _queue<T>(job: () => Promise<T>): Promise<T> {
-        const turn = this._turn.then(job, job);
+    /**
+     * Run `job` once everything asked for before it on the same input has
+     * finished. Taking several queues at once cannot deadlock: the job becomes
+     * the tail of each in one go, so every wait is on something asked for
+     * earlier.
+     */
+    private _queue<T>(uses: InputResource[], job: () => Promise<T>): Promise<T> {
+        const held = this._shared ? ALL_INPUT : uses;
+        const asked = tracer.start();
+        const turn = Promise.all(held.map(use => this._turns.get(use))).then(() => {
+            tracer.end(asked, `wait for ${held.join(', ')}`, 'input queue');
+            return job();
+        });
         // The queue must not stop at the first failure, and an unhandled
         // rejection on it would be reported twice: the caller gets the real one.
-        this._turn = turn.then(() => {}, () => {});
+        const tail = turn.then(() => {}, () => {});
+        for (const use of held) {
+            this._turns.set(use, tail);
+        }
         return turn;
     }
 
@@ -246,19 +333,95 @@ export class DaemonClient {
         }
         const durationMs = events.reduce((sum, e) => sum + Math.max(0, e.dt), 0) / 1000;
         const timeoutMs = Math.max(10000, durationMs + 10000);
-        const json = await this._request('POST', '/play', { events }, timeoutMs);
+        const deadline = GLib.get_monotonic_time() + timeoutMs * 1000;
+        for (;;) {
+            const json = await this._request('POST', '/play', { events }, timeoutMs);
+            // The queues keep our own trains apart, but a device that is both
+            // keyboard and mouse is one clone for both, and a daemon older than
+            // per-clone playback has one for everything: a short wait, not a
+            // failed step.
+            if (json.error === 'busy' && GLib.get_monotonic_time() < deadline) {
+                await new Promise<void>(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, BUSY_RETRY_MS, () => {
+                    resolve();
+                    return GLib.SOURCE_REMOVE;
+                }));
+                continue;
+            }
+            if (json.error) {
+                throw new DaemonError(json.error);
+            }
+            traceTiming(json, `play ${events.length} events`);
+            return { aborted: !!json.aborted };
+        }
+    }
+
+    /**
+     * Have the daemon press `code` and keep it down for `ms`, or until
+     * `release` when that is 0, repeating every `repeatMs` the way a held key
+     * does. Not queued behind `play`: nothing here occupies the daemon while
+     * the key is down, which is the point — a ten second hold as a train would
+     * keep every other macro waiting for ten seconds.
+     *
+     * A train that releases the same key ends the hold, and `stop` ends them
+     * all, so a hold is never left behind by a run that went away.
+     */
+    async hold(code: number, ms: number, repeatMs = 0): Promise<void> {
+        const json = await this._request('POST', '/hold', {
+            code,
+            ms: Math.max(0, Math.round(ms)),
+            repeat_ms: Math.max(0, Math.round(repeatMs)),
+        }, 3000);
+        if (json.error) {
+            throw new DaemonError(json.error);
+        }
+    }
+
+    /** End the hold on `code`; harmless when it has already ended. */
+    async release(code: number): Promise<void> {
+        await this._request('POST', '/release', { code }, 3000);
+    }
+
+    /**
+     * Replay a capture file recorded with `setRecording(true, name)`, at the
+     * pace it was recorded. Queued like `play`, on every input at once. No timeout: a capture can run
+     * for hours, and `stop` is what ends one early.
+     */
+    async playCapture(name: string): Promise<PlayResult> {
+        return this._queue(ALL_INPUT, async () => {
+            const json = await this._request('POST', '/play', { capture: name }, 0);
+            if (json.error) {
+                throw new DaemonError(`capture ${name}: ${json.error}`);
+            }
+            traceTiming(json, `play capture ${name}`);
+            return { aborted: !!json.aborted };
+        });
+    }
+
+    /**
+     * Gamepad mode: the daemon sends WASD, E, C/Esc, the mouse buttons and
+     * mouse motion — real or played — to a virtual gamepad instead of their
+     * clones. Off centres the sticks and lets go of every button.
+     */
+    async setGamepad(on: boolean): Promise<void> {
+        const json = await this._request('POST', '/gamepad', { on }, 3000);
         if (json.error) {
             throw new DaemonError(json.error);
         }
-        return { aborted: !!json.aborted };
     }
 
     async stop(): Promise<void> {
         await this._request('POST', '/stop', {}, 3000);
     }
 
-    async setRecording(on: boolean): Promise<void> {
-        await this._request('POST', '/record', { on }, 3000);
+    /**
+     * With `capture`, the daemon also writes every real event it forwards to
+     * that file until recording stops, for `playCapture` to replay later.
+     */
+    async setRecording(on: boolean, capture?: string): Promise<void> {
+        const json = await this._request('POST', '/record', capture ? { on, capture } : { on }, 3000);
+        if (json.error) {
+            throw new DaemonError(json.error);
+        }
     }
 
 }
@@ -0,0 +1,142 @@
+// What the compositor has drawn, and where: how a wait until knows when its
+// check is worth asking again.
+//
+// Windows say when they have new content — every commit damages the window's
+// actor — and where they are, so a report is a rectangle and a waiting check
+// only hears about the ones over the area it looks at. A window that moves,
+// resizes, hides or is restacked changes what is seen without drawing
+// anything new; those are reported too. What the shell paints itself — the
+// panel, notifications, the overview — has no signal of its own worth having
+// (the stage's repaints say nothing about where), so it is left to the
+// runner's slow recheck.
+
+import type Meta from 'gi://Meta';
+
+import { frameCache, overlaps, type Rect } from './screenshot.js';
+
+/** Where something was drawn, or null for somewhere that cannot be told. */
+export type Damage = Rect | null;
+
+interface Watch {
+    rects: Rect[];
+    onDamage: () => void;
+}
+
+interface TrackedWindow {
+    window: Meta.Window | null;
+    /** Where it was last seen, so a move damages where it left as well. */
+    last: Rect | null;
+    actorIds: number[];
+    windowIds: number[];
+}
+
+function rectOf(window: Meta.Window | null): Rect | null {
+    if (!window) {
+        return null;
+    }
+    const rect = window.get_buffer_rect();
+    return { x: rect.x, y: rect.y, w: rect.width, h: rect.height };
+}
+
+/**
+ * Signals on every window actor there is and on the ones still to come. Only
+ * connected while something is waiting: a session with no wait until running
+ * pays nothing for this.
+ */
+function connectCompositor(report: (damage: Damage) => void): () => void {
+    const tracked = new Map<Meta.WindowActor, TrackedWindow>();
+
+    const untrack = (actor: Meta.WindowActor) => {
+        const entry = tracked.get(actor);
+        if (!entry) {
+            return;
+        }
+        tracked.delete(actor);
+        entry.actorIds.forEach(id => actor.disconnect(id));
+        entry.windowIds.forEach(id => entry.window?.disconnect(id));
+    };
+
+    const track = (actor: Meta.WindowActor | null) => {
+        if (!actor || tracked.has(actor)) {
+            return;
+        }
+        const window = actor.get_meta_window();
+        const entry: TrackedWindow = { window, last: rectOf(window), actorIds: [], windowIds: [] };
+        const moved = () => {
+            const now = rectOf(window);
+            report(entry.last);
+            report(now);
+            entry.last = now;
+        };
+        entry.actorIds.push(
+            actor.connect('damaged', () => report(entry.last)),
+            actor.connect('destroy', () => {
+                report(entry.last);
+                untrack(actor);
+            }),
+        );
+        if (window) {
+            entry.windowIds.push(
+                window.connect('position-changed', moved),
+                window.connect('size-changed', moved),
+                window.connect('notify::minimized', () => report(entry.last)),
+            );
+        }
+        tracked.set(actor, entry);
+    };
+
+    global.get_window_actors().forEach(track);
+    const displayIds = [
+        global.display.connect('window-created', (_display: Meta.Display, window: Meta.Window) =>
+            track(window.get_compositor_private() as Meta.WindowActor | null)),
+        global.display.connect('restacked', () => report(null)),
+    ];
+    const workspaceId = global.workspace_manager.connect('active-workspace-changed', () => report(null));
+
+    return () => {
+        displayIds.forEach(id => global.display.disconnect(id));
+        global.workspace_manager.disconnect(workspaceId);
+        [...tracked.keys()].forEach(untrack);
+    };
+}
+
+/**
+ * Everyone waiting on the screen, sharing one set of signal connections: the
+ * first watch connects them, the last one to go disconnects them. A report
+ * reaches a watch only if it overlaps one of its rectangles.
+ */
+export class DamageWatcher {
+    /** Connects the reports to the compositor; the tests put a stand-in here. */
+    connect: (report: (damage: Damage) => void) => () => void = connectCompositor;
+    private _watches = new Set<Watch>();
+    private _disconnect: (() => void) | null = null;
+
+    /** Call `onDamage` whenever something is drawn over `rects`, until the returned function is called. */
+    watch(rects: Rect[], onDamage: () => void): () => void {
+        const watch: Watch = { rects, onDamage };
+        this._watches.add(watch);
+        this._disconnect ??= this.connect(damage => this._report(damage));
+        return () => {
+            this._watches.delete(watch);
+            if (this._watches.size === 0 && this._disconnect) {
+                const disconnect = this._disconnect;
+                this._disconnect = null;
+                disconnect();
+            }
+        };
+    }
+
+    private _report(damage: Damage): void {
+        // The check this wakes must see the new pixels, not a frame from
+        // before them that is still young enough to be shared.
+        frameCache.forget(damage);
+        for (const watch of [...this._watches]) {
+            if (damage === null || watch.rects.some(rect => overlaps(rect, damage))) {
+                watch.onDamage();
+            }
+        }
+    }
+}
+
+/** The one watcher, shared by every running macro. */
+export const damageWatcher = new DamageWatcher();
@@ -0,0 +1,64 @@
+// The other end of EncodeWorker: a plain gjs process, not part of the shell,
+// that reads encode requests from stdin and writes each finished image to
+// stdout as a line of JSON. Blocking reads are fine here — there is nothing
+// else this process does.
+//
+//   gjs -m encode-helper.js
+
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+import GdkPixbuf from 'gi://GdkPixbuf';
+
+import { encodeForLlm, type EncodeReply, type EncodeRequest } from './encoder.js';
+
+// The Unix stream classes moved to GioUnix in GLib 2.80; older GLib has them
+// on Gio only. Not a static import, which would fail outright on those.
+const GioUnix: { InputStream: typeof Gio.UnixInputStream; OutputStream: typeof Gio.UnixOutputStream } =
+    await import('gi://GioUnix' as string)
+        .then(module => module.default)
+        .catch(() => ({ InputStream: Gio.UnixInputStream, OutputStream: Gio.UnixOutputStream }));
+
+const input = new Gio.DataInputStream({ base_stream: new GioUnix.InputStream({ fd: 0, close_fd: false }) });
+const output = new GioUnix.OutputStream({ fd: 1, close_fd: false });
+const encoder = new TextEncoder();
+
+/** Exactly `length` bytes; a pipe hands them over in whatever pieces it likes. */
+function readExactly(length: number): Uint8Array | null {
+    const data = new Uint8Array(length);
+    let offset = 0;
+    while (offset < length) {
+        const chunk = input.read_bytes(Math.min(length - offset, 1 << 20), null);
+        const bytes = chunk.get_data();
+        if (!bytes || bytes.length === 0) {
+            return null;
+        }
+        data.set(bytes, offset);
+        offset += bytes.length;
+    }
+    return data;
+}
+
+function answer(reply: EncodeReply): void {
+    output.write_all(encoder.encode(`${JSON.stringify(reply)}\n`), null);
+}
+
+for (;;) {
+    const [line] = input.read_line_utf8(null);
+    if (line === null) {
+        break; // the shell closed the pipe
+    }
+    const request = JSON.parse(line) as EncodeRequest;
+    const data = readExactly(request.length);
+    if (!data) {
+        break;
+    }
+    try {
+        const pixbuf = GdkPixbuf.Pixbuf.new_from_bytes(
+            new GLib.Bytes(data), GdkPixbuf.Colorspace.RGB, request.hasAlpha, 8,
+            request.width, request.height, request.rowstride,
+        );
+        answer(encodeForLlm(pixbuf, request.maxWidth));
+    } catch (error) {
+        answer({ error: (error as Error).message });
+    }
+}
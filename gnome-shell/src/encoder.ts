@@ -0,0 +1,237 @@
+// Turning a capture into the picture the model is sent: scale, PNG, base64.
+//
+// For a full screen that is tens of milliseconds of CPU, and gnome-shell has
+// one thread for painting and for every line of extension code, so done in
+// place it is a dropped frame on every monitor each time a check asks the
+// model. GJS has no threads to offer, so the work goes to a helper process —
+// encode-helper.js, run under gjs — that is handed the raw pixels over its
+// stdin and answers with the finished image. The compositor copies the bytes
+// out and waits; everything else happens elsewhere.
+
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+import GdkPixbuf from 'gi://GdkPixbuf';
+
+import { type AsyncDataInputStream, type AsyncOutputStream, ensurePromisified } from './pipes.js';
+import { tracer } from './tracer.js';
+
+export interface EncodedImage {
+    dataUri: string;
+    /** Of the encoded bytes: two checks with the same one sent the same picture. */
+    checksum: string;
+    mimeType: string;
+    byteLength: number;
+    width: number;
+    height: number;
+}
+
+function scaleToWidth(pixbuf: GdkPixbuf.Pixbuf, maxWidth: number): GdkPixbuf.Pixbuf {
+    const width = pixbuf.get_width();
+    if (width <= maxWidth || maxWidth <= 0) {
+        return pixbuf;
+    }
+    const height = Math.max(1, Math.round(pixbuf.get_height() * (maxWidth / width)));
+    return pixbuf.scale_simple(maxWidth, height, GdkPixbuf.InterpType.BILINEAR) ?? pixbuf;
+}
+
+/**
+ * Encode as PNG for the model. Lossless matters more here than it looks: a
+ * screenshot is text and thin lines, exactly what JPEG smears, and at this size
+ * PNG is both smaller and quicker to write than JPEG anyway. The compression
+ * level is left at the default — level 9 buys under a percent for twice the
+ * time, which is felt even off the compositor thread as a slower answer.
+ *
+ * Runs in the helper; in the shell only when the helper cannot.
+ */
+export function encodeForLlm(pixbuf: GdkPixbuf.Pixbuf, maxWidth: number): EncodedImage {
+    const scaled = scaleToWidth(pixbuf, maxWidth);
+
+    const [ok, buffer] = scaled.save_to_bufferv('png', [], []);
+    if (!ok || !buffer) {
+        throw new Error('could not encode the screenshot');
+    }
+
+    return {
+        dataUri: `data:image/png;base64,${GLib.base64_encode(buffer)}`,
+        checksum: GLib.compute_checksum_for_data(GLib.ChecksumType.SHA1, buffer) ?? '',
+        mimeType: 'image/png',
+        byteLength: buffer.length,
+        width: scaled.get_width(),
+        height: scaled.get_height(),
+    };
+}
+
+/**
+ * What goes down the pipe ahead of the pixels: one line of JSON, then exactly
+ * `length` bytes of rows as the pixbuf keeps them.
+ */
+export interface EncodeRequest {
+    width: number;
+    height: number;
+    rowstride: number;
+    hasAlpha: boolean;
+    maxWidth: number;
+    length: number;
+}
+
+/** The helper's answer, one line of JSON per request, in the order asked. */
+export type EncodeReply = EncodedImage | { error: string };
+
+/** Helpers that may die in a row before encoding goes back into the shell for good. */
+const MAX_FAILURES = 3;
+
+interface Helper {
+    process: Gio.Subprocess;
+    stdin: Gio.OutputStream & AsyncOutputStream;
+    cancellable: Gio.Cancellable;
+    /** Answers still owed, oldest first. */
+    waiting: { resolve: (image: EncodedImage) => void; reject: (error: Error) => void }[];
+    /** Tail of the writes: one request's header and pixels never interleave with another's. */
+    writing: Promise<void>;
+}
+
+/**
+ * The helper process, started on the first encode and kept for the next: gjs
+ * takes a tenth of a second to start, which would undo what it saves. If it
+ * cannot be started, or dies, the encode happens in place as it used to —
+ * a dropped frame is better than a check that fails.
+ */
+export class EncodeWorker {
+    private _script: string | null;
+    private _helper: Helper | null = null;
+    /** Set once the helper cannot be had: no point trying on every check. */
+    private _unavailable = false;
+    /** Helpers lost in a row; a few and it is given up on. */
+    private _failures = 0;
+    private _closed = false;
+
+    constructor(script: string | null = helperScript()) {
+        ensurePromisified();
+        this._script = script;
+    }
+
+    destroy(): void {
+        this._closed = true;
+        this._stop(new Error('the encoder was shut down'));
+    }
+
+    encode(pixbuf: GdkPixbuf.Pixbuf, maxWidth: number): Promise<EncodedImage> {
+        return tracer.wrap(this._encode(pixbuf, maxWidth),
+            `encode ${pixbuf.get_width()}×${pixbuf.get_height()}`, 'encodes');
+    }
+
+    private async _encode(pixbuf: GdkPixbuf.Pixbuf, maxWidth: number): Promise<EncodedImage> {
+        const helper = this._closed || this._unavailable ? null : this._helper ?? this._start();
+        if (!helper) {
+            return encodeForLlm(pixbuf, maxWidth);
+        }
+
+        // The one copy made here. For a subpixbuf, the rows start inside the
+        // frame's and keep its stride, which the request carries.
+        const data = pixbuf.get_pixels();
+        const request: EncodeRequest = {
+            width: pixbuf.get_width(),
+            height: pixbuf.get_height(),
+            rowstride: pixbuf.get_rowstride(),
+            hasAlpha: pixbuf.get_has_alpha(),
+            maxWidth,
+            length: data.length,
+        };
+        const header = new TextEncoder().encode(`${JSON.stringify(request)}\n`);
+
+        const answer = new Promise<EncodedImage>((resolve, reject) => helper.waiting.push({ resolve, reject }));
+        helper.writing = helper.writing.then(async () => {
+            await helper.stdin.write_all_async(header, GLib.PRIORITY_DEFAULT, helper.cancellable);
+            await helper.stdin.write_all_async(data, GLib.PRIORITY_DEFAULT, helper.cancellable);
+        }).catch(error => this._stop(error as Error, helper));
+
+        try {
+            const image = await answer;
+            this._failures = 0;
+            return image;
+        } catch (error) {
+            if (this._closed) {
+                throw error;
+            }
+            if (++this._failures >= MAX_FAILURES) {
+                this._unavailable = true;
+            }
+            log(`macroclickwerk: image encoder failed, encoding in the shell: ${(error as Error).message}`);
+            return encodeForLlm(pixbuf, maxWidth);
+        }
+    }
+
+    private _start(): Helper | null {
+        const gjs = GLib.find_program_in_path('gjs');
+        if (!gjs || !this._script) {
+            this._unavailable = true;
+            log('macroclickwerk: gjs not found, screenshots for the model are encoded in the shell');
+            return null;
+        }
+        let process: Gio.Subprocess;
+        try {
+            process = Gio.Subprocess.new(
+                [gjs, '-m', this._script],
+                Gio.SubprocessFlags.STDIN_PIPE | Gio.SubprocessFlags.STDOUT_PIPE,
+            );
+        } catch (error) {
+            this._unavailable = true;
+            log(`macroclickwerk: could not start the image encoder: ${(error as Error).message}`);
+            return null;
+        }
+
+        const helper: Helper = {
+            process,
+            stdin: process.get_stdin_pipe() as Gio.OutputStream & AsyncOutputStream,
+            cancellable: new Gio.Cancellable(),
+            waiting: [],
+            writing: Promise.resolve(),
+        };
+        this._helper = helper;
+        const reader = new Gio.DataInputStream({
+            base_stream: process.get_stdout_pipe()!,
+        }) as Gio.DataInputStream & AsyncDataInputStream;
+        // Deliberately not awaited: the read loop runs until the helper goes.
+        void this._readLoop(helper, reader);
+        return helper;
+    }
+
+    private async _readLoop(helper: Helper, reader: Gio.DataInputStream & AsyncDataInputStream): Promise<void> {
+        const decoder = new TextDecoder();
+        try {
+            for (;;) {
+                const [line] = await reader.read_line_async(GLib.PRIORITY_DEFAULT, helper.cancellable);
+                if (line === null) {
+                    throw new Error('the image encoder exited');
+                }
+                const reply = JSON.parse(decoder.decode(line)) as EncodeReply;
+                const next = helper.waiting.shift();
+                if ('error' in reply) {
+                    next?.reject(new Error(reply.error));
+                } else {
+                    next?.resolve(reply);
+                }
+            }
+        } catch (error) {
+            this._stop(error as Error, helper);
+        }
+    }
+
+    /** Fail whatever is owed and let the next encode start a fresh helper. */
+    private _stop(error: Error, helper = this._helper): void {
+        if (!helper) {
+            return;
+        }
+        if (this._helper === helper) {
+            this._helper = null;
+        }
+        helper.cancellable.cancel();
+        helper.waiting.splice(0).forEach(({ reject }) => reject(error));
+        helper.process.force_exit();
+    }
+}
+
+/** Where the helper is, beside this file in the installed extension. */
+function helperScript(): string | null {
+    return Gio.File.new_for_uri(import.meta.url).get_parent()?.get_child('encode-helper.js').get_path() ?? null;
+}
@@ -3,6 +3,7 @@
 
 import type { MouseButton, RawEvent } from './model.js';
 
+export const EV_SYN = 0;
 export const EV_KEY = 1;
 export const EV_REL = 2;
 
@@ -18,6 +19,10 @@ export const BTN_RIGHT = 0x111;
 export const BTN_MIDDLE = 0x112;
 export const BTN_SIDE = 0x113;
 export const BTN_EXTRA = 0x114;
+// Key codes from BTN_MISC up to KEY_OK are buttons: the daemon plays them on
+// the pointer's clone, not the keyboard's.
+export const BTN_MISC = 0x100;
+export const KEY_OK = 0x160;
 
 export const BUTTON_CODES: Record<MouseButton, number> = {
     left: BTN_LEFT,
@@ -9,13 +9,17 @@ import Gio from 'gi://Gio';
 import GLib from 'gi://GLib';
 import Soup from 'gi://Soup?version=3.0';
 
-import type { EncodedImage } from './screenshot.js';
+import type { EncodedImage } from './encoder.js';
+import type { PerceptualHash } from './screenshot.js';
+import { tracer } from './tracer.js';
 
 export interface LlmSettings {
     endpoint: string;
     model: string;
     apiKey: string;
     timeoutMs: number;
+    /** Requests to the endpoint at once; the rest queue. Unset is one. */
+    maxRequests?: number;
 }
 
 export interface Verdict {
@@ -23,10 +27,50 @@ export interface Verdict {
     match: boolean;
     reason: string;
     latencyMs: number;
+    /**
+     * When the verdict itself could be read, out of a streamed answer; the rest
+     * of `latencyMs` went on the reason. Unset when the answer came in one piece.
+     */
+    verdictMs?: number;
+    /** When the first token of a streamed answer arrived: the model's own start-up. */
+    firstTokenMs?: number;
+    /** Sent to a model that had not answered in a while, and may have had to load. */
+    cold?: boolean;
+    /** Time spent waiting for a turn at the endpoint, before the request went out. */
+    queuedMs?: number;
+    /** Requests ahead of this one, sent or waiting, when it had to queue. */
+    queuedBehind?: number;
+    /** The answer to an identical request already on its way, not one of its own. */
+    shared?: boolean;
+    /** Questions asked in the same request as this one, this one included. */
+    askedWith?: number;
 }
 
 export class LlmError extends Error {}
 
+/**
+ * The asker stopped wanting the answer — another check already decided the
+ * outcome. Not a failure: nothing to report, nothing wrong with the endpoint.
+ */
+export class Cancelled extends LlmError {
+    constructor() {
+        super('cancelled: the answer was no longer needed');
+    }
+}
+
+/** Run `onCancel` when `cancellable` is cancelled, now if it already is; returns the undo. */
+export function onCancelled(cancellable: Gio.Cancellable | null | undefined, onCancel: () => void): () => void {
+    if (!cancellable) {
+        return () => {};
+    }
+    if (cancellable.is_cancelled()) {
+        onCancel();
+        return () => {};
+    }
+    const id = cancellable.connect('cancelled', () => onCancel());
+    return () => cancellable.disconnect(id);
+}
+
 /**
  * Deliberately blunt and repetitive. Small local vision models drift away from
  * a loose format immediately: they answer in prose, wrap JSON in a code fence,
@@ -36,8 +80,37 @@ export class LlmError extends Error {}
  * Exported because preferences shows it verbatim behind an info button. Nobody
  * can word a prompt well without knowing what it is wrapped in, and a copy of
  * this text in the help would be wrong within a release.
+ *
+ * Given several statements, it asks for all of them about the one picture and
+ * an answer per statement, numbered — see `parseVerdicts`.
  */
-export function buildInstruction(question: string): string {
+export function buildInstruction(question: string | string[]): string {
+    if (Array.isArray(question)) {
+        return [
+            'You are a strict visual classifier. Look at the screenshot and decide, for each',
+            'numbered statement below, whether it is TRUE or FALSE for what you see.',
+            '',
+            'STATEMENTS:',
+            ...question.map((text, i) => `${i + 1}. ${text}`),
+            '',
+            'Reply with exactly one JSON object and nothing else.',
+            'No prose. No explanation before or after. No markdown. No ``` code fence.',
+            '',
+            'The object must have exactly one key, "answers": an array with one entry',
+            'per statement, in the same order. Each entry has exactly these three keys:',
+            '  "n"      - the number of the statement.',
+            '  "match"  - the JSON boolean true or false. Not "true", not "yes", not 1.',
+            '  "reason" - a string, at most 10 words.',
+            '',
+            'A valid reply to two statements looks exactly like this:',
+            '{"answers": [{"n": 1, "match": true, "reason": "the left button is green"},',
+            '             {"n": 2, "match": false, "reason": "no dialog is open"}]}',
+            '',
+            'Judge every statement on its own. Use true only when it is clearly true',
+            'in the screenshot. If you are unsure, or cannot see the thing being asked',
+            'about, use false.',
+        ].join('\n');
+    }
     return [
         'You are a strict visual classifier. Look at the screenshot and decide whether',
         'the following statement is TRUE or FALSE for what you see.',
@@ -71,16 +144,23 @@ function ensurePromisified(): void {
         _promisify: (proto: object, method: string, finish?: string) => void;
     };
     try {
-        gio._promisify(Soup.Session.prototype, 'send_and_read_async', 'send_and_read_finish');
+        gio._promisify(Soup.Session.prototype, 'send_async', 'send_finish');
+        gio._promisify(Gio.InputStream.prototype, 'read_bytes_async', 'read_bytes_finish');
+        gio._promisify(Gio.InputStream.prototype, 'close_async', 'close_finish');
     } catch {
         // Already promisified.
     }
 }
 
 interface AsyncSoupSession {
-    send_and_read_async(
+    send_async(
         message: Soup.Message, priority: number, cancellable: Gio.Cancellable | null,
-    ): Promise<GLib.Bytes>;
+    ): Promise<Gio.InputStream>;
+}
+
+interface AsyncInputStream {
+    read_bytes_async(count: number, priority: number, cancellable: Gio.Cancellable | null): Promise<GLib.Bytes>;
+    close_async(priority: number, cancellable: Gio.Cancellable | null): Promise<boolean>;
 }
 
 /** Keys small models reach for when they ignore the one we asked for. */
@@ -153,15 +233,9 @@ export function verdictFromObjects(text: string): { match: boolean; reason: stri
     // after the first, and JSON.parse would choke on the pair.
     for (const candidate of trimmed.match(/\{[\s\S]*?\}/g) ?? []) {
         try {
-            const parsed = JSON.parse(candidate) as Record<string, unknown>;
-            const reason = String(parsed.reason ?? parsed.explanation ?? '');
-            for (const key of VERDICT_KEYS) {
-                if (key in parsed) {
-                    const value = toBool(parsed[key]);
-                    if (value !== null) {
-                        return { match: value, reason };
-                    }
-                }
+            const verdict = verdictOfObject(JSON.parse(candidate));
+            if (verdict) {
+                return verdict;
             }
         } catch {
             // Try the next object, then fall through to the plain-text reading.
@@ -171,6 +245,267 @@ export function verdictFromObjects(text: string): { match: boolean; reason: stri
     return null;
 }
 
+function verdictOfObject(parsed: unknown): { match: boolean; reason: string } | null {
+    if (typeof parsed !== 'object' || parsed === null) {
+        return null;
+    }
+    const object = parsed as Record<string, unknown>;
+    const reason = String(object.reason ?? object.explanation ?? '');
+    for (const key of VERDICT_KEYS) {
+        if (key in object) {
+            const value = toBool(object[key]);
+            if (value !== null) {
+                return { match: value, reason };
+            }
+        }
+    }
+    return null;
+}
+
+/**
+ * Read the answers to `count` numbered statements. The array may come bare or
+ * under any key, entries numbered or merely in order, and an entry may be a
+ * bare boolean. Unlike a single verdict there is no reading this out of prose:
+ * all or nothing, null unless every statement got exactly one answer.
+ */
+export function parseVerdicts(text: string, count: number): { match: boolean; reason: string }[] | null {
+    const trimmed = stripThinking((text ?? '').trim());
+    const start = trimmed.search(/[[{]/);
+    const end = Math.max(trimmed.lastIndexOf(']'), trimmed.lastIndexOf('}'));
+    if (start < 0 || end < start) {
+        return null;
+    }
+    let parsed: unknown;
+    try {
+        parsed = JSON.parse(trimmed.slice(start, end + 1));
+    } catch {
+        return null;
+    }
+    const list = Array.isArray(parsed)
+        ? parsed
+        : Object.values(parsed as Record<string, unknown>).find(value => Array.isArray(value)) as unknown[] | undefined;
+    if (!list || list.length !== count) {
+        return null;
+    }
+
+    const answers: ({ match: boolean; reason: string } | null)[] = new Array(count).fill(null);
+    for (const [i, item] of list.entries()) {
+        const entry = typeof item === 'object' && item !== null ? item as Record<string, unknown> : { match: item };
+        const n = Number(entry.n ?? entry.id ?? entry.number ?? i + 1) - 1;
+        const verdict = verdictOfObject(entry);
+        if (!verdict || !Number.isInteger(n) || n < 0 || n >= count || answers[n]) {
+            return null;
+        }
+        answers[n] = verdict;
+    }
+    return answers as { match: boolean; reason: string }[];
+}
+
+// --- reading a completion ---------------------------------------------------
+
+interface Completion {
+    content: string;
+    reasoning: string;
+    finish: string;
+}
+
+/** The answer's parts out of a whole (not streamed) chat completion. */
+function readCompletion(text: string): Completion {
+    const completion = { content: '', reasoning: '', finish: '' };
+    try {
+        const json = JSON.parse(text) as {
+            choices?: {
+                finish_reason?: string;
+                message?: { content?: unknown; reasoning_content?: unknown };
+            }[];
+            error?: { message?: string };
+        };
+        if (json.error?.message) {
+            throw new LlmError(json.error.message);
+        }
+        const choice = json.choices?.[0];
+        completion.finish = choice?.finish_reason ?? '';
+        const raw = choice?.message?.content;
+        if (typeof raw === 'string') {
+            completion.content = raw;
+        } else if (Array.isArray(raw)) {
+            // Some servers answer with the content-part array form.
+            completion.content = raw
+                .map(part => (typeof part === 'string' ? part : (part as { text?: string })?.text ?? ''))
+                .join(' ');
+        }
+        if (typeof choice?.message?.reasoning_content === 'string') {
+            completion.reasoning = choice.message.reasoning_content;
+        }
+    } catch (error) {
+        if (error instanceof LlmError) {
+            throw error;
+        }
+        throw new LlmError(`could not parse the response: ${text.slice(0, 200)}`);
+    }
+    return completion;
+}
+
+/** Why a completion has no answer in it, if the reason is that it is empty. */
+function emptyAnswer({ content, reasoning, finish }: Completion): LlmError | null {
+    // Naming the empty case separately: an error that ends in a colon and
+    // then nothing reads like the message itself broke.
+    if (content.trim() !== '') {
+        return null;
+    }
+    return new LlmError(reasoning.trim() !== '' || finish === 'length'
+        ? 'the model spent its whole answer thinking and never got to the verdict'
+        : 'the model returned an empty answer');
+}
+
+/** The verdict in a completion, or the error that says why there is none. */
+function verdictOf(completion: Completion): { match: boolean; reason: string } {
+    // A reasoning model that would not be talked out of thinking sometimes
+    // finishes the job inside its thoughts. Only a written-out JSON object
+    // counts there: half a thought is full of the words true and no, and
+    // reading a verdict out of one would be worse than saying we could not
+    // find it.
+    const parsed = parseVerdict(completion.content) ?? verdictFromObjects(completion.reasoning);
+    if (!parsed) {
+        throw emptyAnswer(completion)
+            ?? new LlmError(`could not read a yes/no answer from: ${completion.content.slice(0, 200)}`);
+    }
+    return parsed;
+}
+
+/** The model answered several questions, just not in a shape we can read. */
+class NotInBatchFormat extends LlmError {}
+
+/** The answers to `count` questions in a completion, or why there are none. */
+function verdictsOf(completion: Completion, count: number): { match: boolean; reason: string }[] {
+    const parsed = parseVerdicts(completion.content, count) ?? parseVerdicts(completion.reasoning, count);
+    if (!parsed) {
+        throw emptyAnswer(completion)
+            ?? new NotInBatchFormat(`could not read ${count} answers from: ${completion.content.slice(0, 200)}`);
+    }
+    return parsed;
+}
+
+/**
+ * Longest reason worth waiting for. We ask for ten words; a model that is still
+ * going well past that is explaining itself to nobody, and the rest of it only
+ * holds the macro up.
+ */
+export const MAX_REASON_CHARS = 160;
+
+const STREAMED_MATCH = /"match"\s*:\s*(true|false|"(?:yes|no|true|false)"|[01])/i;
+const STREAMED_REASON = /"reason"\s*:\s*"/i;
+
+/**
+ * A streamed answer, read as it arrives: `data:` lines of server-sent events,
+ * each with a delta of the completion. What matters is that the verdict can be
+ * read long before the model is done — `{"match": true` is the first handful
+ * of tokens — so `early` says when enough has come to stop listening.
+ */
+export class VerdictStream {
+    content = '';
+    reasoning = '';
+    finish = '';
+    /** The server said `[DONE]`. */
+    done = false;
+    private _partial = '';
+
+    /** Take the next piece of the response body, in whatever size it came. */
+    feed(chunk: string): void {
+        const lines = (this._partial + chunk).split('\n');
+        this._partial = lines.pop() ?? '';
+        for (const line of lines) {
+            this.line(line);
+        }
+    }
+
+    /** One line of the event stream; anything but `data:` is ignored. */
+    line(text: string): void {
+        const line = text.replace(/\r$/, '');
+        if (!line.startsWith('data:')) {
+            return;
+        }
+        const data = line.slice(5).trim();
+        if (data === '[DONE]') {
+            this.done = true;
+            return;
+        }
+        let json: {
+            choices?: { finish_reason?: string | null; delta?: { content?: unknown; reasoning_content?: unknown } }[];
+            error?: { message?: string };
+        };
+        try {
+            json = JSON.parse(data);
+        } catch {
+            throw new LlmError(`could not parse the response: ${data.slice(0, 200)}`);
+        }
+        if (json.error?.message) {
+            throw new LlmError(json.error.message);
+        }
+        const choice = json.choices?.[0];
+        if (typeof choice?.delta?.content === 'string') {
+            this.content += choice.delta.content;
+        }
+        if (typeof choice?.delta?.reasoning_content === 'string') {
+            this.reasoning += choice.delta.reasoning_content;
+        }
+        if (choice?.finish_reason) {
+            this.finish = choice.finish_reason;
+        }
+    }
+
+    /** The verdict, as soon as the answer has got as far as saying it. */
+    match(): boolean | null {
+        const found = STREAMED_MATCH.exec(stripThinking(this.content));
+        return found ? toBool(found[1].replace(/"/g, '')) : null;
+    }
+
+    /**
+     * Verdict and reason once there is no point waiting for more: the reason
+     * has closed, or outgrown `maxReason`, or the object closed without one.
+     * Null while either is still to come.
+     */
+    early(maxReason = MAX_REASON_CHARS): { match: boolean; reason: string } | null {
+        const text = stripThinking(this.content);
+        const found = STREAMED_MATCH.exec(text);
+        const match = found ? toBool(found[1].replace(/"/g, '')) : null;
+        if (match === null) {
+            return null;
+        }
+        const opened = STREAMED_REASON.exec(text);
+        if (!opened) {
+            return text.indexOf('}', found!.index) >= 0 ? { match, reason: '' } : null;
+        }
+        let reason = '';
+        for (let i = opened.index + opened[0].length; i < text.length; i++) {
+            const c = text[i];
+            if (c === '"') {
+                return { match, reason };
+            }
+            if (c === '\\') {
+                // An escape cut in half waits for its other half.
+                if (++i >= text.length) {
+                    return null;
+                }
+                reason += text[i] === 'n' ? ' ' : text[i];
+            } else {
+                reason += c;
+            }
+            if (reason.length >= maxReason) {
+                return { match, reason: `${reason}…` };
+            }
+        }
+        return null;
+    }
+
+    /** Everything received, for when the stream ends without stopping early. */
+    completion(): Completion {
+        this.line(this._partial);
+        this._partial = '';
+        return { content: this.content, reasoning: this.reasoning, finish: this.finish };
+    }
+}
+
 // --- connection test -------------------------------------------------------
 
 export interface ConnectionTest {
@@ -183,6 +518,8 @@ export interface ConnectionTest {
     message: string;
 }
 
+const TEST_QUESTION = 'the picture is plain red, with nothing else in it';
+
 /**
  * The picture the test sends: a plain red square, generated rather than stored
  * so there is no blob to keep in the source. Small enough to be instant, large
@@ -200,6 +537,7 @@ function testImage(): EncodedImage {
     }
     return {
         dataUri: `data:image/png;base64,${GLib.base64_encode(data)}`,
+        checksum: GLib.compute_checksum_for_data(GLib.ChecksumType.SHA1, data) ?? '',
         mimeType: 'image/png',
         byteLength: data.length,
         width: 64,
@@ -216,8 +554,7 @@ function testImage(): EncodedImage {
 export async function testConnection(settings: LlmSettings): Promise<ConnectionTest> {
     const client = new LlmClient();
     try {
-        const verdict = await client.ask(
-            'the picture is plain red, with nothing else in it', testImage(), settings);
+        const verdict = await client.ask(TEST_QUESTION, testImage(), settings);
         return { ok: true, sawImage: verdict.match, latencyMs: verdict.latencyMs, message: verdict.reason };
     } catch (error) {
         return { ok: false, sawImage: false, latencyMs: 0, message: (error as Error).message };
@@ -234,21 +571,342 @@ export async function testConnection(settings: LlmSettings): Promise<ConnectionT
  */
 const MAX_TOKENS = 400;
 
+/**
+ * Connections kept open to the endpoint, the most *Requests at once* allows.
+ * Soup's default of two per host would quietly cap anything above that.
+ */
+const MAX_CONNECTIONS = 16;
+
+/**
+ * How long a server keeps a model loaded with nothing to do. Ollama unloads
+ * after five minutes unless told otherwise, and the others are in the same
+ * range; past this, the next question may wait for the model to load again.
+ */
+const IDLE_UNLOAD_MS = 5 * 60 * 1000;
+
+/** Whether the next question should find the model loaded. */
+export type Warmth = 'cold' | 'warming' | 'warm';
+
+/** Bytes asked for per read of a streamed answer; a delta is well under this. */
+const READ_CHUNK = 4096;
+
+/** The whole of a response body that is not worth reading piece by piece. */
+async function readAll(input: Gio.InputStream & AsyncInputStream, cancellable: Gio.Cancellable): Promise<string> {
+    const decoder = new TextDecoder();
+    let text = '';
+    try {
+        for (;;) {
+            const chunk = await input.read_bytes_async(READ_CHUNK * 4, GLib.PRIORITY_DEFAULT, cancellable);
+            if (chunk.get_size() === 0) {
+                return text + decoder.decode();
+            }
+            text += decoder.decode(chunk.get_data() ?? new Uint8Array(0), { stream: true });
+        }
+    } finally {
+        await input.close_async(GLib.PRIORITY_DEFAULT, null).catch(() => false);
+    }
+}
+
+/**
+ * Room for each further question asked in one request: its number, verdict
+ * and reason, and the brackets around them.
+ */
+const TOKENS_PER_QUESTION = 40;
+
+/** A request on its way, and how many askers still want its answer. */
+interface InFlight {
+    answer: Promise<Verdict | Verdict[]>;
+    askers: number;
+    cancellable: Gio.Cancellable;
+}
+
+/** What `_send` makes of a response, whole or streamed. */
+interface Reading<T> {
+    whole(completion: Completion): T;
+    /** The answer out of the stream so far, once the rest is not worth waiting for. */
+    early(stream: VerdictStream): T | null;
+}
+
+interface Timed<T> {
+    answer: T;
+    latencyMs: number;
+    verdictMs?: number;
+    firstTokenMs?: number;
+}
+
+/** The same extra fields on one verdict or on each of several. */
+function stamp<T extends Verdict | Verdict[]>(answer: T, extra: Partial<Verdict>): T {
+    return (Array.isArray(answer) ? answer.map(verdict => ({ ...verdict, ...extra })) : { ...answer, ...extra }) as T;
+}
+
 export class LlmClient {
     private _session: Soup.Session;
     private _jsonMode = true;
     private _noThinking = true;
+    private _stream = true;
+    /** Cleared once the model cannot answer several questions in the form asked. */
+    private _together = true;
+    private _closed = false;
+    /** Requests on their way, by what they ask: see `ask`. */
+    private _inFlight = new Map<string, InFlight>();
+    private _active = 0;
+    private _waiting: (() => void)[] = [];
+    private _peakWaiting = 0;
+    /** When the endpoint last answered, monotonic; 0 after a failure. */
+    private _answeredAt = 0;
+    private _firstTokenMs: number | null = null;
+    private _warming = false;
+    private _onWarmthChanged?: () => void;
 
-    constructor() {
+    /**
+     * One session for the client's life: its connections stay open between
+     * questions, so a check does not pay for a handshake the last one made.
+     */
+    constructor(onWarmthChanged?: () => void) {
         ensurePromisified();
-        this._session = new Soup.Session();
+        this._session = new Soup.Session({ max_conns_per_host: MAX_CONNECTIONS });
+        this._onWarmthChanged = onWarmthChanged;
     }
 
     destroy(): void {
+        this._closed = true;
+        // Whoever is queued goes on to find the client closed, rather than
+        // waiting for a turn that never comes.
+        this._waiting.splice(0).forEach(wake => wake());
         this._session.abort();
     }
 
-    async ask(prompt: string, image: EncodedImage, settings: LlmSettings): Promise<Verdict> {
+    /** Requests waiting for a turn at the endpoint right now. */
+    get queueDepth(): number {
+        return this._waiting.length;
+    }
+
+    /** The most that were ever waiting at once. */
+    get peakQueueDepth(): number {
+        return this._peakWaiting;
+    }
+
+    get warmth(): Warmth {
+        if (this._warming) {
+            return 'warming';
+        }
+        return this._answeredAt > 0 && this.idleMs < IDLE_UNLOAD_MS ? 'warm' : 'cold';
+    }
+
+    /** How soon the model started answering last time, when that was seen. */
+    get firstTokenMs(): number | null {
+        return this._firstTokenMs;
+    }
+
+    /** Since the endpoint last answered, or forever if it has not. */
+    get idleMs(): number {
+        return this._answeredAt > 0 ? (GLib.get_monotonic_time() - this._answeredAt) / 1000 : Infinity;
+    }
+
+    /**
+     * Ask the test question, for nothing but the model loading and staying
+     * loaded. Skipped while anything else is on its way, which does the same
+     * job. A failure is left to the checks to report: they will hit it too,
+     * with a macro and a step to name.
+     */
+    warm(settings: LlmSettings): void {
+        if (this._warming || this._closed || this._active > 0 || !settings.endpoint) {
+            return;
+        }
+        this._warming = true;
+        this._onWarmthChanged?.();
+        this.ask(TEST_QUESTION, testImage(), settings)
+            .catch(error => log(`macroclickwerk: model warm-up failed: ${(error as Error).message}`))
+            .finally(() => {
+                this._warming = false;
+                this._onWarmthChanged?.();
+            });
+    }
+
+    /**
+     * Ask whether the statement holds for the picture. The same question about
+     * the same picture from the same model, asked while it is already on its
+     * way — two macros watching one button — gets that request's answer rather
+     * than a second inference behind the first. Everything else takes a turn:
+     * at most `maxRequests` go to the endpoint at once, so a burst of checks
+     * queues here instead of piling onto a server that would only run them one
+     * after another anyway.
+     *
+     * Cancelling `cancellable` rejects with `Cancelled` at once. The request
+     * itself is dropped — out of the queue, or its connection closed — once
+     * no one else sharing it is still waiting.
+     */
+    ask(
+        prompt: string, image: EncodedImage, settings: LlmSettings, cancellable: Gio.Cancellable | null = null,
+    ): Promise<Verdict> {
+        const key = JSON.stringify([settings.endpoint, settings.model, prompt, image.checksum]);
+        const answer = this._request(key, settings, cancellable, dropped => this._ask(prompt, image, settings, dropped));
+        return tracer.wrap(answer, 'ask model', 'model', { prompt });
+    }
+
+    /** Whether `askMany` still sends its questions in one request. */
+    get asksTogether(): boolean {
+        return this._together;
+    }
+
+    /**
+     * Several statements about one picture, in one request: the picture is
+     * most of what a question costs, and here it is sent and read once. Shared
+     * and queued like `ask`, the questions in the same order counting as the
+     * same request. A model that answers in some other shape is asked one
+     * question at a time from then on.
+     */
+    async askMany(
+        prompts: string[], image: EncodedImage, settings: LlmSettings, cancellable: Gio.Cancellable | null = null,
+    ): Promise<Verdict[]> {
+        const oneByOne = () => Promise.all(prompts.map(prompt => this.ask(prompt, image, settings, cancellable)));
+        if (!this._together || prompts.length < 2) {
+            return oneByOne();
+        }
+        const key = JSON.stringify([settings.endpoint, settings.model, prompts, image.checksum]);
+        try {
+            const answers = this._request(
+                key, settings, cancellable, dropped => this._askMany(prompts, image, settings, dropped));
+            return await tracer.wrap(answers, `ask model ${prompts.length} questions`, 'model', { prompts });
+        } catch (error) {
+            if (!(error instanceof NotInBatchFormat)) {
+                throw error;
+            }
+            if (this._together) {
+                log(`macroclickwerk: ${error.message.slice(0, 120)}; asking one question per request from now on`);
+                this._together = false;
+            }
+            return oneByOne();
+        }
+    }
+
+    /** Share, queue and keep track of warmth for one request; see `ask`. */
+    private _request<T extends Verdict | Verdict[]>(
+        key: string, settings: LlmSettings, cancellable: Gio.Cancellable | null,
+        send: (dropped: Gio.Cancellable) => Promise<T>,
+    ): Promise<T> {
+        const pending = this._inFlight.get(key) as InFlight & { answer: Promise<T> } | undefined;
+        // One everybody has let go of is on its way out, not to be joined.
+        if (pending && !pending.cancellable.is_cancelled()) {
+            return this._heldBy(pending, pending.answer.then(answer => stamp(answer, { shared: true })), cancellable);
+        }
+
+        const cold = this.warmth !== 'warm';
+        const dropped = new Gio.Cancellable();
+        const answer = this._turn(settings.maxRequests ?? 1, () => send(dropped), dropped)
+            .then(answer => {
+                this._answeredAt = GLib.get_monotonic_time();
+                this._firstTokenMs = (Array.isArray(answer) ? answer[0] : answer)?.firstTokenMs ?? this._firstTokenMs;
+                this._onWarmthChanged?.();
+                return cold ? stamp(answer, { cold }) : answer;
+            }, error => {
+                // Dropped on purpose says nothing about the model.
+                if (!(error instanceof Cancelled)) {
+                    this._answeredAt = 0;
+                    this._onWarmthChanged?.();
+                }
+                throw error;
+            })
+            .finally(() => {
+                if (this._inFlight.get(key)?.cancellable === dropped) {
+                    this._inFlight.delete(key);
+                }
+            });
+        const request: InFlight = { answer, askers: 0, cancellable: dropped };
+        this._inFlight.set(key, request);
+        return this._heldBy(request, answer, cancellable);
+    }
+
+    /**
+     * `answer`, for as long as `cancellable` wants it. The request underneath
+     * is only cancelled once every asker sharing it has let go: an asker with
+     * no cancellable holds on for good.
+     */
+    private _heldBy<T>(request: InFlight, answer: Promise<T>, cancellable: Gio.Cancellable | null): Promise<T> {
+        request.askers++;
+        if (!cancellable) {
+            return answer;
+        }
+        return new Promise((resolve, reject) => {
+            let undo = () => {};
+            answer.then(value => (undo(), resolve(value)), error => (undo(), reject(error)));
+            undo = onCancelled(cancellable, () => {
+                undo = () => {};
+                if (--request.askers === 0) {
+                    request.cancellable.cancel();
+                }
+                reject(new Cancelled());
+            });
+        });
+    }
+
+    private async _turn<T extends Verdict | Verdict[]>(
+        limit: number, work: () => Promise<T>, cancellable: Gio.Cancellable,
+    ): Promise<T> {
+        const queued = GLib.get_monotonic_time();
+        let queuedBehind = 0;
+        if (this._active >= Math.max(1, limit)) {
+            queuedBehind = this._active + this._waiting.length;
+            // The slot is handed over by whoever finishes, so it is never
+            // free for an instant in which a newcomer could jump the queue.
+            // Cancelled while waiting, it leaves the queue without one.
+            await new Promise<void>((resolve, reject) => {
+                let undo = () => {};
+                const wake = () => (undo(), resolve());
+                this._waiting.push(wake);
+                this._peakWaiting = Math.max(this._peakWaiting, this._waiting.length);
+                undo = onCancelled(cancellable, () => {
+                    this._waiting.splice(this._waiting.indexOf(wake), 1);
+                    reject(new Cancelled());
+                });
+            });
+        } else {
+            this._active++;
+        }
+        const queuedMs = Math.round((GLib.get_monotonic_time() - queued) / 1000);
+        try {
+            return stamp(await work(), { queuedMs, queuedBehind });
+        } finally {
+            const next = this._waiting.shift();
+            if (next) {
+                next();
+            } else {
+                this._active--;
+            }
+        }
+    }
+
+    private async _ask(
+        prompt: string, image: EncodedImage, settings: LlmSettings, outer: Gio.Cancellable,
+    ): Promise<Verdict> {
+        const { answer, ...timing } = await this._send(buildInstruction(prompt), image, settings, outer, MAX_TOKENS, {
+            whole: verdictOf,
+            early: stream => stream.early(),
+        });
+        return { ...answer, ...timing };
+    }
+
+    private async _askMany(
+        prompts: string[], image: EncodedImage, settings: LlmSettings, outer: Gio.Cancellable,
+    ): Promise<Verdict[]> {
+        const maxTokens = MAX_TOKENS + TOKENS_PER_QUESTION * (prompts.length - 1);
+        const { answer, ...timing } = await this._send(buildInstruction(prompts), image, settings, outer, maxTokens, {
+            whole: completion => verdictsOf(completion, prompts.length),
+            // Every answer is needed, so there is nothing to stop early for.
+            early: () => null,
+        });
+        // When the first of the verdicts came says nothing about the others.
+        return answer.map(verdict => ({ ...verdict, ...timing, verdictMs: undefined, askedWith: prompts.length }));
+    }
+
+    /** Send the instruction and the picture, and read the answer `reading` looks for. */
+    private async _send<T>(
+        instruction: string, image: EncodedImage, settings: LlmSettings, outer: Gio.Cancellable,
+        maxTokens: number, reading: Reading<T>,
+    ): Promise<Timed<T>> {
+        if (this._closed) {
+            throw new LlmError('the model client was shut down');
+        }
         if (!settings.endpoint) {
             throw new LlmError('no LLM endpoint configured');
         }
@@ -256,12 +914,12 @@ export class LlmClient {
         const body: Record<string, unknown> = {
             model: settings.model,
             temperature: 0,
-            max_tokens: MAX_TOKENS,
+            max_tokens: maxTokens,
             messages: [
                 {
                     role: 'user',
                     content: [
-                        { type: 'text', text: buildInstruction(prompt) },
+                        { type: 'text', text: instruction },
                         { type: 'image_url', image_url: { url: image.dataUri } },
                     ],
                 },
@@ -283,6 +941,12 @@ export class LlmClient {
             body.chat_template_kwargs = { enable_thinking: false };
         }
 
+        // Streamed, the verdict can be read from the first few tokens and the
+        // request dropped there, instead of waiting out the reason.
+        if (this._stream) {
+            body.stream = true;
+        }
+
         const message = Soup.Message.new('POST', settings.endpoint);
         if (!message) {
             throw new LlmError(`invalid endpoint URL: ${settings.endpoint}`);
@@ -294,6 +958,7 @@ export class LlmClient {
         message.set_request_body_from_bytes('application/json', new GLib.Bytes(payload));
 
         const cancellable = new Gio.Cancellable();
+        const unlink = onCancelled(outer, () => cancellable.cancel());
         let timeoutId = 0;
         let timedOut = false;
         if (settings.timeoutMs > 0) {
@@ -306,85 +971,82 @@ export class LlmClient {
         }
 
         const started = GLib.get_monotonic_time();
+        const elapsed = () => Math.round((GLib.get_monotonic_time() - started) / 1000);
         try {
             const session = this._session as Soup.Session & AsyncSoupSession;
-            const bytes = await session.send_and_read_async(message, GLib.PRIORITY_DEFAULT, cancellable);
-            const latencyMs = Math.round((GLib.get_monotonic_time() - started) / 1000);
-
+            const input = await session.send_async(message, GLib.PRIORITY_DEFAULT, cancellable) as
+                Gio.InputStream & AsyncInputStream;
             const status = message.get_status();
-            const text = new TextDecoder().decode(bytes.get_data() ?? new Uint8Array(0));
-
-            if (status !== Soup.Status.OK) {
-                // A rejected request may be about either extra field, and there
-                // is no telling which from the status alone. Give up the one we
-                // can most afford to lose first, and try again.
-                if (status === 400 && this._noThinking) {
-                    log('macroclickwerk: endpoint rejected chat_template_kwargs, retrying without it');
-                    this._noThinking = false;
-                    return this.ask(prompt, image, settings);
-                }
-                if (status === 400 && this._jsonMode) {
-                    log('macroclickwerk: endpoint rejected response_format, retrying without JSON mode');
-                    this._jsonMode = false;
-                    return this.ask(prompt, image, settings);
+            const type = message.response_headers.get_one('Content-Type') ?? '';
+
+            if (status !== Soup.Status.OK || !type.includes('text/event-stream')) {
+                const text = await readAll(input, cancellable);
+                const latencyMs = elapsed();
+                if (status !== Soup.Status.OK) {
+                    // A rejected request may be about any of the extra fields.
+                    // The error usually names the one; when it does not, give
+                    // up the one we can most afford to lose first, and
+                    // streaming — what makes a verdict arrive early — last.
+                    const optional = [
+                        { field: 'chat_template_kwargs', on: this._noThinking, off: () => { this._noThinking = false; } },
+                        { field: 'response_format', on: this._jsonMode, off: () => { this._jsonMode = false; } },
+                        { field: 'stream', on: this._stream, off: () => { this._stream = false; } },
+                    ].filter(option => option.on);
+                    const culprit = optional.find(option => text.includes(option.field)) ?? optional[0];
+                    if (status === 400 && culprit) {
+                        log(`macroclickwerk: endpoint rejected ${culprit.field}, retrying without it`);
+                        culprit.off();
+                        return this._send(instruction, image, settings, outer, maxTokens, reading);
+                    }
+                    throw new LlmError(`HTTP ${status}: ${text.slice(0, 200)}`);
                 }
-                throw new LlmError(`HTTP ${status}: ${text.slice(0, 200)}`);
+                // Asked to stream and answered in one piece all the same.
+                return { answer: reading.whole(readCompletion(text)), latencyMs };
             }
 
-            let content = '';
-            let reasoning = '';
-            let finish = '';
+            const stream = new VerdictStream();
+            const decoder = new TextDecoder();
+            let verdictMs: number | undefined;
+            let firstTokenMs: number | undefined;
             try {
-                const json = JSON.parse(text) as {
-                    choices?: {
-                        finish_reason?: string;
-                        message?: { content?: unknown; reasoning_content?: unknown };
-                    }[];
-                    error?: { message?: string };
-                };
-                if (json.error?.message) {
-                    throw new LlmError(json.error.message);
-                }
-                const choice = json.choices?.[0];
-                finish = choice?.finish_reason ?? '';
-                const raw = choice?.message?.content;
-                if (typeof raw === 'string') {
-                    content = raw;
-                } else if (Array.isArray(raw)) {
-                    // Some servers answer with the content-part array form.
-                    content = raw
-                        .map(part => (typeof part === 'string' ? part : (part as { text?: string })?.text ?? ''))
-                        .join(' ');
-                }
-                if (typeof choice?.message?.reasoning_content === 'string') {
-                    reasoning = choice.message.reasoning_content;
-                }
-            } catch (error) {
-                if (error instanceof LlmError) {
-                    throw error;
+                for (;;) {
+                    const chunk = await input.read_bytes_async(READ_CHUNK, GLib.PRIORITY_DEFAULT, cancellable);
+                    if (chunk.get_size() === 0) {
+                        break;
+                    }
+                    stream.feed(decoder.decode(chunk.get_data() ?? new Uint8Array(0), { stream: true }));
+                    if (firstTokenMs === undefined && (stream.content !== '' || stream.reasoning !== '')) {
+                        firstTokenMs = elapsed();
+                    }
+                    if (verdictMs === undefined && stream.match() !== null) {
+                        verdictMs = elapsed();
+                    }
+                    const early = reading.early(stream);
+                    if (early) {
+                        // Cancelled, not just closed: closing reads out the
+                        // rest of the body, so the verdict would wait for the
+                        // whole reason and the server would go on writing it.
+                        // Cancelling drops the connection, which stops both.
+                        cancellable.cancel();
+                        return { answer: early, latencyMs: elapsed(), verdictMs, firstTokenMs };
+                    }
+                    if (stream.done) {
+                        break;
+                    }
                 }
-                throw new LlmError(`could not parse the response: ${text.slice(0, 200)}`);
-            }
-
-            // A reasoning model that would not be talked out of thinking
-            // sometimes finishes the job inside its thoughts. Only a written-out
-            // JSON object counts there: half a thought is full of the words true
-            // and no, and reading a verdict out of one would be worse than
-            // saying we could not find it.
-            const parsed = parseVerdict(content) ?? verdictFromObjects(reasoning);
-            if (!parsed) {
-                // Naming the empty case separately: an error that ends in a
-                // colon and then nothing reads like the message itself broke.
-                if (content.trim() === '') {
-                    throw new LlmError(reasoning.trim() !== '' || finish === 'length'
-                        ? 'the model spent its whole answer thinking and never got to the verdict'
-                        : 'the model returned an empty answer');
+            } finally {
+                if (cancellable.is_cancelled()) {
+                    // Nothing left to read, and nothing to wait for.
+                    input.close_async(GLib.PRIORITY_DEFAULT, null).catch(() => false);
+                } else {
+                    await input.close_async(GLib.PRIORITY_DEFAULT, null).catch(() => false);
                 }
-                throw new LlmError(`could not read a yes/no answer from: ${content.slice(0, 200)}`);
             }
-
-            return { match: parsed.match, reason: parsed.reason, latencyMs };
+            return { answer: reading.whole(stream.completion()), latencyMs: elapsed(), verdictMs, firstTokenMs };
         } catch (error) {
+            if (outer.is_cancelled()) {
+                throw new Cancelled();
+            }
             if (timedOut) {
                 throw new LlmError(`timed out after ${settings.timeoutMs}ms`);
             }
@@ -393,9 +1055,95 @@ export class LlmClient {
             }
             throw new LlmError((error as Error).message ?? String(error));
         } finally {
+            unlink();
             if (timeoutId) {
                 GLib.source_remove(timeoutId);
             }
         }
     }
 }
+
+// --- remembered answers ----------------------------------------------------
+
+/** Bits that differ between two perceptual hashes. */
+export function hammingDistance(a: PerceptualHash, b: PerceptualHash): number {
+    let distance = 0;
+    for (let i = 0; i < Math.min(a.length, b.length); i++) {
+        let v = (a[i] ^ b[i]) >>> 0;
+        v -= (v >>> 1) & 0x55555555;
+        v = (v & 0x33333333) + ((v >>> 2) & 0x33333333);
+        distance += (((v + (v >>> 4)) & 0x0f0f0f0f) * 0x01010101) >>> 24;
+    }
+    return distance;
+}
+
+export interface RememberedVerdict {
+    verdict: Verdict;
+    ageMs: number;
+    /** How far the picture asked about now is from the one that was answered. */
+    distance: number;
+}
+
+/**
+ * Answers the model gave, by question and by the picture. A question asked
+ * again, no longer ago than `ttlMs`, of the very picture already answered —
+ * the same checksum — gets the same answer without asking: the shipped macro
+ * asks the same thing every ten seconds of a screen that is mostly the same,
+ * and each ask is seconds of GPU. With a tolerance, a picture within
+ * `maxDistance` bits of perceptual hash counts as the same too.
+ */
+export class VerdictCache {
+    static readonly MAX_ENTRIES = 64;
+    private _entries: {
+        key: string; hash: PerceptualHash | null; checksum: string; verdict: Verdict; at: number;
+    }[] = [];
+
+    /** The nearest answer that still counts, or null. */
+    lookup(key: string, hash: PerceptualHash, maxDistance: number, ttlMs: number): RememberedVerdict | null {
+        if (ttlMs <= 0) {
+            return null;
+        }
+        const now = GLib.get_monotonic_time();
+        this._entries = this._entries.filter(entry => now - entry.at <= ttlMs * 1000);
+
+        let best: RememberedVerdict | null = null;
+        for (const entry of this._entries) {
+            if (entry.key !== key || !entry.hash) {
+                continue;
+            }
+            const distance = hammingDistance(entry.hash, hash);
+            if (distance <= maxDistance && (!best || distance < best.distance)) {
+                best = { verdict: entry.verdict, ageMs: Math.round((now - entry.at) / 1000), distance };
+            }
+        }
+        return best;
+    }
+
+    /** The answer to this question about exactly this picture, or null. */
+    recall(key: string, checksum: string, ttlMs: number): RememberedVerdict | null {
+        if (ttlMs <= 0 || !checksum) {
+            return null;
+        }
+        const now = GLib.get_monotonic_time();
+        this._entries = this._entries.filter(entry => now - entry.at <= ttlMs * 1000);
+        const entry = this._entries.find(other => other.key === key && other.checksum === checksum);
+        return entry ? { verdict: entry.verdict, ageMs: Math.round((now - entry.at) / 1000), distance: 0 } : null;
+    }
+
+    /** `hash` is null when only the exact picture is to count; `checksum` is the encoded picture's. */
+    store(key: string, hash: PerceptualHash | null, verdict: Verdict, checksum = ''): void {
+        // One answer per picture: the fresher replaces the older.
+        const samePicture = (entry: { hash: PerceptualHash | null; checksum: string }) =>
+            (checksum !== '' && entry.checksum === checksum) ||
+            (hash !== null && entry.hash !== null && hammingDistance(entry.hash, hash) === 0);
+        this._entries = this._entries.filter(entry => entry.key !== key || !samePicture(entry));
+        this._entries.push({ key, hash, checksum, verdict, at: GLib.get_monotonic_time() });
+        if (this._entries.length > VerdictCache.MAX_ENTRIES) {
+            this._entries.shift();
+        }
+    }
+
+    clear(): void {
+        this._entries = [];
+    }
+}
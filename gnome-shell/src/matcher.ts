@@ -0,0 +1,199 @@
+// Finding a picked picture on the screen: the search behind image checks.
+//
+// A patch of 64×64 looked for across 1920×1080 is two million positions, and
+// whatever the shell does it does on the thread that paints. The search goes
+// to macroclickwerk-match, a small C helper installed beside the daemon
+// (match.c), where SIMD does it in a few milliseconds. The pixels do not go
+// down its pipe: both pictures are written to a file in the runtime directory,
+// which is tmpfs, and the helper has that file mapped. One line goes down the
+// pipe saying where in it each picture is, and one comes back with the best
+// spot. There is no search in the shell to fall back to — at a hundred times
+// the cost, a check that polls would take the desktop down with it — so
+// without the helper an image check fails, and says how to install it.
+
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+
+import { type AsyncDataInputStream, type AsyncOutputStream, ensurePromisified } from './pipes.js';
+import { pixbufFromBase64, type Pixels, pixelsOf } from './screenshot.js';
+import { tracer } from './tracer.js';
+
+/** The best spot, in the frame's pixels. */
+export interface MatchResult {
+    /** 0..1: 1 is the picture exactly, under about 0.8 is something else. */
+    score: number;
+    /** The top left corner of where the picture is. */
+    x: number;
+    y: number;
+    /** How long the search took in the helper. */
+    micros: number;
+}
+
+/** A search that could not be done, with what to do about it. */
+export class MatcherError extends Error {
+    hint: string;
+
+    constructor(message: string, hint: string) {
+        super(message);
+        this.hint = hint;
+    }
+}
+
+const HELPER = 'macroclickwerk-match';
+/** Where `make install` puts it, for a shell whose PATH does not have that. */
+const INSTALLED = `/usr/local/bin/${HELPER}`;
+/** Pictures kept decoded: a check in a loop should not decode its PNG on every pass. */
+const MAX_PATCHES = 16;
+/** Where the patch starts after the frame; aligned, for the helper's loads. */
+const ALIGN = 64;
+/** The helper's answer to a patch larger than the area: its EINVAL, as it words it. */
+const TOO_SMALL = 'the patch is larger than the area searched';
+
+interface Helper {
+    process: Gio.Subprocess;
+    stdin: Gio.OutputStream & AsyncOutputStream;
+    stdout: Gio.DataInputStream & AsyncDataInputStream;
+    /** The shared file, open for writing; the helper has it mapped. */
+    shared: Gio.FileIOStream;
+    path: string;
+}
+
+/**
+ * The helper, started on the first search and kept for the next. Searches go
+ * one at a time — there is one shared file — which at a few milliseconds each
+ * is no queue worth the name. A helper that dies is started again on the next.
+ */
+export class ImageMatcher {
+    private _helper: Helper | null = null;
+    private _patches = new Map<string, Pixels>();
+    /** Tail of the searches: one is written and answered before the next is written. */
+    private _queue: Promise<unknown> = Promise.resolve();
+    private _closed = false;
+
+    constructor() {
+        ensurePromisified();
+    }
+
+    destroy(): void {
+        this._closed = true;
+        this._stop();
+        this._patches.clear();
+    }
+
+    /** Where `png` — an image check's picture — best matches in `frame`. */
+    find(frame: Pixels, png: string): Promise<MatchResult> {
+        const search = this._queue.then(() => tracer.wrap(this._find(frame, this._patch(png)),
+            `search ${frame.width}×${frame.height}`, 'image searches'));
+        this._queue = search.catch(() => undefined);
+        return search;
+    }
+
+    private _patch(png: string): Pixels {
+        let patch = this._patches.get(png);
+        if (!patch) {
+            patch = pixelsOf(pixbufFromBase64(png));
+            if (this._patches.size >= MAX_PATCHES) {
+                this._patches.delete(this._patches.keys().next().value!);
+            }
+            this._patches.set(png, patch);
+        }
+        return patch;
+    }
+
+    private async _find(frame: Pixels, patch: Pixels): Promise<MatchResult> {
+        if (this._closed) {
+            throw new Error('the image matcher was shut down');
+        }
+        const helper = this._helper ?? this._start();
+        const patchAt = Math.ceil(frame.data.length / ALIGN) * ALIGN;
+        const layout = (pixels: Pixels, at: number) =>
+            `${at} ${pixels.width} ${pixels.height} ${pixels.rowstride} ${pixels.channels}`;
+        try {
+            // In place: the file only ever grows, and the helper maps it
+            // again when it has.
+            helper.shared.seek(0, GLib.SeekType.SET, null);
+            const out = helper.shared.get_output_stream() as Gio.OutputStream & AsyncOutputStream;
+            await out.write_all_async(frame.data, GLib.PRIORITY_DEFAULT, null);
+            helper.shared.seek(patchAt, GLib.SeekType.SET, null);
+            await out.write_all_async(patch.data, GLib.PRIORITY_DEFAULT, null);
+            out.flush(null);
+
+            const request = `${layout(frame, 0)} ${layout(patch, patchAt)}\n`;
+            await helper.stdin.write_all_async(new TextEncoder().encode(request), GLib.PRIORITY_DEFAULT, null);
+            const [line] = await helper.stdout.read_line_async(GLib.PRIORITY_DEFAULT, null);
+            if (line === null) {
+                throw new Error(`${HELPER} exited`);
+            }
+            const reply = new TextDecoder().decode(line).trim();
+            if (reply === `error ${TOO_SMALL}`) {
+                // The helper is fine; the request was not, and the one way a
+                // document can make it so is an area smaller than the picture.
+                throw new MatcherError(TOO_SMALL,
+                    'The search area has to be at least the size of the picture: widen it, or pick a smaller one.');
+            }
+            if (reply.startsWith('error ')) {
+                // Anything else — the file it could not map, a layout it could
+                // not read — is the helper or its file gone wrong: a fresh one.
+                throw new Error(`${HELPER}: ${reply.slice('error '.length)}`);
+            }
+            const [score, x, y, micros] = reply.split(' ').map(Number);
+            if ([score, x, y, micros].some(value => !Number.isFinite(value))) {
+                throw new Error(`${HELPER} said “${reply}”`);
+            }
+            return { score, x, y, micros };
+        } catch (error) {
+            if (!(error instanceof MatcherError)) {
+                this._stop();
+            }
+            throw error;
+        }
+    }
+
+    private _start(): Helper {
+        const program = GLib.find_program_in_path(HELPER) ??
+            (GLib.file_test(INSTALLED, GLib.FileTest.IS_EXECUTABLE) ? INSTALLED : null);
+        if (!program) {
+            throw new MatcherError(`${HELPER} is not installed`,
+                'It is built and installed with the daemon: make && sudo make install, in the repository.');
+        }
+        const path = GLib.build_filenamev([GLib.get_user_runtime_dir(), `macroclickwerk-match-${Date.now()}`]);
+        const file = Gio.File.new_for_path(path);
+        const shared = file.replace_readwrite(null, false, Gio.FileCreateFlags.PRIVATE, null);
+        let process: Gio.Subprocess;
+        try {
+            process = Gio.Subprocess.new([program, path],
+                Gio.SubprocessFlags.STDIN_PIPE | Gio.SubprocessFlags.STDOUT_PIPE);
+        } catch (error) {
+            shared.close(null);
+            file.delete(null);
+            throw new MatcherError(`could not start ${HELPER}: ${(error as Error).message}`,
+                'Check that it runs from a terminal; make && sudo make install puts a fresh one in place.');
+        }
+        this._helper = {
+            process,
+            stdin: process.get_stdin_pipe() as Gio.OutputStream & AsyncOutputStream,
+            stdout: new Gio.DataInputStream({
+                base_stream: process.get_stdout_pipe()!,
+            }) as Gio.DataInputStream & AsyncDataInputStream,
+            shared,
+            path,
+        };
+        return this._helper;
+    }
+
+    /** Let the next search start a fresh helper, with a fresh file. */
+    private _stop(): void {
+        const helper = this._helper;
+        if (!helper) {
+            return;
+        }
+        this._helper = null;
+        helper.process.force_exit();
+        try {
+            helper.shared.close(null);
+            Gio.File.new_for_path(helper.path).delete(null);
+        } catch {
+            // Gone already; the runtime directory is cleared at logout anyway.
+        }
+    }
+}
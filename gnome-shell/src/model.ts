@@ -27,6 +27,12 @@ export interface LlmCondition {
     region?: Region | null;
     /** Flash a green outline over the checked area whenever this check runs. */
     flash?: boolean;
+    /**
+     * Share of the area, 0..1, that has to change after an answer before the
+     * model is asked again; until then that answer stands. Absent or 0 asks
+     * every time.
+     */
+    minChange?: number;
 }
 
 /**
@@ -45,6 +51,23 @@ export interface ColorCondition {
     coverage: number;
 }
 
+/**
+ * A picture picked off the screen, looked for in an area of it. The search
+ * runs in macroclickwerk-match, beside the daemon; where the picture was found
+ * is what a click or move aimed at 'found' goes to.
+ */
+export interface ImageCondition {
+    type: 'image';
+    /** The picture, a PNG in base64, at the screen's own pixels. */
+    png: string;
+    w: number;
+    h: number;
+    /** null/undefined means "the whole screen". */
+    region?: Region | null;
+    /** How alike the best spot must be, 0..1; see match.h for the scale. */
+    threshold: number;
+}
+
 export interface AndCondition {
     type: 'and';
     of: Condition[];
@@ -64,6 +87,7 @@ export type Condition =
     | AlwaysCondition
     | LlmCondition
     | ColorCondition
+    | ImageCondition
     | AndCondition
     | OrCondition
     | NotCondition;
@@ -96,11 +120,12 @@ export type ClickStep = StepCommon & {
     kind: 'click';
     button: MouseButton;
     /**
-     * 'abs' moves to x/y first, 'current' clicks wherever the pointer is, and
+     * 'abs' moves to x/y first, 'current' clicks wherever the pointer is,
      * 'prev' moves back to where the pointer was before the last positioned
-     * step — the excursion undone before clicking.
+     * step — the excursion undone before clicking — and 'found' goes to the
+     * middle of what the last image check that matched found.
      */
-    mode: 'abs' | 'current' | 'prev';
+    mode: 'abs' | 'current' | 'prev' | 'found';
     x?: number;
     y?: number;
     holdMs?: number;
@@ -111,9 +136,10 @@ export type MoveStep = StepCommon & {
     /**
      * 'prev' is the same return move a 'prev' click makes, without the click.
      * 'store' does not move at all: it remembers where the pointer is now, and
-     * that spot is what 'prev' means for the rest of the run.
+     * that spot is what 'prev' means for the rest of the run. 'found' is the
+     * same move a 'found' click makes.
      */
-    mode: 'abs' | 'rel' | 'prev' | 'store';
+    mode: 'abs' | 'rel' | 'prev' | 'store' | 'found';
     x?: number;
     y?: number;
     dx?: number;
@@ -134,6 +160,12 @@ export type KeyStep = StepCommon & {
     /** Modifier key names held around the key, e.g. ['KEY_LEFTCTRL']. */
     mods?: string[];
     holdMs?: number;
+    /**
+     * Autorepeat while the key is down, every this many milliseconds, the way
+     * a held key types the same letter again: from 250 ms in, so a shorter
+     * tap does not repeat. Absent or 0 for none.
+     */
+    repeatMs?: number;
 };
 
 export type TextStep = StepCommon & {
@@ -149,6 +181,17 @@ export type WaitStep = StepCommon & {
     jitterMs?: number;
 };
 
+/**
+ * Real input captured to a file by the daemon, played back at the pace it was
+ * recorded. The file stays with the daemon — only its name is in the macro —
+ * so a session of any length costs the document nothing.
+ */
+export type ReplayStep = StepCommon & {
+    kind: 'replay';
+    /** Capture name, a file in the daemon's /var/lib/macroclickwerk. */
+    capture: string;
+};
+
 /**
  * A loop, and nothing else. It has no condition of its own: `loop while C` is
  * exactly `loop forever: [if not C: break, …]`, and expressing it that way keeps
@@ -168,6 +211,24 @@ export type IfStep = StepCommon & {
     else?: Step[];
 };
 
+/**
+ * Waiting for the screen to show something, instead of a loop that looks and
+ * sleeps: the check is asked again only once something was drawn where it
+ * looks, so it answers within a frame of the change and costs nothing while
+ * the screen stands still. `minIntervalMs` keeps a screen that never stops —
+ * a video beside the button — from turning that into a check per frame.
+ */
+export type UntilStep = StepCommon & {
+    kind: 'until';
+    cond: Condition;
+    /** How long to wait before giving up; 0 waits for as long as it takes. */
+    timeoutMs: number;
+    /** The least time between two checks, however busy the screen is. */
+    minIntervalMs: number;
+    /** Runs when it gave up; either way the run goes on after the step. */
+    timeout: Step[];
+};
+
 export type FlowStep = StepCommon & {
     kind: 'break' | 'continue';
 };
@@ -200,8 +261,10 @@ export type Step =
     | KeyStep
     | TextStep
     | WaitStep
+    | ReplayStep
     | LoopStep
     | IfStep
+    | UntilStep
     | FlowStep
     | MacroStep;
 
@@ -261,6 +324,9 @@ export function newCondition(type: ConditionType): Condition {
                 x: 0, y: 0, w: 1, h: 1,
                 color: '#22aa33', tolerance: 24, coverage: 1,
             };
+        case 'image':
+            // Nothing to look for until a picture is picked.
+            return { type: 'image', png: '', w: 0, h: 0, region: null, threshold: 0.9 };
         case 'and':
             return { type: 'and', of: [] };
         case 'or':
@@ -288,10 +354,14 @@ export function newStep(kind: StepKind): Step {
             return { id, kind: 'text', value: '', delayMs: 12 };
         case 'wait':
             return { id, kind: 'wait', ms: 1000, jitterMs: 0 };
+        case 'replay':
+            return { id, kind: 'replay', capture: '' };
         case 'loop':
             return { id, kind: 'loop', count: 'forever', body: [] };
         case 'if':
             return { id, kind: 'if', cond: newCondition('color'), then: [], else: [] };
+        case 'until':
+            return { id, kind: 'until', cond: newCondition('color'), timeoutMs: 30000, minIntervalMs: 100, timeout: [] };
         case 'break':
         case 'continue':
             return { id, kind };
@@ -320,6 +390,8 @@ export function childLists(step: Step): { key: string; steps: Step[] }[] {
                 { key: 'else', steps: step.else },
                 { key: 'then', steps: step.then },
             ];
+        case 'until':
+            return [{ key: 'timeout', steps: step.timeout }];
         default:
             return [];
     }
@@ -380,6 +452,30 @@ export function findStep(list: Step[], id: string): StepLocation | null {
     return found;
 }
 
+/** Whether the condition, or any inside it, is a model check. */
+export function conditionAsksModel(cond: Condition): boolean {
+    switch (cond.type) {
+        case 'llm':
+            return true;
+        case 'and':
+        case 'or':
+            return cond.of.some(conditionAsksModel);
+        case 'not':
+            return conditionAsksModel(cond.of);
+        default:
+            return false;
+    }
+}
+
+/** Whether any check in `list` asks the model — what decides keeping it warm. */
+export function asksModel(list: Step[]): boolean {
+    let found = false;
+    walk(list, ({ step }) => {
+        found ||= (step.kind === 'if' || step.kind === 'until') && conditionAsksModel(step.cond);
+    });
+    return found;
+}
+
 /** Where a recording lands: a list, and the index to put the first step at. */
 export interface RecordTarget {
     list: Step[];
@@ -574,10 +670,11 @@ export function lastPointerEndpoint(steps: Step[]): { x: number; y: number } | n
         }
         if (step.mode === 'abs' && typeof step.x === 'number' && typeof step.y === 'number') {
             endpoint = { x: step.x, y: step.y };
-        } else if (step.mode === 'prev') {
+        } else if (step.mode === 'prev' || step.mode === 'found') {
             // "@ previous" moves somewhere no document can name — away from
-            // the last absolute target by definition — so past it there is no
-            // endpoint to claim until another absolute step sets one.
+            // the last absolute target by definition — and "@ found" wherever
+            // the screen says, so past either there is no endpoint to claim
+            // until another absolute step sets one.
             endpoint = null;
         }
     });
@@ -619,6 +716,9 @@ function containsLoopExit(steps: Step[]): boolean {
                 return true;
             }
         }
+        if (step.kind === 'until' && containsLoopExit(step.timeout)) {
+            return true;
+        }
     }
     return false;
 }
@@ -640,6 +740,156 @@ export function reachesEnd(steps: Step[]): boolean {
     return true;
 }
 
+/**
+ * The input a step plays through: the daemon's pointer clone or its keyboard
+ * clone. Two steps only have to wait for each other when they share one, so a
+ * macro typing keeps going while another walks the pointer to a click.
+ */
+export type InputResource = 'pointer' | 'keyboard';
+
+export const ALL_INPUT: InputResource[] = ['pointer', 'keyboard'];
+
+/**
+ * What a step plays through, declared by kind. Empty for steps that play
+ * nothing — waits, conditions, flow — and everything for a replay, which can
+ * hold any input at all. A move that only stores the pointer touches nothing.
+ */
+export function stepResources(step: Step): InputResource[] {
+    switch (step.kind) {
+        case 'click':
+        case 'scroll':
+            return ['pointer'];
+        case 'move':
+            return step.mode === 'store' ? [] : ['pointer'];
+        case 'key':
+        case 'text':
+            return ['keyboard'];
+        case 'replay':
+            return ALL_INPUT;
+        default:
+            return [];
+    }
+}
+
+// --- compilation -----------------------------------------------------------
+
+/**
+ * One instruction of a compiled macro. Every step of the tree is one entry —
+ * `index` points at it — and loops, ifs and waits until add the jumps between
+ * their bodies.
+ * `parents` is the chain of loops and ifs the step sits in, outermost first,
+ * shared by every instruction of the same list: it is what the runner shows
+ * as the path, and how it tells that two steps are siblings.
+ */
+export type Instr =
+    /** A primitive, or a start or stop: executed as it is. */
+    | { op: 'step'; step: Step; parents: Step[] }
+    /** Entering a loop: resets its count, or skips it when the body is empty. */
+    | { op: 'loop'; step: LoopStep; parents: Step[]; slot: number; exit: number }
+    /** The top of each pass: out to `exit` once the count has been run. */
+    | { op: 'test'; step: LoopStep; slot: number; exit: number }
+    /** The end of each pass: back to the test, via the main loop. */
+    | { op: 'next'; to: number }
+    /** An if: on to the then branch, or to `else` when the condition says no. */
+    | { op: 'if'; step: IfStep; parents: Step[]; else: number }
+    /** A wait until: on to `done` once the condition holds, into the timeout branch if it never does. */
+    | { op: 'until'; step: UntilStep; parents: Step[]; done: number }
+    /** A break or continue, its target resolved: the enclosing loop's exit or next. */
+    | { op: 'flow'; step: FlowStep; parents: Step[]; to: number }
+    | { op: 'jump'; to: number };
+
+/** The instructions that stand for a step, the ones a run can start at. */
+export type StepInstr = Extract<Instr, { step: Step; parents: Step[] }>;
+
+export interface Program {
+    code: Instr[];
+    /** Step id to the instruction for that step. */
+    index: Map<string, number>;
+    /** How many loops there are: each has a counter slot of its own. */
+    loops: number;
+}
+
+/**
+ * Lower a step tree into a flat program, for the runner to execute with a
+ * program counter instead of recursing through the tree. Starting part-way in
+ * is then a lookup in `index`, and a break or continue a jump that was worked
+ * out here rather than a signal passed up through every list in between.
+ *
+ * A break or continue that is in no loop at all ends the run, as it always
+ * has. Compiled fresh for each run, so an edit can never leave a stale program
+ * behind.
+ */
+export function compileSteps(body: Step[]): Program {
+    const code: Instr[] = [];
+    const index = new Map<string, number>();
+    let loops = 0;
+    // Break and continue instructions waiting for their loop's targets, and
+    // the ones outside any loop, waiting for the end of the program.
+    type Pending = { breaks: { to: number }[]; continues: { to: number }[] };
+    const ends: { to: number }[] = [];
+
+    const emit = (list: Step[], parents: Step[], loop: Pending | null): void => {
+        for (const step of list) {
+            index.set(step.id, code.length);
+            switch (step.kind) {
+                case 'loop': {
+                    const slot = loops++;
+                    const entry = { op: 'loop' as const, step, parents, slot, exit: -1 };
+                    code.push(entry);
+                    const test = { op: 'test' as const, step, slot, exit: -1 };
+                    const top = code.length;
+                    code.push(test);
+                    const pending: Pending = { breaks: [], continues: [] };
+                    emit(step.body, [...parents, step], pending);
+                    const next = code.length;
+                    code.push({ op: 'next', to: top });
+                    entry.exit = test.exit = code.length;
+                    pending.breaks.forEach(instr => { instr.to = code.length; });
+                    pending.continues.forEach(instr => { instr.to = next; });
+                    break;
+                }
+                case 'if': {
+                    const entry = { op: 'if' as const, step, parents, else: -1 };
+                    code.push(entry);
+                    const inner = [...parents, step];
+                    emit(step.then, inner, loop);
+                    const otherwise = step.else ?? [];
+                    if (otherwise.length > 0) {
+                        const skip = { op: 'jump' as const, to: -1 };
+                        code.push(skip);
+                        entry.else = code.length;
+                        emit(otherwise, inner, loop);
+                        skip.to = code.length;
+                    } else {
+                        entry.else = code.length;
+                    }
+                    break;
+                }
+                case 'until': {
+                    const entry = { op: 'until' as const, step, parents, done: -1 };
+                    code.push(entry);
+                    emit(step.timeout, [...parents, step], loop);
+                    entry.done = code.length;
+                    break;
+                }
+                case 'break':
+                case 'continue': {
+                    const flow = { op: 'flow' as const, step, parents, to: -1 };
+                    code.push(flow);
+                    (loop ? (step.kind === 'break' ? loop.breaks : loop.continues) : ends).push(flow);
+                    break;
+                }
+                default:
+                    code.push({ op: 'step', step, parents });
+            }
+        }
+    };
+
+    emit(body, [], null);
+    ends.forEach(instr => { instr.to = code.length; });
+    return { code, index, loops };
+}
+
 // --- serialisation ---------------------------------------------------------
 
 /** `not` that avoids stacking double negations when migrating. */
@@ -957,6 +1207,9 @@ export function describeCondition(cond: Condition | null | undefined): string {
             return 'always';
         case 'llm':
             return `LLM: "${truncate(cond.prompt)}"`;
+        case 'image':
+            return `image ${cond.w}×${cond.h}${cond.region ? ` in ${cond.region.w}×${cond.region.h} @ ${cond.region.x},${cond.region.y}` : ''}` +
+                ` ≥ ${Math.round(cond.threshold * 100)}%`;
         case 'color':
             return cond.w * cond.h === 1
                 ? `pixel ${cond.x},${cond.y} ≈ ${cond.color}`
@@ -998,10 +1251,12 @@ export function describeStep(
         case 'click':
             return step.mode === 'abs' ? `Click ${step.button} @ ${step.x ?? 0},${step.y ?? 0}`
                 : step.mode === 'prev' ? `Click ${step.button} @ previous`
+                : step.mode === 'found' ? `Click ${step.button} @ found`
                 : `Click ${step.button} at pointer`;
         case 'move':
             return step.mode === 'abs' ? `Move to ${step.x ?? 0},${step.y ?? 0}`
                 : step.mode === 'prev' ? 'Move to previous'
+                : step.mode === 'found' ? 'Move to found'
                 : step.mode === 'store' ? 'Store pointer position'
                 : `Move by ${step.dx ?? 0},${step.dy ?? 0}`;
         case 'scroll':
@@ -1019,10 +1274,16 @@ export function describeStep(
             return step.jitterMs
                 ? `Wait ${formatMs(step.ms)} ±${formatMs(step.jitterMs)}`
                 : `Wait ${formatMs(step.ms)}`;
+        case 'replay':
+            return step.capture ? `Replay capture “${step.capture}”` : 'Replay a capture';
         case 'loop':
             return step.count === 'forever' ? 'Repeat forever' : `Repeat ${step.count}×`;
         case 'if':
             return `If ${describeCondition(step.cond)}`;
+        case 'until':
+            return step.timeoutMs > 0
+                ? `Wait until ${describeCondition(step.cond)}, at most ${formatMs(step.timeoutMs)}`
+                : `Wait until ${describeCondition(step.cond)}`;
         case 'break':
             return 'Break out of the loop';
         case 'continue':
@@ -1049,8 +1310,8 @@ export function describeStep(
  * recording is gone, is all of them.
  */
 export const AUTHORABLE_STEP_KINDS: StepKind[] = [
-    'click', 'move', 'scroll', 'key', 'text', 'wait',
-    'loop', 'if', 'break', 'continue', 'start', 'stop',
+    'click', 'move', 'scroll', 'key', 'text', 'wait', 'replay',
+    'until', 'loop', 'if', 'break', 'continue', 'start', 'stop',
 ];
 
 export const STEP_KIND_LABELS: Record<StepKind, string> = {
@@ -1060,8 +1321,10 @@ export const STEP_KIND_LABELS: Record<StepKind, string> = {
     key: 'Key press',
     text: 'Type text',
     wait: 'Wait',
+    replay: 'Replay a capture',
     loop: 'Loop',
     if: 'If / else',
+    until: 'Wait until',
     break: 'Break',
     continue: 'Continue',
     start: 'Start a macro',
@@ -1072,6 +1335,7 @@ export const CONDITION_TYPE_LABELS: Record<ConditionType, string> = {
     always: 'Always true',
     llm: 'Ask the LLM about a screenshot',
     color: 'Screen colour',
+    image: 'A picture on the screen',
     and: 'All of…',
     or: 'Any of…',
     not: 'Not…',
@@ -0,0 +1,40 @@
+// The async reads and writes the helper processes are driven through: the
+// encoder's and the matcher's, which both talk to a child over its stdin and
+// stdout. Only Gio, so encode-helper.ts, which loads the encoder outside the
+// shell, can load this too.
+
+import Gio from 'gi://Gio';
+
+let promisified = false;
+
+/** Make the methods below return promises; cheap after the first call. */
+export function ensurePromisified(): void {
+    if (promisified) {
+        return;
+    }
+    promisified = true;
+    const gio = Gio as unknown as {
+        _promisify: (proto: object, method: string, finish?: string) => void;
+    };
+    const pairs: [object, string, string][] = [
+        [Gio.OutputStream.prototype, 'write_all_async', 'write_all_finish'],
+        [Gio.DataInputStream.prototype, 'read_line_async', 'read_line_finish'],
+    ];
+    for (const [proto, method, finish] of pairs) {
+        try {
+            gio._promisify(proto, method, finish);
+        } catch {
+            // Already promisified by the shell or another extension.
+        }
+    }
+}
+
+export interface AsyncOutputStream {
+    write_all_async(
+        buffer: Uint8Array, priority: number, cancellable: Gio.Cancellable | null,
+    ): Promise<[boolean, number]>;
+}
+
+export interface AsyncDataInputStream {
+    read_line_async(priority: number, cancellable: Gio.Cancellable | null): Promise<[Uint8Array | null, number]>;
+}
@@ -1,13 +1,20 @@
-// The macro interpreter. Walks the step tree, compiles each primitive into an
-// evdev event train and hands it to the daemon one step at a time, which is what
-// makes the panic shortcut able to stop playback immediately.
+// The macro interpreter. Runs the flat program a macro compiles to (see
+// `compileSteps`), turns each primitive into an evdev event train and hands it
+// to the daemon. Runs of plain primitives —
+// keys, text, scrolls, relative moves and the waits between them — go out as
+// one train, so their timing is the daemon's rather than the main loop's; the
+// rest goes one step at a time. Trains are kept short, which is what keeps the
+// panic shortcut able to stop playback immediately.
 
 import Gio from 'gi://Gio';
 import GLib from 'gi://GLib';
 import type Clutter from 'gi://Clutter';
+import type Meta from 'gi://Meta';
 
 import { ConditionEvaluator } from './conditions.js';
 import { DaemonClient, type Playback } from './daemon.js';
+import { damageWatcher } from './damage.js';
+import { frameCache, type FrameStats } from './screenshot.js';
 import {
     BUTTON_CODES,
     EV_KEY,
@@ -22,22 +29,29 @@ import {
 } from './keymap.js';
 import type {
     ClickStep,
+    InputResource,
+    Instr,
     KeyStep,
     Macro,
     MoveStep,
     RawEvent,
+    ReplayStep,
     ScrollStep,
+    Program,
     Step,
+    StepInstr,
     TextStep,
+    UntilStep,
     WaitStep,
 } from './model.js';
-import { describeStep, findStep, pathToStep } from './model.js';
+import { compileSteps, describeStep, stepResources } from './model.js';
 import { reportProblem } from './problems.js';
 import type { Config } from './store.js';
+import { tracer, writeTrace } from './tracer.js';
 
 export type FinishReason = 'done' | 'stopped' | 'error';
 
-type Signal = 'normal' | 'break' | 'continue' | 'stop';
+type Signal = 'normal' | 'stop';
 
 /** One entry of the chain of steps the runner is inside. */
 export interface RunningStep {
@@ -71,13 +85,95 @@ export interface RunnerCallbacks {
     macroName?: (macroId: string) => string | undefined;
 }
 
+/** How a run plays: the defaults are the extension's; the benchmarks compare. */
+export interface RunnerOptions {
+    /**
+     * Whether runs of primitives are joined into one train. On; off is the
+     * step-at-a-time player it replaced, for test/bench-steps.mjs to measure
+     * against.
+     */
+    coalesce?: boolean;
+}
+
 // A warp lands exactly, so a couple of passes only cover the pointer being
 // moved between warp and measure — by a hand on the mouse, mostly.
 const MAX_WARP_ITERATIONS = 3;
+// How long a warp or a nudge gets to show up before it is taken as swallowed.
+// A backstop only: the pointer is read the moment the compositor reports it
+// moved, which is well under a millisecond on an idle desktop.
+const WARP_LAND_MS = 10;
+const NUDGE_LAND_MS = 12;
 // The relative fallback fights the acceleration curve, so a move may need a
 // few more passes; each is one daemon round trip, so a higher ceiling is cheap.
 const MAX_MOVE_ITERATIONS = 12;
 const PAUSE_POLL_MS = 120;
+// Held longer than this, a key is left to the daemon to hold: a train would
+// keep the daemon busy, and every other macro waiting, for the whole hold.
+const DAEMON_HOLD_MS = 500;
+// How long a held key waits before it starts to repeat, in the daemon as in
+// the kernel. A tap let go sooner never repeats, so it is a train like any.
+const REPEAT_DELAY_MS = 250;
+// The longest run of steps joined into one train. A train holds its input
+// until it is done, so other macros on the same keyboard or mouse queue behind
+// it, and pause and stop only get a say between trains.
+const MAX_TRAIN_MS = 1000;
+// A wait until asks again at least this often with nothing drawn where it
+// looks: what the shell paints itself, a notification over the spot, reports
+// no damage, and this is how long such a change can go unseen.
+const UNTIL_RECHECK_MS = 2000;
+
+/** Consecutive primitive steps compiled into one train; see `_collectTrain`. */
+interface Train {
+    steps: Step[];
+    /** The loops and ifs the steps sit in; one list, so the same for all. */
+    parents: Step[];
+    /** The input any of the steps plays through. */
+    uses: InputResource[];
+    /** When each step starts, in microseconds from the start of the train. */
+    starts: number[];
+    events: RawEvent[];
+}
+
+/**
+ * How long positioned steps took to get the pointer there, in buckets that
+ * double from a millisecond, and how many never did. One per run, written to
+ * the journal when the run ends.
+ */
+export class LandingHistogram {
+    static readonly BOUNDS_MS = [1, 2, 4, 8, 16, 32, 64, 128];
+    readonly counts = new Array<number>(LandingHistogram.BOUNDS_MS.length + 1).fill(0);
+    missed = 0;
+    total = 0;
+
+    record(ms: number, landed: boolean): void {
+        this.total++;
+        if (!landed) {
+            this.missed++;
+            return;
+        }
+        const bucket = LandingHistogram.BOUNDS_MS.findIndex(bound => ms <= bound);
+        this.counts[bucket < 0 ? this.counts.length - 1 : bucket]++;
+    }
+
+    clear(): void {
+        this.counts.fill(0);
+        this.missed = 0;
+        this.total = 0;
+    }
+
+    /** Like "≤1 ms 12, ≤2 ms 3, >128 ms 1", leaving out the empty buckets. */
+    toString(): string {
+        const bounds = LandingHistogram.BOUNDS_MS;
+        const parts = this.counts
+            .map((count, i) => [i < bounds.length ? `≤${bounds[i]} ms` : `>${bounds[bounds.length - 1]} ms`, count] as const)
+            .filter(([, count]) => count > 0)
+            .map(([label, count]) => `${label} ${count}`);
+        if (this.missed > 0) {
+            parts.push(`missed ${this.missed}`);
+        }
+        return parts.join(', ');
+    }
+}
 
 export class MacroRunner {
     private _daemon: DaemonClient;
@@ -97,12 +193,14 @@ export class MacroRunner {
     private _failedStepId = '';
     /** Which macro is running, so a step naming "this one" can name it. */
     private _macroId = '';
-    /**
-     * Ids from the macro body down to the step this run starts at, outermost
-     * first. Consumed on the way down and empty for the rest of the run, so
-     * only the first pass through each list is affected.
-     */
-    private _resume: string[] = [];
+    /** The row of a trace this run's steps go on: the macro's name, so two macros get a row each. */
+    private _traceLane = '';
+    /** Time-to-land of this run's positioned steps; see `LandingHistogram`. */
+    private _landing = new LandingHistogram();
+    /** Screen captures this run's checks took, and the ones another check's spared them. */
+    private _frames: FrameStats = { captured: 0, reused: 0 };
+    /** Path entries by step, so a tight loop does not describe its steps afresh each pass. */
+    private _entries = new Map<Step, RunningStep>();
     /**
      * Where the pointer was before the last positioned step, which is what a
      * step aimed at 'prev' goes back to. Per run: a fresh run has no history.
@@ -110,6 +208,11 @@ export class MacroRunner {
     private _prevPointer: { x: number; y: number } | null = null;
     /** Set by a 'store' move: 'prev' then means that spot, not the last excursion. */
     private _prevPinned = false;
+    /**
+     * Where the last image check that matched found its picture, which is
+     * where a step aimed at 'found' goes. Per run, like `_prevPointer`.
+     */
+    private _found: { x: number; y: number } | null = null;
     /**
      * Empty repeats already complained about, by step id. Per run, and per step
      * rather than one flag for all of them: an empty repeat inside a loop would
@@ -117,6 +220,8 @@ export class MacroRunner {
      * two different things to fix.
      */
     private _warnedEmptyLoops = new Set<string>();
+    /** See `RunnerOptions`. */
+    private readonly _coalesce: boolean;
 
     constructor(
         daemon: DaemonClient,
@@ -124,12 +229,14 @@ export class MacroRunner {
         settings: Gio.Settings,
         config: Config,
         callbacks: RunnerCallbacks = {},
+        options: RunnerOptions = {},
     ) {
         this._daemon = daemon;
         this._evaluator = evaluator;
         this._settings = settings;
         this._config = config;
         this._callbacks = callbacks;
+        this._coalesce = options.coalesce ?? true;
     }
 
     get running(): boolean {
@@ -148,6 +255,16 @@ export class MacroRunner {
         return this._path.length > 0 ? this._path[this._path.length - 1].id : '';
     }
 
+    /** How long the last run's positioned steps took to land. */
+    get landing(): LandingHistogram {
+        return this._landing;
+    }
+
+    /** Screen captures the last run's checks took and were spared. */
+    get frames(): FrameStats {
+        return this._frames;
+    }
+
     /** The step that threw, after a run ended in an error. */
     get failedStepId(): string {
         return this._failedStepId;
@@ -200,28 +317,34 @@ export class MacroRunner {
         this._failedAt = '';
         this._failedStepId = '';
         this._macroId = macro.id;
+        this._traceLane = `“${macro.name}”`;
         this._prevPointer = null;
         this._prevPinned = false;
+        this._found = null;
         this._warnedEmptyLoops.clear();
-        this._resume = resumeAt ? pathToStep(macro.body, resumeAt) : [];
+        this._entries.clear();
+        this._landing.clear();
+        this._frames = { captured: 0, reused: 0 };
         this._callbacks.onRunningChanged?.(true);
 
-        const from = this._resume.length > 0
-            ? findStep(macro.body, resumeAt)?.step
-            : undefined;
+        const program = compileSteps(macro.body);
+        // A step that is not there any more starts from the top.
+        const at = resumeAt ? program.index.get(resumeAt) : undefined;
+        const pc = at ?? 0;
+        const from = at !== undefined ? (program.code[at] as StepInstr).step : undefined;
         this._status(from
             ? `Running “${macro.name}” from ${describeStep(from, this._callbacks.macroName)}`
             : `Running “${macro.name}”`);
 
         let reason: FinishReason = 'done';
         let failure: Error | undefined;
+        const trace = this._config.traceRuns ? tracer.begin() : null;
+        const started = tracer.start();
 
         try {
-            const signal = await this._runList(macro.body);
+            await this._interpret(program, pc);
             if (this._cancelled) {
                 reason = 'stopped';
-            } else if (signal === 'stop') {
-                reason = 'done';
             }
         } catch (error) {
             if (this._cancelled) {
@@ -235,6 +358,7 @@ export class MacroRunner {
                 });
             }
         } finally {
+            tracer.end(started, macro.name, 'runs', { reason });
             this._running = false;
             this._path = [];
             this._callbacks.onStepsChanged?.([]);
@@ -246,6 +370,22 @@ export class MacroRunner {
             : reason === 'stopped' ? 'Stopped'
             : `Failed: ${failure?.message ?? 'unknown error'}`,
         );
+        if (this._landing.total > 0) {
+            log(`macroclickwerk: “${macro.name}” pointer landed: ${this._landing}`);
+        }
+        if (this._frames.captured + this._frames.reused > 0) {
+            log(`macroclickwerk: “${macro.name}” screen captures: ${this._frames.captured} taken, ` +
+                `${this._frames.reused} shared`);
+        }
+        if (trace) {
+            writeTrace(tracer.finish(trace), macro.name).then(
+                path => log(`macroclickwerk: “${macro.name}” trace written to ${path}`),
+                error => reportProblem('Macro',
+                    `could not write the trace of “${macro.name}”: ${(error as Error).message}`, {
+                        error: error as Error,
+                        hint: 'Check that ~/.cache/macroclickwerk can be written to, or turn tracing off.',
+                    }));
+        }
         this._callbacks.onFinished?.(reason, failure);
     }
 
@@ -266,11 +406,15 @@ export class MacroRunner {
         // left over from whichever full run happened to finish last.
         this._prevPointer = null;
         this._prevPinned = false;
+        this._found = null;
         this._warnedEmptyLoops.clear();
+        this._entries.clear();
+        this._landing.clear();
+        this._frames = { captured: 0, reused: 0 };
         this._callbacks.onRunningChanged?.(true);
         let result: { ok: boolean; message: string };
         try {
-            await this._runStep(step);
+            await this._interpret(compileSteps([step]));
             result = { ok: true, message: `Ran: ${describeStep(step, this._callbacks.macroName)}` };
             this._status(result.message);
         } catch (error) {
@@ -323,63 +467,336 @@ export class MacroRunner {
     // --- interpreter -------------------------------------------------------
 
     /**
-     * `depth` is how far down the resume chain this list sits. Only the first
-     * list at each depth can start part-way in: by the time a loop comes round
-     * again the chain has been consumed, so the second iteration runs whole.
+     * Execute a compiled macro from `pc`. Starting part-way in means starting
+     * inside whatever loops and ifs hold that step: each is shown as entered
+     * first, an if's condition is not asked — asking again could send the run
+     * down the other branch, which would skip the step you asked to continue
+     * from — and a loop is on its first pass, so only that pass is shortened.
      */
-    private async _runList(steps: Step[], depth = 0): Promise<Signal> {
-        let index = 0;
-        if (depth < this._resume.length) {
-            const at = steps.findIndex(step => step.id === this._resume[depth]);
-            if (at < 0) {
-                // The macro was edited after the resume point was set. Running
-                // the whole list beats silently skipping it.
-                this._resume = [];
-            } else {
-                index = at;
+    private async _interpret(program: Program, pc = 0): Promise<void> {
+        const { code } = program;
+        const counters = new Array<number>(program.loops).fill(0);
+
+        if (pc > 0) {
+            const { parents } = code[pc] as StepInstr;
+            for (const [depth, parent] of parents.entries()) {
+                const instr = code[program.index.get(parent.id) ?? 0];
+                if (instr.op === 'loop') {
+                    counters[instr.slot] = 1;
+                }
+                this._path = parents.slice(0, depth + 1).map(step => this._entry(step));
+                this._callbacks.onStepsChanged?.([...this._path]);
             }
         }
 
-        for (; index < steps.length; index++) {
+        while (pc < code.length && !this._cancelled) {
+            const instr = code[pc];
+            switch (instr.op) {
+                case 'test':
+                    if (instr.step.count !== 'forever' && counters[instr.slot] >= instr.step.count) {
+                        pc = instr.exit;
+                    } else {
+                        counters[instr.slot]++;
+                        pc++;
+                    }
+                    continue;
+                case 'next':
+                    // Yield to the main loop so a body with no waits in it
+                    // cannot starve the compositor.
+                    await this._sleep(0);
+                    pc = instr.to;
+                    continue;
+                case 'jump':
+                    pc = instr.to;
+                    continue;
+            }
+
+            const train = this._coalesce && instr.op === 'step' ? this._collectTrain(code, pc) : null;
+            if (train) {
+                await this._runTrain(train);
+                pc += train.steps.length;
+                continue;
+            }
+
+            await this._waitWhilePaused();
             if (this._cancelled) {
-                return 'stop';
+                return;
             }
-            const signal = await this._runStep(steps[index], depth);
-            if (signal !== 'normal') {
-                return signal;
+            // The loops and ifs a step is in stay on the path while it runs,
+            // so the editor can mark the loop you are in as well as the step
+            // inside it.
+            this._path = [...instr.parents, instr.step].map(step => this._entry(step));
+            this._callbacks.onStepsChanged?.([...this._path]);
+            const started = tracer.start();
+            try {
+                pc = await this._step(instr, pc, counters, code.length);
+                tracer.end(started, this._entry(instr.step).label, this._traceLane);
+            } catch (error) {
+                tracer.end(started, this._entry(instr.step).label, this._traceLane, { error: (error as Error).message });
+                this._failedAt = this._where();
+                this._failedStepId = instr.step.id;
+                throw error;
             }
         }
-        return 'normal';
     }
 
-    private async _runStep(step: Step, depth = 0): Promise<Signal> {
-        // Arrived at the step this run was told to start from; everything from
-        // here on is an ordinary run.
-        if (this._resume.length === depth + 1 && this._resume[depth] === step.id) {
-            this._resume = [];
+    /** Execute one instruction that is a step of the macro; returns where to go next. */
+    private async _step(instr: StepInstr, pc: number, counters: number[], end: number): Promise<number> {
+        switch (instr.op) {
+            case 'step':
+                return await this._execute(instr.step) === 'stop' ? end : pc + 1;
+            case 'flow':
+                return instr.to;
+            case 'if': {
+                const proceed = await this._evaluator.evaluate(instr.step.cond, this._frames, point => {
+                    this._found = point;
+                });
+                return proceed ? pc + 1 : instr.else;
+            }
+            case 'until':
+                return await this._waitUntil(instr.step) ? instr.done : pc + 1;
+            case 'loop':
+                // A repeat with nothing in it can only spin: each pass does no
+                // work, so the next one cannot come out differently, and a
+                // forever one would sit there for the rest of the session
+                // holding the compositor's frames down with it. Skipped rather
+                // than entered — an empty body is nearly always a step that was
+                // meant to go inside it and landed beside it instead, and a
+                // wedged desktop is a poor way to find that out.
+                if (instr.step.body.length === 0) {
+                    if (!this._warnedEmptyLoops.has(instr.step.id)) {
+                        this._warnedEmptyLoops.add(instr.step.id);
+                        this._status('Skipped a repeat with nothing in it');
+                        reportProblem('Step', 'a repeat has nothing in it, so it was skipped', {
+                            where: this._where(),
+                            hint: 'Steps go inside a repeat by being added under it — use the ' +
+                                'arrows to move a step into an open body. A repeat that stays ' +
+                                'empty runs nothing, and forever would never end.',
+                        });
+                    }
+                    return instr.exit;
+                }
+                counters[instr.slot] = 0;
+                return pc + 1;
         }
+    }
 
+    /**
+     * Hold the run until the step's condition holds — true — or its time is up.
+     * Asked at once, and after that only when something was drawn where the
+     * condition looks, so a screen that stands still costs no captures; never
+     * sooner than `minIntervalMs` after the last time, so a screen that never
+     * stands still costs no more than that.
+     */
+    private async _waitUntil(step: UntilStep): Promise<boolean> {
+        const nowMs = () => GLib.get_monotonic_time() / 1000;
+        const deadline = step.timeoutMs > 0 ? nowMs() + step.timeoutMs : Infinity;
+        const minInterval = Math.max(0, step.minIntervalMs);
+        let lastCheck = -Infinity;
+        let dirty = true;
+        // Drawing that lands while a check is on its way counts for the next
+        // one: that check may have been looking at the frame before it.
+        const stopWatching = damageWatcher.watch(this._evaluator.regionsOf(step.cond), () => {
+            if (!dirty) {
+                dirty = true;
+                this._wakeNow();
+            }
+        });
+        try {
+            const giveUp = () => {
+                this._status(`Gave up waiting after ${step.timeoutMs}ms`);
+                return false;
+            };
+            while (!this._cancelled) {
+                const now = nowMs();
+                // Before anything else: on a screen that never stops drawing,
+                // with a check as slow as the interval, a check is always due.
+                // The first check is asked whatever the limit.
+                if (lastCheck > -Infinity && now >= deadline) {
+                    return giveUp();
+                }
+                if ((dirty || now - lastCheck >= UNTIL_RECHECK_MS) && now - lastCheck >= minInterval) {
+                    dirty = false;
+                    lastCheck = now;
+                    const held = await this._evaluator.evaluate(step.cond, this._frames, point => {
+                        this._found = point;
+                    });
+                    if (held) {
+                        return true;
+                    }
+                    if (nowMs() >= deadline) {
+                        return this._cancelled ? false : giveUp();
+                    }
+                    continue;
+                }
+                const next = lastCheck + (dirty ? minInterval : UNTIL_RECHECK_MS);
+                await this._sleep(Math.ceil(Math.min(next, deadline) - now));
+            }
+            return false;
+        } finally {
+            stopWatching();
+        }
+    }
+
+    private _entry(step: Step): RunningStep {
+        let entry = this._entries.get(step);
+        if (!entry) {
+            entry = { id: step.id, label: describeStep(step, this._callbacks.macroName) };
+            this._entries.set(step, entry);
+        }
+        return entry;
+    }
+
+    // --- trains ------------------------------------------------------------
+
+    /**
+     * The events a step plays when it goes out as part of a larger train, and
+     * how long it lasts after the last of them; null for a step that cannot —
+     * one that looks at the screen or the pointer, holds the daemon, or is not
+     * a primitive at all. Throws, like the step itself would, for a key that
+     * does not exist.
+     */
+    private _compile(step: Step): { events: RawEvent[]; after: number } | null {
+        switch (step.kind) {
+            case 'key': {
+                if (MacroRunner._heldByDaemon(step)) {
+                    return null;
+                }
+                const { code, mods } = MacroRunner._resolveKey(step);
+                return { events: MacroRunner._keyEvents(step, code, mods), after: 0 };
+            }
+            case 'text':
+                return { events: textToEvents(step.value, step.delayMs ?? 12), after: 0 };
+            case 'scroll':
+                return { events: MacroRunner._scrollEvents(step), after: 0 };
+            case 'move':
+                return step.mode === 'rel'
+                    ? { events: MacroRunner._relativeEvents(step.dx ?? 0, step.dy ?? 0), after: 0 }
+                    : null;
+            case 'wait':
+                return { events: [], after: MacroRunner._waitMs(step) * 1000 };
+            default:
+                return null;
+        }
+    }
+
+    /**
+     * The run of primitives starting at `from`, as one train, or null when
+     * there is not one worth joining: fewer than two steps, or nothing to play.
+     * Waits become the gaps between events. A wait at the end is left out —
+     * there is no event after it to carry it — and runs as a step of its own.
+     * A train is one list's steps: it ends where the list does, or at anything
+     * that jumps.
+     */
+    private _collectTrain(code: Instr[], from: number): Train | null {
+        const first = code[from] as StepInstr;
+        const train: Train = { steps: [], parents: first.parents, uses: [], starts: [], events: [] };
+        // Microseconds from the start of the train: where the last step ended,
+        // and the last event that was played.
+        let now = 0;
+        let lastEvent = 0;
+        let played = 0;
+        let end = 0;
+
+        for (let i = from; i < code.length; i++) {
+            const instr = code[i];
+            if (instr.op !== 'step' || instr.parents !== train.parents) {
+                break;
+            }
+            let compiled: { events: RawEvent[]; after: number } | null;
+            try {
+                compiled = this._compile(instr.step);
+            } catch {
+                // Not here: the step runs on its own and fails with its own
+                // name on it.
+                compiled = null;
+            }
+            if (!compiled) {
+                break;
+            }
+            const span = compiled.events.reduce((sum, event) => sum + Math.max(0, event.dt), 0) + compiled.after;
+            if (train.steps.length > 0 && now + span > MAX_TRAIN_MS * 1000) {
+                break;
+            }
+
+            train.steps.push(instr.step);
+            train.starts.push(now);
+            for (const [k, event] of compiled.events.entries()) {
+                const dt = Math.max(0, event.dt);
+                now += dt;
+                // The first event also waits for whatever came between it and
+                // the last one played: earlier steps' tails, and waits.
+                train.events.push({ ...event, dt: k === 0 ? now - lastEvent : dt });
+                lastEvent = now;
+            }
+            now += compiled.after;
+            if (compiled.events.length > 0) {
+                played = train.steps.length;
+                end = train.events.length;
+            }
+        }
+
+        train.steps.length = played;
+        train.starts.length = played;
+        train.events.length = end;
+        train.uses = [...new Set(train.steps.flatMap(step => stepResources(step)))];
+        return played >= 2 ? train : null;
+    }
+
+    /**
+     * Play a train, and still show each of its steps as current while it
+     * plays — the path, the pause-and-resume point and a failure all name the
+     * step the daemon is on, as if the steps had gone one at a time.
+     */
+    private async _runTrain(train: Train): Promise<void> {
         await this._waitWhilePaused();
         if (this._cancelled) {
-            return 'stop';
+            return;
         }
-        // A container stays on the path for as long as its body runs, so the
-        // editor can mark the loop you are in as well as the step inside it.
-        this._path.push({ id: step.id, label: describeStep(step, this._callbacks.macroName) });
-        this._callbacks.onStepsChanged?.([...this._path]);
+
+        this._path = train.parents.map(step => this._entry(step));
+        const slot = this._path.length;
+        let shown = 0;
+        const showUpTo = (last: number) => {
+            for (; shown <= last && shown < train.steps.length && !this._cancelled; shown++) {
+                this._path[slot] = this._entry(train.steps[shown]);
+                this._callbacks.onStepsChanged?.([...this._path]);
+            }
+        };
+        // On the same clock as the daemon's playing, give or take the request.
+        const timers = new Set<number>();
+        train.starts.slice(1).forEach((start, i) => {
+            const id = GLib.timeout_add(GLib.PRIORITY_DEFAULT, Math.round(start / 1000), () => {
+                timers.delete(id);
+                showUpTo(i + 1);
+                return GLib.SOURCE_REMOVE;
+            });
+            timers.add(id);
+        });
+
+        const started = tracer.start();
+        const traced = (args?: Record<string, unknown>) => {
+            if (started) {
+                tracer.end(started, `${train.steps.length} steps in one go`, this._traceLane,
+                    { steps: train.steps.map(step => this._entry(step).label), ...args });
+            }
+        };
         try {
-            return await this._execute(step, depth);
+            showUpTo(0);
+            await this._play(train.events, train.uses);
+            traced();
+            // Whatever the timers have not got to yet — the answer can come
+            // back ahead of them — as long as the train was not cut short.
+            showUpTo(train.steps.length - 1);
         } catch (error) {
-            // Each frame pops the path on the way out, so by the time run() sees
-            // the throw the trail is gone. The innermost frame runs first, which
-            // is why the first one to write wins.
+            traced({ error: (error as Error).message });
             if (!this._failedAt) {
                 this._failedAt = this._where();
-                this._failedStepId = step.id;
+                this._failedStepId = this._path[slot]?.id ?? '';
             }
             throw error;
         } finally {
-            this._path.pop();
+            timers.forEach(id => GLib.source_remove(id));
         }
     }
 
@@ -388,7 +805,11 @@ export class MacroRunner {
         return this._path.map(entry => entry.label).join(' › ');
     }
 
-    private async _execute(step: Step, depth = 0): Promise<Signal> {
+    /**
+     * A step that is not a loop, an if, a wait until, a break or a continue —
+     * those are compiled into jumps and never get here. 'stop' ends the run.
+     */
+    private async _execute(step: Step): Promise<Signal> {
         switch (step.kind) {
             case 'click':
                 await this._doClick(step);
@@ -408,76 +829,9 @@ export class MacroRunner {
             case 'wait':
                 await this._doWait(step);
                 return 'normal';
-
-            case 'loop': {
-                // A repeat with nothing in it can only spin: each pass does no
-                // work, so the next one cannot come out differently, and a
-                // forever one would sit there for the rest of the session
-                // holding the compositor's frames down with it. Skipped rather
-                // than entered — an empty body is nearly always a step that was
-                // meant to go inside it and landed beside it instead, and a
-                // wedged desktop is a poor way to find that out.
-                if (step.body.length === 0) {
-                    if (!this._warnedEmptyLoops.has(step.id)) {
-                        this._warnedEmptyLoops.add(step.id);
-                        this._status('Skipped a repeat with nothing in it');
-                        reportProblem('Step', 'a repeat has nothing in it, so it was skipped', {
-                            where: this._where(),
-                            hint: 'Steps go inside a repeat by being added under it — use the ' +
-                                'arrows to move a step into an open body. A repeat that stays ' +
-                                'empty runs nothing, and forever would never end.',
-                        });
-                    }
-                    return 'normal';
-                }
-
-                let iteration = 0;
-                for (;;) {
-                    if (this._cancelled) {
-                        return 'stop';
-                    }
-                    if (step.count !== 'forever' && iteration >= step.count) {
-                        return 'normal';
-                    }
-                    iteration++;
-                    const signal = await this._runList(step.body, depth + 1);
-                    if (signal === 'break') {
-                        return 'normal';
-                    }
-                    if (signal === 'stop') {
-                        return 'stop';
-                    }
-                    // Yield to the main loop so a body with no waits in it cannot
-                    // starve the compositor.
-                    await this._sleep(0);
-                }
-            }
-
-            case 'if': {
-                // Resuming into one of the branches: take the branch the resume
-                // point is in without asking the condition again. Re-evaluating
-                // could send the run down the other branch, which would skip the
-                // step you asked to continue from.
-                if (this._resume[depth] === step.id && this._resume.length > depth + 1) {
-                    const next = this._resume[depth + 1];
-                    const branch = step.then.some(s => s.id === next) ? step.then
-                        : (step.else ?? []).some(s => s.id === next) ? step.else ?? []
-                        : null;
-                    if (branch) {
-                        return this._runList(branch, depth + 1);
-                    }
-                }
-                const proceed = await this._evaluator.evaluate(step.cond);
-                if (this._cancelled) {
-                    return 'stop';
-                }
-                return this._runList(proceed ? step.then : step.else ?? [], depth + 1);
-            }
-
-            case 'break':
-                return 'break';
-            case 'continue':
-                return 'continue';
+            case 'replay':
+                await this._doReplay(step);
+                return 'normal';
 
             case 'stop':
                 // Stopping ourselves is the ordinary end of a run, not a message
@@ -494,6 +848,8 @@ export class MacroRunner {
                 // this step runs.
                 this._control('start', step.macro || this._macroId, step.at ?? '');
                 return 'normal';
+            default:
+                return 'normal';
         }
     }
 
@@ -512,14 +868,17 @@ export class MacroRunner {
     // --- primitives --------------------------------------------------------
 
     /**
-     * `via` is which right to play this goes out under: the daemon's queue by
-     * default, or the lease held by a walk to a fixed position.
+     * `uses` is the input the step declares it plays through, which decides
+     * whose turn it waits for; see `stepResources`. `via` is which right to
+     * play this goes out under: the daemon's queues by default, or the lease
+     * held by a walk to a fixed position.
      */
-    private async _play(events: RawEvent[], via: Playback = this._daemon): Promise<void> {
+    private async _play(events: RawEvent[], uses: InputResource[], via: Playback = this._daemon): Promise<void> {
         if (this._cancelled || events.length === 0) {
             return;
         }
-        const result = await via.play(events);
+        const result = await via.play(events, uses);
+        frameCache.played();
         if (result.aborted) {
             this._cancelled = true;
         }
@@ -528,19 +887,23 @@ export class MacroRunner {
     private async _doClick(step: ClickStep): Promise<void> {
         const code = BUTTON_CODES[step.button] ?? BUTTON_CODES.left;
         const hold = Math.max(0, step.holdMs ?? 20) * 1000;
+        const uses = stepResources(step);
         const press = (via?: Playback) => this._play([
             { dt: 0, type: EV_KEY, code, value: 1 },
             { dt: hold, type: EV_KEY, code, value: 0 },
-        ], via);
+        ], uses, via);
 
         if (step.mode === 'current') {
             await press();
             return;
         }
+        if (!this._foundFor(step)) {
+            return;
+        }
         // Getting there and clicking are one thing: a click that lands where the
         // move left off is the whole point, and another macro nudging the pointer
         // between the two would land it somewhere else entirely.
-        await this._daemon.exclusive(async lease => {
+        await this._daemon.exclusive(uses, async lease => {
             await this._moveToTarget(step, lease);
             if (this._cancelled) {
                 return;
@@ -562,8 +925,11 @@ export class MacroRunner {
             this._prevPinned = true;
             return;
         }
+        if (!this._foundFor(step)) {
+            return;
+        }
         // Only the move to hold together here — there is nothing after it.
-        await this._daemon.exclusive(lease => this._moveToTarget(step, lease));
+        await this._daemon.exclusive(stepResources(step), lease => this._moveToTarget(step, lease));
     }
 
     /**
@@ -575,11 +941,12 @@ export class MacroRunner {
      * a spot deliberately; then that spot is what 'prev' means until the run
      * ends or another store replaces it. A 'prev' before any excursion has
      * nowhere to go and stays put, which for a click means clicking where the
-     * pointer already is.
+     * pointer already is. 'found' is the middle of the last picture an image
+     * check found; `_foundFor` has made sure there is one.
      */
     private async _moveToTarget(step: ClickStep | MoveStep, lease: Playback): Promise<void> {
-        const target = step.mode === 'prev'
-            ? this._prevPointer
+        const target = step.mode === 'prev' ? this._prevPointer
+            : step.mode === 'found' ? this._found
             : { x: step.x ?? 0, y: step.y ?? 0 };
         if (!target) {
             return;
@@ -591,7 +958,26 @@ export class MacroRunner {
         await this._moveAbs(target.x, target.y, lease);
     }
 
-    private async _playRelative(dx: number, dy: number, via?: Playback): Promise<void> {
+    /**
+     * Whether a step aimed at 'found' has somewhere to go. Unlike a 'prev'
+     * with no history, one with nothing found is not left to click where the
+     * pointer happens to be: the click was meant for a picture, and wherever
+     * the pointer is, it is not on one. Skipped, and said why.
+     */
+    private _foundFor(step: ClickStep | MoveStep): boolean {
+        if (step.mode !== 'found' || this._found) {
+            return true;
+        }
+        this._status('Skipped a step aimed at a found picture: nothing was found yet');
+        reportProblem('Step', 'nothing has been found to go to, so the step was skipped', {
+            where: this._where(),
+            hint: 'A step aimed at “found” goes where the last image check that matched found its ' +
+                'picture. Put it inside an if whose condition is that check.',
+        });
+        return false;
+    }
+
+    private static _relativeEvents(dx: number, dy: number): RawEvent[] {
         const events: RawEvent[] = [];
         if (dx) {
             events.push({ dt: 0, type: EV_REL, code: REL_X, value: Math.round(dx), syn: dy === 0 });
@@ -599,7 +985,11 @@ export class MacroRunner {
         if (dy) {
             events.push({ dt: 0, type: EV_REL, code: REL_Y, value: Math.round(dy), syn: true });
         }
-        await this._play(events, via);
+        return events;
+    }
+
+    private async _playRelative(dx: number, dy: number, via?: Playback): Promise<void> {
+        await this._play(MacroRunner._relativeEvents(dx, dy), ['pointer'], via);
     }
 
     /**
@@ -617,56 +1007,113 @@ export class MacroRunner {
      * mouse is answered by the next pass, which reads where it really is.
      */
     private async _moveAbs(x: number, y: number, via?: Playback): Promise<void> {
+        const started = GLib.get_monotonic_time();
+        const landed = await this._reach(x, y, via);
+        if (this._cancelled) {
+            return;
+        }
+        this._landing.record((GLib.get_monotonic_time() - started) / 1000, landed);
+        if (landed || this._warnedAboutMotion) {
+            return;
+        }
+
+        this._warnedAboutMotion = true;
+        const [px, py] = global.get_pointer();
+        this._status(`Pointer stopped at ${Math.round(px)},${Math.round(py)} instead of ${x},${y}`);
+        reportProblem('Step', `the pointer stopped at ${Math.round(px)},${Math.round(py)} instead of ${x},${y}`, {
+            where: this._where(),
+            hint: 'Everything after this clicked in the wrong place. If the target grabs the ' +
+                'pointer (games with mouse look), record relative motion instead of absolute clicks.',
+        });
+    }
+
+    /** The warp, then the walk if it has to; true once the pointer is on (x, y). */
+    private async _reach(x: number, y: number, via?: Playback): Promise<boolean> {
+        const on = (px: number, py: number) => Math.abs(x - px) <= 1 && Math.abs(y - py) <= 1;
         const seat = await this._defaultSeat();
         for (let i = 0; seat && i < MAX_WARP_ITERATIONS; i++) {
             if (this._cancelled) {
-                return;
+                return false;
             }
             seat.warp_pointer(x, y);
             // The warp is applied on the input thread, not inside the call:
-            // measuring straight away would read the old position back.
-            await this._sleep(2);
-            const [px, py] = global.get_pointer();
-            if (Math.abs(x - px) <= 1 && Math.abs(y - py) <= 1) {
-                return;
+            // reading straight away would see the old position, so the read
+            // waits for the compositor to say the pointer moved.
+            if (await this._pointerSettles(on, WARP_LAND_MS)) {
+                return true;
             }
         }
 
         for (let i = 0; i < MAX_MOVE_ITERATIONS; i++) {
             if (this._cancelled) {
-                return;
+                return false;
             }
             const [px, py] = global.get_pointer();
             const dx = Math.round(x - px);
             const dy = Math.round(y - py);
             if (Math.abs(dx) <= 1 && Math.abs(dy) <= 1) {
-                return;
+                return true;
             }
             await this._playRelative(dx, dy, via);
-            await this._sleep(6);
+            // Any move at all is this nudge arriving; where it put the pointer
+            // is for the next pass to read.
+            await this._pointerSettles((nx, ny) => nx !== px || ny !== py, NUDGE_LAND_MS);
         }
 
         // The loop checks before nudging, so the last nudge of all would go
         // unmeasured: without this, a walk that arrived on its final pass is
         // reported as "stopped at 4000,0 instead of 4000,0".
         const [ex, ey] = global.get_pointer();
-        if (this._cancelled || (Math.abs(x - ex) <= 1 && Math.abs(y - ey) <= 1)) {
-            return;
-        }
+        return on(ex, ey);
+    }
 
-        if (!this._warnedAboutMotion) {
-            this._warnedAboutMotion = true;
+    /**
+     * Resolve true as soon as the pointer is where `arrived` wants it: checked
+     * now, and again each time the compositor's cursor tracker reports a
+     * move, so a pointer that lands in a fraction of a millisecond is not kept
+     * waiting for a fixed sleep. False when `timeoutMs` passes first — a grab
+     * that swallows motion reports none. Under plain gjs there is no tracker,
+     * and the timeout is all there is.
+     */
+    private _pointerSettles(arrived: (x: number, y: number) => boolean, timeoutMs: number): Promise<boolean> {
+        const check = () => {
             const [px, py] = global.get_pointer();
-            this._status(`Pointer stopped at ${Math.round(px)},${Math.round(py)} instead of ${x},${y}`);
-            reportProblem('Step', `the pointer stopped at ${Math.round(px)},${Math.round(py)} instead of ${x},${y}`, {
-                where: this._where(),
-                hint: 'Everything after this clicked in the wrong place. If the target grabs the ' +
-                    'pointer (games with mouse look), record relative motion instead of absolute clicks.',
-            });
+            return arrived(px, py);
+        };
+        if (check()) {
+            return Promise.resolve(true);
         }
+        return new Promise<boolean>(resolve => {
+            const tracker = MacroRunner._cursorTracker();
+            let handler = 0;
+            let timeoutId = 0;
+            const finish = (landed: boolean) => {
+                if (handler) {
+                    tracker?.disconnect(handler);
+                    handler = 0;
+                }
+                if (timeoutId) {
+                    GLib.source_remove(timeoutId);
+                    timeoutId = 0;
+                }
+                resolve(landed);
+            };
+            if (tracker) {
+                handler = tracker.connect('position-invalidated', () => {
+                    if (check()) {
+                        finish(true);
+                    }
+                });
+            }
+            timeoutId = GLib.timeout_add(GLib.PRIORITY_DEFAULT, timeoutMs, () => {
+                timeoutId = 0;
+                finish(check());
+                return GLib.SOURCE_REMOVE;
+            });
+        });
     }
 
-    private async _doScroll(step: ScrollStep): Promise<void> {
+    private static _scrollEvents(step: ScrollStep): RawEvent[] {
         const events: RawEvent[] = [];
         if (step.dx) {
             events.push({ dt: 0, type: EV_REL, code: REL_HWHEEL, value: Math.round(step.dx), syn: !step.dy });
@@ -674,10 +1121,14 @@ export class MacroRunner {
         if (step.dy) {
             events.push({ dt: 0, type: EV_REL, code: REL_WHEEL, value: Math.round(step.dy), syn: true });
         }
-        await this._play(events);
+        return events;
     }
 
-    private async _doKey(step: KeyStep): Promise<void> {
+    private async _doScroll(step: ScrollStep): Promise<void> {
+        await this._play(MacroRunner._scrollEvents(step), stepResources(step));
+    }
+
+    private static _resolveKey(step: KeyStep): { code: number; mods: number[] } {
         const code = keyCode(step.code);
         if (code === null) {
             throw new Error(`unknown key ${step.code}`);
@@ -685,6 +1136,20 @@ export class MacroRunner {
         const mods = (step.mods ?? [])
             .map(name => keyCode(name))
             .filter((value): value is number => value !== null);
+        return { code, mods };
+    }
+
+    /** Whether a key step is the daemon's to hold rather than a train; see `_holdKey`. */
+    private static _heldByDaemon(step: KeyStep): boolean {
+        const hold = Math.max(0, step.holdMs ?? 20);
+        const repeatMs = Math.max(0, step.repeatMs ?? 0);
+        if (step.action === 'tap') {
+            return hold >= DAEMON_HOLD_MS || (repeatMs > 0 && hold > REPEAT_DELAY_MS);
+        }
+        return step.action === 'down' && repeatMs > 0;
+    }
+
+    private static _keyEvents(step: KeyStep, code: number, mods: number[]): RawEvent[] {
         const hold = Math.max(0, step.holdMs ?? 20) * 1000;
         const events: RawEvent[] = [];
 
@@ -706,18 +1171,80 @@ export class MacroRunner {
                 events.push({ dt: 0, type: EV_KEY, code: mod, value: 0 });
             }
         }
+        return events;
+    }
 
-        await this._play(events);
+    private async _doKey(step: KeyStep): Promise<void> {
+        const { code, mods } = MacroRunner._resolveKey(step);
+        if (MacroRunner._heldByDaemon(step)) {
+            await this._holdKey(step, code, mods, Math.max(0, step.repeatMs ?? 0));
+            return;
+        }
+        await this._play(MacroRunner._keyEvents(step, code, mods), stepResources(step));
+    }
+
+    /**
+     * A key the daemon holds rather than plays: the modifiers go down as a
+     * train, then one request presses the key, and the daemon repeats it and
+     * lets go at the deadline on its own. A `down` stays held for a later `up`
+     * step — whose release ends the hold — exactly as a pressed key would.
+     */
+    private async _holdKey(step: KeyStep, code: number, mods: number[], repeatMs: number): Promise<void> {
+        await this._play(mods.map(mod => ({ dt: 0, type: EV_KEY, code: mod, value: 1 })), stepResources(step));
+        if (this._cancelled) {
+            return;
+        }
+        const holdMs = step.action === 'tap' ? Math.max(0, step.holdMs ?? 20) : 0;
+        await this._daemon.hold(code, holdMs, repeatMs);
+        frameCache.played();
+        if (step.action === 'down') {
+            return;
+        }
+
+        // The daemon lets go at the deadline it was given, which had begun
+        // before this sleep did. Released here only when a stop cuts the hold
+        // short: a release after the deadline would end any newer hold of the
+        // same key, another macro's. Straight to the daemon rather than
+        // through _play, which skips everything once the run is cancelled: a
+        // stop that arrives mid-hold must still leave no modifier down behind it.
+        await this._sleep(holdMs);
+        if (this._cancelled) {
+            await this._daemon.release(code);
+        }
+        const ups = [...mods].reverse().map(mod => ({ dt: 0, type: EV_KEY, code: mod, value: 0 }));
+        if (ups.length > 0) {
+            await this._daemon.play(ups, stepResources(step));
+        }
+        frameCache.played();
     }
 
     private async _doText(step: TextStep): Promise<void> {
-        await this._play(textToEvents(step.value, step.delayMs ?? 12));
+        await this._play(textToEvents(step.value, step.delayMs ?? 12), stepResources(step));
     }
 
-    private async _doWait(step: WaitStep): Promise<void> {
+    /** How long this pass of a wait step lasts, its jitter drawn afresh each time. */
+    private static _waitMs(step: WaitStep): number {
         const jitter = Math.max(0, step.jitterMs ?? 0);
         const offset = jitter > 0 ? (Math.random() * 2 - 1) * jitter : 0;
-        await this._sleep(Math.max(0, Math.round(step.ms + offset)));
+        return Math.max(0, Math.round(step.ms + offset));
+    }
+
+    private async _doWait(step: WaitStep): Promise<void> {
+        await this._sleep(MacroRunner._waitMs(step));
+    }
+
+    private async _doReplay(step: ReplayStep): Promise<void> {
+        if (!step.capture) {
+            throw new Error('no capture named');
+        }
+        if (this._cancelled) {
+            return;
+        }
+        const result = await this._daemon.playCapture(step.capture);
+        frameCache.played();
+        if (result.aborted) {
+            this._cancelled = true;
+        }
     }
 
     // --- helpers -----------------------------------------------------------
@@ -742,6 +1269,24 @@ export class MacroRunner {
         return MacroRunner._seat;
     }
 
+    /** See `_cursorTracker`. `undefined` means not asked yet. */
+    private static _tracker: Meta.CursorTracker | null | undefined;
+
+    /**
+     * The compositor's cursor tracker, whose moves `_pointerSettles` waits on,
+     * or null under plain gjs, where there is no backend to ask.
+     */
+    private static _cursorTracker(): Meta.CursorTracker | null {
+        if (MacroRunner._tracker === undefined) {
+            try {
+                MacroRunner._tracker = global.backend.get_cursor_tracker();
+            } catch {
+                MacroRunner._tracker = null;
+            }
+        }
+        return MacroRunner._tracker;
+    }
+
     private _status(text: string): void {
         this._callbacks.onStatus?.(text);
     }
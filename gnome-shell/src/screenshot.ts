@@ -6,6 +6,8 @@ import GLib from 'gi://GLib';
 import GdkPixbuf from 'gi://GdkPixbuf';
 import Shell from 'gi://Shell';
 
+import { tracer } from './tracer.js';
+
 export interface Rgb {
     r: number;
     g: number;
@@ -25,6 +27,7 @@ function ensurePromisified(): void {
     for (const [method, finish] of [
         ['screenshot', 'screenshot_finish'],
         ['screenshot_area', 'screenshot_area_finish'],
+        ['pick_color', 'pick_color_finish'],
     ]) {
         try {
             gio._promisify(Shell.Screenshot.prototype, method, finish);
@@ -37,6 +40,49 @@ function ensurePromisified(): void {
 interface AsyncScreenshot {
     screenshot(includeCursor: boolean, stream: Gio.OutputStream): Promise<unknown>;
     screenshot_area(x: number, y: number, width: number, height: number, stream: Gio.OutputStream): Promise<unknown>;
+    pick_color(x: number, y: number): Promise<[{ red: number; green: number; blue: number }]>;
+}
+
+/**
+ * Raw pixel rows, RGB or RGBA: what the colour helpers work on, so that where
+ * the bytes came from — a decoded capture or a single pixel read off the
+ * stage — is the capture's business and not theirs.
+ */
+export interface Pixels {
+    width: number;
+    height: number;
+    rowstride: number;
+    channels: number;
+    data: Uint8Array;
+}
+
+/** The bytes of a pixbuf, copied out once: GJS copies on every get_pixels(). */
+export function pixelsOf(pixbuf: GdkPixbuf.Pixbuf): Pixels {
+    return {
+        width: pixbuf.get_width(),
+        height: pixbuf.get_height(),
+        rowstride: pixbuf.get_rowstride(),
+        channels: pixbuf.get_n_channels(),
+        data: pixbuf.get_pixels(),
+    };
+}
+
+/**
+ * The part of `pixels`, captured as `frame`, that is `rect` — without a copy:
+ * the view's rows start inside the frame's and keep its stride.
+ */
+export function viewOf(pixels: Pixels, frame: Rect, rect: Rect): Pixels {
+    // A HiDPI stage captures more pixels than it has logical ones.
+    const scale = pixels.width / frame.w;
+    const x = Math.round((rect.x - frame.x) * scale);
+    const y = Math.round((rect.y - frame.y) * scale);
+    return {
+        width: Math.max(1, Math.min(Math.round(rect.w * scale), pixels.width - x)),
+        height: Math.max(1, Math.min(Math.round(rect.h * scale), pixels.height - y)),
+        rowstride: pixels.rowstride,
+        channels: pixels.channels,
+        data: pixels.data.subarray(y * pixels.rowstride + x * pixels.channels),
+    };
 }
 
 function pixbufFromBytes(bytes: GLib.Bytes): GdkPixbuf.Pixbuf {
@@ -49,37 +95,381 @@ function pixbufFromBytes(bytes: GLib.Bytes): GdkPixbuf.Pixbuf {
     return pixbuf;
 }
 
-/** Full stage capture, across all monitors. */
-export async function captureScreen(): Promise<GdkPixbuf.Pixbuf> {
+/** A PNG kept in the document as base64, such as an image check's picture. */
+export function pixbufFromBase64(png: string): GdkPixbuf.Pixbuf {
+    return pixbufFromBytes(new GLib.Bytes(GLib.base64_decode(png)));
+}
+
+/** The other way: a capture as a PNG in base64, for the document. */
+export function base64Png(pixbuf: GdkPixbuf.Pixbuf): string {
+    const [ok, buffer] = pixbuf.save_to_bufferv('png', [], []);
+    if (!ok || !buffer) {
+        throw new Error('could not encode the picture');
+    }
+    return GLib.base64_encode(buffer);
+}
+
+function stageSize(): [number, number] {
+    return [global.stage.width, global.stage.height];
+}
+
+/** The whole stage, across all monitors, in logical pixels. */
+export function stageRect(): Rect {
+    const [stageWidth, stageHeight] = stageSize();
+    return { x: 0, y: 0, w: stageWidth, h: stageHeight };
+}
+
+async function shoot(rect: Rect): Promise<GdkPixbuf.Pixbuf> {
     ensurePromisified();
     const shooter = new Shell.Screenshot() as Shell.Screenshot & AsyncScreenshot;
     const stream = Gio.MemoryOutputStream.new_resizable();
-    await shooter.screenshot(false, stream);
+    await shooter.screenshot_area(rect.x, rect.y, rect.w, rect.h, stream);
     stream.close(null);
     return pixbufFromBytes(stream.steal_as_bytes());
 }
 
-function stageSize(): [number, number] {
-    return [global.stage.width, global.stage.height];
+// --- the frame cache -------------------------------------------------------
+
+export interface Rect {
+    x: number;
+    y: number;
+    w: number;
+    h: number;
 }
 
-/** Capture a rectangle, clamped to the stage so a stale coordinate cannot throw. */
-export async function captureRegion(
-    x: number, y: number, width: number, height: number,
-): Promise<GdkPixbuf.Pixbuf> {
-    ensurePromisified();
-    const [stageWidth, stageHeight] = stageSize();
+function contains(outer: Rect, inner: Rect): boolean {
+    return inner.x >= outer.x && inner.y >= outer.y &&
+        inner.x + inner.w <= outer.x + outer.w && inner.y + inner.h <= outer.y + outer.h;
+}
+
+/** Whether the two share a pixel. */
+export function overlaps(a: Rect, b: Rect): boolean {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+function union(a: Rect, b: Rect): Rect {
+    const x = Math.min(a.x, b.x);
+    const y = Math.min(a.y, b.y);
+    return {
+        x, y,
+        w: Math.max(a.x + a.w, b.x + b.w) - x,
+        h: Math.max(a.y + a.h, b.y + b.h) - y,
+    };
+}
 
+/** Clamped to the stage, so a stale coordinate cannot throw. */
+export function clampToStage(x: number, y: number, width: number, height: number): Rect {
+    const [stageWidth, stageHeight] = stageSize();
     const cx = Math.max(0, Math.min(Math.round(x), stageWidth - 1));
     const cy = Math.max(0, Math.min(Math.round(y), stageHeight - 1));
-    const cw = Math.max(1, Math.min(Math.round(width), stageWidth - cx));
-    const ch = Math.max(1, Math.min(Math.round(height), stageHeight - cy));
+    return {
+        x: cx,
+        y: cy,
+        w: Math.max(1, Math.min(Math.round(width), stageWidth - cx)),
+        h: Math.max(1, Math.min(Math.round(height), stageHeight - cy)),
+    };
+}
+
+/**
+ * Stage captures one run's checks needed, against the ones they got from a
+ * frame that was already there. The runner keeps one per run and puts it in
+ * the journal at the end.
+ */
+export interface FrameStats {
+    captured: number;
+    reused: number;
+}
+
+interface Frame {
+    rect: Rect;
+    /** When the capture was asked for, in µs: the frame is at least this fresh. */
+    at: number;
+    pixbuf: Promise<GdkPixbuf.Pixbuf>;
+    /** The pixbuf is there, not on its way. */
+    settled: boolean;
+}
+
+interface FrameRequest {
+    rect: Rect;
+    stats?: FrameStats;
+    resolve: (frame: Frame) => void;
+}
+
+/** How long a region that was asked for is taken along into later captures. */
+const RECENT_MS = 1000;
+/**
+ * Regions are captured together while their union is at most this many times
+ * their combined area, plus MERGE_ALLOWANCE. Past that the pixels in between
+ * cost more to encode and decode than the second capture saves — two far
+ * corners of the screen would otherwise make every capture a full-screen one.
+ */
+const MERGE_SLACK = 2;
+/**
+ * Pixels a capture's fixed cost — the stage paint, the stream, the codec's
+ * setup — is worth: small areas near each other are always taken together.
+ */
+const MERGE_ALLOWANCE = 128 * 128;
+
+/**
+ * Captures shared between every check that looks within a few milliseconds of
+ * the others: the children of one and/or, ifs in a row, and macros polling
+ * their own corners of the screen at the same time.
+ *
+ * A frame younger than `freshMs` that covers a region answers for it,
+ * cropped, without a capture — still in flight counts. Requests that miss are
+ * held until the main loop comes round, then captured as few rectangles as
+ * makes sense, each the union of its requests and of the regions asked for
+ * lately, which are likely to be asked for again before this frame goes
+ * stale. 0 turns the sharing off. Input a macro plays ends every frame taken
+ * before it: a check right after a click must see what the click did.
+ */
+export class FrameCache {
+    freshMs = 50;
+    /** Takes the actual capture; the benchmarks put a stand-in here. */
+    shoot: (rect: Rect) => Promise<GdkPixbuf.Pixbuf> = shoot;
+    private _frames: Frame[] = [];
+    private _pending: FrameRequest[] = [];
+    private _recent: { rect: Rect; at: number }[] = [];
+    private _flushId = 0;
+    private _expiry = new Set<number>();
+    /** When a macro last played input; no frame from before it is fresh. */
+    private _inputAt = 0;
+
+    async capture(rect: Rect, stats?: FrameStats): Promise<GdkPixbuf.Pixbuf> {
+        if (this.freshMs <= 0) {
+            if (stats) {
+                stats.captured++;
+            }
+            return this.shoot(rect);
+        }
+
+        const now = GLib.get_monotonic_time();
+        this._remember(rect, now);
+        let frame = this._fresh(rect, now);
+        if (frame) {
+            if (stats) {
+                stats.reused++;
+            }
+        } else {
+            frame = await new Promise<Frame>(resolve => {
+                this._pending.push({ rect, stats, resolve });
+                this._flushId ||= GLib.idle_add(GLib.PRIORITY_DEFAULT, () => {
+                    this._flushId = 0;
+                    this._flush();
+                    return GLib.SOURCE_REMOVE;
+                });
+            });
+        }
+        return crop(await frame.pixbuf, frame.rect, rect);
+    }
+
+    /** A frame already captured — not one on its way — that covers `rect`. */
+    peek(rect: Rect, stats?: FrameStats): Promise<GdkPixbuf.Pixbuf> | null {
+        if (this.freshMs <= 0) {
+            return null;
+        }
+        const frame = this._fresh(rect, GLib.get_monotonic_time(), true);
+        if (!frame) {
+            return null;
+        }
+        if (stats) {
+            stats.reused++;
+        }
+        return frame.pixbuf.then(pixbuf => crop(pixbuf, frame.rect, rect));
+    }
+
+    /**
+     * Something was drawn over `rect` — anywhere, for null — so the frames that
+     * overlap it no longer show what is there, and must not answer for it.
+     * Ones still on their way were asked for before the drawing, too.
+     */
+    forget(rect: Rect | null): void {
+        this._frames = this._frames.filter(frame => rect !== null && !overlaps(frame.rect, rect));
+    }
+
+    /**
+     * A macro has just played input — a train, a hold, a capture — which may
+     * have changed anything on screen. Every frame taken before now is let go,
+     * settled or still on its way.
+     */
+    played(): void {
+        this._inputAt = GLib.get_monotonic_time();
+        this.forget(null);
+    }
+
+    clear(): void {
+        if (this._flushId) {
+            GLib.source_remove(this._flushId);
+            this._flushId = 0;
+        }
+        // Whoever is waiting still gets a frame, just not a shared one.
+        const pending = this._pending;
+        this._pending = [];
+        for (const request of pending) {
+            request.resolve(this._shoot(request.rect, GLib.get_monotonic_time()));
+        }
+        for (const id of this._expiry) {
+            GLib.source_remove(id);
+        }
+        this._expiry.clear();
+        this._frames = [];
+        this._recent = [];
+    }
+
+    private _fresh(rect: Rect, now: number, settled = false): Frame | undefined {
+        const oldest = Math.max(now - this.freshMs * 1000, this._inputAt);
+        this._frames = this._frames.filter(frame => frame.at >= oldest);
+        return this._frames.find(frame => contains(frame.rect, rect) && (frame.settled || !settled));
+    }
 
+    private _remember(rect: Rect, now: number): void {
+        const oldest = now - RECENT_MS * 1000;
+        this._recent = this._recent.filter(recent => recent.at >= oldest);
+        const covering = this._recent.find(recent => contains(recent.rect, rect));
+        if (covering) {
+            covering.at = now;
+        } else {
+            this._recent = this._recent.filter(recent => !contains(rect, recent.rect));
+            this._recent.push({ rect, at: now });
+        }
+    }
+
+    private _flush(): void {
+        const now = GLib.get_monotonic_time();
+        const pending = this._pending;
+        this._pending = [];
+
+        for (const group of groupRegions(pending.map(request => request.rect))) {
+            for (const recent of this._recent) {
+                const area = recent.rect.w * recent.rect.h;
+                if (!contains(group.rect, recent.rect) && worthMerging(group.rect, group.area, recent.rect, area)) {
+                    group.rect = union(group.rect, recent.rect);
+                    group.area += area;
+                }
+            }
+            const frame = this._shoot(group.rect, now);
+            group.members.forEach((member, i) => {
+                // One capture, however many asked for it: the first paid for
+                // it, the others were spared theirs.
+                const request = pending[member];
+                if (request.stats) {
+                    request.stats[i === 0 ? 'captured' : 'reused']++;
+                }
+                request.resolve(frame);
+            });
+        }
+    }
+
+    private _shoot(rect: Rect, at: number): Frame {
+        const pixbuf = tracer.wrap(this.shoot(rect), `capture ${rect.w}×${rect.h}`, 'screen captures');
+        const frame: Frame = { rect, at, pixbuf, settled: false };
+        frame.pixbuf.then(() => {
+            frame.settled = true;
+            if (!this._frames.includes(frame)) {
+                return;
+            }
+            // Let go of the pixels once nobody may use them any more: a
+            // full-screen frame is tens of megabytes.
+            const id = GLib.timeout_add(GLib.PRIORITY_DEFAULT, Math.max(1, this.freshMs), () => {
+                this._expiry.delete(id);
+                this._frames = this._frames.filter(other => other !== frame);
+                return GLib.SOURCE_REMOVE;
+            });
+            this._expiry.add(id);
+        }, () => {
+            // A failed capture must not answer for anyone after it; those
+            // waiting on it get the error from their own await.
+            this._frames = this._frames.filter(other => other !== frame);
+        });
+        this._frames.push(frame);
+        return frame;
+    }
+}
+
+function worthMerging(rect: Rect, area: number, other: Rect, otherArea: number): boolean {
+    const merged = union(rect, other);
+    return merged.w * merged.h <= MERGE_SLACK * (area + otherArea) + MERGE_ALLOWANCE;
+}
+
+/** Rectangles to capture for `rects`, and which of them each one covers. */
+export interface RegionGroup {
+    rect: Rect;
+    /** Summed area of the members, which the union is held against. */
+    area: number;
+    /** Indices into the rects that were grouped. */
+    members: number[];
+}
+
+/**
+ * As few rectangles as make sense to cover `rects` with: greedily, each joins
+ * the first group it merges into cheaply, or starts its own.
+ */
+export function groupRegions(rects: Rect[]): RegionGroup[] {
+    const groups: RegionGroup[] = [];
+    rects.forEach((rect, i) => {
+        const area = rect.w * rect.h;
+        const group = groups.find(candidate => worthMerging(candidate.rect, candidate.area, rect, area));
+        if (group) {
+            group.rect = union(group.rect, rect);
+            group.area += area;
+            group.members.push(i);
+        } else {
+            groups.push({ rect, area, members: [i] });
+        }
+    });
+    return groups;
+}
+
+/** The part of a frame's pixbuf that is `rect`; shares the frame's pixels. */
+function crop(pixbuf: GdkPixbuf.Pixbuf, frameRect: Rect, rect: Rect): GdkPixbuf.Pixbuf {
+    if (frameRect.x === rect.x && frameRect.y === rect.y && frameRect.w === rect.w && frameRect.h === rect.h) {
+        return pixbuf;
+    }
+    // A HiDPI stage captures more pixels than it has logical ones.
+    const scale = pixbuf.get_width() / frameRect.w;
+    const x = Math.round((rect.x - frameRect.x) * scale);
+    const y = Math.round((rect.y - frameRect.y) * scale);
+    const w = Math.max(1, Math.min(Math.round(rect.w * scale), pixbuf.get_width() - x));
+    const h = Math.max(1, Math.min(Math.round(rect.h * scale), pixbuf.get_height() - y));
+    return pixbuf.new_subpixbuf(x, y, w, h);
+}
+
+/** The one cache, shared by every evaluator and so by every running macro. */
+export const frameCache = new FrameCache();
+
+/** Full stage capture, across all monitors. */
+export function captureScreen(stats?: FrameStats): Promise<GdkPixbuf.Pixbuf> {
+    return frameCache.capture(stageRect(), stats);
+}
+
+/** Capture a rectangle, clamped to the stage so a stale coordinate cannot throw. */
+export function captureRegion(
+    x: number, y: number, width: number, height: number, stats?: FrameStats,
+): Promise<GdkPixbuf.Pixbuf> {
+    return frameCache.capture(clampToStage(x, y, width, height), stats);
+}
+
+/**
+ * One pixel, read straight off the stage. No PNG in between: screenshot_area
+ * would encode the pixel into a PNG only for it to be decoded again here, and
+ * for a check polled in a loop that round trip was nearly all of its cost.
+ */
+export async function capturePixel(x: number, y: number, stats?: FrameStats): Promise<Rgb> {
+    const rect = clampToStage(x, y, 1, 1);
+    // A frame that is already there is cheaper still, and the same moment the
+    // checks beside this one saw.
+    const cached = frameCache.peek(rect, stats);
+    if (cached) {
+        return readPixel(pixelsOf(await cached));
+    }
+
+    ensurePromisified();
+    if (stats) {
+        stats.captured++;
+    }
     const shooter = new Shell.Screenshot() as Shell.Screenshot & AsyncScreenshot;
-    const stream = Gio.MemoryOutputStream.new_resizable();
-    await shooter.screenshot_area(cx, cy, cw, ch, stream);
-    stream.close(null);
-    return pixbufFromBytes(stream.steal_as_bytes());
+    const [color] = await tracer.wrap(shooter.pick_color(rect.x, rect.y), 'pick colour', 'screen captures');
+    return { r: color.red, g: color.green, b: color.blue };
 }
 
 // --- colour helpers --------------------------------------------------------
@@ -116,33 +506,30 @@ export function colorDistance(a: Rgb, b: Rgb): number {
     return Math.sqrt(dr * dr + dg * dg + db * db);
 }
 
-export function readPixel(pixbuf: GdkPixbuf.Pixbuf, x = 0, y = 0): Rgb {
-    const pixels = pixbuf.get_pixels();
-    const channels = pixbuf.get_n_channels();
-    const rowstride = pixbuf.get_rowstride();
-    const px = Math.max(0, Math.min(x, pixbuf.get_width() - 1));
-    const py = Math.max(0, Math.min(y, pixbuf.get_height() - 1));
-    const offset = py * rowstride + px * channels;
-    return { r: pixels[offset], g: pixels[offset + 1], b: pixels[offset + 2] };
+export function readPixel(pixels: Pixels, x = 0, y = 0): Rgb {
+    const px = Math.max(0, Math.min(x, pixels.width - 1));
+    const py = Math.max(0, Math.min(y, pixels.height - 1));
+    const offset = py * pixels.rowstride + px * pixels.channels;
+    return { r: pixels.data[offset], g: pixels.data[offset + 1], b: pixels.data[offset + 2] };
 }
 
-/** Fraction of pixels within `tolerance` of `target`, 0..1. */
-export function colorCoverage(pixbuf: GdkPixbuf.Pixbuf, target: Rgb, tolerance: number): number {
-    const pixels = pixbuf.get_pixels();
-    const channels = pixbuf.get_n_channels();
-    const rowstride = pixbuf.get_rowstride();
-    const width = pixbuf.get_width();
-    const height = pixbuf.get_height();
+/**
+ * Fraction of pixels within `tolerance` of `target`, 0..1. The same distance as
+ * colorDistance(), compared squared and without an object per pixel: a large
+ * area is tens of thousands of pixels, and this runs on the compositor thread.
+ */
+export function colorCoverage(pixels: Pixels, target: Rgb, tolerance: number): number {
+    const { width, height, rowstride, channels, data } = pixels;
+    const limit = tolerance * tolerance;
 
     let matched = 0;
     for (let y = 0; y < height; y++) {
-        for (let x = 0; x < width; x++) {
-            const offset = y * rowstride + x * channels;
-            const distance = colorDistance(
-                { r: pixels[offset], g: pixels[offset + 1], b: pixels[offset + 2] },
-                target,
-            );
-            if (distance <= tolerance) {
+        let offset = y * rowstride;
+        for (let x = 0; x < width; x++, offset += channels) {
+            const dr = data[offset] - target.r;
+            const dg = data[offset + 1] - target.g;
+            const db = data[offset + 2] - target.b;
+            if (dr * dr + dg * dg + db * db <= limit) {
                 matched++;
             }
         }
@@ -150,45 +537,149 @@ export function colorCoverage(pixbuf: GdkPixbuf.Pixbuf, target: Rgb, tolerance:
     return matched / Math.max(1, width * height);
 }
 
-// --- encoding for the LLM --------------------------------------------------
+export interface CoverageVerdict {
+    result: boolean;
+    /** Pixels that matched, of the `seen` looked at before the answer was certain. */
+    matched: number;
+    seen: number;
+    total: number;
+}
 
-function scaleToWidth(pixbuf: GdkPixbuf.Pixbuf, maxWidth: number): GdkPixbuf.Pixbuf {
-    const width = pixbuf.get_width();
-    if (width <= maxWidth || maxWidth <= 0) {
-        return pixbuf;
+/**
+ * Whether at least `need` (0..1) of the pixels are within `tolerance` of
+ * `target`. Stops at the row where the answer is settled: enough matched
+ * already, or too few left to get there.
+ */
+export function coverageAtLeast(pixels: Pixels, target: Rgb, tolerance: number, need: number): CoverageVerdict {
+    const { width, height, rowstride, channels, data } = pixels;
+    const limit = tolerance * tolerance;
+    const total = Math.max(1, width * height);
+
+    let matched = 0;
+    let seen = 0;
+    for (let y = 0; y < height; y++) {
+        let offset = y * rowstride;
+        for (let x = 0; x < width; x++, offset += channels) {
+            const dr = data[offset] - target.r;
+            const dg = data[offset + 1] - target.g;
+            const db = data[offset + 2] - target.b;
+            if (dr * dr + dg * dg + db * db <= limit) {
+                matched++;
+            }
+        }
+        seen += width;
+        // As fractions, the way colorCoverage() was compared, so an early
+        // answer is never a different one.
+        if (matched / total >= need) {
+            return { result: true, matched, seen, total };
+        }
+        if ((matched + total - seen) / total < need) {
+            return { result: false, matched, seen, total };
+        }
     }
-    const height = Math.max(1, Math.round(pixbuf.get_height() * (maxWidth / width)));
-    return pixbuf.scale_simple(maxWidth, height, GdkPixbuf.InterpType.BILINEAR) ?? pixbuf;
+    return { result: matched / total >= need, matched, seen, total };
 }
 
-export interface EncodedImage {
-    dataUri: string;
-    mimeType: string;
-    byteLength: number;
-    width: number;
-    height: number;
+// --- perceptual hash -------------------------------------------------------
+
+/** 160 bits as five unsigned 32-bit words; compare with `hammingDistance`. */
+export type PerceptualHash = number[];
+
+/**
+ * A fingerprint of what a picture looks like rather than of its bytes, so that
+ * a clock ticking over or a caret blinking moves it by a bit or two instead of
+ * changing it outright. Two halves:
+ *
+ * - 64 bits of difference hash: 9×8 luminance, one bit per neighbouring pair
+ *   saying which is brighter. The shape of the picture.
+ * - 96 bits of colour: 4×4 cells, each channel in four levels, Gray coded so
+ *   a level either way costs one bit. A difference hash alone sees a solid
+ *   green button and a solid red one as the same picture — and that is the
+ *   very question a model gets asked.
+ *
+ * Both thumbnails come out of gdk-pixbuf's scaler, so a full-screen capture
+ * costs a scale, not a walk over its pixels here.
+ */
+export function perceptualHash(pixbuf: GdkPixbuf.Pixbuf): PerceptualHash | null {
+    const shape = pixbuf.scale_simple(9, 8, GdkPixbuf.InterpType.BILINEAR);
+    const colour = pixbuf.scale_simple(4, 4, GdkPixbuf.InterpType.BILINEAR);
+    if (!shape || !colour) {
+        return null;
+    }
+
+    const words = [0, 0, 0, 0, 0];
+    let bit = 0;
+    const push = (on: boolean) => {
+        if (on) {
+            words[bit >>> 5] |= 1 << (bit & 31);
+        }
+        bit++;
+    };
+
+    const luma = pixelsOf(shape);
+    const brightness = (x: number, y: number) => {
+        const offset = y * luma.rowstride + x * luma.channels;
+        return 299 * luma.data[offset] + 587 * luma.data[offset + 1] + 114 * luma.data[offset + 2];
+    };
+    for (let y = 0; y < 8; y++) {
+        for (let x = 0; x < 8; x++) {
+            push(brightness(x, y) > brightness(x + 1, y));
+        }
+    }
+
+    const cells = pixelsOf(colour);
+    for (let y = 0; y < 4; y++) {
+        for (let x = 0; x < 4; x++) {
+            const offset = y * cells.rowstride + x * cells.channels;
+            for (let channel = 0; channel < 3; channel++) {
+                const level = cells.data[offset + channel] >> 6;
+                const gray = level ^ (level >> 1);
+                push((gray & 2) !== 0);
+                push((gray & 1) !== 0);
+            }
+        }
+    }
+    return words.map(word => word >>> 0);
 }
 
+// --- change detection ------------------------------------------------------
+
+/** Cells per side of a luminance signature. */
+const SIGNATURE_SIZE = 16;
 /**
- * Encode as PNG for the model. Lossless matters more here than it looks: a
- * screenshot is text and thin lines, exactly what JPEG smears, and at this size
- * PNG is both smaller and quicker to write than JPEG anyway. The compression
- * level is left at the default — level 9 buys under a percent for twice the
- * time, and this runs on the compositor thread.
+ * Luminance levels a cell may drift by without counting as changed: capture
+ * noise, a gradient redrawn a shade off, the cursor's shadow at the edge.
  */
-export function encodeForLlm(pixbuf: GdkPixbuf.Pixbuf, maxWidth: number): EncodedImage {
-    const scaled = scaleToWidth(pixbuf, maxWidth);
+const SIGNATURE_NOISE = 12;
 
-    const [ok, buffer] = scaled.save_to_bufferv('png', [], []);
-    if (!ok || !buffer) {
-        throw new Error('could not encode the screenshot');
+/**
+ * What a picture looks like at 16×16 in luminance, scaled down by gdk-pixbuf:
+ * cheap to take of every capture, and enough to say whether anything moved.
+ */
+export function luminanceSignature(pixbuf: GdkPixbuf.Pixbuf): Uint8Array | null {
+    const thumbnail = pixbuf.scale_simple(SIGNATURE_SIZE, SIGNATURE_SIZE, GdkPixbuf.InterpType.BILINEAR);
+    if (!thumbnail) {
+        return null;
+    }
+    const { rowstride, channels, data } = pixelsOf(thumbnail);
+    const signature = new Uint8Array(SIGNATURE_SIZE * SIGNATURE_SIZE);
+    for (let y = 0; y < SIGNATURE_SIZE; y++) {
+        for (let x = 0; x < SIGNATURE_SIZE; x++) {
+            const offset = y * rowstride + x * channels;
+            signature[y * SIGNATURE_SIZE + x] =
+                (299 * data[offset] + 587 * data[offset + 1] + 114 * data[offset + 2]) / 1000;
+        }
     }
+    return signature;
+}
 
-    return {
-        dataUri: `data:image/png;base64,${GLib.base64_encode(buffer)}`,
-        mimeType: 'image/png',
-        byteLength: buffer.length,
-        width: scaled.get_width(),
-        height: scaled.get_height(),
-    };
+/** Share of the cells, 0..1, that moved past the noise between two signatures. */
+export function signatureChange(a: Uint8Array, b: Uint8Array): number {
+    let changed = 0;
+    for (let i = 0; i < a.length; i++) {
+        if (Math.abs(a[i] - b[i]) > SIGNATURE_NOISE) {
+            changed++;
+        }
+    }
+    return changed / Math.max(1, a.length);
 }
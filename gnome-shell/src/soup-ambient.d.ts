@@ -9,6 +9,7 @@ declare module 'gi://Soup?version=3.0' {
     namespace Soup {
         class MessageHeaders {
             append(name: string, value: string): void;
+            get_one(name: string): string | null;
         }
 
         class Message {
@@ -31,6 +32,13 @@ declare module 'gi://Soup?version=3.0' {
                 callback: ((source: Session | null, result: Gio.AsyncResult) => void) | null,
             ): void;
             send_and_read_finish(result: Gio.AsyncResult): GLib.Bytes;
+            send_async(
+                msg: Message,
+                ioPriority: number,
+                cancellable: Gio.Cancellable | null,
+                callback: ((source: Session | null, result: Gio.AsyncResult) => void) | null,
+            ): void;
+            send_finish(result: Gio.AsyncResult): Gio.InputStream;
         }
 
         enum Status {
@@ -19,10 +19,24 @@ export interface Config {
     llmApiKey: string;
     llmTimeoutMs: number;
     llmMaxWidth: number;
+    /** Model requests sent at once; the rest wait their turn. */
+    llmMaxRequests: number;
+    /** Model checks of one and/or evaluated at once; 1 is one after another. */
+    conditionParallelism: number;
+    /** While a macro may ask the model, how idle it may get before a ping; 0 never pings. */
+    llmKeepAliveMs: number;
+    /** How long a model's answer is reused for an unchanged picture; 0 never. */
+    llmCacheTtlMs: number;
+    /** Perceptual-hash bits a picture may differ by and still count as unchanged. */
+    llmCacheDistance: number;
+    /** How old a screen capture may be and still answer a check; 0 never shares. */
+    frameFreshMs: number;
     controlSocket: string;
     eventSocket: string;
     /** 0 means: do not turn idle gaps into wait steps. */
     recordGapMs: number;
+    /** Write each run's timeline to the cache directory. */
+    traceRuns: boolean;
 }
 
 export class MacroStore {
@@ -170,9 +184,16 @@ export class MacroStore {
             llmApiKey: s.get_string('llm-api-key'),
             llmTimeoutMs: s.get_int('llm-timeout-ms'),
             llmMaxWidth: s.get_int('llm-max-width'),
+            llmMaxRequests: s.get_int('llm-max-requests'),
+            conditionParallelism: s.get_int('condition-parallelism'),
+            llmKeepAliveMs: s.get_int('llm-keep-alive-ms'),
+            llmCacheTtlMs: s.get_int('llm-cache-ttl-ms'),
+            llmCacheDistance: s.get_int('llm-cache-distance'),
+            frameFreshMs: s.get_int('frame-fresh-ms'),
             controlSocket: s.get_string('control-socket'),
             eventSocket: s.get_string('event-socket'),
             recordGapMs: s.get_int('record-gap-ms'),
+            traceRuns: s.get_boolean('trace-runs'),
         };
     }
 }
@@ -0,0 +1,241 @@
+// Where a run's time goes, on one timeline: each step, the wait for the
+// daemon's queue, the request and what the daemon did with it, each capture,
+// encode, search and model call. Written as a Chrome trace, which Perfetto
+// (ui.perfetto.dev) and chrome://tracing open as they are.
+//
+// Off unless "Trace runs" is on. While no traced run is going, a span costs
+// one comparison and records nothing.
+//
+// A module singleton, like the problem list: most spans come from shared code
+// — the daemon client, the frame cache, the model client — which does not know
+// which macro asked. So a run's trace is everything that happened while it
+// ran. With several macros going, it shows the others too, and they are often
+// the answer to why this one was slow.
+//
+// The daemon stamps its stages of a /play with CLOCK_MONOTONIC, the clock
+// GLib.get_monotonic_time() reads, so they go into the same timeline as they
+// are, under a process of their own.
+
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+
+/** One event in Chrome's trace format; times in µs. */
+export interface TraceEvent {
+    name: string;
+    cat: string;
+    ph: 'X' | 'M';
+    ts: number;
+    dur?: number;
+    pid: number;
+    tid: number;
+    args?: Record<string, unknown>;
+}
+
+/** A span with its times already known, such as the ones the daemon reports. */
+export interface TimedSpan {
+    name: string;
+    start: number;
+    end: number;
+    args?: Record<string, unknown>;
+}
+
+/** The trace's two processes. */
+export const SHELL_PID = 1;
+export const DAEMON_PID = 2;
+
+/** Spans kept at most, oldest dropped first: a run left tracing all day must not eat the shell. */
+const MAX_EVENTS = 200000;
+/** Traces kept on disk; the oldest go as new ones are written. */
+const MAX_TRACES = 20;
+
+/**
+ * A row of the timeline. Spans on one row must not overlap, so a category
+ * gets as many rows as it has spans going at once: `_lane` finds the first
+ * one that is free.
+ */
+interface Lane {
+    pid: number;
+    tid: number;
+    category: string;
+    /** What the timeline calls it: the category, numbered from the second row on. */
+    name: string;
+    /** The latest end of anything on it. */
+    end: number;
+}
+
+/** One traced run, from `begin` to `finish`. */
+export interface TraceSession {
+    started: number;
+}
+
+let promisified = false;
+
+function ensurePromisified(): void {
+    if (promisified) {
+        return;
+    }
+    promisified = true;
+    const gio = Gio as unknown as {
+        _promisify: (proto: object, method: string, finish?: string) => void;
+    };
+    try {
+        gio._promisify(Gio.File.prototype, 'replace_contents_bytes_async', 'replace_contents_finish');
+    } catch {
+        // Already promisified by the shell or another extension.
+    }
+}
+
+interface AsyncFile {
+    replace_contents_bytes_async(
+        contents: GLib.Bytes, etag: string | null, makeBackup: boolean,
+        flags: Gio.FileCreateFlags, cancellable: Gio.Cancellable | null,
+    ): Promise<[boolean, string]>;
+}
+
+export class Tracer {
+    private _events: TraceEvent[] = [];
+    private _lanes: Lane[] = [];
+    private _sessions = new Set<TraceSession>();
+
+    /** Whether anything is being traced right now. */
+    get active(): boolean {
+        return this._sessions.size > 0;
+    }
+
+    /** Now, for a span about to begin; 0 when nothing is being traced. */
+    start(): number {
+        return this._sessions.size > 0 ? GLib.get_monotonic_time() : 0;
+    }
+
+    /** A span from `start`, as `start()` gave it, to now. Nothing for a start of 0. */
+    end(start: number, name: string, category: string, args?: Record<string, unknown>): void {
+        if (start && this._sessions.size > 0) {
+            this.add(SHELL_PID, category, [{ name, start, end: GLib.get_monotonic_time(), args }]);
+        }
+    }
+
+    /** `work` as a span that ends when it settles, either way. */
+    wrap<T>(work: Promise<T>, name: string, category: string, args?: Record<string, unknown>): Promise<T> {
+        const start = this.start();
+        if (!start) {
+            return work;
+        }
+        return work.then(value => {
+            this.end(start, name, category, args);
+            return value;
+        }, error => {
+            this.end(start, name, category, { ...args, error: (error as Error)?.message });
+            throw error;
+        });
+    }
+
+    /** Spans that follow one another, put on one row of `category` together. */
+    add(pid: number, category: string, spans: TimedSpan[]): void {
+        if (this._sessions.size === 0 || spans.length === 0) {
+            return;
+        }
+        const lane = this._lane(pid, category, spans[0].start, spans[spans.length - 1].end);
+        for (const span of spans) {
+            this._events.push({
+                name: span.name,
+                cat: category,
+                ph: 'X',
+                ts: span.start,
+                dur: Math.max(0, span.end - span.start),
+                pid,
+                tid: lane.tid,
+                args: span.args,
+            });
+        }
+        if (this._events.length > MAX_EVENTS) {
+            this._events.splice(0, this._events.length - MAX_EVENTS);
+        }
+    }
+
+    /** Start recording, for one run. */
+    begin(): TraceSession {
+        const session = { started: GLib.get_monotonic_time() };
+        this._sessions.add(session);
+        return session;
+    }
+
+    /**
+     * Stop recording for this run, and hand back what happened while it ran,
+     * ready to write out. What no other traced run can still want is let go.
+     */
+    finish(session: TraceSession): TraceEvent[] {
+        this._sessions.delete(session);
+        const events = this._events.filter(event => event.ts + (event.dur ?? 0) >= session.started);
+        const used = new Set(events.map(event => `${event.pid}:${event.tid}`));
+        const named = (kind: string, pid: number, tid: number, name: string): TraceEvent =>
+            ({ name: kind, cat: '__metadata', ph: 'M', ts: 0, pid, tid, args: { name } });
+        const names = [
+            named('process_name', SHELL_PID, 0, 'gnome-shell (macroclickwerk)'),
+            named('process_name', DAEMON_PID, 0, 'macroclickwerk daemon'),
+            ...this._lanes.filter(lane => used.has(`${lane.pid}:${lane.tid}`))
+                .map(lane => named('thread_name', lane.pid, lane.tid, lane.name)),
+        ];
+
+        if (this._sessions.size === 0) {
+            this._events = [];
+            this._lanes = [];
+        } else {
+            const oldest = Math.min(...[...this._sessions].map(other => other.started));
+            this._events = this._events.filter(event => event.ts + (event.dur ?? 0) >= oldest);
+        }
+        return [...names, ...events];
+    }
+
+    private _lane(pid: number, category: string, start: number, end: number): Lane {
+        const rows = this._lanes.filter(lane => lane.pid === pid && lane.category === category);
+        const free = rows.find(lane => lane.end <= start);
+        if (free) {
+            free.end = end;
+            return free;
+        }
+        const lane: Lane = {
+            pid,
+            tid: this._lanes.filter(other => other.pid === pid).length + 1,
+            category,
+            name: rows.length === 0 ? category : `${category} ${rows.length + 1}`,
+            end,
+        };
+        this._lanes.push(lane);
+        return lane;
+    }
+}
+
+/** The one tracer, shared by every running macro. */
+export const tracer = new Tracer();
+
+/**
+ * Write a run's trace to the cache directory, as JSON that Perfetto opens;
+ * resolves to where it went. Only the newest MAX_TRACES are kept.
+ */
+export async function writeTrace(events: TraceEvent[], macroName: string): Promise<string> {
+    ensurePromisified();
+    const dir = GLib.build_filenamev([GLib.get_user_cache_dir(), 'macroclickwerk', 'traces']);
+    GLib.mkdir_with_parents(dir, 0o700);
+
+    const stamp = GLib.DateTime.new_now_local().format('%Y%m%d-%H%M%S') ?? '';
+    const safe = macroName.replace(/[^A-Za-z0-9_-]+/g, '-').replace(/^-+|-+$/g, '') || 'macro';
+    const path = GLib.build_filenamev([dir, `${stamp}-${safe}.json`]);
+    const json = JSON.stringify({ traceEvents: events, displayTimeUnit: 'ms' });
+    const file = Gio.File.new_for_path(path) as Gio.File & AsyncFile;
+    await file.replace_contents_bytes_async(new GLib.Bytes(new TextEncoder().encode(json)), null, false,
+        Gio.FileCreateFlags.PRIVATE | Gio.FileCreateFlags.REPLACE_DESTINATION, null);
+
+    // Names start with the time, so sorted they are oldest first.
+    const traces: string[] = [];
+    const children = Gio.File.new_for_path(dir).enumerate_children('standard::name', Gio.FileQueryInfoFlags.NONE, null);
+    for (let info = children.next_file(null); info; info = children.next_file(null)) {
+        if (info.get_name().endsWith('.json')) {
+            traces.push(info.get_name());
+        }
+    }
+    children.close(null);
+    for (const name of traces.sort().slice(0, Math.max(0, traces.length - MAX_TRACES))) {
+        Gio.File.new_for_path(GLib.build_filenamev([dir, name])).delete(null);
+    }
+    return path;
+}
@@ -0,0 +1,147 @@
+// Cost of a colour check, the PNG round trip against reading the stage.
+//
+// This one needs a compositor to read from, so it does not run under plain
+// gjs: load it into a running shell — the nested one from ./run.sh will do —
+// from Looking Glass (Alt+F2, `lg`):
+//
+//   import('file:///path/to/gnome-shell/test/bench-capture.mjs')
+//
+// and read the results in the journal, which ./run.sh already follows.
+//
+// A pixel check is timed both ways: a 1×1 screenshot_area, encoded to PNG and
+// decoded again, against pick_color. An area check always takes the capture;
+// what is compared there is counting the matching pixels the old way, an
+// object and a square root per pixel, against the loop over the raw bytes.
+// Then several macros checking their own patches of screen at once, each
+// capturing for itself against sharing frames through the cache. Last, what a
+// model check costs the desktop: the longest the main loop went without a turn
+// while a full-screen capture became the picture sent, encoded in the shell
+// against handed to the helper process.
+
+import GLib from 'gi://GLib';
+
+import { EncodeWorker, encodeForLlm } from '../dist/src/encoder.js';
+import {
+    capturePixel, captureRegion, captureScreen, colorCoverage, colorDistance, frameCache, parseColor, pixelsOf,
+    readPixel,
+} from '../dist/src/screenshot.js';
+
+const ROUNDS = 200;
+const AREAS = [[10, 10], [100, 100], [400, 300]];
+const target = parseColor('#3584e4');
+const TOLERANCE = 24;
+// Four macros, each polling a 40×40 patch of its own near the others'.
+const PATCHES = [[100, 100], [160, 100], [100, 160], [160, 160]];
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+const sleep = ms => new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, ms,
+    () => (resolve(), GLib.SOURCE_REMOVE)));
+
+/** `restMs` passes before each round, outside what is timed. */
+async function time(label, rounds, work, restMs = 0) {
+    const took = [];
+    for (let i = 0; i < rounds; i++) {
+        if (restMs > 0) {
+            await sleep(restMs);
+        }
+        const start = GLib.get_monotonic_time();
+        await work(i);
+        took.push((GLib.get_monotonic_time() - start) / 1000);
+    }
+    report(label, took);
+}
+
+function report(label, took) {
+    took.sort((a, b) => a - b);
+    const mean = took.reduce((sum, x) => sum + x, 0) / took.length;
+    log(`macroclickwerk bench: ${label.padEnd(28)} mean ${mean.toFixed(3)} ms, ` +
+        `p50 ${percentile(took, 0.5).toFixed(3)}, p95 ${percentile(took, 0.95).toFixed(3)}, ` +
+        `max ${took[took.length - 1].toFixed(3)}`);
+}
+
+/**
+ * The longest the main loop went without a turn while `work` ran: a tick every
+ * millisecond at high priority, and the widest gap between two of them.
+ */
+async function stall(work) {
+    let last = GLib.get_monotonic_time();
+    let longest = 0;
+    const tick = GLib.timeout_add(GLib.PRIORITY_HIGH, 1, () => {
+        const now = GLib.get_monotonic_time();
+        longest = Math.max(longest, now - last);
+        last = now;
+        return GLib.SOURCE_CONTINUE;
+    });
+    await work();
+    longest = Math.max(longest, GLib.get_monotonic_time() - last);
+    GLib.source_remove(tick);
+    return longest / 1000;
+}
+
+/** What colorCoverage() did before it worked on raw bytes. */
+function coverageByObject(pixels) {
+    let matched = 0;
+    for (let y = 0; y < pixels.height; y++) {
+        for (let x = 0; x < pixels.width; x++) {
+            if (colorDistance(readPixel(pixels, x, y), target) <= TOLERANCE) {
+                matched++;
+            }
+        }
+    }
+    return matched / Math.max(1, pixels.width * pixels.height);
+}
+
+// Walk the pixel around a little so no layer can hand back a cached answer.
+const spot = i => [100 + (i % 37), 100 + (i % 23)];
+
+log(`macroclickwerk bench: ${ROUNDS} rounds each`);
+const freshMs = frameCache.freshMs;
+// Every round its own capture, until the part that is about sharing them.
+frameCache.freshMs = 0;
+await time('pixel, PNG round trip', ROUNDS, async i => {
+    readPixel(pixelsOf(await captureRegion(...spot(i), 1, 1)));
+});
+await time('pixel, read off the stage', ROUNDS, async i => {
+    await capturePixel(...spot(i));
+});
+
+for (const [w, h] of AREAS) {
+    const rounds = Math.max(10, Math.round(ROUNDS * 100 / (w * h)));
+    await time(`${w}×${h}, per-pixel objects`, rounds, async i => {
+        coverageByObject(pixelsOf(await captureRegion(...spot(i), w, h)));
+    });
+    await time(`${w}×${h}, raw bytes`, rounds, async i => {
+        colorCoverage(pixelsOf(await captureRegion(...spot(i), w, h)), target, TOLERANCE);
+    });
+}
+
+for (const [label, window] of [['patches, each its own', 0], ['patches, shared', 50]]) {
+    frameCache.freshMs = window;
+    const stats = { captured: 0, reused: 0 };
+    // Rounds apart by more than the window, as polling macros would be: the
+    // sharing measured is within a round, not a frame left over from the last.
+    await time(label, ROUNDS / 4, () => Promise.all(PATCHES.map(async ([x, y]) => {
+        colorCoverage(pixelsOf(await captureRegion(x, y, 40, 40, stats)), target, TOLERANCE);
+    })), 60);
+    log(`macroclickwerk bench:   ${stats.captured} captures taken, ${stats.reused} shared`);
+}
+frameCache.freshMs = freshMs;
+
+// One screen, encoded over and over: the capture is not what is measured.
+const screen = await captureScreen();
+const worker = new EncodeWorker();
+await worker.encode(screen, 1280); // the helper starts on first use
+for (const [label, encode] of [
+    ['model picture, in the shell', () => encodeForLlm(screen, 1280)],
+    ['model picture, in the helper', () => worker.encode(screen, 1280)],
+]) {
+    const stalls = [];
+    await time(label, ROUNDS / 10, async () => {
+        stalls.push(await stall(encode));
+    });
+    report(`  main loop stalled`, stalls);
+}
+worker.destroy();
@@ -0,0 +1,208 @@
+// Colour conditions in one tree, a capture per leaf against a capture per
+// planned group; counting coverage to the end against stopping once the
+// answer is certain; and the model checks of an `or` asked one after another
+// against all at once, the first yes cancelling the rest.
+//
+// The stage is stood in for by a pixbuf of a made-up screen. A capture crops
+// it and goes through a PNG encode and decode, as screenshot_area's does, so
+// what a capture costs here is roughly what it costs in the shell. Needs the
+// Shell typelib, as prefsload.mjs does:
+//
+//   GI_TYPELIB_PATH=/usr/lib/gnome-shell/girepository-1.0 \
+//   LD_LIBRARY_PATH=/usr/lib/gnome-shell gjs -m test/bench-conditions.mjs
+
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+import GdkPixbuf from 'gi://GdkPixbuf';
+
+import { ConditionEvaluator } from '../dist/src/conditions.js';
+import { newCondition } from '../dist/src/model.js';
+import {
+    colorCoverage, coverageAtLeast, frameCache, parseColor, pixelsOf,
+} from '../dist/src/screenshot.js';
+
+const ROUNDS = 40;
+const WIDTH = 1920;
+const HEIGHT = 1080;
+
+// --- the stand-in stage ----------------------------------------------------
+
+globalThis.global = { stage: { width: WIDTH, height: HEIGHT } };
+
+// Blue on the left half, grey on the right, so some areas match and some do not.
+const screen = GdkPixbuf.Pixbuf.new(GdkPixbuf.Colorspace.RGB, false, 8, WIDTH, HEIGHT);
+screen.fill(0x888888ff);
+screen.new_subpixbuf(0, 0, WIDTH / 2, HEIGHT).fill(0x3584e4ff);
+
+let captures = 0;
+frameCache.shoot = async rect => {
+    captures++;
+    const part = screen.new_subpixbuf(rect.x, rect.y, rect.w, rect.h).copy();
+    const [, png] = part.save_to_bufferv('png', [], []);
+    const input = Gio.MemoryInputStream.new_from_bytes(new GLib.Bytes(png));
+    const decoded = GdkPixbuf.Pixbuf.new_from_stream(input, null);
+    input.close(null);
+    return decoded;
+};
+// Every evaluation its own captures: what is measured is the planning.
+frameCache.freshMs = 0;
+
+// --- the trees ---------------------------------------------------------------
+
+function leaf(x, y, w, h, coverage = 0.5) {
+    const condition = newCondition('color');
+    Object.assign(condition, { x, y, w, h, color: '#3584e4', tolerance: 24, coverage });
+    return condition;
+}
+
+/** and/or alternating `depth` levels down, a colour leaf beside each level. */
+function deep(depth) {
+    let node = leaf(900, 500, 40, 40);
+    for (let i = depth - 1; i >= 0; i--) {
+        const kind = i % 2 === 0 ? 'and' : 'or';
+        // The leaf beside an `or` fails, so the walk goes on down.
+        const beside = kind === 'or' ? leaf(980 + i * 4, 500, 20, 20) : leaf(900 - i * 4, 460, 20, 20);
+        node = { type: kind, of: [beside, node] };
+    }
+    return node;
+}
+
+// Four big areas side by side, all of which must match.
+const large = {
+    type: 'and',
+    of: [leaf(100, 100, 400, 300), leaf(500, 100, 400, 300), leaf(100, 400, 400, 300), leaf(500, 400, 400, 300)],
+};
+
+const config = { frameFreshMs: 0 };
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function report(label, took, extra = '') {
+    took.sort((a, b) => a - b);
+    const mean = took.reduce((sum, x) => sum + x, 0) / took.length;
+    print(`${label.padEnd(30)} mean ${mean.toFixed(2)} ms, p50 ${percentile(took, 0.5).toFixed(2)}, ` +
+          `p95 ${percentile(took, 0.95).toFixed(2)}${extra}`);
+}
+
+async function measure(label, tree, batch) {
+    const evaluator = new ConditionEvaluator(config, undefined, undefined, undefined, { batchColours: batch });
+    captures = 0;
+    const took = [];
+    let result;
+    for (let i = 0; i < ROUNDS; i++) {
+        const start = GLib.get_monotonic_time();
+        result = await evaluator.evaluate(tree);
+        took.push((GLib.get_monotonic_time() - start) / 1000);
+    }
+    evaluator.destroy();
+    report(label, took, `  (${(captures / ROUNDS).toFixed(1)} captures each, says ${result})`);
+    return result;
+}
+
+print(`${ROUNDS} evaluations each, on a ${WIDTH}×${HEIGHT} stand-in stage`);
+for (const [name, tree] of [['deep tree', deep(8)], ['four 400×300 areas', large]]) {
+    const apart = await measure(`${name}, leaf at a time`, tree, false);
+    const planned = await measure(`${name}, planned`, tree, true);
+    if (apart !== planned) {
+        print(`MISMATCH ${name}: ${apart} against ${planned}`);
+        imports.system.exit(1);
+    }
+}
+
+// Counting alone, no capture: a full-screen area that is plainly blue, or
+// plainly not.
+const whole = pixelsOf(screen);
+const blue = parseColor('#3584e4');
+for (const [name, need] of [['needs 30%, has 50%', 0.3], ['needs 80%, has 50%', 0.8]]) {
+    for (const [label, count] of [
+        ['to the end', () => colorCoverage(whole, blue, 24) >= need],
+        ['until certain', () => coverageAtLeast(whole, blue, 24, need).result],
+    ]) {
+        const took = [];
+        for (let i = 0; i < ROUNDS / 4; i++) {
+            const start = GLib.get_monotonic_time();
+            count();
+            took.push((GLib.get_monotonic_time() - start) / 1000);
+        }
+        report(`${name}, ${label}`, took);
+    }
+}
+
+// Three model checks in an `or`, against a stand-in model that takes as long
+// as each prompt says and answers what it says. No request leaves the machine.
+const answers = { 'no, after 300ms': [300, false], 'yes, after 100ms': [100, true], 'yes, after 400ms': [400, true] };
+const either = { type: 'or', of: Object.keys(answers).map(prompt => ({ ...newCondition('llm'), prompt })) };
+for (const parallelism of [1, 4]) {
+    const evaluator = new ConditionEvaluator({
+        ...config, llmEndpoint: 'http://stand-in/', llmModel: 'stand-in', llmMaxRequests: 4, llmCacheTtlMs: 0,
+        conditionParallelism: parallelism,
+    }, undefined, undefined, undefined, { askTogether: false });
+    evaluator._encoder.encode = async () => ({ dataUri: '', checksum: 'stand-in' });
+    let dropped = 0;
+    evaluator._llm._ask = (prompt, image, settings, cancellable) => new Promise((resolve, reject) => {
+        const [ms, match] = answers[prompt];
+        const id = GLib.timeout_add(GLib.PRIORITY_DEFAULT, ms, () => {
+            resolve({ match, reason: prompt, latencyMs: ms });
+            return GLib.SOURCE_REMOVE;
+        });
+        cancellable.connect('cancelled', () => {
+            GLib.source_remove(id);
+            dropped++;
+            reject(new Error('cancelled'));
+        });
+    });
+    const took = [];
+    let result;
+    for (let i = 0; i < ROUNDS / 8; i++) {
+        const start = GLib.get_monotonic_time();
+        result = await evaluator.evaluate(either);
+        took.push((GLib.get_monotonic_time() - start) / 1000);
+    }
+    evaluator.destroy();
+    report(`or of 3 model checks, ${parallelism} at once`, took,
+        `  (says ${result}, ${(dropped / (ROUNDS / 8)).toFixed(1)} requests dropped each)`);
+    if (result !== true) {
+        print('MISMATCH: the or should have said yes');
+        imports.system.exit(1);
+    }
+}
+
+// Three questions about the same screen in an `and`, all of them needed: one
+// picture each, or one picture for the three. The stand-in takes 300ms to read
+// a picture and 20ms more per question, roughly where a local model spends it.
+const all = { type: 'and', of: ['green?', 'dialog open?', 'timer at zero?'].map(prompt => ({ ...newCondition('llm'), prompt })) };
+for (const together of [false, true]) {
+    const evaluator = new ConditionEvaluator({
+        ...config, llmEndpoint: 'http://stand-in/', llmModel: 'stand-in', llmMaxRequests: 1, llmCacheTtlMs: 0,
+        conditionParallelism: 4,
+    }, undefined, undefined, undefined, { askTogether: together });
+    evaluator._encoder.encode = async () => ({ dataUri: '', checksum: 'stand-in' });
+    let pictures = 0;
+    evaluator._llm._send = (instruction, image, settings, outer, maxTokens, reading) => new Promise(resolve => {
+        const questions = (instruction.match(/^\d+\. /gm) ?? ['']).length;
+        const content = questions > 1
+            ? JSON.stringify({ answers: Array.from({ length: questions }, (_, i) => ({ n: i + 1, match: true })) })
+            : '{"match": true}';
+        pictures++;
+        GLib.timeout_add(GLib.PRIORITY_DEFAULT, 300 + 20 * questions, () => {
+            resolve({ answer: reading.whole({ content, reasoning: '', finish: 'stop' }), latencyMs: 0 });
+            return GLib.SOURCE_REMOVE;
+        });
+    });
+    const took = [];
+    let result;
+    for (let i = 0; i < ROUNDS / 8; i++) {
+        const start = GLib.get_monotonic_time();
+        result = await evaluator.evaluate(all);
+        took.push((GLib.get_monotonic_time() - start) / 1000);
+    }
+    evaluator.destroy();
+    report(`and of 3 questions about one screen, ${together ? 'asked together' : 'one picture each'}`, took,
+        `  (says ${result}, ${(pictures / (ROUNDS / 8)).toFixed(1)} pictures sent each)`);
+    if (result !== true) {
+        print('MISMATCH: the and should have said yes');
+        imports.system.exit(1);
+    }
+}
@@ -0,0 +1,173 @@
+// Throughput of several macros at once: keyboard-only macros typing while a
+// pointer macro walks to clicks, with one queue for all input against a queue
+// per input.
+//
+// The daemon is stood in for by a socket server in this process, as in
+// bench-steps.mjs, that keeps the real daemon's rule: one train per clone at a
+// time, "busy" for a second one. Motion moves a pretend pointer by half of what
+// was asked, the way an acceleration curve gets in the way, so a click at a
+// position is a walk of several passes — nudge, read back, nudge again.
+//
+// What counts for the typists is how far apart their key presses really land
+// against how far apart the macro says they should; for the walker, how many
+// clicks it got in meanwhile.
+
+import GLib from 'gi://GLib';
+
+import { DaemonClient } from '../dist/src/daemon.js';
+import { BTN_MISC, EV_KEY, EV_REL, KEY_OK, REL_X, REL_Y } from '../dist/src/keymap.js';
+import { newMacro, newStep } from '../dist/src/model.js';
+import { MacroRunner } from '../dist/src/runner.js';
+import { listen, readRequest, respond } from './stand-in.mjs';
+
+const TYPISTS = ['KEY_A', 'KEY_B'];
+const TAPS = 60;
+const HOLD_MS = 10;
+const WAIT_MS = 20;
+
+// --- the stand-in daemon ---------------------------------------------------
+
+const socketPath = GLib.build_filenamev([GLib.get_tmp_dir(), `mcw-bench-leases-${new Date().getTime()}.sock`]);
+const presses = new Map();
+let clicks = 0;
+let pointer = [0, 0];
+const busy = new Set();
+
+globalThis.global = { get_pointer: () => pointer };
+
+function clones(events) {
+    const uses = new Set();
+    for (const event of events) {
+        uses.add(event.type === EV_KEY && (event.code < BTN_MISC || event.code >= KEY_OK) ? 'keyboard' : 'pointer');
+    }
+    return [...uses];
+}
+
+async function play(events) {
+    const start = GLib.get_monotonic_time();
+    let at = 0;
+    for (const event of events) {
+        at += event.dt;
+        if (event.type === EV_REL && event.code === REL_X) {
+            pointer = [pointer[0] + event.value / 2, pointer[1]];
+        } else if (event.type === EV_REL && event.code === REL_Y) {
+            pointer = [pointer[0], pointer[1] + event.value / 2];
+        } else if (event.type === EV_KEY && event.value === 1) {
+            if (event.code >= BTN_MISC) {
+                clicks++;
+            } else {
+                if (!presses.has(event.code)) {
+                    presses.set(event.code, []);
+                }
+                presses.get(event.code).push(start + at);
+            }
+        }
+    }
+    await new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, Math.round(at / 1000),
+        () => (resolve(), GLib.SOURCE_REMOVE)));
+    return `{"played":${events.length},"aborted":false}`;
+}
+
+async function serve(connection) {
+    const { line, body } = await readRequest(connection);
+
+    let status = '200 OK';
+    let answer = '{}';
+    if (line.startsWith('POST /play')) {
+        const { events } = JSON.parse(body);
+        const uses = clones(events);
+        if (uses.some(use => busy.has(use))) {
+            status = '409 Conflict';
+            answer = '{"error":"busy"}';
+        } else {
+            uses.forEach(use => busy.add(use));
+            try {
+                answer = await play(events);
+            } finally {
+                uses.forEach(use => busy.delete(use));
+            }
+        }
+    }
+
+    await respond(connection, status, answer);
+}
+
+const standIn = listen(serve, socketPath);
+
+// --- the macros ------------------------------------------------------------
+
+function typist(code) {
+    const macro = newMacro(code);
+    for (let i = 0; i < TAPS; i++) {
+        const key = newStep('key');
+        key.code = code;
+        key.holdMs = HOLD_MS;
+        const wait = newStep('wait');
+        wait.ms = WAIT_MS;
+        macro.body.push(key, wait);
+    }
+    return macro;
+}
+
+// Back and forth between two spots for as long as the typists type.
+const walker = newMacro('walker');
+const loop = newStep('loop');
+loop.count = 'forever';
+for (const x of [600, 0]) {
+    const click = newStep('click');
+    click.x = x;
+    click.y = 0;
+    loop.body.push(click);
+}
+walker.body.push(loop);
+
+const evaluator = { evaluate: async () => true };
+// No compositor here: every click walks, the fallback a grabbed pointer gets.
+MacroRunner._seat = null;
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+async function measure(label, shared) {
+    presses.clear();
+    clicks = 0;
+    pointer = [0, 0];
+    const daemon = new DaemonClient(socketPath, socketPath, { sharedQueue: shared });
+
+    const walking = new MacroRunner(daemon, evaluator, {}, {}, {});
+    const walked = walking.run(walker);
+    const started = GLib.get_monotonic_time();
+    await Promise.all(TYPISTS.map(code => {
+        // A request per tap, so every tap takes its own turn: the waiting for
+        // turns is what is being measured, not the daemon's clock.
+        const runner = new MacroRunner(daemon, evaluator, {}, {}, {}, { coalesce: false });
+        return runner.run(typist(code));
+    }));
+    const total = (GLib.get_monotonic_time() - started) / 1000;
+    walking.stop(false);
+    await walked;
+
+    // Added latency per tap: the real gap between presses, less the gap the
+    // macro asks for, over every typist.
+    const extra = [];
+    for (const times of presses.values()) {
+        for (let i = 1; i < times.length; i++) {
+            extra.push((times[i] - times[i - 1]) / 1000 - (HOLD_MS + WAIT_MS));
+        }
+    }
+    extra.sort((a, b) => a - b);
+    const mean = extra.reduce((sum, x) => sum + x, 0) / extra.length;
+    print(`${label.padEnd(16)} added per tap: mean ${mean.toFixed(2)} ms, ` +
+          `p50 ${percentile(extra, 0.5).toFixed(2)}, p95 ${percentile(extra, 0.95).toFixed(2)}, ` +
+          `max ${extra[extra.length - 1].toFixed(2)}  ` +
+          `(typing ${total.toFixed(0)} ms, ideal ${TAPS * (HOLD_MS + WAIT_MS)}; ` +
+          `${clicks} clicks walked meanwhile)`);
+}
+
+print(`${TYPISTS.length} typists of ${TAPS} taps, ${HOLD_MS} ms held, ${WAIT_MS} ms apart, ` +
+      'beside a macro walking to clicks');
+await measure('one queue', true);
+await measure('queue per input', false);
+
+standIn.stop();
@@ -0,0 +1,101 @@
+// Step-to-step latency of the runner, step at a time against coalesced trains.
+//
+// The daemon is stood in for by a socket server in this process that speaks
+// just enough HTTP for /play: it takes the train, "plays" it on its own clock —
+// noting when each event would have gone out — and answers once the train is
+// over, the way the real one does. Everything between the runner and that
+// socket is the real code, so a request's cost and the main loop's timer slack
+// are both in what gets measured.
+//
+// The macro is a burst of key taps with short waits between them. What counts
+// is how far apart the key presses really land against how far apart the
+// macro says they should: everything past that is latency the runner added.
+
+import GLib from 'gi://GLib';
+
+import { DaemonClient } from '../dist/src/daemon.js';
+import { EV_KEY } from '../dist/src/keymap.js';
+import { newMacro, newStep } from '../dist/src/model.js';
+import { MacroRunner } from '../dist/src/runner.js';
+import { listen, readRequest, respond } from './stand-in.mjs';
+
+const TAPS = 40;
+const HOLD_MS = 20;
+const WAIT_MS = 30;
+
+// --- the stand-in daemon ---------------------------------------------------
+
+const socketPath = GLib.build_filenamev([GLib.get_tmp_dir(), `mcw-bench-steps-${new Date().getTime()}.sock`]);
+const presses = [];
+let requests = 0;
+
+async function serve(connection) {
+    const { line, body } = await readRequest(connection);
+
+    let answer = '{}';
+    if (line.startsWith('POST /play')) {
+        requests++;
+        const { events } = JSON.parse(body);
+        const start = GLib.get_monotonic_time();
+        let at = 0;
+        for (const event of events) {
+            at += event.dt;
+            if (event.type === EV_KEY && event.value === 1) {
+                presses.push(start + at);
+            }
+        }
+        await new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, Math.round(at / 1000),
+            () => (resolve(), GLib.SOURCE_REMOVE)));
+        answer = `{"played":${events.length},"aborted":false}`;
+    }
+
+    await respond(connection, '200 OK', answer);
+}
+
+const daemon = new DaemonClient(socketPath, socketPath);
+const standIn = listen(serve, socketPath);
+
+// --- the runs --------------------------------------------------------------
+
+const macro = newMacro('burst');
+for (let i = 0; i < TAPS; i++) {
+    const key = newStep('key');
+    key.code = 'KEY_A';
+    key.holdMs = HOLD_MS;
+    const wait = newStep('wait');
+    wait.ms = WAIT_MS;
+    macro.body.push(key, wait);
+}
+const evaluator = { evaluate: async () => true };
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+async function measure(label, coalesce) {
+    presses.length = 0;
+    requests = 0;
+    const runner = new MacroRunner(daemon, evaluator, {}, {}, {}, { coalesce });
+    const started = GLib.get_monotonic_time();
+    await runner.run(macro);
+    const total = (GLib.get_monotonic_time() - started) / 1000;
+
+    // Added latency per step: the real gap between presses, less the gap the
+    // macro asks for.
+    const extra = [];
+    for (let i = 1; i < presses.length; i++) {
+        extra.push((presses[i] - presses[i - 1]) / 1000 - (HOLD_MS + WAIT_MS));
+    }
+    extra.sort((a, b) => a - b);
+    const mean = extra.reduce((sum, x) => sum + x, 0) / extra.length;
+    print(`${label.padEnd(14)} ${String(requests).padStart(4)} requests  ` +
+          `added per step: mean ${mean.toFixed(2)} ms, p50 ${percentile(extra, 0.5).toFixed(2)}, ` +
+          `p95 ${percentile(extra, 0.95).toFixed(2)}, max ${extra[extra.length - 1].toFixed(2)}  ` +
+          `(run ${total.toFixed(0)} ms, ideal ${TAPS * (HOLD_MS + WAIT_MS)})`);
+}
+
+print(`${TAPS} taps of ${HOLD_MS} ms, ${WAIT_MS} ms apart`);
+await measure('step at a time', false);
+await measure('coalesced', true);
+
+standIn.stop();
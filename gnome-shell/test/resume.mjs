@@ -5,8 +5,9 @@
 import GLib from 'gi://GLib';
 
 import { MacroRunner } from '../dist/src/runner.js';
-import { newMacro, newStep, pathToStep } from '../dist/src/model.js';
+import { compileSteps, newMacro, newStep, pathToStep } from '../dist/src/model.js';
 import { clearProblems, listProblems } from '../dist/src/problems.js';
+import { damageWatcher } from '../dist/src/damage.js';
 
 let failures = 0;
 const check = (name, cond, extra = '') => {
@@ -23,11 +24,24 @@ const daemon = {
 
 let condition = true;
 let evaluated = 0;
+/** How long a check takes, for one as slow as a model's. */
+let evaluateMs = 0;
 const evaluator = {
     evaluate: async () => {
         evaluated++;
+        if (evaluateMs > 0) {
+            await new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, evaluateMs, () => (resolve(), GLib.SOURCE_REMOVE)));
+        }
         return condition;
     },
+    regionsOf: () => [{ x: 0, y: 0, w: 10, h: 10 }],
+};
+
+// The compositor, as far as a wait until can tell: whatever the test reports.
+let report = null;
+damageWatcher.connect = push => {
+    report = push;
+    return () => { report = null; };
 };
 
 /** A step that does nothing but be identifiable in the trace. */
@@ -130,6 +144,26 @@ await trace(looped, '', (runner, id) => {
 });
 check('currentStepId is the innermost step', at === l2.id, at);
 
+// Every check in a run counts its screen captures into that run's tally, and
+// a new run starts a new one.
+{
+    const looking = {
+        evaluate: async (_condition, frames) => {
+            frames.captured++;
+            frames.reused += 2;
+            return false;
+        },
+    };
+    const runner = new MacroRunner(daemon, looking, {}, {}, {});
+    const branchy = newMacro('branchy');
+    branchy.body.push(named('if', 'c1'), named('if', 'c2'));
+    await runner.run(branchy);
+    check('a run counts the captures its checks took and shared',
+          runner.frames.captured === 2 && runner.frames.reused === 4, JSON.stringify(runner.frames));
+    await runner.run(branchy);
+    check('and the next run counts afresh', runner.frames.captured === 2, JSON.stringify(runner.frames));
+}
+
 const broken = newMacro('broken');
 const bad = named('key', 'bad');
 bad.code = 'no-such-key';
@@ -143,6 +177,41 @@ check('a failing run stops at the step that threw', failed.seen === 'badLoop ok
 check('and reports it as the place to continue from',
       failed.runner.failedStepId === bad.id, failed.runner.failedStepId);
 
+// --- runs of primitives --------------------------------------------------
+
+// Keys and the waits between them go to the daemon as one train, with the
+// waits as gaps between events, and each step still shows up as it starts.
+{
+    const trains = [];
+    const counting = {
+        play: async events => {
+            trains.push(events);
+            return { aborted: false };
+        },
+        stop: async () => {},
+    };
+    const burst = newMacro('burst');
+    const gap = named('wait', 'gap');
+    gap.ms = 40;
+    const tail = named('wait', 'tail');
+    tail.ms = 0;
+    burst.body.push(named('key', 'k1'), gap, named('key', 'k2'), tail);
+
+    const seen = [];
+    const runner = new MacroRunner(counting, evaluator, {}, {}, {
+        onStepsChanged: path => {
+            if (path.length > 0) {
+                seen.push(NAMES.get(path[path.length - 1].id));
+            }
+        },
+    });
+    await runner.run(burst);
+    check('a run of keys and waits is one train', trains.length === 1, String(trains.length));
+    check('the wait is the gap before the next key', trains[0]?.[2]?.dt === 40000,
+          JSON.stringify(trains[0]?.map(e => e.dt)));
+    check('and every step is still entered in order', seen.join(' ') === 'k1 gap k2 tail', seen.join(' '));
+}
+
 // --- the path the resume walks ---------------------------------------------
 
 check('pathToStep finds a top-level step',
@@ -153,6 +222,47 @@ check('pathToStep reaches into an else branch',
       pathToStep(branched.body, e1.id).join('/') === `${branch.id}/${e1.id}`);
 check('pathToStep of a missing step is empty', pathToStep(flat.body, 'gone').length === 0);
 
+// --- the compiled program ------------------------------------------------
+
+// A run executes the flat program the tree compiles to: every step has an
+// entry in the index, and a break or continue already knows where it goes.
+{
+    const program = compileSteps(looped.body);
+    check('the index points at each step',
+          program.code[program.index.get(l2.id)]?.step === l2 &&
+          program.code[program.index.get(loop.id)]?.op === 'loop');
+    check('a loop has a counter of its own', program.loops === 1, String(program.loops));
+
+    const jumps = newMacro('jumps');
+    const outerLoop = named('loop', 'outer');
+    outerLoop.count = 2;
+    const skip = named('continue', 'skip');
+    const done = named('break', 'done');
+    const guard = named('if', 'guard');
+    guard.then.push(done);
+    guard.else = [skip];
+    outerLoop.body.push(named('key', 'j1'), guard, named('key', 'never'));
+    jumps.body.push(outerLoop, named('key', 'out'));
+
+    const compiled = compileSteps(jumps.body);
+    const target = id => compiled.code[compiled.index.get(id)].to;
+    check('a break jumps to the step after its loop',
+          compiled.code[target(done.id)]?.step?.id === jumps.body[1].id);
+    check('a continue jumps to the end of the pass',
+          compiled.code[target(skip.id)]?.op === 'next');
+
+    condition = false;
+    check('continue skips the rest of each pass',
+          (await trace(jumps)).seen === 'outer j1 guard skip j1 guard skip out');
+    condition = true;
+    check('break leaves the loop from inside an if',
+          (await trace(jumps)).seen === 'outer j1 guard done out');
+
+    const stray = newMacro('stray');
+    stray.body.push(named('key', 's1'), named('break', 'brk'), named('key', 's2'));
+    check('a break outside any loop ends the run', (await trace(stray)).seen === 's1 brk');
+}
+
 // --- two macros at once ----------------------------------------------------
 
 // Every enabled macro runs, and they run alongside each other rather than one
@@ -215,7 +325,7 @@ check('pathToStep of a missing step is empty', pathToStep(flat.body, 'gone').len
                     log.push('s');   // the other macro's scrolling
                 }
             } else {
-                log.push('c');
+                log.push(event.code >= 0x100 ? 'c' : 'k');
             }
         }
         return { aborted: false };
@@ -255,6 +365,63 @@ check('pathToStep of a missing step is empty', pathToStep(flat.body, 'gone').len
     // delta of 1, so its true distance can be up to 1.5.
     check('a click @ previous returns to where the excursion began',
           Math.abs(pointer[0] - 5) <= 2, String(pointer));
+
+    // The walk holds the pointer and nothing else: a macro that only types
+    // goes on typing while it lasts.
+    log.length = 0;
+    pointer = [0, 0];
+    const typing = newMacro('typing');
+    for (let i = 0; i < 4; i++) {
+        const key = newStep('key');
+        key.holdMs = 0;
+        const pause = newStep('wait');
+        pause.ms = 3;
+        typing.body.push(key, pause);
+    }
+    // A request per key, so each one can land mid-walk.
+    const typist = new MacroRunner(daemon, evaluator, {}, {}, {}, { coalesce: false });
+    // Nudges that take as long as real ones, so there is a walk to type into.
+    const instant = DaemonClient.prototype._play;
+    DaemonClient.prototype._play = async function (events) {
+        if (events.some(event => event.type === EV_REL)) {
+            await new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, 2,
+                () => (resolve(), GLib.SOURCE_REMOVE)));
+        }
+        return instant.call(this, events);
+    };
+    await Promise.all([start(walk), typist.run(typing)]);
+    DaemonClient.prototype._play = instant;
+    const mixed = log.join('');
+    check('keys are typed while another macro walks the pointer', /m+k+m/.test(mixed), mixed);
+    check('and the walk still clicks where it meant to', /^[mk]*c[ck]*$/.test(mixed), mixed);
+    // Each positioned step counts how long the pointer took to get there.
+    pointer = [0, 0];
+    const timed = new MacroRunner(daemon, evaluator, {}, {}, {});
+    await timed.run(walk);
+    check('a positioned step records its time to land',
+          timed.landing.total === 1 && timed.landing.missed === 0 &&
+          timed.landing.counts.reduce((sum, n) => sum + n, 0) === 1, String(timed.landing));
+
+    // The wait for a pointer to land ends when the compositor says it moved,
+    // not when a fixed sleep or the backstop runs out.
+    const listeners = new Map();
+    let listener = 0;
+    MacroRunner._tracker = {
+        connect: (_signal, callback) => (listeners.set(++listener, callback), listener),
+        disconnect: id => listeners.delete(id),
+    };
+    pointer = [0, 0];
+    GLib.timeout_add(GLib.PRIORITY_DEFAULT, 1, () => {
+        pointer = [50, 0];
+        listeners.forEach(callback => callback());
+        return GLib.SOURCE_REMOVE;
+    });
+    const asked = GLib.get_monotonic_time();
+    const landed = await timed._pointerSettles(x => x === 50, 1000);
+    const waited = (GLib.get_monotonic_time() - asked) / 1000;
+    check('a move the compositor reports is read at once', landed && waited < 500, `${landed} after ${waited} ms`);
+    check('and the listener is let go after', listeners.size === 0, String(listeners.size));
+    MacroRunner._tracker = undefined;
 }
 
 // --- starting and stopping other macros ------------------------------------
@@ -366,6 +533,85 @@ check('pathToStep of a missing step is empty', pathToStep(flat.body, 'gone').len
           `count ${counted?.count}`);
 }
 
+// --- wait until ------------------------------------------------------------
+
+{
+    const after = (ms, then) => GLib.timeout_add(GLib.PRIORITY_DEFAULT, ms, () => (then(), GLib.SOURCE_REMOVE));
+    const waiting = newMacro('wait until');
+    const until = named('until', 'until');
+    until.timeout.push(named('key', 'late'));
+    waiting.body.push(until, named('key', 'next'));
+
+    condition = true;
+    evaluated = 0;
+    check('a wait until that already holds goes straight on',
+          (await trace(waiting)).seen === 'until next' && evaluated === 1, `asked ${evaluated}`);
+
+    // Nothing drawn, nothing asked: the one check on the way in, and the timeout.
+    condition = false;
+    evaluated = 0;
+    until.timeoutMs = 80;
+    let seen = (await trace(waiting)).seen;
+    check('a still screen is asked once and then times out', seen === 'until late next' && evaluated === 1,
+          `${seen}, asked ${evaluated}`);
+    check('and lets go of the compositor after', report === null);
+
+    // Drawing over the spot is what asks again, and at once.
+    evaluated = 0;
+    until.timeoutMs = 5000;
+    until.minIntervalMs = 0;
+    after(30, () => {
+        condition = true;
+        report({ x: 5, y: 5, w: 2, h: 2 });
+    });
+    const started = GLib.get_monotonic_time();
+    seen = (await trace(waiting)).seen;
+    const tookMs = (GLib.get_monotonic_time() - started) / 1000;
+    check('drawing where it looks wakes it', seen === 'until next' && evaluated === 2 && tookMs < 1000,
+          `${seen}, asked ${evaluated}, ${tookMs}ms`);
+
+    // Drawing somewhere else is not its business.
+    condition = false;
+    evaluated = 0;
+    until.timeoutMs = 150;
+    after(30, () => {
+        condition = true;
+        report({ x: 500, y: 500, w: 20, h: 20 });
+    });
+    seen = (await trace(waiting)).seen;
+    check('drawing elsewhere does not', seen === 'until late next' && evaluated === 1, `${seen}, asked ${evaluated}`);
+
+    // A screen that never stops is asked no more often than the step allows.
+    condition = false;
+    evaluated = 0;
+    until.timeoutMs = 400;
+    until.minIntervalMs = 100;
+    const busy = GLib.timeout_add(GLib.PRIORITY_DEFAULT, 5, () => (report?.({ x: 0, y: 0, w: 10, h: 10 }), GLib.SOURCE_CONTINUE));
+    seen = (await trace(waiting)).seen;
+    GLib.source_remove(busy);
+    check('a busy screen is held to the minimum interval', seen === 'until late next' && evaluated >= 3 && evaluated <= 5,
+          `${seen}, asked ${evaluated}`);
+
+    // A check slower than the interval, on a screen that never stops: one is
+    // always due as the last comes back, and the limit must still end it.
+    condition = false;
+    evaluated = 0;
+    evaluateMs = 120;
+    until.timeoutMs = 300;
+    until.minIntervalMs = 100;
+    const redrawing = GLib.timeout_add(GLib.PRIORITY_DEFAULT, 5, () => (report?.({ x: 0, y: 0, w: 10, h: 10 }), GLib.SOURCE_CONTINUE));
+    const slowStarted = GLib.get_monotonic_time();
+    seen = await Promise.race([
+        trace(waiting).then(result => result.seen),
+        new Promise(resolve => after(3000, () => resolve('still waiting'))),
+    ]);
+    const slowMs = (GLib.get_monotonic_time() - slowStarted) / 1000;
+    GLib.source_remove(redrawing);
+    evaluateMs = 0;
+    check('a slow check on a busy screen still times out', seen === 'until late next' && slowMs < 1000,
+          `${seen}, asked ${evaluated}, ${slowMs}ms`);
+}
+
 print(failures === 0 ? '\nALL PASSED' : `\n${failures} FAILURES`);
 if (failures > 0) {
     imports.system.exit(1);
@@ -1,3 +1,7 @@
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+import GdkPixbuf from 'gi://GdkPixbuf';
+
 import {
     parseDocument, stringifyDocument, newStep, describeStep, describeCondition,
     insertStep, moveStep, moveStepNested, parentOf, removeStep, cloneStep, walk, findStep, newMacro,
@@ -5,15 +9,22 @@ import {
     resolveRunStart,
     macroEnabled,
     STEP_KIND_LABELS, parseNumbers, reachesEnd, lastPointerEndpoint,
-    AUTHORABLE_STEP_KINDS,
+    AUTHORABLE_STEP_KINDS, asksModel, compileSteps,
 } from '../dist/src/model.js';
 import { textToEvents, keyCode, keyName, charToKey, buttonFromCode } from '../dist/src/keymap.js';
 import { starterMacro } from '../dist/src/starter.js';
-import { parseVerdict, verdictFromObjects } from '../dist/src/llm.js';
+import {
+    Cancelled, hammingDistance, LlmClient, MAX_REASON_CHARS, parseVerdict, parseVerdicts, VerdictCache, verdictFromObjects,
+    VerdictStream,
+} from '../dist/src/llm.js';
+import { EncodeWorker, encodeForLlm } from '../dist/src/encoder.js';
+import { traceTiming } from '../dist/src/daemon.js';
+import { DAEMON_PID, SHELL_PID, Tracer, tracer } from '../dist/src/tracer.js';
 import { isLoopbackEndpoint } from '../dist/src/store.js';
 import {
     reportProblem, listProblems, problemCount, clearProblems, onProblemsChanged,
 } from '../dist/src/problems.js';
+import { listen, readRequest } from './stand-in.mjs';
 
 let failures = 0;
 const check = (name, cond, extra = '') => {
@@ -380,6 +391,38 @@ check('nested condition migrated', cols[2].cond.of[0].type === 'color');
 check('1x1 colour describes as a pixel', describeCondition(cols[0].cond).startsWith('pixel'), describeCondition(cols[0].cond));
 check('area colour describes as coverage', describeCondition(cols[1].cond).includes('30×40'), describeCondition(cols[1].cond));
 
+// image checks, and the steps that go where one found its picture
+const picture = { type: 'image', png: 'AAAA', w: 48, h: 32, region: { x: 10, y: 20, w: 300, h: 200 }, threshold: 0.85 };
+check('image describes its size, area and threshold',
+      describeCondition(picture) === 'image 48×32 in 300×200 @ 10,20 ≥ 85%', describeCondition(picture));
+check('image over the whole screen', describeCondition({ ...picture, region: null }) === 'image 48×32 ≥ 85%',
+      describeCondition({ ...picture, region: null }));
+check('image survives a round trip', eqp(parseDocument(stringifyDocument({ version: 1, macros: [{
+    id: 'm', name: 'i', body: [{ id: 'a', kind: 'if', cond: picture, then: [], else: [] }],
+}] })).macros[0].body[0].cond, picture));
+check('click at found describes', describeStep({ id: 'f', kind: 'click', button: 'left', mode: 'found' }) === 'Click left @ found');
+check('move to found describes', describeStep({ id: 'f', kind: 'move', mode: 'found' }) === 'Move to found');
+check('found has no endpoint', lastPointerEndpoint([
+    { id: 'a', kind: 'click', button: 'left', mode: 'abs', x: 1, y: 2 },
+    { id: 'b', kind: 'click', button: 'left', mode: 'found' },
+]) === null);
+
+// wait until: a condition, a limit, and a branch for when the limit is reached
+const until = newStep('until');
+until.cond = { type: 'color', x: 5, y: 6, w: 1, h: 1, color: '#abcdef', tolerance: 9, coverage: 1 };
+check('wait until describes its limit', describeStep(until) === 'Wait until pixel 5,6 ≈ #abcdef, at most 30s', describeStep(until));
+check('wait until without one', describeStep({ ...until, timeoutMs: 0 }) === 'Wait until pixel 5,6 ≈ #abcdef',
+      describeStep({ ...until, timeoutMs: 0 }));
+until.timeout.push({ id: 'late', kind: 'key', code: 'KEY_A', action: 'tap', mods: [], holdMs: 20 });
+const untilProgram = compileSteps([until, { id: 'next', kind: 'wait', ms: 1, jitterMs: 0 }]);
+check('wait until compiles to a jump past its timeout branch',
+      untilProgram.code[0].op === 'until' && untilProgram.code[0].done === 2 && untilProgram.index.get('next') === 2,
+      JSON.stringify(untilProgram.code.map(instr => instr.op)));
+check('a break in the timeout branch frees a loop', reachesEnd([
+    { id: 'l', kind: 'loop', count: 'forever', body: [{ ...until, timeout: [{ id: 'b', kind: 'break' }] }] }]));
+check('a model check in a wait until asks the model',
+      asksModel([{ ...until, cond: { type: 'llm', prompt: 'done?', region: null } }]));
+
 // llm verdict parsing
 check('verdict json', parseVerdict('{"match": true, "reason": "green"}').match === true);
 check('verdict fenced', parseVerdict('```json\n{"match": false, "reason":"grey"}\n```').match === false);
@@ -412,6 +455,302 @@ check('objects-only reads written-out json',
       verdictFromObjects('I decided. {"match": false, "reason":"grey"}').match === false);
 check('objects-only ignores a stray yes', verdictFromObjects('yes, that is true') === null);
 
+// streamed answers: the verdict as soon as it is written
+{
+    const delta = text => `data: ${JSON.stringify({ choices: [{ delta: { content: text } }] })}\n`;
+    const stream = new VerdictStream();
+    stream.feed(delta('{"mat'));
+    check('stream: nothing yet', stream.match() === null && stream.early() === null);
+    // A line split between two reads is put back together.
+    const split = delta('ch": true, "reason": "the but');
+    stream.feed(split.slice(0, 10));
+    stream.feed(split.slice(10));
+    check('stream: verdict readable', stream.match() === true);
+    check('stream: but the reason is still coming', stream.early() === null);
+    stream.feed(delta('ton is \\"green\\""'));
+    check('stream: stops once the reason closes',
+          JSON.stringify(stream.early()) === JSON.stringify({ match: true, reason: 'the button is "green"' }),
+          JSON.stringify(stream.early()));
+}
+{
+    const stream = new VerdictStream();
+    stream.line(`data: ${JSON.stringify({ choices: [{ delta: { content: '<think>"match": true</think>{"match": "no"}' } }] })}`);
+    check('stream: thinking is not the answer, an object with no reason is', stream.early()?.match === false);
+    const rambling = new VerdictStream();
+    rambling.line(`data: ${JSON.stringify({ choices: [{ delta: { content: `{"match": 1, "reason": "${'very '.repeat(60)}` } }] })}`);
+    check('stream: a long reason is cut short', rambling.early()?.reason.length === MAX_REASON_CHARS + 1);
+    rambling.line('data: [DONE]');
+    check('stream: done', rambling.done);
+    let threw = false;
+    try {
+        new VerdictStream().line('data: {"error": {"message": "model not loaded"}}');
+    } catch (error) {
+        threw = error.message === 'model not loaded';
+    }
+    check('stream: an error event is an error', threw);
+}
+
+// a verdict read early hangs up on the rest, rather than reading it out
+{
+    const REASON_MS = 3000;
+    const sleep = ms => new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, ms, () => (resolve(), GLib.SOURCE_REMOVE)));
+    const delta = text => `data: ${JSON.stringify({ choices: [{ delta: { content: text } }] })}\n\n`;
+    let hungUp = 0;
+    // A slow server: the verdict at once, then the reason a few words at a
+    // time for seconds, for as long as anyone is still reading.
+    const endpoint = listen(async connection => {
+        await readRequest(connection);
+        const out = connection.get_output_stream();
+        const send = text => out.write_all_async(new TextEncoder().encode(text), GLib.PRIORITY_DEFAULT, null);
+        await send('HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nConnection: close\r\n\r\n');
+        await send(delta('{"match": true, "reason": "green"}'));
+        const started = GLib.get_monotonic_time();
+        try {
+            while (GLib.get_monotonic_time() - started < REASON_MS * 1000) {
+                await sleep(20);
+                await send(delta(' and then some'));
+            }
+            await send('data: [DONE]\n\n');
+        } catch {
+            hungUp = GLib.get_monotonic_time();
+        }
+        connection.close(null);
+    });
+
+    const client = new LlmClient();
+    const settings = {
+        endpoint: `http://127.0.0.1:${endpoint.port}/v1/chat/completions`, model: 'm', apiKey: '', timeoutMs: 10000,
+    };
+    const started = GLib.get_monotonic_time();
+    const verdict = await client.ask('green?', { dataUri: 'data:image/png;base64,', checksum: 'slow' }, settings);
+    const answeredMs = (GLib.get_monotonic_time() - started) / 1000;
+    check('stream: the verdict does not wait for the reason', verdict.match && answeredMs < REASON_MS / 3,
+          `${answeredMs.toFixed(0)} ms`);
+    for (let i = 0; i < 50 && !hungUp; i++) {
+        await sleep(20);
+    }
+    const hungUpMs = (hungUp - started) / 1000;
+    check('stream: and the server is hung up on', hungUp > 0 && hungUpMs < REASON_MS / 2, `${hungUpMs.toFixed(0)} ms`);
+    client.destroy();
+    endpoint.stop();
+}
+
+// remembered answers
+check('hamming counts differing bits', hammingDistance([0, 0xffffffff, 5], [1, 0, 6]) === 35);
+{
+    const verdicts = new VerdictCache();
+    const picture = [0x12345678, 0, 0, 0, 0];
+    const answer = { match: true, reason: 'green', latencyMs: 2000 };
+    verdicts.store('q', picture, answer);
+    check('same question, same picture: remembered', verdicts.lookup('q', picture, 0, 60000)?.verdict === answer);
+    check('a picture a bit off still counts', verdicts.lookup('q', [0x12345679, 0, 0, 0, 0], 2, 60000)?.distance === 1);
+    check('past the tolerance it does not', verdicts.lookup('q', [0x12345679, 0, 0, 0, 0], 0, 60000) === null);
+    check('another question is not answered', verdicts.lookup('other', picture, 6, 60000) === null);
+    check('nor is an expired answer', verdicts.lookup('q', picture, 6, 0) === null);
+
+    // Exact reuse goes by the encoded picture, which sees what a thumbnail does not.
+    const exact = new VerdictCache();
+    exact.store('q', null, answer, 'abc');
+    check('the very same picture: remembered', exact.recall('q', 'abc', 60000)?.verdict === answer);
+    check('any other picture is asked again', exact.recall('q', 'abd', 60000) === null);
+    check('an exact answer does not count for a tolerance', exact.lookup('q', picture, 64, 60000) === null);
+    const fresher = { match: false, reason: 'red', latencyMs: 1500 };
+    exact.store('q', null, fresher, 'abc');
+    check('the fresher answer replaces the older', exact.recall('q', 'abc', 60000)?.verdict === fresher);
+}
+
+// one inference for the same question asked twice at once, and a queue for the rest
+{
+    const client = new LlmClient();
+    let sent = 0;
+    let release;
+    client._ask = async () => {
+        sent++;
+        await new Promise(resolve => { release = resolve; });
+        return { match: true, reason: '', latencyMs: 1 };
+    };
+    const settings = { endpoint: 'http://localhost/', model: 'm', apiKey: '', timeoutMs: 0, maxRequests: 1 };
+    const picture = { checksum: 'abc' };
+    const first = client.ask('green?', picture, settings);
+    const again = client.ask('green?', picture, settings);
+    const other = client.ask('red?', picture, settings);
+    await Promise.resolve();
+    check('an identical request in flight is not sent again', sent === 1, String(sent));
+    check('a different one waits its turn', client.queueDepth === 1, String(client.queueDepth));
+    release();
+    const [a, b] = await Promise.all([first, again]);
+    check('and both askers get the one answer', a.match && b.match && b.shared === true && !a.shared);
+    await new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, 1, () => (resolve(), GLib.SOURCE_REMOVE)));
+    check('the queued one goes when the first is done', sent === 2 && client.queueDepth === 0, String(sent));
+    release();
+    check('and says it queued behind one', (await other).queuedBehind === 1 && client.peakQueueDepth === 1);
+    client.destroy();
+}
+
+// letting go of an answer nobody needs any more
+{
+    const client = new LlmClient();
+    const releases = [];
+    let dropped = 0;
+    client._ask = (prompt, image, settings, cancellable) => new Promise((resolve, reject) => {
+        releases.push(() => resolve({ match: true, reason: prompt, latencyMs: 1 }));
+        cancellable.connect('cancelled', () => (dropped++, reject(new Cancelled())));
+    });
+    const settings = { endpoint: 'http://localhost/', model: 'm', apiKey: '', timeoutMs: 0, maxRequests: 1 };
+    const tick = () => new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, 1, () => (resolve(), GLib.SOURCE_REMOVE)));
+    const outcome = promise => promise.then(verdict => verdict.reason, error => error instanceof Cancelled ? 'cancelled' : error.message);
+
+    const first = client.ask('first', { checksum: 'a' }, settings);
+    const waiting = new Gio.Cancellable();
+    const queued = outcome(client.ask('queued', { checksum: 'a' }, settings, waiting));
+    await tick();
+    waiting.cancel();
+    check('a cancelled ask leaves the queue', await queued === 'cancelled' && client.queueDepth === 0);
+    releases.shift()();
+    await first;
+
+    const one = new Gio.Cancellable();
+    const other = new Gio.Cancellable();
+    const a = outcome(client.ask('shared', { checksum: 'b' }, settings, one));
+    const b = outcome(client.ask('shared', { checksum: 'b' }, settings, other));
+    await tick();
+    one.cancel();
+    check('one of two askers letting go keeps the request', await a === 'cancelled' && dropped === 0);
+    other.cancel();
+    check('the last one letting go drops it', await b === 'cancelled' && dropped === 1);
+    await tick();
+    const again = outcome(client.ask('shared', { checksum: 'b' }, settings));
+    await tick();
+    releases.pop()();
+    check('and the same question asked afresh goes out again', await again === 'shared');
+    check('a dropped request leaves the model warm', client.warmth === 'warm', client.warmth);
+    client.destroy();
+}
+
+// several questions about one picture, answered in one go
+{
+    const read = text => JSON.stringify(parseVerdicts(text, 2)?.map(({ match }) => match));
+    check('verdicts under answers', read('{"answers": [{"n": 1, "match": true}, {"n": 2, "match": false}]}') === '[true,false]');
+    check('verdicts numbered out of order', read('{"answers": [{"n": 2, "match": "no"}, {"n": 1, "match": "yes"}]}') === '[true,false]');
+    check('verdicts bare and fenced', read('```json\n[true, {"answer": false, "reason": "grey"}]\n```') === '[true,false]');
+    check('verdicts one short', parseVerdicts('{"answers": [{"n": 1, "match": true}]}', 2) === null);
+    check('verdicts one twice', parseVerdicts('[{"n": 1, "match": true}, {"n": 1, "match": false}]', 2) === null);
+    check('verdicts a single object is not a batch', parseVerdicts('{"match": true}', 2) === null);
+    check('verdicts keep their reasons',
+          parseVerdicts('{"answers": [{"n": 1, "match": true, "reason": "green"}]}', 1)?.[0].reason === 'green');
+
+    const client = new LlmClient();
+    const sent = [];
+    let reply = '{"answers": [{"n": 1, "match": true, "reason": "green"}, {"n": 2, "match": false}]}';
+    client._send = async (instruction, image, settings, outer, maxTokens, reading) => {
+        const batch = instruction.includes('STATEMENTS:');
+        sent.push(batch ? 'batch' : 'one');
+        return { answer: reading.whole({ content: batch ? reply : '{"match": true}', reasoning: '', finish: 'stop' }), latencyMs: 5 };
+    };
+    const settings = { endpoint: 'http://localhost/', model: 'm', apiKey: '', timeoutMs: 0 };
+    const [green, dialog] = await client.askMany(['green?', 'dialog open?'], { checksum: 'a' }, settings);
+    check('two questions, one request', sent.join() === 'batch', sent.join());
+    check('each gets its own answer', green.match && green.reason === 'green' && !dialog.match && dialog.askedWith === 2);
+
+    reply = 'Statement 1: yes. Statement 2: no.';
+    sent.length = 0;
+    const fallback = await client.askMany(['green?', 'dialog open?'], { checksum: 'b' }, settings);
+    check('a model that ignores the format is asked one at a time', sent.join() === 'batch,one,one' &&
+          fallback.every(verdict => verdict.match) && !client.asksTogether, sent.join());
+    sent.length = 0;
+    await client.askMany(['green?', 'dialog open?'], { checksum: 'c' }, settings);
+    check('and is not sent batches again', sent.join() === 'one,one', sent.join());
+    client.destroy();
+}
+
+// warming the model up before the first check needs it
+{
+    let changes = 0;
+    const client = new LlmClient(() => changes++);
+    let release;
+    const asked = [];
+    client._ask = async prompt => {
+        asked.push(prompt);
+        await new Promise(resolve => { release = resolve; });
+        return { match: true, reason: '', latencyMs: 900, firstTokenMs: 700 };
+    };
+    const settings = { endpoint: 'http://localhost/', model: 'm', apiKey: '', timeoutMs: 0 };
+    check('a new client is cold', client.warmth === 'cold' && client.idleMs === Infinity);
+    client.warm(settings);
+    await Promise.resolve();
+    check('warming up asks one question', client.warmth === 'warming' && asked.length === 1 && changes === 1);
+    client.warm(settings);
+    check('and not a second one meanwhile', asked.length === 1);
+    release();
+    await new Promise(resolve => GLib.timeout_add(GLib.PRIORITY_DEFAULT, 1, () => (resolve(), GLib.SOURCE_REMOVE)));
+    check('then it is warm', client.warmth === 'warm' && client.firstTokenMs === 700, client.warmth);
+    const next = client.ask('green?', { checksum: 'x' }, settings);
+    await Promise.resolve();
+    release();
+    check('a check after the warm-up is not cold', (await next).cold === undefined);
+    client._ask = async () => { throw new Error('refused'); };
+    await client.ask('red?', { checksum: 'y' }, settings).catch(() => null);
+    check('a failure leaves it cold', client.warmth === 'cold');
+    client.destroy();
+}
+
+// encoding in the helper process gives the same picture as encoding in place
+{
+    const picture = GdkPixbuf.Pixbuf.new(GdkPixbuf.Colorspace.RGB, true, 8, 300, 200);
+    picture.fill(0x3584e4ff);
+    picture.new_subpixbuf(10, 10, 120, 40).fill(0xffffffff);
+    // A part of a bigger frame: rows that do not start at the frame's edge.
+    const part = picture.new_subpixbuf(5, 5, 150, 90);
+    const worker = new EncodeWorker();
+    const [helped, scaled] = await Promise.all([worker.encode(part, 1280), worker.encode(picture, 100)]);
+    const inPlace = encodeForLlm(part, 1280);
+    check('helper encodes the same bytes', helped.checksum === inPlace.checksum && helped.width === 150,
+          `${helped.checksum} ${inPlace.checksum}`);
+    check('helper scales down to the width asked', scaled.width === 100 && scaled.height === 67,
+          `${scaled.width}×${scaled.height}`);
+    worker.destroy();
+}
+
+// tracing: nothing while off, a row per span going at once, the daemon's side merged in
+{
+    const idle = new Tracer();
+    check('no span while nothing is traced', idle.start() === 0);
+
+    const session = tracer.begin();
+    const t = session.started;
+    tracer.add(SHELL_PID, 'captures', [{ name: 'a', start: t, end: t + 100 }]);
+    tracer.add(SHELL_PID, 'captures', [{ name: 'b', start: t + 50, end: t + 150 }]);
+    tracer.add(SHELL_PID, 'captures', [{ name: 'c', start: t + 200, end: t + 300 }]);
+    traceTiming({ played: 4, aborted: false }, 'play 4 events');
+    traceTiming({
+        played: 4, aborted: false,
+        timing: { arrived: t + 10, received: t + 20, started: t + 30, ended: t + 90, late: 7 },
+    }, 'play 4 events');
+    let failed = false;
+    try {
+        await tracer.wrap(Promise.reject(new Error('gone')), 'ask model', 'model');
+    } catch (error) {
+        failed = error.message === 'gone';
+    }
+    check('a traced failure is still a failure', failed);
+
+    const events = tracer.finish(session);
+    const spans = events.filter(event => event.ph === 'X');
+    const byName = name => spans.find(event => event.name === name);
+    check('overlapping spans get a row each', byName('a').tid !== byName('b').tid);
+    check('a free row is used again', byName('c').tid === byName('a').tid);
+    check('the daemon has its own process', ['read request', 'parse', 'play 4 events']
+        .every(name => byName(name)?.pid === DAEMON_PID));
+    check('daemon stages keep its times', byName('parse').ts === t + 20 && byName('parse').dur === 10);
+    check('no timing, no daemon spans', spans.filter(event => event.pid === DAEMON_PID).length === 3);
+    check('a failed span says why', byName('ask model')?.args?.error === 'gone');
+    const rows = events.filter(event => event.name === 'thread_name').map(event => event.args.name);
+    check('rows are named', rows.includes('captures') && rows.includes('captures 2') && rows.includes('playback'),
+          rows.join(', '));
+    check('a trace is plain JSON', JSON.parse(JSON.stringify({ traceEvents: events })).traceEvents.length === events.length);
+    check('finished, nothing more is recorded', tracer.start() === 0);
+}
+
 // endpoint check
 check('loopback localhost', isLoopbackEndpoint('http://localhost:11434/v1/chat/completions'));
 check('loopback 127', isLoopbackEndpoint('http://127.0.0.1:8080/v1/chat/completions'));
@@ -0,0 +1,87 @@
+// A server in this process that stands in for the daemon or a model endpoint:
+// just enough HTTP to read a request and answer it, so everything between the
+// code under test and the socket is the real code.
+
+import Gio from 'gi://Gio';
+import GLib from 'gi://GLib';
+
+for (const [proto, method, finish] of [
+    [Gio.DataInputStream.prototype, 'read_line_async', 'read_line_finish'],
+    [Gio.InputStream.prototype, 'read_bytes_async', 'read_bytes_finish'],
+    [Gio.OutputStream.prototype, 'write_all_async', 'write_all_finish'],
+]) {
+    try {
+        Gio._promisify(proto, method, finish);
+    } catch {
+        // Already promisified by the code under test.
+    }
+}
+
+/** The request line — "POST /play HTTP/1.1" — and the body, read off `connection`. */
+export async function readRequest(connection) {
+    const input = new Gio.DataInputStream({ base_stream: connection.get_input_stream() });
+    let length = 0;
+    let line = '';
+    for (;;) {
+        const [bytes] = await input.read_line_async(GLib.PRIORITY_DEFAULT, null);
+        const text = bytes ? new TextDecoder().decode(bytes).trim() : '';
+        if (text === '') {
+            break;
+        }
+        line ||= text;
+        const match = /^content-length:\s*(\d+)/i.exec(text);
+        if (match) {
+            length = Number(match[1]);
+        }
+    }
+    const chunks = [];
+    let got = 0;
+    while (got < length) {
+        const bytes = await input.read_bytes_async(length - got, GLib.PRIORITY_DEFAULT, null);
+        const data = bytes.get_data();
+        if (!data || data.length === 0) {
+            break;
+        }
+        chunks.push(new TextDecoder().decode(data));
+        got += data.length;
+    }
+    return { line, body: chunks.join('') };
+}
+
+/** Answer with `body` and hang up. */
+export async function respond(connection, status, body, type = 'application/json') {
+    const response = `HTTP/1.1 ${status}\r\nContent-Type: ${type}\r\n` +
+        `Content-Length: ${new TextEncoder().encode(body).length}\r\nConnection: close\r\n\r\n${body}`;
+    await connection.get_output_stream().write_all_async(
+        new TextEncoder().encode(response), GLib.PRIORITY_DEFAULT, null);
+    connection.close(null);
+}
+
+/**
+ * Hand every connection to `serve`: on the Unix socket at `path`, or without
+ * one on a TCP port of its own, which `port` says. `stop()` when done.
+ */
+export function listen(serve, path = null) {
+    const service = new Gio.SocketService();
+    let port = 0;
+    if (path) {
+        service.add_address(Gio.UnixSocketAddress.new(path), Gio.SocketType.STREAM,
+            Gio.SocketProtocol.DEFAULT, null);
+    } else {
+        port = service.add_any_inet_port(null);
+    }
+    service.connect('incoming', (_service, connection) => {
+        serve(connection).catch(error => print(`stand-in: ${error.message}`));
+        return true;
+    });
+    service.start();
+    return {
+        port,
+        stop() {
+            service.stop();
+            if (path) {
+                GLib.unlink(path);
+            }
+        },
+    };
+}
@@ -124,9 +124,11 @@ export function flashRegion(region?: Region | null): void {
 
 /**
  * Drag a rectangle over the screen. Resolves null when cancelled with Escape or
- * a right click.
+ * a right click. `prompt` says what the rectangle is for.
  */
-export function pickRegion(): Promise<Region | null> {
+export function pickRegion(
+    prompt = 'Drag to select the area the model should look at — Escape to cancel',
+): Promise<Region | null> {
     return new Promise(resolve => {
         const overlay = new St.Widget({
             style_class: 'macroclickwerk-picker',
@@ -143,7 +145,7 @@ export function pickRegion(): Promise<Region | null> {
 
         const hint = new St.Label({
             style_class: 'macroclickwerk-picker-hint',
-            text: 'Drag to select the area the model should look at — Escape to cancel',
+            text: prompt,
         });
         overlay.add_child(hint);
         hint.set_position(
@@ -17,6 +17,8 @@ export interface PopupDeps {
     runningMacroIds: () => string[];
     isPaused: () => boolean;
     isRecording: () => boolean;
+    /** How ready the model is, while a running macro may ask it; empty otherwise. */
+    modelState: () => string;
     /** The editor's selected row, which is also where a run continues from. */
     resumeStep: () => string;
     onEnabledChanged: (enabled: boolean) => void;
@@ -165,7 +167,11 @@ export class MacroPopup {
         } else if (running && this._deps.isPaused()) {
             this._statusLabel.text = one ? `Holding — “${one.name}”` : `Holding — ${many}`;
         } else if (running) {
-            this._statusLabel.text = one ? `Running “${one.name}”` : `Running ${many}`;
+            // Whether the first model check will be quick or wait for a load
+            // is worth knowing before it times out.
+            const model = this._deps.modelState();
+            this._statusLabel.text = (one ? `Running “${one.name}”` : `Running ${many}`) +
+                (model ? ` — ${model}` : '');
         } else if (enabled.length === 0) {
             this._statusLabel.text = store.macros.length === 0
                 ? 'No macros yet'
@@ -0,0 +1,145 @@
+// macroclickwerk-match - the image condition's search, for the extension.
+//
+// The extension starts one of these and keeps it. Pixels do not go through the
+// pipe: the extension writes the frame and the patch into a file on tmpfs, and
+// this maps that file, so a 1920x1080 frame costs one copy in and none out.
+// Then one line per search on stdin, where each picture is in the file and how
+// it is laid out:
+//
+//   FRAME-OFFSET WIDTH HEIGHT STRIDE CHANNELS PATCH-OFFSET WIDTH HEIGHT STRIDE CHANNELS
+//
+// and one line back on stdout, the best spot's score (0..1), its top left
+// corner, and how long the search took:
+//
+//   0.998 412 87 2730          or          error <what was wrong>
+//
+// The file may grow between searches (a bigger search area); it is mapped
+// again when it has. Exits when stdin closes.
+//
+//   macroclickwerk-match SHARED-FILE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "match.h"
+
+struct shared {
+    const char *path;
+    int fd;
+    const uint8_t *map;
+    size_t size;
+};
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// The file as it is now: mapped again only if its size changed.
+static int shared_refresh(struct shared *s) {
+    struct stat st;
+    if (fstat(s->fd, &st) != 0) {
+        return -1;
+    }
+    if (s->map && (size_t)st.st_size == s->size) {
+        return 0;
+    }
+    if (s->map) {
+        munmap((void *)s->map, s->size);
+        s->map = NULL;
+        s->size = 0;
+    }
+    if (st.st_size == 0) {
+        errno = ENODATA;
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    s->map = map;
+    s->size = (size_t)st.st_size;
+    return 0;
+}
+
+// A picture from the request, or NULL if it does not lie inside the file.
+static const char *image_at(const struct shared *s, long long offset, int width, int height, int stride,
+                            int channels, struct match_image *out) {
+    if (width <= 0 || height <= 0 || (channels != 3 && channels != 4) || stride < width * channels) {
+        return "bad layout";
+    }
+    if (offset < 0 || (size_t)offset + (size_t)(height - 1) * (size_t)stride + (size_t)width * (size_t)channels >
+                          s->size) {
+        return "picture is past the end of the shared file";
+    }
+    *out = (struct match_image){
+        .pixels = s->map + offset, .width = width, .height = height, .stride = stride, .channels = channels,
+    };
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SHARED-FILE\n", argv[0]);
+        fprintf(stderr, "Searches are read from stdin, one per line; see the top of macroclickwerk-match.c.\n");
+        return EXIT_FAILURE;
+    }
+    struct shared shared = { .path = argv[1] };
+    shared.fd = open(shared.path, O_RDONLY | O_CLOEXEC);
+    if (shared.fd < 0) {
+        fprintf(stderr, "Error: cannot open %s: %s\n", shared.path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "macroclickwerk-match: %s kernel\n", match_kernel());
+
+    struct match_scratch scratch = { 0 };
+    char line[256];
+    // One answer per line, and the extension is waiting on it.
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    while (fgets(line, sizeof(line), stdin)) {
+        long long frame_offset, patch_offset;
+        int fw, fh, fs, fc, pw, ph, ps, pc;
+        if (sscanf(line, "%lld %d %d %d %d %lld %d %d %d %d", &frame_offset, &fw, &fh, &fs, &fc, &patch_offset,
+                   &pw, &ph, &ps, &pc) != 10) {
+            printf("error cannot read the request\n");
+            continue;
+        }
+        if (shared_refresh(&shared) != 0) {
+            printf("error cannot map %s: %s\n", shared.path, strerror(errno));
+            continue;
+        }
+        struct match_image frame, patch;
+        const char *wrong = image_at(&shared, frame_offset, fw, fh, fs, fc, &frame);
+        if (!wrong) {
+            wrong = image_at(&shared, patch_offset, pw, ph, ps, pc, &patch);
+        }
+        if (wrong) {
+            printf("error %s\n", wrong);
+            continue;
+        }
+
+        long long start = now_us();
+        struct match_result found;
+        if (match_find(&frame, &patch, &scratch, &found) != 0) {
+            // Worded as matcher.ts looks for it: the one error a document can cause.
+            printf("error %s\n", errno == EINVAL ? "the patch is larger than the area searched" : strerror(errno));
+            continue;
+        }
+        printf("%.4f %d %d %lld\n", found.score, found.x, found.y, now_us() - start);
+    }
+
+    match_scratch_free(&scratch);
+    if (shared.map) {
+        munmap((void *)shared.map, shared.size);
+    }
+    close(shared.fd);
+    return EXIT_SUCCESS;
+}
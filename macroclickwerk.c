@@ -31,14 +31,20 @@
 #include <limits.h>
 #include <sys/inotify.h>
 #include <poll.h>
+#include <ctype.h>
+
+#include "capture.h"
+#include "gamepad.h"
 
 #define SOCKET_PATH       "/var/run/macroclickwerk-socket"
 #define EVENT_SOCKET_PATH "/var/run/macroclickwerk-events"
+#define CAPTURE_DIR       "/var/lib/macroclickwerk"
 
 #define MAX_DEVICES        8
 #define MAX_STREAM_CLIENTS 8
 #define MAX_PLAY_EVENTS    100000
-#define API_VERSION        2
+#define MAX_HOLDS          32
+#define API_VERSION        4
 
 #define CLASS_KEYBOARD 1
 #define CLASS_POINTER  2
@@ -75,16 +81,38 @@ static int spec_count = 0;
 // -a: capture every keyboard and pointer instead of only what specs name.
 static bool auto_capture = false;
 
+// -c and -e: a second daemon, the benchmark's, must not take over the sockets
+// of the one the desktop is using.
+static const char *control_path = SOCKET_PATH;
+static const char *event_path = EVENT_SOCKET_PATH;
+static bool gamepad_at_start = false;
+
 static volatile sig_atomic_t keep_running = 1;
 static struct MHD_Daemon *http_daemon = NULL;
 
 static pthread_mutex_t emit_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Playback state. Only one event train plays at a time; /play blocks until the
-// train is done so the extension can simply await the HTTP response.
+// Playback state. /play blocks until the train is done so the extension can
+// simply await the HTTP response. Trains that land on different clones play at
+// the same time — a macro typing need not wait for another one clicking — and
+// one that wants a clone another train is on is answered "busy". A bit per
+// clone slot, and one for the pad, all under play_mutex.
 static pthread_mutex_t play_mutex = PTHREAD_MUTEX_INITIALIZER;
-static volatile sig_atomic_t play_abort = 0;
-static volatile bool playing = false;
+static unsigned int play_busy = 0;
+static volatile int playing = 0;
+#define PLAY_PAD (1u << MAX_DEVICES)
+#define PLAY_ALL ((PLAY_PAD << 1) - 1)
+
+// Bumped by /stop and the signals. A train notes it when it starts and gives
+// up once it changes, so one stop ends every train playing, while a train
+// started after the stop is not ended by it.
+static volatile sig_atomic_t play_generation = 0;
+
+// An atomic add, not ++: HTTP threads and signal handlers bump it at once, and
+// two stops must not collapse into one. Lock-free on an int, so signal-safe.
+static void stop_all_trains(void) {
+    __atomic_fetch_add(&play_generation, 1, __ATOMIC_SEQ_CST);
+}
 
 // Keys/buttons this daemon currently holds down, so /stop can release them and
 // never leave a stuck Ctrl or BTN_LEFT behind. EV_KEY covers KEY_* and BTN_*.
@@ -92,8 +120,47 @@ static pthread_mutex_t held_mutex = PTHREAD_MUTEX_INITIALIZER;
 static unsigned char held[KEY_MAX + 1];
 static int held_fd[KEY_MAX + 1];
 
+// Holds the daemon owns rather than plays: a key pressed by /hold that stays
+// down until its deadline or a /release, with autorepeat in between if asked
+// for. A ten second hold is one request instead of a train with an event per
+// repeat. Guarded by held_mutex, like held[] itself, which every hold is also
+// entered in — so /stop and the sleep hook let go of these the same way.
+struct hold {
+    bool active;
+    __u16 code;
+    int fd;
+    long long release_at;   // monotonic µs; 0 holds until /release
+    long long next_repeat;  // monotonic µs of the next value-2 event; 0 for none
+    long long period;       // µs between repeats
+};
+static struct hold holds[MAX_HOLDS];
+static pthread_cond_t hold_cond;
+
 static volatile bool recording = false;
 
+// The capture file being written, if any: while it is open every event the
+// readers forward goes into it as well.
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct capture_writer capture;
+static char capture_name[NAME_MAX + 1];
+static volatile bool capturing = false;
+
+// Gamepad mode (-g, or /gamepad): keys and mouse motion the gamepad mapping
+// takes go to a virtual pad instead of their clone, in the same pass that
+// forwards everything else. The pad is made the first time the mode is turned
+// on and kept after, so a game does not see its controller come and go.
+static pthread_mutex_t gamepad_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct gamepad pad = { .fd = -1, .timer_fd = -1 };
+// The stick engine's thread, joined at shutdown before the pad goes away.
+static pthread_t stick_ticker;
+static bool stick_ticking = false;
+static volatile bool gamepad_mode = false;
+static struct stick_config stick;     // -s, what every profile starts from
+// -m, or the built-in mapping; /gamepad's "profile" and SIGUSR2 pick the
+// profile, and its "stick" tunes the one in use.
+static struct gamepad_map gamepad_map;
+static int gamepad_profile = 0;
+
 // Event stream clients.
 static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int stream_clients[MAX_STREAM_CLIENTS];
@@ -131,6 +198,13 @@ static int emit_tracked(int fd, __u16 type, __u16 code, __s32 value) {
         pthread_mutex_lock(&held_mutex);
         if (value == 0) {
             held[code] = 0;
+            // A train that releases a held key ends the hold too: otherwise the
+            // hold thread would go on repeating a key that is already up.
+            for (int i = 0; i < MAX_HOLDS; i++) {
+                if (holds[i].active && holds[i].code == code) {
+                    holds[i].active = false;
+                }
+            }
         } else {
             held[code] = 1;
             held_fd[code] = fd;
@@ -142,6 +216,12 @@ static int emit_tracked(int fd, __u16 type, __u16 code, __s32 value) {
 
 static void release_all_held(void) {
     pthread_mutex_lock(&held_mutex);
+    // Holds first, so the hold thread cannot press or repeat anything again
+    // between the loop below letting go of a key and the next one.
+    for (int i = 0; i < MAX_HOLDS; i++) {
+        holds[i].active = false;
+    }
+    pthread_cond_broadcast(&hold_cond);
     for (int code = 0; code <= KEY_MAX; code++) {
         if (!held[code]) {
             continue;
@@ -157,6 +237,13 @@ static void release_all_held(void) {
         pthread_mutex_lock(&held_mutex);
     }
     pthread_mutex_unlock(&held_mutex);
+
+    // The pad keeps no held[] entries of its own; let go of all of it.
+    pthread_mutex_lock(&gamepad_mutex);
+    if (pad.fd >= 0) {
+        gamepad_reset(&pad);
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
 }
 
 // ---------------------------------------------------------------------------
@@ -436,6 +523,31 @@ fail:
     return false;
 }
 
+/**
+ * One event through the pad, in gamepad mode only: keyboard and mouse events
+ * go through the mapping, and `native` also lets gamepad buttons and sticks
+ * through as they are, which only played events may do — a real touchpad's
+ * ABS_X is not a stick. Out of the mode the pad, kept from before, takes
+ * nothing: a replayed tablet or touchscreen capture goes to its clones. The
+ * pad's frame is written when the source frame ends. True when the pad took
+ * the event, which then goes nowhere else. Callers skip it, lock and all,
+ * when the mode is off.
+ */
+static bool route_gamepad(const struct input_event *ev, bool end_of_frame, bool native) {
+    pthread_mutex_lock(&gamepad_mutex);
+    bool taken = false;
+    if (pad.fd >= 0 && gamepad_mode) {
+        taken = (native && gamepad_set(&pad, ev->type, ev->code, ev->value)) ||
+                gamepad_translate(&pad, ev);
+        gamepad_wake(&pad);
+        if (end_of_frame) {
+            gamepad_flush(&pad);
+        }
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+    return taken;
+}
+
 static void* reader_thread(void *arg) {
     struct captured_device *d = arg;
     struct input_event ev = {0};
@@ -457,14 +569,21 @@ static void* reader_thread(void *arg) {
         }
 
         // Always forward. Withholding real input would also withhold it from the
-        // shell, which is what handles the emergency stop.
-        if (d->grabbed) {
+        // shell, which is what handles the emergency stop. Gamepad mode only
+        // diverts what its mapping names; the stop shortcut is not among it.
+        if (d->grabbed && !(gamepad_mode && route_gamepad(&ev, ev.type == EV_SYN && ev.code == SYN_REPORT, false))) {
             emit(d->fdo, ev.type, ev.code, ev.value);
         }
 
         if (recording) {
             stream_broadcast(d->index, &ev);
         }
+
+        if (capturing) {
+            pthread_mutex_lock(&capture_mutex);
+            capture_write(&capture, &ev);
+            pthread_mutex_unlock(&capture_mutex);
+        }
     }
 
     // Unplugging a device — or restarting whatever created it, which is what
@@ -539,12 +658,19 @@ static struct captured_device *device_for(unsigned int type, unsigned int code)
     return found;
 }
 
-static void sleep_us_abortable(long long us) {
-    const long long slice = 2000; // check the abort flag every 2ms
-    while (us > 0 && !play_abort) {
-        long long chunk = us > slice ? slice : us;
-        usleep((useconds_t)chunk);
-        us -= chunk;
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_abortable(long long deadline, sig_atomic_t generation) {
+    const long long slice = 2000; // check for a stop every 2ms
+    long long now;
+    while (play_generation == generation && (now = monotonic_us()) < deadline) {
+        long long until = deadline - now > slice ? now + slice : deadline;
+        struct timespec ts = { .tv_sec = until / 1000000, .tv_nsec = (until % 1000000) * 1000 };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
     }
 }
 
@@ -556,34 +682,131 @@ struct play_event {
     bool syn;       // emit SYN_REPORT afterwards
 };
 
-// Returns the number of events played, or -1 on error.
-static long play_events(struct play_event *events, long count, bool *aborted) {
+// What play_events() plays: a train parsed from a /play body, or a capture
+// file read one record at a time as it plays.
+struct play_source {
+    const struct play_event *events;
+    long count;
+    long next;
+    struct capture_reader *capture;
+    long long last_t;
+};
+
+static bool next_event(struct play_source *src, struct play_event *out) {
+    if (!src->capture) {
+        if (src->next >= src->count) {
+            return false;
+        }
+        *out = src->events[src->next++];
+        return true;
+    }
+
+    struct capture_event ev;
+    do {
+        if (!capture_next(src->capture, &ev)) {
+            return false;
+        }
+    // Scan codes only annotate the key event after them, and a clone makes
+    // no use of them.
+    } while (ev.type == EV_MSC);
+
+    // Records from different devices can be a few µs out of order; never wait
+    // backwards.
+    out->dt = ev.t > src->last_t ? ev.t - src->last_t : 0;
+    if (ev.t > src->last_t) {
+        src->last_t = ev.t;
+    }
+    out->type = ev.type;
+    out->code = ev.code;
+    out->value = ev.value;
+    out->syn = false;   // a capture has its own SYN_REPORTs
+    return true;
+}
+
+/**
+ * The clones a train will land on, and the pad, as play_busy bits. A capture
+ * can hold anything, so it takes them all. Worked out the way play_events()
+ * routes, except that any train takes the pad in gamepad mode: whether the
+ * mapping wants an event depends on the profile, which can change mid-train.
+ * Out of the mode nothing goes to the pad.
+ */
+static unsigned int play_needs(const struct play_source *src) {
+    if (src->capture) {
+        return PLAY_ALL;
+    }
+    unsigned int needs = 0;
+    for (long i = 0; i < src->count; i++) {
+        const struct play_event *ev = &src->events[i];
+        if (gamepad_mode) {
+            needs |= PLAY_PAD;
+        }
+        // A SYN_REPORT goes where the event before it went.
+        if (ev->type == EV_SYN && i > 0) {
+            continue;
+        }
+        struct captured_device *d = device_for(ev->type, ev->code);
+        if (d) {
+            needs |= 1u << (d - devices);
+        }
+    }
+    return needs;
+}
+
+// Returns the number of events played, or -1 on error. *late is how far
+// behind when it was due the latest event went out, in µs.
+static long play_events(struct play_source *src, bool *aborted, long long *late) {
     long played = 0;
+    struct captured_device *last = NULL;
+    struct play_event ev;
+    sig_atomic_t generation = play_generation;
     *aborted = false;
+    *late = 0;
 
-    for (long i = 0; i < count; i++) {
-        if (play_abort) {
+    // Each dt counts from when the previous event was due, not from when it
+    // actually went out, so the lateness of every wakeup does not add up over
+    // a long train.
+    long long due = monotonic_us();
+
+    while (next_event(src, &ev)) {
+        if (play_generation != generation) {
             *aborted = true;
             break;
         }
 
-        if (events[i].dt > 0) {
-            sleep_us_abortable(events[i].dt);
-            if (play_abort) {
+        if (ev.dt > 0) {
+            due += ev.dt;
+            sleep_until_abortable(due, generation);
+            if (play_generation != generation) {
                 *aborted = true;
                 break;
             }
+            long long behind = monotonic_us() - due;
+            if (behind > *late) {
+                *late = behind;
+            }
+        }
+
+        // In gamepad mode, gamepad events — native ones, and mapped keys and
+        // motion — go to the pad, which writes its frame at the end of the
+        // train's.
+        struct input_event ie = { .type = ev.type, .code = ev.code, .value = ev.value };
+        if (gamepad_mode && route_gamepad(&ie, ev.syn || (ev.type == EV_SYN && ev.code == SYN_REPORT), true)) {
+            played++;
+            continue;
         }
 
-        struct captured_device *d = device_for(events[i].type, events[i].code);
+        // A SYN_REPORT ends the frame of the event before it and belongs on
+        // that event's clone; by class it would go to whichever comes first.
+        struct captured_device *d = (ev.type == EV_SYN && last) ? last : device_for(ev.type, ev.code);
         if (!d) {
             fprintf(stderr, "[ERROR] No device available for event type %u code %u\n",
-                    events[i].type, events[i].code);
+                    ev.type, ev.code);
             return -1;
         }
+        last = d;
 
-        emit_tracked(d->fdo, events[i].type, events[i].code, events[i].value);
-        if (events[i].syn) {
+        emit_tracked(d->fdo, ev.type, ev.code, ev.value);
+        if (ev.syn) {
             emit(d->fdo, EV_SYN, SYN_REPORT, 0);
         }
         played++;
@@ -592,6 +815,245 @@ static long play_events(struct play_event *events, long count, bool *aborted) {
     return played;
 }
 
+// ---------------------------------------------------------------------------
+// Captures
+// ---------------------------------------------------------------------------
+
+// A capture is named, never addressed by path: the daemon runs as root and the
+// socket is world-writable, so a name must not be able to leave CAPTURE_DIR.
+static bool capture_path(const char *name, char *path, size_t size) {
+    size_t length = name ? strlen(name) : 0;
+    if (length == 0 || length > 64 || name[0] == '.') {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isalnum((unsigned char)name[i]) && !strchr("._-", name[i])) {
+            return false;
+        }
+    }
+    snprintf(path, size, "%s/%s", CAPTURE_DIR, name);
+    return true;
+}
+
+// Caller holds capture_mutex. Returns how many events went into the file.
+static unsigned long long finish_capture(void) {
+    if (!capturing) {
+        return 0;
+    }
+    capturing = false;
+    unsigned long long count = capture.count;
+    capture_finish(&capture);
+    printf("[DEBUG] Capture %s closed, %llu events\n", capture_name, count);
+    capture_name[0] = '\0';
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Holds
+// ---------------------------------------------------------------------------
+
+/**
+ * Releases holds whose deadline has passed and emits the autorepeats of the
+ * rest. One thread for every hold: it sleeps until the earliest thing due, and
+ * a new hold, a /release or a /stop wakes it to work that out again.
+ *
+ * Events go out with held_mutex taken. That is what keeps a repeat from
+ * landing after /stop has already let go of its key, and it cannot deadlock:
+ * emit() takes emit_mutex on its own, and nothing holding emit_mutex ever
+ * asks for held_mutex.
+ */
+static void *hold_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&held_mutex);
+    while (keep_running) {
+        long long now = monotonic_us();
+        // Bounded even with nothing held, so shutdown is never kept waiting on
+        // a condition nobody is going to signal.
+        long long wake = now + 500000;
+
+        for (int i = 0; i < MAX_HOLDS; i++) {
+            struct hold *h = &holds[i];
+            if (!h->active) {
+                continue;
+            }
+            if (h->release_at && now >= h->release_at) {
+                h->active = false;
+                held[h->code] = 0;
+                emit(h->fd, EV_KEY, h->code, 0);
+                emit(h->fd, EV_SYN, SYN_REPORT, 0);
+                continue;
+            }
+            if (h->next_repeat && now >= h->next_repeat) {
+                emit(h->fd, EV_KEY, h->code, 2);
+                emit(h->fd, EV_SYN, SYN_REPORT, 0);
+                // Skip what a stall cost rather than catch up on it: a burst
+                // of back-to-back repeats is not what a held key sends.
+                while (h->next_repeat <= now) {
+                    h->next_repeat += h->period;
+                }
+            }
+            if (h->release_at && h->release_at < wake) {
+                wake = h->release_at;
+            }
+            if (h->next_repeat && h->next_repeat < wake) {
+                wake = h->next_repeat;
+            }
+        }
+
+        struct timespec until = { .tv_sec = wake / 1000000, .tv_nsec = (wake % 1000000) * 1000 };
+        pthread_cond_timedwait(&hold_cond, &held_mutex, &until);
+    }
+    pthread_mutex_unlock(&held_mutex);
+    return NULL;
+}
+
+/**
+ * Press `code` and keep it down for `ms` milliseconds, or until /release when
+ * that is 0, repeating every `repeat_ms` after an initial `delay_ms` the way
+ * the kernel's own autorepeat does. Holding a key that is already held by a
+ * hold replaces its timing rather than pressing it twice.
+ *
+ * Returns false when every hold slot is taken.
+ */
+static bool start_hold(struct captured_device *d, __u16 code, long long ms, long long repeat_ms, long long delay_ms) {
+    long long now = monotonic_us();
+    bool ok = false;
+
+    pthread_mutex_lock(&held_mutex);
+    struct hold *slot = NULL;
+    for (int i = 0; i < MAX_HOLDS && !slot; i++) {
+        if (holds[i].active && holds[i].code == code) {
+            slot = &holds[i];
+        }
+    }
+    for (int i = 0; i < MAX_HOLDS && !slot; i++) {
+        if (!holds[i].active) {
+            slot = &holds[i];
+        }
+    }
+
+    if (slot) {
+        if (!held[code]) {
+            emit(d->fdo, EV_KEY, code, 1);
+            emit(d->fdo, EV_SYN, SYN_REPORT, 0);
+            held[code] = 1;
+            held_fd[code] = d->fdo;
+        }
+        slot->active = true;
+        slot->code = code;
+        slot->fd = held_fd[code];
+        slot->release_at = ms > 0 ? now + ms * 1000 : 0;
+        slot->period = repeat_ms * 1000;
+        slot->next_repeat = repeat_ms > 0 ? now + delay_ms * 1000 : 0;
+        pthread_cond_signal(&hold_cond);
+        ok = true;
+    }
+    pthread_mutex_unlock(&held_mutex);
+    return ok;
+}
+
+/** Let go of the hold on `code`, or of every hold when `code` is negative. */
+static int release_holds(int code) {
+    int released = 0;
+
+    pthread_mutex_lock(&held_mutex);
+    for (int i = 0; i < MAX_HOLDS; i++) {
+        struct hold *h = &holds[i];
+        if (!h->active || (code >= 0 && h->code != code)) {
+            continue;
+        }
+        h->active = false;
+        if (held[h->code]) {
+            held[h->code] = 0;
+            emit(h->fd, EV_KEY, h->code, 0);
+            emit(h->fd, EV_SYN, SYN_REPORT, 0);
+        }
+        released++;
+    }
+    pthread_cond_signal(&hold_cond);
+    pthread_mutex_unlock(&held_mutex);
+    return released;
+}
+
+// ---------------------------------------------------------------------------
+// Gamepad mode
+// ---------------------------------------------------------------------------
+
+// The stick engine's clock. The read happens outside gamepad_mutex, so a
+// reader thread never waits on a tick that has not come yet; the timer is
+// disarmed whenever the stick is at rest, and then this sleeps in read().
+// Shutdown wakes it with gamepad_interrupt() and joins it.
+static void *stick_thread(void *arg) {
+    (void)arg;
+    while (keep_running) {
+        unsigned long long expirations;
+        ssize_t n = read(pad.timer_fd, &expirations, sizeof(expirations));
+        if (n != (ssize_t)sizeof(expirations)) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            perror("stick timer");
+            break;
+        }
+        if (!keep_running) {
+            break;
+        }
+        pthread_mutex_lock(&gamepad_mutex);
+        gamepad_on_timer(&pad, expirations);
+        pthread_mutex_unlock(&gamepad_mutex);
+    }
+    return NULL;
+}
+
+// The pad, made if it is not there yet; called with gamepad_mutex held.
+static bool ensure_pad_locked(void) {
+    if (pad.fd >= 0) {
+        return true;
+    }
+    if (!gamepad_create(&pad, "Macroclickwerk Virtual Gamepad")) {
+        return false;
+    }
+    gamepad_use_profile(&pad, &gamepad_map.profiles[gamepad_profile]);
+    stick_ticking = pthread_create(&stick_ticker, NULL, stick_thread, NULL) == 0;
+    printf("[DEBUG] Created virtual gamepad\n");
+    return true;
+}
+
+// The pad, made if it is not there yet, without turning the mode on.
+static bool ensure_pad(void) {
+    pthread_mutex_lock(&gamepad_mutex);
+    bool ok = ensure_pad_locked();
+    pthread_mutex_unlock(&gamepad_mutex);
+    return ok;
+}
+
+static bool set_gamepad_mode(bool on) {
+    pthread_mutex_lock(&gamepad_mutex);
+    bool ok = !on || ensure_pad_locked();
+    if (ok) {
+        // Leaving the mode lets go of everything: a stick left deflected
+        // would keep the character walking with nothing left to stop it.
+        if (!on && pad.fd >= 0) {
+            gamepad_reset(&pad);
+        }
+        gamepad_mode = on;
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+    return ok;
+}
+
+// Switching lets go of whatever the old profile held, as leaving the mode does.
+static void select_profile(int index) {
+    pthread_mutex_lock(&gamepad_mutex);
+    gamepad_profile = index;
+    if (pad.fd >= 0) {
+        gamepad_use_profile(&pad, &gamepad_map.profiles[index]);
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+    printf("[DEBUG] Gamepad profile %s\n", gamepad_map.profiles[index].name);
+}
+
 // ---------------------------------------------------------------------------
 // HTTP control API
 // ---------------------------------------------------------------------------
@@ -599,6 +1061,19 @@ static long play_events(struct play_event *events, long count, bool *aborted) {
 struct request_data {
     char *post_data;
     size_t size;
+    long long arrived;  // when the headers were in, for /play's timing
+};
+
+/**
+ * When a /play went through each stage, on CLOCK_MONOTONIC — the clock the
+ * extension's GLib.get_monotonic_time() reads, so it can put them straight
+ * into its own trace. Answered with every /play that was played.
+ */
+struct play_timing {
+    long long arrived;  // headers read
+    long long received; // body read
+    long long started;  // parsed, and the clones taken
+    long long ended;    // last event written
 };
 
 static enum MHD_Result send_json(struct MHD_Connection *connection, unsigned int code, const char *body) {
@@ -639,18 +1114,107 @@ static enum MHD_Result send_status(struct MHD_Connection *connection) {
     }
     pthread_mutex_unlock(&devices_mutex);
 
+    int hold_count = 0;
+    pthread_mutex_lock(&held_mutex);
+    for (int i = 0; i < MAX_HOLDS; i++) {
+        hold_count += holds[i].active ? 1 : 0;
+    }
+    pthread_mutex_unlock(&held_mutex);
+
+    // Names are checked by capture_path(), so one can go into JSON as it is.
+    char capture_json[NAME_MAX + 3];
+    pthread_mutex_lock(&capture_mutex);
+    if (capturing) {
+        snprintf(capture_json, sizeof(capture_json), "\"%s\"", capture_name);
+    } else {
+        strcpy(capture_json, "null");
+    }
+    pthread_mutex_unlock(&capture_mutex);
+
+    // Profile names are checked by gamepad_map_load() the same way.
+    char profile_name[GAMEPAD_PROFILE_NAME];
+    pthread_mutex_lock(&gamepad_mutex);
+    snprintf(profile_name, sizeof(profile_name), "%s", gamepad_map.profiles[gamepad_profile].name);
+    pthread_mutex_unlock(&gamepad_mutex);
+
     snprintf(body, sizeof(body),
-             "{\"version\":%d,\"recording\":%s,\"playing\":%s,\"devices\":[%s]}",
+             "{\"version\":%d,\"recording\":%s,\"playing\":%s,\"holds\":%d,\"capture\":%s,\"gamepad\":%s,\"profile\":\"%s\",\"devices\":[%s]}",
              API_VERSION,
              recording ? "true" : "false",
-             playing ? "true" : "false",
+             playing > 0 ? "true" : "false",
+             hold_count,
+             capture_json,
+             gamepad_mode ? "true" : "false",
+             profile_name,
              devs);
 
     return send_json(connection, MHD_HTTP_OK, body);
 }
 
-static enum MHD_Result handle_play(struct MHD_Connection *connection, struct json_object *parsed) {
+static enum MHD_Result run_play(struct MHD_Connection *connection, struct play_source *src,
+                                struct play_timing *timing) {
+    unsigned int needs = play_needs(src);
+    pthread_mutex_lock(&play_mutex);
+    if (play_busy & needs) {
+        pthread_mutex_unlock(&play_mutex);
+        return send_json(connection, MHD_HTTP_CONFLICT, "{\"error\":\"busy\"}");
+    }
+    play_busy |= needs;
+    playing++;
+    pthread_mutex_unlock(&play_mutex);
+
+    bool aborted = false;
+    long long late = 0;
+    timing->started = monotonic_us();
+    long played = play_events(src, &aborted, &late);
+    timing->ended = monotonic_us();
+
+    pthread_mutex_lock(&play_mutex);
+    play_busy &= ~needs;
+    playing--;
+    pthread_mutex_unlock(&play_mutex);
+
+    if (played < 0) {
+        return send_json(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "{\"error\":\"no suitable device\"}");
+    }
+
+    char body[256];
+    snprintf(body, sizeof(body),
+             "{\"played\":%ld,\"aborted\":%s,\"timing\":{\"arrived\":%lld,\"received\":%lld,"
+             "\"started\":%lld,\"ended\":%lld,\"late\":%lld}}",
+             played, aborted ? "true" : "false",
+             timing->arrived, timing->received, timing->started, timing->ended, late);
+    return send_json(connection, MHD_HTTP_OK, body);
+}
+
+// Plays a capture file. Nothing of it is held in memory beyond the page being
+// read, which is why there is no MAX_PLAY_EVENTS here.
+static enum MHD_Result handle_play_capture(struct MHD_Connection *connection, const char *name,
+                                           struct play_timing *timing) {
+    char path[PATH_MAX];
+    if (!capture_path(name, path, sizeof(path))) {
+        return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"invalid capture name\"}");
+    }
+
+    struct capture_reader reader;
+    if (!capture_map(&reader, path)) {
+        return errno == ENOENT
+            ? send_json(connection, MHD_HTTP_NOT_FOUND, "{\"error\":\"no such capture\"}")
+            : send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"unreadable capture\"}");
+    }
+
+    struct play_source src = { .capture = &reader };
+    enum MHD_Result ret = run_play(connection, &src, timing);
+    capture_unmap(&reader);
+    return ret;
+}
+
+static enum MHD_Result handle_play(struct MHD_Connection *connection, struct json_object *parsed,
+                                   struct play_timing *timing) {
     struct json_object *events_obj;
+    if (json_object_object_get_ex(parsed, "capture", &events_obj)) {
+        return handle_play_capture(connection, json_object_get_string(events_obj), timing);
+    }
     if (!json_object_object_get_ex(parsed, "events", &events_obj) ||
         json_object_get_type(events_obj) != json_type_array) {
         return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"missing events array\"}");
@@ -684,29 +1248,96 @@ static enum MHD_Result handle_play(struct MHD_Connection *connection, struct jso
         }
     }
 
-    if (pthread_mutex_trylock(&play_mutex) != 0) {
-        free(events);
-        return send_json(connection, MHD_HTTP_CONFLICT, "{\"error\":\"busy\"}");
+    struct play_source src = { .events = events, .count = (long)count };
+    enum MHD_Result ret = run_play(connection, &src, timing);
+    free(events);
+    return ret;
+}
+
+/**
+ * Recording on or off. With "capture", recording also writes every forwarded
+ * event to that file in CAPTURE_DIR until the next /record; turning it off
+ * answers how many events the file got.
+ */
+static enum MHD_Result handle_record(struct MHD_Connection *connection, struct json_object *parsed) {
+    struct json_object *field;
+    bool on = parsed && json_object_object_get_ex(parsed, "on", &field) && json_object_get_boolean(field);
+    const char *name = on && parsed && json_object_object_get_ex(parsed, "capture", &field)
+        ? json_object_get_string(field) : NULL;
+
+    char path[PATH_MAX];
+    if (name && !capture_path(name, path, sizeof(path))) {
+        return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"invalid capture name\"}");
+    }
+
+    pthread_mutex_lock(&capture_mutex);
+    bool had_capture = capturing;
+    unsigned long long captured = finish_capture();
+    if (name) {
+        if (!capture_create(&capture, path)) {
+            pthread_mutex_unlock(&capture_mutex);
+            recording = false;
+            return errno == EEXIST
+                ? send_json(connection, MHD_HTTP_CONFLICT, "{\"error\":\"capture exists\"}")
+                : send_json(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "{\"error\":\"cannot create capture\"}");
+        }
+        snprintf(capture_name, sizeof(capture_name), "%s", name);
+        capturing = true;
     }
+    pthread_mutex_unlock(&capture_mutex);
 
-    play_abort = 0;
-    playing = true;
-    bool aborted = false;
-    long played = play_events(events, (long)count, &aborted);
-    playing = false;
-    pthread_mutex_unlock(&play_mutex);
-    free(events);
+    recording = on;
+    printf("[DEBUG] Recording %s%s%s\n", on ? "started" : "stopped", name ? " into " : "", name ? name : "");
 
-    if (played < 0) {
+    char body[128];
+    if (had_capture) {
+        snprintf(body, sizeof(body), "{\"recording\":%s,\"captured\":%llu}", on ? "true" : "false", captured);
+    } else {
+        snprintf(body, sizeof(body), "{\"recording\":%s}", on ? "true" : "false");
+    }
+    return send_json(connection, MHD_HTTP_OK, body);
+}
+
+static enum MHD_Result handle_hold(struct MHD_Connection *connection, struct json_object *parsed) {
+    struct json_object *field;
+
+    // Keys and buttons only: there is nothing to hold down on an axis.
+    if (json_object_object_get_ex(parsed, "type", &field) && json_object_get_int(field) != EV_KEY) {
+        return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"only EV_KEY can be held\"}");
+    }
+    if (!json_object_object_get_ex(parsed, "code", &field)) {
+        return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"missing code\"}");
+    }
+    int code = json_object_get_int(field);
+    if (code <= 0 || code > KEY_MAX) {
+        return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"code out of range\"}");
+    }
+
+    long long ms = json_object_object_get_ex(parsed, "ms", &field) ? json_object_get_int64(field) : 0;
+    long long repeat_ms = json_object_object_get_ex(parsed, "repeat_ms", &field) ? json_object_get_int64(field) : 0;
+    // 250 ms is the kernel's own default delay before a held key repeats.
+    long long delay_ms = json_object_object_get_ex(parsed, "delay_ms", &field) ? json_object_get_int64(field) : 250;
+    if (ms < 0 || repeat_ms < 0 || delay_ms < 0) {
+        return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"negative duration\"}");
+    }
+
+    struct captured_device *d = device_for(EV_KEY, (unsigned int)code);
+    if (!d) {
         return send_json(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "{\"error\":\"no suitable device\"}");
     }
+    if (!start_hold(d, (__u16)code, ms, repeat_ms, delay_ms)) {
+        return send_json(connection, MHD_HTTP_CONFLICT, "{\"error\":\"too many holds\"}");
+    }
 
-    char body[128];
-    snprintf(body, sizeof(body), "{\"played\":%ld,\"aborted\":%s}", played, aborted ? "true" : "false");
+    char body[64];
+    snprintf(body, sizeof(body), "{\"held\":%d}", code);
     return send_json(connection, MHD_HTTP_OK, body);
 }
 
-static enum MHD_Result handle_post(struct MHD_Connection *connection, const char *url, const char *data) {
+static enum MHD_Result handle_post(struct MHD_Connection *connection, const char *url,
+                                   const struct request_data *req) {
+    const char *data = req->post_data;
+    struct play_timing timing = { .arrived = req->arrived, .received = monotonic_us() };
     struct json_object *parsed = data ? json_tokener_parse(data) : NULL;
     struct json_object *field;
     enum MHD_Result ret;
@@ -715,13 +1346,91 @@ static enum MHD_Result handle_post(struct MHD_Connection *connection, const char
         if (!parsed) {
             return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"invalid json\"}");
         }
-        ret = handle_play(connection, parsed);
+        ret = handle_play(connection, parsed, &timing);
         json_object_put(parsed);
         return ret;
     }
 
+    if (strcmp(url, "/hold") == 0) {
+        if (!parsed) {
+            return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"invalid json\"}");
+        }
+        ret = handle_hold(connection, parsed);
+        json_object_put(parsed);
+        return ret;
+    }
+
+    if (strcmp(url, "/release") == 0) {
+        int code = parsed && json_object_object_get_ex(parsed, "code", &field) ? json_object_get_int(field) : -1;
+        char body[64];
+        snprintf(body, sizeof(body), "{\"released\":%d}", release_holds(code));
+        if (parsed) {
+            json_object_put(parsed);
+        }
+        return send_json(connection, MHD_HTTP_OK, body);
+    }
+
+    if (strcmp(url, "/gamepad") == 0) {
+        // Without "on" the mode stays as it is, so a profile or the stick can
+        // be changed on their own.
+        bool on = gamepad_mode;
+        if (parsed && json_object_object_get_ex(parsed, "on", &field)) {
+            on = json_object_get_boolean(field);
+        }
+        // Everything is checked, and the pad made, before anything changes:
+        // a request that fails leaves the profile and the stick as they were.
+        int profile = -1;
+        if (parsed && json_object_object_get_ex(parsed, "profile", &field)) {
+            profile = gamepad_map_find(&gamepad_map, json_object_get_string(field));
+            if (profile < 0) {
+                json_object_put(parsed);
+                return send_json(connection, MHD_HTTP_NOT_FOUND, "{\"error\":\"no such profile\"}");
+            }
+        }
+        bool new_stick = parsed && json_object_object_get_ex(parsed, "stick", &field);
+        struct stick_config next;
+        if (new_stick) {
+            pthread_mutex_lock(&gamepad_mutex);
+            next = gamepad_map.profiles[profile >= 0 ? profile : gamepad_profile].stick;
+            pthread_mutex_unlock(&gamepad_mutex);
+            if (!stick_parse(&next, json_object_get_string(field))) {
+                json_object_put(parsed);
+                return send_json(connection, MHD_HTTP_BAD_REQUEST, "{\"error\":\"bad stick settings\"}");
+            }
+        }
+        if (parsed) {
+            json_object_put(parsed);
+        }
+        if (on && !ensure_pad()) {
+            return send_json(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "{\"error\":\"cannot create gamepad\"}");
+        }
+
+        if (profile >= 0) {
+            select_profile(profile);
+        }
+        if (new_stick) {
+            pthread_mutex_lock(&gamepad_mutex);
+            struct stick_config *current = &gamepad_map.profiles[gamepad_profile].stick;
+            *current = next;
+            if (pad.fd >= 0) {
+                gamepad_configure(&pad, current);
+            }
+            pthread_mutex_unlock(&gamepad_mutex);
+        }
+        // The pad is there when it is wanted, so this cannot fail now.
+        set_gamepad_mode(on);
+        printf("[DEBUG] Gamepad mode %s\n", on ? "on" : "off");
+
+        char body[96];
+        pthread_mutex_lock(&gamepad_mutex);
+        snprintf(body, sizeof(body), "{\"gamepad\":%s,\"profile\":\"%s\"}",
+                 on ? "true" : "false", gamepad_map.profiles[gamepad_profile].name);
+        pthread_mutex_unlock(&gamepad_mutex);
+        return send_json(connection, MHD_HTTP_OK, body);
+    }
+
     if (strcmp(url, "/stop") == 0) {
-        play_abort = 1;
+        stop_all_trains();
         release_all_held();
         if (parsed) {
             json_object_put(parsed);
@@ -730,13 +1439,11 @@ static enum MHD_Result handle_post(struct MHD_Connection *connection, const char
     }
 
     if (strcmp(url, "/record") == 0) {
-        bool on = parsed && json_object_object_get_ex(parsed, "on", &field) && json_object_get_boolean(field);
-        recording = on;
-        printf("[DEBUG] Recording %s\n", on ? "started" : "stopped");
+        ret = handle_record(connection, parsed);
         if (parsed) {
             json_object_put(parsed);
         }
-        return send_json(connection, MHD_HTTP_OK, on ? "{\"recording\":true}" : "{\"recording\":false}");
+        return ret;
     }
 
     if (parsed) {
@@ -760,6 +1467,7 @@ static enum MHD_Result handle_request(void *cls,
         if (!data) {
             return MHD_NO;
         }
+        data->arrived = monotonic_us();
         *con_cls = data;
         return MHD_YES;
     }
@@ -787,7 +1495,7 @@ static enum MHD_Result handle_request(void *cls,
         }
 
         printf("[DEBUG] POST %s (%zu bytes)\n", url, req_data->size);
-        return handle_post(connection, url, req_data->post_data);
+        return handle_post(connection, url, req_data);
     }
 
     return send_json(connection, MHD_HTTP_METHOD_NOT_ALLOWED, "{\"error\":\"Method not allowed\"}");
@@ -822,7 +1530,7 @@ static void release_devices(void) {
 
 static void sig_handler(int sig) {
     keep_running = 0;
-    play_abort = 1;
+    stop_all_trains();
     release_devices();
 
     if (sig == SIGSEGV || sig == SIGABRT) {
@@ -840,7 +1548,16 @@ static volatile sig_atomic_t soft_stop = 0;
 static void soft_stop_handler(int sig) {
     (void)sig;
     soft_stop = 1;
-    play_abort = 1;
+    stop_all_trains();
+}
+
+// SIGUSR2 steps to the next gamepad profile — for a hotkey daemon, or a game
+// launcher's wrapper script. Counted here, switched by the main loop.
+static volatile sig_atomic_t profile_steps = 0;
+
+static void next_profile_handler(int sig) {
+    (void)sig;
+    profile_steps++;
 }
 
 static int create_unix_listener(const char *path) {
@@ -877,7 +1594,7 @@ static void usage(const char *path) {
     const char *basename = strrchr(path, '/');
     basename = basename ? basename + 1 : path;
 
-    fprintf(stderr, "usage: %s [-a] [-d PATH] [-n NAME] …\n", basename);
+    fprintf(stderr, "usage: %s [-a] [-d PATH] [-n NAME] [-g] [-m MAPPING] [-s STICK] [-c SOCKET] [-e SOCKET] …\n", basename);
     fprintf(stderr, "  -a     \tCapture every keyboard and pointer, present or plugged in later.\n");
     fprintf(stderr, "         \tDevices another process holds exclusively — a key remapper's\n");
     fprintf(stderr, "         \treal keyboard — are left to it; its virtual output is taken\n");
@@ -887,6 +1604,16 @@ static void usage(const char *path) {
     fprintf(stderr, "         \tUse this for receiver-paired devices, which have no stable\n");
     fprintf(stderr, "         \tpath under /dev/input/by-id. Names are listed by:\n");
     fprintf(stderr, "         \t  grep '^N: Name' /proc/bus/input/devices\n");
+    fprintf(stderr, "  -g     \tStart in gamepad mode: WASD, E, C/Esc, mouse motion and buttons\n");
+    fprintf(stderr, "         \tdrive a virtual gamepad instead (see also POST /gamepad).\n");
+    fprintf(stderr, "  -m MAPPING\tGamepad keys, buttons and profiles from a mapping file (see\n");
+    fprintf(stderr, "         \tgamepad.map); SIGUSR2 steps to the next profile.\n");
+    fprintf(stderr, "  -s STICK\tHow mouse motion moves the right stick, as key=value,…:\n");
+    fprintf(stderr, "         \trate (Hz, 1000), decay (ms back to centre, 60), filter (ticks\n");
+    fprintf(stderr, "         \taveraged, 4), scale (counts for full tilt, 400), inner (0.1),\n");
+    fprintf(stderr, "         \tcurve=linear | exp:EXPONENT (exp:0.5) | lut:P0/P1/…\n");
+    fprintf(stderr, "  -c SOCKET\tControl socket (default %s).\n", SOCKET_PATH);
+    fprintf(stderr, "  -e SOCKET\tEvent stream socket (default %s).\n", EVENT_SOCKET_PATH);
     fprintf(stderr, "  At most %d devices in total.\n", MAX_DEVICES);
     fprintf(stderr, "\nDevices do not have to exist at startup: /dev/input is watched, and\n");
     fprintf(stderr, "anything matching is captured when it appears and reattached when it\n");
@@ -1248,10 +1975,14 @@ int main(int argc, char *argv[]) {
     signal(SIGSEGV, sig_handler);
     signal(SIGABRT, sig_handler);
     signal(SIGUSR1, soft_stop_handler);
+    signal(SIGUSR2, next_profile_handler);
+
+    stick_defaults(&stick);
+    const char *mapping = NULL;
 
     int opt;
 
-    while ((opt = getopt(argc, argv, "ad:n:h")) != -1) {
+    while ((opt = getopt(argc, argv, "ad:n:c:e:gm:s:h")) != -1) {
         switch (opt) {
             case 'a':
                 auto_capture = true;
@@ -1266,6 +1997,23 @@ int main(int argc, char *argv[]) {
                 specs[spec_count].value = optarg;
                 spec_count++;
                 break;
+            case 'c':
+                control_path = optarg;
+                break;
+            case 'g':
+                gamepad_at_start = true;
+                break;
+            case 'm':
+                mapping = optarg;
+                break;
+            case 's':
+                if (!stick_parse(&stick, optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                event_path = optarg;
+                break;
             case 'h':
                 usage(argv[0]);
                 return EXIT_SUCCESS;
@@ -1281,6 +2029,15 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    // After the options, so -s is there for every profile to start from.
+    if (mapping) {
+        if (!gamepad_map_load(&gamepad_map, mapping, &stick)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        gamepad_map_builtin(&gamepad_map, &stick);
+    }
+
     // A device that is not there is a warning, not a failure. It may simply not
     // have appeared yet — a wireless mouse pairing, or an upstream remapper
     // still building the virtual keyboard this daemon sits behind — and the
@@ -1297,16 +2054,36 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    control_listen_fd = create_unix_listener(SOCKET_PATH);
+    // Hold deadlines are monotonic: a clock change must not end a hold early
+    // or stretch it out to whenever the wall clock catches up. Set up before
+    // the HTTP daemon, which is what hands out holds.
+    pthread_condattr_t hold_attr;
+    pthread_condattr_init(&hold_attr);
+    pthread_condattr_setclock(&hold_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hold_cond, &hold_attr);
+    pthread_condattr_destroy(&hold_attr);
+
+    if (gamepad_at_start && !set_gamepad_mode(true)) {
+        release_devices();
+        return EXIT_FAILURE;
+    }
+
+    // systemd's StateDirectory= creates this already; running by hand, it may
+    // not exist yet.
+    if (mkdir(CAPTURE_DIR, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Warning: cannot create %s: %s. Captures will fail.\n", CAPTURE_DIR, strerror(errno));
+    }
+
+    control_listen_fd = create_unix_listener(control_path);
     if (control_listen_fd < 0) {
         release_devices();
         return EXIT_FAILURE;
     }
 
-    event_listen_fd = create_unix_listener(EVENT_SOCKET_PATH);
+    event_listen_fd = create_unix_listener(event_path);
     if (event_listen_fd < 0) {
         close(control_listen_fd);
-        unlink(SOCKET_PATH);
+        unlink(control_path);
         release_devices();
         return EXIT_FAILURE;
     }
@@ -1322,8 +2099,8 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Failed to start HTTP daemon\n");
         close(control_listen_fd);
         close(event_listen_fd);
-        unlink(SOCKET_PATH);
-        unlink(EVENT_SOCKET_PATH);
+        unlink(control_path);
+        unlink(event_path);
         release_devices();
         return EXIT_FAILURE;
     }
@@ -1331,12 +2108,15 @@ int main(int argc, char *argv[]) {
     pthread_t stream_thread;
     pthread_create(&stream_thread, NULL, stream_accept_thread, NULL);
 
+    pthread_t holder;
+    pthread_create(&holder, NULL, hold_thread, NULL);
+
     // Readers are started by attach_device(), so devices captured during
     // rescan() above are already running by now.
     pthread_t hotplug_thread;
     pthread_create(&hotplug_thread, NULL, monitor_thread, NULL);
 
-    printf("[DEBUG] Listening on %s and %s\n", SOCKET_PATH, EVENT_SOCKET_PATH);
+    printf("[DEBUG] Listening on %s and %s\n", control_path, event_path);
 
     // Polled rather than pause()d: a process-directed signal may be delivered
     // to whichever thread has it unblocked, and a pause() that another thread's
@@ -1349,16 +2129,41 @@ int main(int argc, char *argv[]) {
             release_all_held();
             fprintf(stderr, "macroclickwerk: playback stopped, held keys released\n");
         }
+        if (profile_steps) {
+            int steps = profile_steps;
+            profile_steps = 0;
+            pthread_mutex_lock(&gamepad_mutex);
+            int next = (gamepad_profile + steps) % gamepad_map.count;
+            pthread_mutex_unlock(&gamepad_mutex);
+            select_profile(next);
+        }
     }
 
     printf("[DEBUG] Shutting down\n");
     release_all_held();
+    // The hold thread emits to the clones, so it goes before they do. The
+    // broadcast wakes it to find keep_running cleared.
+    pthread_mutex_lock(&held_mutex);
+    pthread_cond_broadcast(&hold_cond);
+    pthread_mutex_unlock(&held_mutex);
+    pthread_join(holder, NULL);
     MHD_stop_daemon(http_daemon);
+    // What is still in the stdio buffer is the end of the capture.
+    pthread_mutex_lock(&capture_mutex);
+    finish_capture();
+    pthread_mutex_unlock(&capture_mutex);
     close(event_listen_fd);
-    unlink(SOCKET_PATH);
-    unlink(EVENT_SOCKET_PATH);
+    unlink(control_path);
+    unlink(event_path);
     release_devices();
 
+    if (stick_ticking) {
+        pthread_mutex_lock(&gamepad_mutex);
+        gamepad_interrupt(&pad);
+        pthread_mutex_unlock(&gamepad_mutex);
+        pthread_join(stick_ticker, NULL);
+    }
+    gamepad_destroy(&pad);
     for (int i = 0; i < device_count; i++) {
         if (devices[i].fdo >= 0) {
             ioctl(devices[i].fdo, UI_DEV_DESTROY);
@@ -0,0 +1,298 @@
+// match-bench - what the image condition's search costs, and that it finds.
+//
+// Builds a stand-in screen — a gradient with a few hundred flat rectangles on
+// it, a little noise over everything — hides a patch in it somewhere, and times
+// the search for it, frame already in memory as the helper would have it mapped.
+// Every search is checked: the patch must be found where it was hidden, and one
+// that was never hidden must score well below it. Exits non-zero if not.
+//
+//   ./match-bench [-k KERNEL] [-n ROUNDS]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "match.h"
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-k KERNEL] [-n ROUNDS]\n", name);
+    fprintf(stderr, "  -k KERNEL\tavx2 or scalar (the best this CPU has).\n");
+    fprintf(stderr, "  -n ROUNDS\tSearches per case (50).\n");
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Not rand(): the same screen on every machine, whatever its libc.
+static unsigned int seed = 12345;
+static unsigned int next_random(void) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+struct picture {
+    unsigned char *pixels;
+    int width;
+    int height;
+    int channels;
+};
+
+static struct picture picture_new(int width, int height, int channels) {
+    struct picture p = { calloc((size_t)width * height * channels, 1), width, height, channels };
+    if (!p.pixels) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void fill_rect(struct picture *p, int x0, int y0, int w, int h, const unsigned char rgb[3]) {
+    for (int y = y0; y < y0 + h && y < p->height; y++) {
+        for (int x = x0; x < x0 + w && x < p->width; x++) {
+            unsigned char *px = p->pixels + ((size_t)y * p->width + x) * p->channels;
+            memcpy(px, rgb, 3);
+            if (p->channels == 4) {
+                px[3] = 255;
+            }
+        }
+    }
+}
+
+// Something a desktop might show: a backdrop and a clutter of flat boxes.
+static void scenery(struct picture *p, int boxes, int max_side) {
+    for (int y = 0; y < p->height; y++) {
+        for (int x = 0; x < p->width; x++) {
+            unsigned char rgb[3] = { (unsigned char)(x * 255 / p->width), (unsigned char)(y * 255 / p->height), 90 };
+            fill_rect(p, x, y, 1, 1, rgb);
+        }
+    }
+    for (int i = 0; i < boxes; i++) {
+        unsigned char rgb[3] = { next_random() & 255, next_random() & 255, next_random() & 255 };
+        fill_rect(p, (int)(next_random() % p->width), (int)(next_random() % p->height),
+                  2 + (int)(next_random() % max_side), 2 + (int)(next_random() % max_side), rgb);
+    }
+}
+
+static void noise(struct picture *p, int amount) {
+    size_t n = (size_t)p->width * p->height * p->channels;
+    for (size_t i = 0; i < n; i++) {
+        if (p->channels == 4 && i % 4 == 3) {
+            continue;
+        }
+        int v = p->pixels[i] + (int)(next_random() % (2 * amount + 1)) - amount;
+        p->pixels[i] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+}
+
+static void paste(struct picture *into, const struct picture *patch, int x0, int y0) {
+    for (int y = 0; y < patch->height; y++) {
+        for (int x = 0; x < patch->width; x++) {
+            const unsigned char *src = patch->pixels + ((size_t)y * patch->width + x) * patch->channels;
+            fill_rect(into, x0 + x, y0 + y, 1, 1, src);
+        }
+    }
+}
+
+static struct match_image image_of(const struct picture *p) {
+    return (struct match_image){
+        .pixels = p->pixels, .width = p->width, .height = p->height,
+        .stride = p->width * p->channels, .channels = p->channels,
+    };
+}
+
+static int failures = 0;
+
+static void run_case(int frame_w, int frame_h, int channels, int side, int rounds) {
+    struct picture frame = picture_new(frame_w, frame_h, channels);
+    scenery(&frame, 400, 200);
+    struct picture patch = picture_new(side, side, channels);
+    scenery(&patch, 12, side / 2);
+    struct picture absent = picture_new(side, side, channels);
+    scenery(&absent, 12, side / 2);
+
+    int at_x = (int)(next_random() % (unsigned)(frame_w - side));
+    int at_y = (int)(next_random() % (unsigned)(frame_h - side));
+    paste(&frame, &patch, at_x, at_y);
+    // The patch as it was picked, the screen as it is now: not byte-for-byte.
+    noise(&frame, 6);
+
+    struct match_image f = image_of(&frame), p = image_of(&patch), a = image_of(&absent);
+    struct match_scratch scratch = { 0 };
+    struct match_result found, missing;
+    long long *took = malloc((size_t)rounds * sizeof(*took));
+    if (!took) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < rounds; i++) {
+        long long start = now_ns();
+        if (match_find(&f, &p, &scratch, &found) != 0) {
+            perror("match_find");
+            exit(EXIT_FAILURE);
+        }
+        took[i] = now_ns() - start;
+    }
+    if (match_find(&f, &a, &scratch, &missing) != 0) {
+        perror("match_find");
+        exit(EXIT_FAILURE);
+    }
+    qsort(took, (size_t)rounds, sizeof(*took), compare_ll);
+    long long sum = 0;
+    for (int i = 0; i < rounds; i++) {
+        sum += took[i];
+    }
+
+    bool ok = found.x == at_x && found.y == at_y && found.score >= 0.9 && missing.score < found.score - 0.2;
+    printf("%2dx%-3d in %4dx%-4d %s  mean %6.2f ms, p50 %6.2f, p95 %6.2f   found %.3f at %d,%d, absent %.3f%s\n",
+           side, side, frame_w, frame_h, channels == 4 ? "RGBA" : "RGB ",
+           (double)sum / rounds / 1e6, (double)took[rounds / 2] / 1e6, (double)took[rounds * 95 / 100] / 1e6,
+           found.score, found.x, found.y, missing.score, ok ? "" : "   MISMATCH");
+    if (!ok) {
+        fprintf(stderr, "  hidden at %d,%d\n", at_x, at_y);
+        failures++;
+    }
+
+    free(took);
+    match_scratch_free(&scratch);
+    free(frame.pixels);
+    free(patch.pixels);
+    free(absent.pixels);
+}
+
+// A label picked off a white dialog, looked for on a screen that is all white:
+// mostly background, it is close in grey to any blank spot, and must still not
+// be found there. A blank patch, on the other hand, is found on a blank screen.
+static void run_blank_case(void) {
+    const unsigned char white[3] = { 255, 255, 255 }, ink[3] = { 30, 30, 30 };
+    struct picture frame = picture_new(400, 300, 4);
+    fill_rect(&frame, 0, 0, frame.width, frame.height, white);
+    struct picture label = picture_new(64, 24, 4);
+    fill_rect(&label, 0, 0, label.width, label.height, white);
+    for (int x = 4; x < 60; x += 7) {
+        fill_rect(&label, x, 6, 2, 12, ink);
+        fill_rect(&label, x, 6, 5, 2, ink);
+    }
+    struct picture blank = picture_new(32, 32, 4);
+    fill_rect(&blank, 0, 0, blank.width, blank.height, white);
+
+    struct match_image f = image_of(&frame), l = image_of(&label), b = image_of(&blank);
+    struct match_scratch scratch = { 0 };
+    struct match_result absent, flat;
+    if (match_find(&f, &l, &scratch, &absent) != 0 || match_find(&f, &b, &scratch, &flat) != 0) {
+        perror("match_find");
+        exit(EXIT_FAILURE);
+    }
+    bool ok = absent.score < 0.5 && flat.score >= 0.9;
+    printf("label on a blank screen: absent %.3f, blank patch %.3f%s\n", absent.score, flat.score,
+           ok ? "" : "   MISMATCH");
+    if (!ok) {
+        failures++;
+    }
+
+    match_scratch_free(&scratch);
+    free(frame.pixels);
+    free(label.pixels);
+    free(blank.pixels);
+}
+
+// The SIMD coarse search must keep the spots the plain one does, with the same
+// sums: a wrong sum is mostly hidden by the refining and scoring after it, so
+// the cases above would not notice. Patch widths are multiples of four, which
+// the SIMD search compares in full; the patch sits at an x the second half of
+// a sixteen-spot block looks at.
+static void run_kernel_case(void) {
+    const char *kept = match_kernel();
+    if (match_use_kernel("avx2") != 0) {
+        printf("coarse sums: no avx2 kernel to check\n");
+        return;
+    }
+    struct picture frame = picture_new(320, 200, 4);
+    scenery(&frame, 60, 60);
+    noise(&frame, 40);
+    static const int widths[] = { 4, 12, 20, 36, 64 };
+    struct match_scratch scratch = { 0 };
+    int wrong = 0;
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        struct picture patch = picture_new(widths[w], 16, 4);
+        for (int y = 0; y < patch.height; y++) {
+            memcpy(patch.pixels + (size_t)y * patch.width * 4,
+                   frame.pixels + ((size_t)(70 + y) * frame.width + 137) * 4, (size_t)patch.width * 4);
+        }
+        noise(&patch, 20);
+        struct match_image f = image_of(&frame), p = image_of(&patch);
+        struct match_spot simd[16], plain[16];
+        match_use_kernel("avx2");
+        int n = match_coarse(&f, &p, &scratch, simd, 16);
+        match_use_kernel("scalar");
+        int m = match_coarse(&f, &p, &scratch, plain, 16);
+        if (n < 0 || m < 0) {
+            perror("match_coarse");
+            exit(EXIT_FAILURE);
+        }
+        if (n != m) {
+            wrong++;
+        }
+        for (int i = 0; i < n && i < m; i++) {
+            if (simd[i].x != plain[i].x || simd[i].y != plain[i].y || simd[i].sad != plain[i].sad) {
+                wrong++;
+            }
+        }
+        free(patch.pixels);
+    }
+    printf("coarse sums: avx2 against scalar, %d spots differ%s\n", wrong, wrong ? "   MISMATCH" : "");
+    if (wrong) {
+        failures++;
+    }
+    match_use_kernel(kept);
+    match_scratch_free(&scratch);
+    free(frame.pixels);
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 50;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:n:h")) != -1) {
+        switch (opt) {
+            case 'k':
+                if (match_use_kernel(optarg) != 0) {
+                    fprintf(stderr, "Error: no %s kernel on this CPU\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (rounds < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("kernel %s, %d searches each\n", match_kernel(), rounds);
+    run_case(1920, 1080, 4, 64, rounds);
+    run_case(1920, 1080, 3, 64, rounds);
+    run_case(1920, 1080, 4, 24, rounds);
+    run_case(1920, 1080, 4, 128, rounds);
+    run_case(800, 600, 4, 32, rounds);
+    run_blank_case();
+    run_kernel_case();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,561 @@
+// Finding a small picture in a bigger one; the approach is described in match.h.
+
+#include "match.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCH_X86 1
+#endif
+
+// Smallest side the patch may shrink to at the coarse level. Much below this
+// an icon is a smudge, and the spots kept there are not worth following.
+#define MIN_COARSE_SIDE 12
+#define MAX_LEVELS 6
+// Spots kept from the coarse search. At a sixteenth of its pixels the real
+// match can rank a few places down behind look-alikes; rarely this far.
+#define CANDIDATES 12
+// How far around its position from the level above a spot is searched again.
+#define REFINE_RADIUS 2
+
+/** A grey picture, rows packed. */
+struct plane {
+    uint8_t *p;
+    int w;
+    int h;
+};
+
+struct spot {
+    int x;
+    int y;
+    uint32_t sad;
+};
+
+/** The best spots so far, best first. */
+struct spots {
+    int n;
+    struct spot s[CANDIDATES];
+};
+
+// ---------------------------------------------------------------------------
+// Grey and the pyramid
+// ---------------------------------------------------------------------------
+
+// BT.601 weights in 128ths. Colour is dropped on purpose: what finds an icon
+// at a quarter of its size is its edges. The channel count is a constant in
+// each caller so the compiler can vectorise the loop for it.
+static inline __attribute__((always_inline))
+void grey_rows(const struct match_image *im, const struct plane *out, int channels) {
+    for (int y = 0; y < im->height; y++) {
+        const uint8_t *src = im->pixels + (size_t)y * (size_t)im->stride;
+        uint8_t *dst = out->p + (size_t)y * (size_t)out->w;
+        for (int x = 0; x < im->width; x++) {
+            const uint8_t *px = src + x * channels;
+            dst[x] = (uint8_t)((38 * px[0] + 75 * px[1] + 15 * px[2] + 64) >> 7);
+        }
+    }
+}
+
+static void grey_scalar(const struct match_image *im, const struct plane *out) {
+    if (im->channels == 4) {
+        grey_rows(im, out, 4);
+    } else {
+        grey_rows(im, out, 3);
+    }
+}
+
+static void half_scalar(const struct plane *src, const struct plane *dst) {
+    for (int y = 0; y < dst->h; y++) {
+        const uint8_t *a = src->p + (size_t)(2 * y) * (size_t)src->w;
+        const uint8_t *b = a + src->w;
+        uint8_t *d = dst->p + (size_t)y * (size_t)dst->w;
+        for (int x = 0; x < dst->w; x++) {
+            d[x] = (uint8_t)((a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2) >> 2);
+        }
+    }
+}
+
+#ifdef MATCH_X86
+// Eight pixels, spread to RGBX if they are RGB.
+__attribute__((target("avx2")))
+static inline __m256i eight_pixels(const uint8_t *src, int channels) {
+    if (channels == 4) {
+        return _mm256_loadu_si256((const __m256i *)src);
+    }
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m256i both = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+                                           _mm_loadu_si128((const __m128i *)(src + 12)), 1);
+    return _mm256_shuffle_epi8(both, spread);
+}
+
+// Thirty-two pixels at a time: maddubs weighs R,G and B,X into pairs, hadd
+// adds the pairs, and the packing leaves them in an order one permute fixes.
+// An RGB row stops two pixels early, its loads reading four bytes ahead.
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline))
+void grey_rows_avx2(const struct match_image *im, const struct plane *out, int channels) {
+    const __m256i weights = _mm256_set1_epi32(38 | 75 << 8 | 15 << 16);
+    const __m256i round = _mm256_set1_epi16(64);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int ahead = channels == 4 ? 0 : 2;
+    for (int y = 0; y < im->height; y++) {
+        const uint8_t *src = im->pixels + (size_t)y * (size_t)im->stride;
+        uint8_t *dst = out->p + (size_t)y * (size_t)out->w;
+        int x = 0;
+        for (; x + 32 + ahead <= im->width; x += 32) {
+            const uint8_t *px = src + channels * x;
+            __m256i a = _mm256_hadd_epi16(_mm256_maddubs_epi16(eight_pixels(px, channels), weights),
+                                          _mm256_maddubs_epi16(eight_pixels(px + 8 * channels, channels), weights));
+            __m256i b = _mm256_hadd_epi16(_mm256_maddubs_epi16(eight_pixels(px + 16 * channels, channels), weights),
+                                          _mm256_maddubs_epi16(eight_pixels(px + 24 * channels, channels), weights));
+            a = _mm256_srli_epi16(_mm256_add_epi16(a, round), 7);
+            b = _mm256_srli_epi16(_mm256_add_epi16(b, round), 7);
+            _mm256_storeu_si256((__m256i *)(dst + x), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(a, b), order));
+        }
+        for (; x < im->width; x++) {
+            const uint8_t *px = src + channels * x;
+            dst[x] = (uint8_t)((38 * px[0] + 75 * px[1] + 15 * px[2] + 64) >> 7);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void grey_avx2(const struct match_image *im, const struct plane *out) {
+    if (im->channels == 4) {
+        grey_rows_avx2(im, out, 4);
+    } else {
+        grey_rows_avx2(im, out, 3);
+    }
+}
+
+__attribute__((target("avx2")))
+static void half_avx2(const struct plane *src, const struct plane *dst) {
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi16(2);
+    for (int y = 0; y < dst->h; y++) {
+        const uint8_t *a = src->p + (size_t)(2 * y) * (size_t)src->w;
+        const uint8_t *b = a + src->w;
+        uint8_t *d = dst->p + (size_t)y * (size_t)dst->w;
+        int x = 0;
+        for (; x + 32 <= dst->w; x += 32) {
+            __m256i lo = _mm256_add_epi16(
+                _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(a + 2 * x)), ones),
+                _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(b + 2 * x)), ones));
+            __m256i hi = _mm256_add_epi16(
+                _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(a + 2 * x + 32)), ones),
+                _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(b + 2 * x + 32)), ones));
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+            _mm256_storeu_si256((__m256i *)(d + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+        }
+        for (; x < dst->w; x++) {
+            d[x] = (uint8_t)((a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2) >> 2);
+        }
+    }
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Sums of absolute differences
+// ---------------------------------------------------------------------------
+
+static inline uint32_t row_sad_scalar(const uint8_t *a, const uint8_t *b, int n) {
+    uint32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += (uint32_t)abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+#ifdef MATCH_X86
+__attribute__((target("avx2")))
+static inline uint32_t row_sad_avx2(const uint8_t *a, const uint8_t *b, int n) {
+    __m256i wide = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        wide = _mm256_add_epi64(wide, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                      _mm256_loadu_si256((const __m256i *)(b + i))));
+    }
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(wide), _mm256_extracti128_si256(wide, 1));
+    if (i + 16 <= n) {
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                              _mm_loadu_si128((const __m128i *)(b + i))));
+        i += 16;
+    }
+    if (i + 8 <= n) {
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadl_epi64((const __m128i *)(a + i)),
+                                              _mm_loadl_epi64((const __m128i *)(b + i))));
+        i += 8;
+    }
+    uint32_t total = (uint32_t)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+    return total + row_sad_scalar(a + i, b + i, n - i);
+}
+#endif
+
+typedef uint32_t (*row_sad_fn)(const uint8_t *a, const uint8_t *b, int n);
+
+// The patch against the frame at (x, y), given up on once past `limit`. The
+// row kernel is a constant in each caller below, so each gets its own copy
+// with the kernel inlined and compiled for its instruction set.
+static inline __attribute__((always_inline))
+uint32_t sad_at(row_sad_fn row, const struct plane *f, const struct plane *t, int x, int y, uint32_t limit) {
+    const uint8_t *fp = f->p + (size_t)y * (size_t)f->w + x;
+    const uint8_t *tp = t->p;
+    uint32_t sum = 0;
+    for (int r = 0; r < t->h; r++, fp += f->w, tp += t->w) {
+        sum += row(fp, tp, t->w);
+        // Every few rows: the check costs about what a short row does.
+        if ((r & 3) == 3 && sum >= limit) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static uint32_t spots_limit(const struct spots *k) {
+    return k->n < CANDIDATES ? UINT32_MAX : k->s[k->n - 1].sad;
+}
+
+static void spots_add(struct spots *k, int x, int y, uint32_t sad) {
+    // Next to a kept spot is the same find a pixel off: keep the better one.
+    for (int i = 0; i < k->n; i++) {
+        if (abs(k->s[i].x - x) <= REFINE_RADIUS && abs(k->s[i].y - y) <= REFINE_RADIUS) {
+            if (k->s[i].sad <= sad) {
+                return;
+            }
+            memmove(&k->s[i], &k->s[i + 1], (size_t)(k->n - i - 1) * sizeof(k->s[0]));
+            k->n--;
+            break;
+        }
+    }
+    // A full list loses its worst to make room.
+    int i = k->n < CANDIDATES ? k->n : CANDIDATES - 1;
+    for (; i > 0 && k->s[i - 1].sad > sad; i--) {
+        k->s[i] = k->s[i - 1];
+    }
+    k->s[i] = (struct spot){ .x = x, .y = y, .sad = sad };
+    if (k->n < CANDIDATES) {
+        k->n++;
+    }
+}
+
+static inline __attribute__((always_inline))
+void scan(row_sad_fn row, const struct plane *f, const struct plane *t, struct spots *k) {
+    for (int y = 0; y + t->h <= f->h; y++) {
+        for (int x = 0; x + t->w <= f->w; x++) {
+            uint32_t limit = spots_limit(k);
+            uint32_t sad = sad_at(row, f, t, x, y, limit);
+            if (sad < limit) {
+                spots_add(k, x, y, sad);
+            }
+        }
+    }
+}
+
+struct kernel {
+    const char *name;
+    void (*grey)(const struct match_image *im, const struct plane *out);
+    void (*half)(const struct plane *src, const struct plane *dst);
+    void (*scan)(const struct plane *f, const struct plane *t, struct spots *k);
+    uint32_t (*sad)(const struct plane *f, const struct plane *t, int x, int y);
+};
+
+static void scan_scalar(const struct plane *f, const struct plane *t, struct spots *k) {
+    scan(row_sad_scalar, f, t, k);
+}
+
+static uint32_t sad_scalar(const struct plane *f, const struct plane *t, int x, int y) {
+    return sad_at(row_sad_scalar, f, t, x, y, UINT32_MAX);
+}
+
+#ifdef MATCH_X86
+// AVX2 searches sixteen neighbouring spots at once rather than one at a time:
+// mpsadbw takes four patch pixels against eight frame offsets per lane. Its
+// immediate is two three-bit fields, low lane then high: bit 2 the frame
+// offset in bytes over 4, bits 1:0 which four patch pixels. The
+// patch's last columns past a multiple of four are left out, which costs the
+// coarse ranking nothing. Sums run in 16 bits and are moved to 32 before they
+// can overflow; a block is given up on once all sixteen are past the limit.
+__attribute__((target("avx2")))
+static void scan_avx2(const struct plane *f, const struct plane *t, struct spots *k) {
+    int quads = t->w / 4;
+    if (quads == 0 || quads * 4 * 255 > UINT16_MAX) {
+        scan(row_sad_avx2, f, t, k);
+        return;
+    }
+    int rows_per_flush = UINT16_MAX / (quads * 4 * 255);
+    int last = f->w - t->w;
+    const __m256i zero = _mm256_setzero_si256();
+    for (int y = 0; y + t->h <= f->h; y++) {
+        for (int x0 = 0; x0 <= last; x0 += 16) {
+            uint32_t limit = spots_limit(k);
+            __m256i lim = _mm256_set1_epi32((int)limit);
+            __m256i acc = zero, lo = zero, hi = zero;
+            const uint8_t *fp = f->p + (size_t)y * (size_t)f->w + x0;
+            const uint8_t *tp = t->p;
+            for (int r = 0; r < t->h; r++, fp += f->w, tp += t->w) {
+                for (int c = 0; c < 4 * quads; c += 16) {
+                    __m256i b = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(tp + c)));
+                    __m256i a0 = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(fp + c))),
+                        _mm_loadu_si128((const __m128i *)(fp + c + 8)), 1);
+                    acc = _mm256_add_epi16(acc, _mm256_mpsadbw_epu8(a0, b, 0));
+                    if (c + 4 < 4 * quads) {
+                        acc = _mm256_add_epi16(acc, _mm256_mpsadbw_epu8(a0, b, 055));
+                    }
+                    if (c + 8 < 4 * quads) {
+                        __m256i a1 = _mm256_inserti128_si256(
+                            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(fp + c + 8))),
+                            _mm_loadu_si128((const __m128i *)(fp + c + 16)), 1);
+                        acc = _mm256_add_epi16(acc, _mm256_mpsadbw_epu8(a1, b, 022));
+                        if (c + 12 < 4 * quads) {
+                            acc = _mm256_add_epi16(acc, _mm256_mpsadbw_epu8(a1, b, 077));
+                        }
+                    }
+                }
+                if ((r + 1) % rows_per_flush == 0 || r + 1 == t->h) {
+                    lo = _mm256_add_epi32(lo, _mm256_unpacklo_epi16(acc, zero));
+                    hi = _mm256_add_epi32(hi, _mm256_unpackhi_epi16(acc, zero));
+                    acc = zero;
+                    __m256i least = _mm256_min_epu32(lo, hi);
+                    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_max_epu32(least, lim), least)) == -1) {
+                        break;
+                    }
+                }
+            }
+            // Unpacking left them as spots 0-3 and 8-11 in `lo`, 4-7 and 12-15 in `hi`.
+            uint32_t l[8], h[8];
+            _mm256_storeu_si256((__m256i *)l, lo);
+            _mm256_storeu_si256((__m256i *)h, hi);
+            for (int i = 0; i < 16 && x0 + i <= last; i++) {
+                uint32_t sad = (i & 4) ? h[(i & 3) | ((i & 8) >> 1)] : l[(i & 3) | ((i & 8) >> 1)];
+                if (sad < spots_limit(k)) {
+                    spots_add(k, x0 + i, y, sad);
+                }
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static uint32_t sad_avx2(const struct plane *f, const struct plane *t, int x, int y) {
+    return sad_at(row_sad_avx2, f, t, x, y, UINT32_MAX);
+}
+#endif
+
+static const struct kernel kernels[] = {
+#ifdef MATCH_X86
+    { "avx2", grey_avx2, half_avx2, scan_avx2, sad_avx2 },
+#endif
+    { "scalar", grey_scalar, half_scalar, scan_scalar, sad_scalar },
+};
+
+static const struct kernel *chosen;
+
+static bool supported(const struct kernel *k) {
+#ifdef MATCH_X86
+    if (strcmp(k->name, "avx2") == 0) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    (void)k;
+    return true;
+}
+
+static const struct kernel *kernel(void) {
+    // The first the CPU has, best first.
+    for (size_t i = 0; !chosen && i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (supported(&kernels[i])) {
+            chosen = &kernels[i];
+        }
+    }
+    return chosen;
+}
+
+const char *match_kernel(void) {
+    return kernel()->name;
+}
+
+int match_use_kernel(const char *name) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, name) == 0 && supported(&kernels[i])) {
+            chosen = &kernels[i];
+            return 0;
+        }
+    }
+    errno = ENOTSUP;
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Scoring
+// ---------------------------------------------------------------------------
+
+// Zero-normalised cross-correlation: 1 for the patch itself however bright
+// or faded, 0 or less for anything unrelated. A flat patch has no shape to
+// correlate, so it falls back to how close the greys are. A patch with shape
+// on a flat spot is not there: mostly background, it would be close in grey.
+static double score_at(const struct plane *f, const struct plane *t, int x, int y) {
+    int64_t sf = 0, sff = 0, st = 0, stt = 0, sft = 0, sad = 0;
+    for (int r = 0; r < t->h; r++) {
+        const uint8_t *fp = f->p + (size_t)(y + r) * (size_t)f->w + x;
+        const uint8_t *tp = t->p + (size_t)r * (size_t)t->w;
+        for (int c = 0; c < t->w; c++) {
+            int a = fp[c], b = tp[c];
+            sf += a;
+            sff += a * a;
+            st += b;
+            stt += b * b;
+            sft += a * b;
+            sad += abs(a - b);
+        }
+    }
+    double n = (double)t->w * (double)t->h;
+    double vf = n * (double)sff - (double)sf * (double)sf;
+    double vt = n * (double)stt - (double)st * (double)st;
+    // Below a grey level of spread, n² times the variance.
+    if (vt < n * n) {
+        return 1.0 - (double)sad / (n * 255.0);
+    }
+    if (vf < n * n) {
+        return 0;
+    }
+    double ncc = (n * (double)sft - (double)sf * (double)st) / sqrt(vf * vt);
+    return ncc > 0 ? ncc : 0;
+}
+
+// ---------------------------------------------------------------------------
+// The search
+// ---------------------------------------------------------------------------
+
+static bool usable(const struct match_image *im) {
+    return im->pixels && im->width > 0 && im->height > 0 && (im->channels == 3 || im->channels == 4) &&
+           im->stride >= im->width * im->channels;
+}
+
+// `need` bytes of scratch, or NULL with errno set.
+static uint8_t *scratch_of(struct match_scratch *scratch, size_t need) {
+    if (scratch->size < need) {
+        uint8_t *grown = realloc(scratch->buffer, need);
+        if (!grown) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        scratch->buffer = grown;
+        scratch->size = need;
+    }
+    return scratch->buffer;
+}
+
+int match_find(const struct match_image *frame, const struct match_image *patch,
+               struct match_scratch *scratch, struct match_result *out) {
+    if (!usable(frame) || !usable(patch) || patch->width > frame->width || patch->height > frame->height) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int side = patch->width < patch->height ? patch->width : patch->height;
+    int top = 0;
+    while (top + 1 < MAX_LEVELS && (side >> (top + 1)) >= MIN_COARSE_SIDE) {
+        top++;
+    }
+
+    struct plane f[MAX_LEVELS], t[MAX_LEVELS];
+    // The SIMD loads may read a little past the last row.
+    size_t need = 64;
+    for (int l = 0; l <= top; l++) {
+        f[l] = (struct plane){ .w = frame->width >> l, .h = frame->height >> l };
+        t[l] = (struct plane){ .w = patch->width >> l, .h = patch->height >> l };
+        need += (size_t)f[l].w * (size_t)f[l].h + (size_t)t[l].w * (size_t)t[l].h;
+    }
+    uint8_t *next = scratch_of(scratch, need);
+    if (!next) {
+        return -1;
+    }
+    for (int l = 0; l <= top; l++) {
+        f[l].p = next;
+        next += (size_t)f[l].w * (size_t)f[l].h;
+        t[l].p = next;
+        next += (size_t)t[l].w * (size_t)t[l].h;
+    }
+
+    const struct kernel *k = kernel();
+    k->grey(frame, &f[0]);
+    k->grey(patch, &t[0]);
+    for (int l = 1; l <= top; l++) {
+        k->half(&f[l - 1], &f[l]);
+        k->half(&t[l - 1], &t[l]);
+    }
+
+    struct spots spots = { 0 };
+    k->scan(&f[top], &t[top], &spots);
+
+    struct match_result best = { .score = -1 };
+    for (int i = 0; i < spots.n; i++) {
+        int x = spots.s[i].x, y = spots.s[i].y;
+        for (int l = top - 1; l >= 0; l--) {
+            int max_x = f[l].w - t[l].w, max_y = f[l].h - t[l].h;
+            int cx = 2 * x < max_x ? 2 * x : max_x, cy = 2 * y < max_y ? 2 * y : max_y;
+            uint32_t least = UINT32_MAX;
+            for (int yy = cy - REFINE_RADIUS; yy <= cy + REFINE_RADIUS; yy++) {
+                for (int xx = cx - REFINE_RADIUS; xx <= cx + REFINE_RADIUS; xx++) {
+                    if (xx < 0 || yy < 0 || xx > max_x || yy > max_y) {
+                        continue;
+                    }
+                    uint32_t sad = k->sad(&f[l], &t[l], xx, yy);
+                    if (sad < least) {
+                        least = sad;
+                        x = xx;
+                        y = yy;
+                    }
+                }
+            }
+        }
+        double score = score_at(&f[0], &t[0], x, y);
+        if (score > best.score) {
+            best = (struct match_result){ .score = score, .x = x, .y = y };
+        }
+    }
+    *out = best;
+    return 0;
+}
+
+int match_coarse(const struct match_image *frame, const struct match_image *patch,
+                 struct match_scratch *scratch, struct match_spot *out, int max) {
+    if (!usable(frame) || !usable(patch) || patch->width > frame->width || patch->height > frame->height) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct plane f = { .w = frame->width, .h = frame->height };
+    struct plane t = { .w = patch->width, .h = patch->height };
+    uint8_t *buffer = scratch_of(scratch, 64 + (size_t)f.w * (size_t)f.h + (size_t)t.w * (size_t)t.h);
+    if (!buffer) {
+        return -1;
+    }
+    f.p = buffer;
+    t.p = buffer + (size_t)f.w * (size_t)f.h;
+
+    const struct kernel *k = kernel();
+    k->grey(frame, &f);
+    k->grey(patch, &t);
+    struct spots spots = { 0 };
+    k->scan(&f, &t, &spots);
+    int n = spots.n < max ? spots.n : max;
+    for (int i = 0; i < n; i++) {
+        out[i] = (struct match_spot){ .x = spots.s[i].x, .y = spots.s[i].y, .sad = spots.s[i].sad };
+    }
+    return n;
+}
+
+void match_scratch_free(struct match_scratch *scratch) {
+    free(scratch->buffer);
+    scratch->buffer = NULL;
+    scratch->size = 0;
+}
@@ -0,0 +1,69 @@
+// Finding a small picture in a bigger one: the image condition's search, run
+// by macroclickwerk-match on the frames the extension hands it.
+//
+// Both pictures go to grey first. The search itself is coarse to fine: a
+// pyramid of half-size copies, the whole area searched at the smallest level
+// where the patch is still recognisable — a sixteenth of the positions and a
+// sixteenth of the pixels at each for a patch of 64 — keeping the best few
+// spots, each followed back down to full size in a small window. Where the CPU
+// has AVX2 the grey, the halving and the sums of absolute differences that do
+// the comparing are SIMD, the coarse search sixteen spots at a time; a spot is
+// given up on as soon as its sum is worse than the best ones kept. The winner
+// is scored by zero-normalised cross-correlation, so the score does not care
+// about brightness or contrast: 1 is the patch exactly, anything under about
+// 0.8 is something else.
+
+#ifndef MACROCLICKWERK_MATCH_H
+#define MACROCLICKWERK_MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Pixels as a GdkPixbuf holds them: rows of RGB or RGBA, `stride` bytes apart. */
+struct match_image {
+    const uint8_t *pixels;
+    int width;
+    int height;
+    int stride;
+    int channels;   // 3 or 4
+};
+
+struct match_result {
+    double score;   // 0..1, see above
+    int x;          // where the patch's top left corner is, in frame pixels
+    int y;
+};
+
+/** A spot the coarse search kept, and its sum of absolute differences there. */
+struct match_spot {
+    int x;
+    int y;
+    uint32_t sad;
+};
+
+/** Buffers kept between searches, so a search in a loop does not allocate. */
+struct match_scratch {
+    uint8_t *buffer;
+    size_t size;
+};
+
+// 0 and the best spot in `out`, or -1 with errno set: EINVAL for a patch
+// larger than the frame or pixels that are not RGB/RGBA, ENOMEM.
+int match_find(const struct match_image *frame, const struct match_image *patch,
+               struct match_scratch *scratch, struct match_result *out);
+
+// The coarse search alone, by the kernel in use, on the grey pictures at full
+// size: up to `max` of the spots it keeps, best first, and how many; -1 as
+// match_find. For match-bench, to hold the kernels to the same sums.
+int match_coarse(const struct match_image *frame, const struct match_image *patch,
+                 struct match_scratch *scratch, struct match_spot *out, int max);
+
+void match_scratch_free(struct match_scratch *scratch);
+
+// The kernel this CPU gets: "avx2" or "scalar".
+const char *match_kernel(void);
+
+// Use another kernel, for comparing them; -1 with ENOTSUP if the CPU lacks it.
+int match_use_kernel(const char *name);
+
+#endif